@@ -0,0 +1,27 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef MBB_ARENA_H
+#define MBB_ARENA_H
+
+#include <glib.h>
+
+typedef struct arena Arena;
+
+Arena *arena_new(void);
+void arena_free(Arena *arena);
+
+gpointer arena_alloc(Arena *arena, gsize size);
+gpointer arena_alloc0(Arena *arena, gsize size);
+gchar *arena_strdup(Arena *arena, const gchar *str);
+gchar *arena_strndup(Arena *arena, const gchar *str, gsize len);
+
+void arena_push(Arena *arena, gpointer data, GDestroyNotify destroy);
+
+void arena_enter(Arena *arena);
+Arena *arena_leave(void);
+Arena *arena_current(void);
+
+#define arena_new0(arena, type) ((type *) arena_alloc0(arena, sizeof(type)))
+
+#endif
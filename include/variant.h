@@ -6,9 +6,12 @@
 
 #include <glib.h>
 
+#include "arena.h"
+
 typedef struct variant Variant;
 
 void variant_free(Variant *var);
+Arena *variant_get_arena(Variant *var);
 
 Variant *variant_new_int(gint value);
 Variant *variant_new_long(glong value);
@@ -0,0 +1,36 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef XML_PACK_H
+#define XML_PACK_H
+
+#include <glib.h>
+
+#include "xmltag.h"
+
+/* a zero byte never starts an xml document */
+#define XML_PACK_MAGIC "\0MBB\1"
+#define XML_PACK_MAGIC_LEN 5
+
+/* payload length (big endian) followed by the frame type */
+#define XML_PACK_HEAD_LEN 5
+#define XML_PACK_FRAME_MAX (16 << 20)
+
+enum {
+	XML_PACK_TEXT,
+	XML_PACK_TAG
+};
+
+typedef struct xml_unpacker XmlUnpacker;
+
+void xml_pack_head(gchar *head, guint type, gsize len);
+void xml_tag_pack(XmlTag *tag, GString *string);
+void xml_tag_pack_frame(XmlTag *tag, GString *string);
+void xml_text_pack_frame(gchar *text, gsize len, GString *string);
+
+XmlUnpacker *xml_unpacker_new(gboolean (*func)(XmlTag *, gpointer), gpointer data);
+gboolean xml_unpacker_feed(XmlUnpacker *unpacker, gchar *buf, gsize len,
+			   GError **error);
+void xml_unpacker_free(XmlUnpacker *unpacker);
+
+#endif
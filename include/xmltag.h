@@ -10,19 +10,55 @@
 
 #include "variant.h"
 #include "macros.h"
+#include "arena.h"
 
 typedef struct xml_tag XmlTag;
 typedef struct xml_tag_var XmlTagVar;
 
+typedef enum {
+	XML_TAG_FORMAT_XML,
+	XML_TAG_FORMAT_XML_ESCAPE,
+	XML_TAG_FORMAT_JSON
+} XmlTagFormat;
+
+struct xml_tag_attr {
+	gchar *name;
+	Variant *value;
+};
+
+/* children of one name, chained through next */
+struct xml_tag_group {
+	gchar *name;
+	struct xml_tag *head;
+};
+
 struct xml_tag {
 	gchar *name;
-	GHashTable *attrs;
 	Variant *body;
-	GHashTable *childs;
+
+	struct xml_tag_attr *attrs;
+	guint nattr;
+	guint attr_size;
+
+	struct xml_tag_group *childs;
+	guint nchild;
+	guint child_size;
+	GHashTable *child_index;
+
+	/* the owner tag frees the whole arena at once */
+	Arena *arena;
+	gboolean owner;
 
 	struct xml_tag *next;
 };
 
+/* the first root made within the scope enters an arena for its tree */
+struct xml_tag_scope {
+	gboolean armed;
+	Arena *arena;
+	struct xml_tag_scope *prev;
+};
+
 struct xml_tag_var {
 	gchar *path;
 	gchar *name;
@@ -48,6 +84,14 @@ void xml_tag_set_body(XmlTag *tag, Variant *var);
 Variant *xml_tag_get_body(XmlTag *tag);
 
 void xml_tag_free(XmlTag *tag);
+XmlTag *xml_tag_copy(XmlTag *tag);
+
+void xml_tag_arena_enter(void);
+void xml_tag_arena_leave(XmlTag *tag);
+
+void xml_tag_scope_begin(struct xml_tag_scope *scope);
+void xml_tag_scope_root(void);
+void xml_tag_scope_end(struct xml_tag_scope *scope, XmlTag *tag);
 
 XmlTag *xml_tag_add_child(XmlTag *tag, XmlTag *child);
 void xml_tag_reorder(XmlTag *tag);
@@ -58,6 +102,7 @@ void xml_tag_sort_with_data(XmlTag *tag, gchar *name, GCompareDataFunc func,
 			    gpointer data);
 void xml_tag_sort_by_attr(XmlTag *tag, gchar *name, gchar *attr);
 
+void xml_tag_write(XmlTag *tag, XmlTagFormat format, GString *string);
 void xml_tag_print(XmlTag *tag, FILE *fp);
 gchar *xml_tag_to_string(XmlTag *tag);
 gchar *xml_tag_to_string_escape(XmlTag *tag);
@@ -0,0 +1,175 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN (2 * sizeof(gpointer))
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	gsize size;
+	gsize used;
+};
+
+struct arena_destroy {
+	struct arena_destroy *next;
+	gpointer data;
+	GDestroyNotify destroy;
+};
+
+struct arena {
+	struct arena_chunk *chunk;
+	struct arena_destroy *destroy;
+
+	/* enclosing arena of the thread */
+	struct arena *prev;
+};
+
+#define CHUNK_HEADER ARENA_ROUND(sizeof(struct arena_chunk))
+#define CHUNK_DATA(chunk) ((gchar *) (chunk) + CHUNK_HEADER)
+
+static GStaticPrivate arena_key = G_STATIC_PRIVATE_INIT;
+
+static struct arena_chunk *arena_chunk_new(gsize size,
+					   struct arena_chunk *next)
+{
+	struct arena_chunk *chunk;
+
+	chunk = g_malloc(CHUNK_HEADER + size);
+	chunk->next = next;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+Arena *arena_new(void)
+{
+	Arena *arena;
+
+	arena = g_new(Arena, 1);
+	arena->chunk = NULL;
+	arena->destroy = NULL;
+	arena->prev = NULL;
+
+	return arena;
+}
+
+void arena_free(Arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+	struct arena_destroy *ad;
+
+	/* entries live in the chunks, so run them first */
+	for (ad = arena->destroy; ad != NULL; ad = ad->next)
+		ad->destroy(ad->data);
+
+	for (chunk = arena->chunk; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		g_free(chunk);
+	}
+
+	g_free(arena);
+}
+
+gpointer arena_alloc(Arena *arena, gsize size)
+{
+	struct arena_chunk *chunk;
+	gpointer p;
+
+	size = ARENA_ROUND(size);
+
+	chunk = arena->chunk;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		if (size > ARENA_CHUNK_SIZE / 4) {
+			/* large blocks get a chunk of their own behind the current */
+			chunk = arena_chunk_new(size, NULL);
+			if (arena->chunk == NULL)
+				arena->chunk = chunk;
+			else {
+				chunk->next = arena->chunk->next;
+				arena->chunk->next = chunk;
+			}
+		} else {
+			chunk = arena_chunk_new(ARENA_CHUNK_SIZE, arena->chunk);
+			arena->chunk = chunk;
+		}
+	}
+
+	p = CHUNK_DATA(chunk) + chunk->used;
+	chunk->used += size;
+
+	return p;
+}
+
+gpointer arena_alloc0(Arena *arena, gsize size)
+{
+	gpointer p;
+
+	p = arena_alloc(arena, size);
+	memset(p, 0, size);
+
+	return p;
+}
+
+gchar *arena_strndup(Arena *arena, const gchar *str, gsize len)
+{
+	gchar *s;
+
+	if (str == NULL)
+		return NULL;
+
+	s = arena_alloc(arena, len + 1);
+	memcpy(s, str, len);
+	s[len] = '\0';
+
+	return s;
+}
+
+gchar *arena_strdup(Arena *arena, const gchar *str)
+{
+	if (str == NULL)
+		return NULL;
+
+	return arena_strndup(arena, str, strlen(str));
+}
+
+void arena_push(Arena *arena, gpointer data, GDestroyNotify destroy)
+{
+	struct arena_destroy *ad;
+
+	ad = arena_alloc(arena, sizeof(struct arena_destroy));
+	ad->data = data;
+	ad->destroy = destroy;
+	ad->next = arena->destroy;
+	arena->destroy = ad;
+}
+
+void arena_enter(Arena *arena)
+{
+	arena->prev = g_static_private_get(&arena_key);
+	g_static_private_set(&arena_key, arena, NULL);
+}
+
+Arena *arena_leave(void)
+{
+	Arena *arena;
+
+	arena = g_static_private_get(&arena_key);
+	if (arena != NULL) {
+		g_static_private_set(&arena_key, arena->prev, NULL);
+		arena->prev = NULL;
+	}
+
+	return arena;
+}
+
+Arena *arena_current(void)
+{
+	return g_static_private_get(&arena_key);
+}
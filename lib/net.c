@@ -87,7 +87,7 @@ int write_all(int fd, const void *buf, size_t count)
 	int n;
 
 	s = buf;
-	while ((n = write(fd, buf, count)) > 0) {
+	while (count > 0 && (n = write(fd, s, count)) > 0) {
 		count -= n;
 		s += n;
 	}
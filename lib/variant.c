@@ -2,6 +2,7 @@
 /* Published under the GNU General Public License V.2, see file COPYING */
 
 #include "variant.h"
+#include "arena.h"
 
 enum variant_type {
 	VARIANT_INT,
@@ -23,9 +24,29 @@ struct variant {
 			void (*free)(gpointer *);
 		} ptr;
 	} un;
+
+	/* values made inside an arena scope die with the arena */
+	Arena *arena;
 };
 
-void variant_free(Variant *var)
+static Variant *variant_alloc(enum variant_type type)
+{
+	Variant *var;
+	Arena *arena;
+
+	arena = arena_current();
+	if (arena == NULL)
+		var = g_new(Variant, 1);
+	else
+		var = arena_alloc(arena, sizeof(Variant));
+
+	var->type = type;
+	var->arena = arena;
+
+	return var;
+}
+
+static void variant_release(Variant *var)
 {
 	if (var->type == VARIANT_STRING)
 		g_free(var->un.str);
@@ -33,16 +54,27 @@ void variant_free(Variant *var)
 		if (var->un.ptr.free != NULL)
 			var->un.ptr.free(var->un.ptr.data);
 	}
+}
 
+void variant_free(Variant *var)
+{
+	if (var->arena != NULL)
+		return;
+
+	variant_release(var);
 	g_free(var);
 }
-	
+
+Arena *variant_get_arena(Variant *var)
+{
+	return var->arena;
+}
+
 Variant *variant_new_int(gint value)
 {
 	Variant *var;
 
-	var = g_new(Variant, 1);
-	var->type = VARIANT_INT;
+	var = variant_alloc(VARIANT_INT);
 	var->un.num = value;
 
 	return var;
@@ -52,8 +84,7 @@ Variant *variant_new_long(glong value)
 {
 	Variant *var;
 
-	var = g_new(Variant, 1);
-	var->type = VARIANT_LONG;
+	var = variant_alloc(VARIANT_LONG);
 	var->un.lnum = value;
 
 	return var;
@@ -63,9 +94,14 @@ Variant *variant_new_string(gchar *str)
 {
 	Variant *var;
 
-	var = g_new(Variant, 1);
-	var->type = VARIANT_STRING;
-	var->un.str = g_strdup(str);
+	var = variant_alloc(VARIANT_STATIC_STRING);
+
+	if (var->arena != NULL)
+		var->un.str = arena_strdup(var->arena, str);
+	else {
+		var->type = VARIANT_STRING;
+		var->un.str = g_strdup(str);
+	}
 
 	return var;
 }
@@ -74,10 +110,12 @@ Variant *variant_new_alloc_string(gchar *str)
 {
 	Variant *var;
 
-	var = g_new(Variant, 1);
-	var->type = VARIANT_STRING;
+	var = variant_alloc(VARIANT_STRING);
 	var->un.str = str;
 
+	if (var->arena != NULL)
+		arena_push(var->arena, str, g_free);
+
 	return var;
 }
 
@@ -85,8 +123,7 @@ Variant *variant_new_static_string(gchar *str)
 {
 	Variant *var;
 
-	var = g_new(Variant, 1);
-	var->type = VARIANT_STATIC_STRING;
+	var = variant_alloc(VARIANT_STATIC_STRING);
 	var->un.str = str;
 
 	return var;
@@ -97,12 +134,14 @@ Variant *variant_new_pointer(gpointer *data, gchar *(*convert)(gpointer *),
 {
 	Variant *var;
 
-	var = g_new(Variant, 1);
-	var->type = VARIANT_POINTER;
+	var = variant_alloc(VARIANT_POINTER);
 	var->un.ptr.data = data;
 	var->un.ptr.convert = convert;
 	var->un.ptr.free = free;
 
+	if (var->arena != NULL && free != NULL)
+		arena_push(var->arena, var, (GDestroyNotify) variant_release);
+
 	return var;
 }
 
@@ -0,0 +1,454 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+/* tags are packed as msgpack [name, {attr: value}, body, [child, ...]] */
+
+#include <string.h>
+
+#include "xmlparser.h"
+#include "xmlpack.h"
+#include "variant.h"
+#include "arena.h"
+
+#define UNPACK_DEPTH_MAX 64
+
+struct xml_unpacker {
+	GString *buf;
+	XmlParser *parser;
+
+	gboolean (*user_func)(XmlTag *tag, gpointer data);
+	gpointer user_data;
+};
+
+struct unpack {
+	const guchar *p;
+	const guchar *end;
+	Arena *arena;
+};
+
+static void pack_uint(GString *string, guchar code, guint64 value, guint size)
+{
+	g_string_append_c(string, code);
+
+	while (size--)
+		g_string_append_c(string, (value >> (size * 8)) & 0xff);
+}
+
+static void pack_len(GString *string, guchar fix, guint fix_max,
+		     guchar code16, guint32 len)
+{
+	if (len <= fix_max)
+		g_string_append_c(string, fix | len);
+	else if (len <= 0xffff)
+		pack_uint(string, code16, len, 2);
+	else
+		pack_uint(string, code16 + 1, len, 4);
+}
+
+static void pack_str(GString *string, const gchar *str)
+{
+	gsize len;
+
+	if (str == NULL) {
+		g_string_append_c(string, 0xc0);
+		return;
+	}
+
+	len = strlen(str);
+	if (len > 31 && len <= 0xff)
+		pack_uint(string, 0xd9, len, 1);
+	else
+		pack_len(string, 0xa0, 31, 0xda, len);
+
+	g_string_append_len(string, str, len);
+}
+
+static void pack_int(GString *string, gint64 value)
+{
+	if (value >= 0 && value <= 0x7f)
+		g_string_append_c(string, value);
+	else if (value < 0 && value >= -32)
+		g_string_append_c(string, value & 0xff);
+	else if (value >= G_MININT && value <= G_MAXINT)
+		pack_uint(string, 0xd2, (guint32) value, 4);
+	else
+		pack_uint(string, 0xd3, (guint64) value, 8);
+}
+
+static void pack_value(GString *string, Variant *var)
+{
+	gchar *str;
+
+	if (var == NULL)
+		g_string_append_c(string, 0xc0);
+	else if (variant_is_string(var))
+		pack_str(string, variant_get_string(var));
+	else if (variant_is_int(var))
+		pack_int(string, variant_get_int(var));
+	else if (variant_is_long(var))
+		pack_int(string, variant_get_long(var));
+	else {
+		str = variant_to_string(var);
+		pack_str(string, str);
+		g_free(str);
+	}
+}
+
+void xml_tag_pack(XmlTag *tag, GString *string)
+{
+	XmlTag *child;
+	guint nchild;
+	guint n;
+
+	g_string_append_c(string, 0x94);
+	pack_str(string, tag->name);
+
+	pack_len(string, 0x80, 15, 0xde, tag->nattr);
+	for (n = 0; n < tag->nattr; n++) {
+		pack_str(string, tag->attrs[n].name);
+		pack_value(string, tag->attrs[n].value);
+	}
+
+	pack_value(string, tag->body);
+
+	nchild = 0;
+	for (n = 0; n < tag->nchild; n++) {
+		for (child = tag->childs[n].head; child; child = child->next)
+			nchild++;
+	}
+
+	pack_len(string, 0x90, 15, 0xdc, nchild);
+	for (n = 0; n < tag->nchild; n++) {
+		for (child = tag->childs[n].head; child; child = child->next)
+			xml_tag_pack(child, string);
+	}
+}
+
+void xml_pack_head(gchar *head, guint type, gsize len)
+{
+	head[0] = (len >> 24) & 0xff;
+	head[1] = (len >> 16) & 0xff;
+	head[2] = (len >> 8) & 0xff;
+	head[3] = len & 0xff;
+	head[4] = type;
+}
+
+void xml_tag_pack_frame(XmlTag *tag, GString *string)
+{
+	gsize off;
+
+	off = string->len;
+	g_string_set_size(string, off + XML_PACK_HEAD_LEN);
+	xml_tag_pack(tag, string);
+
+	xml_pack_head(string->str + off, XML_PACK_TAG,
+		string->len - off - XML_PACK_HEAD_LEN
+	);
+}
+
+void xml_text_pack_frame(gchar *text, gsize len, GString *string)
+{
+	gchar head[XML_PACK_HEAD_LEN];
+
+	xml_pack_head(head, XML_PACK_TEXT, len);
+	g_string_append_len(string, head, sizeof(head));
+	g_string_append_len(string, text, len);
+}
+
+static gboolean unpack_uint(struct unpack *u, guint size, guint64 *value)
+{
+	if ((gsize) (u->end - u->p) < size)
+		return FALSE;
+
+	for (*value = 0; size--; u->p++)
+		*value = (*value << 8) | *u->p;
+
+	return TRUE;
+}
+
+static gboolean unpack_len(struct unpack *u, guchar fix, guint fix_max,
+			   guchar code16, guint32 *len)
+{
+	guint64 value;
+	guchar c;
+
+	if (u->p == u->end)
+		return FALSE;
+
+	c = *u->p++;
+	if ((c & ~fix_max) == fix) {
+		*len = c & fix_max;
+		return TRUE;
+	}
+
+	if (c == code16 && unpack_uint(u, 2, &value))
+		;
+	else if (c == code16 + 1 && unpack_uint(u, 4, &value))
+		;
+	else
+		return FALSE;
+
+	*len = value;
+
+	return TRUE;
+}
+
+static gboolean unpack_str(struct unpack *u, gchar **str)
+{
+	guint64 value;
+	guchar c;
+	gsize len;
+
+	if (u->p == u->end)
+		return FALSE;
+
+	c = *u->p;
+	if (c == 0xc0) {
+		u->p++;
+		*str = NULL;
+		return TRUE;
+	}
+
+	if ((c & 0xe0) == 0xa0) {
+		u->p++;
+		len = c & 0x1f;
+	} else if (c == 0xd9) {
+		u->p++;
+		if (! unpack_uint(u, 1, &value))
+			return FALSE;
+		len = value;
+	} else {
+		guint32 len32;
+
+		if (! unpack_len(u, 0xa0, 31, 0xda, &len32))
+			return FALSE;
+		len = len32;
+	}
+
+	if ((gsize) (u->end - u->p) < len)
+		return FALSE;
+
+	*str = arena_strndup(u->arena, (const gchar *) u->p, len);
+	u->p += len;
+
+	return TRUE;
+}
+
+static gboolean unpack_value(struct unpack *u, Variant **var)
+{
+	guint64 value;
+	gint64 num;
+	gchar *str;
+	guchar c;
+
+	if (u->p == u->end)
+		return FALSE;
+
+	c = *u->p;
+	if (c <= 0x7f || c >= 0xe0) {
+		u->p++;
+		num = (gint8) c;
+		if (c <= 0x7f)
+			num = c;
+	} else if (c >= 0xcc && c <= 0xcf) {
+		u->p++;
+		if (! unpack_uint(u, 1 << (c - 0xcc), &value))
+			return FALSE;
+		num = value;
+	} else if (c >= 0xd0 && c <= 0xd3) {
+		guint size = 1 << (c - 0xd0);
+
+		u->p++;
+		if (! unpack_uint(u, size, &value))
+			return FALSE;
+
+		/* sign extend */
+		if (size < 8 && (value >> (size * 8 - 1)) & 1)
+			value |= ~(guint64) 0 << (size * 8);
+		num = value;
+	} else {
+		if (! unpack_str(u, &str))
+			return FALSE;
+
+		*var = str == NULL ? NULL : variant_new_static_string(str);
+		return TRUE;
+	}
+
+	if (num >= G_MININT && num <= G_MAXINT)
+		*var = variant_new_int(num);
+	else
+		*var = variant_new_long(num);
+
+	return TRUE;
+}
+
+static XmlTag *unpack_tag(struct unpack *u, guint depth)
+{
+	XmlTag *tag, *child;
+	guint32 len;
+	Variant *var;
+	gchar *name;
+	guint n;
+
+	if (depth > UNPACK_DEPTH_MAX)
+		return NULL;
+
+	if (u->p == u->end || *u->p++ != 0x94)
+		return NULL;
+
+	if (! unpack_str(u, &name) || name == NULL)
+		return NULL;
+
+	tag = xml_tag_newc(name);
+
+	if (! unpack_len(u, 0x80, 15, 0xde, &len))
+		return NULL;
+
+	while (len--) {
+		if (! unpack_str(u, &name) || name == NULL)
+			return NULL;
+		if (! unpack_value(u, &var))
+			return NULL;
+		if (var != NULL)
+			xml_tag_set_attr(tag, name, var);
+	}
+
+	if (! unpack_value(u, &var))
+		return NULL;
+	xml_tag_set_body(tag, var);
+
+	if (! unpack_len(u, 0x90, 15, 0xdc, &len))
+		return NULL;
+
+	while (len--) {
+		child = unpack_tag(u, depth + 1);
+		if (child == NULL)
+			return NULL;
+		xml_tag_add_child(tag, child);
+	}
+
+	/* add_child links the group in reverse order */
+	for (n = 0; n < tag->nchild; n++)
+		xml_tag_reorder(tag->childs[n].head);
+
+	return tag;
+}
+
+static XmlTag *xml_tag_unpack(const gchar *buf, gsize len)
+{
+	struct unpack u;
+	XmlTag *tag;
+
+	u.p = (const guchar *) buf;
+	u.end = u.p + len;
+	u.arena = arena_new();
+
+	arena_enter(u.arena);
+	tag = unpack_tag(&u, 0);
+	arena_leave();
+
+	if (tag == NULL || u.p != u.end) {
+		arena_free(u.arena);
+		return NULL;
+	}
+
+	/* the tree is handed over with its arena */
+	tag->owner = TRUE;
+
+	return tag;
+}
+
+XmlUnpacker *xml_unpacker_new(gboolean (*func)(XmlTag *, gpointer), gpointer data)
+{
+	XmlUnpacker *unpacker;
+
+	unpacker = g_new(XmlUnpacker, 1);
+	unpacker->buf = g_string_new(NULL);
+	unpacker->parser = NULL;
+	unpacker->user_func = func;
+	unpacker->user_data = data;
+
+	return unpacker;
+}
+
+static gboolean xml_unpacker_frame(XmlUnpacker *unpacker, guint type,
+				   gchar *buf, gsize len, GError **error)
+{
+	XmlTag *tag;
+
+	if (type == XML_PACK_TEXT) {
+		if (unpacker->parser == NULL) {
+			unpacker->parser = xml_parser_new(
+				unpacker->user_func, unpacker->user_data
+			);
+		}
+
+		return xml_parser_parse(unpacker->parser, buf, len, error);
+	}
+
+	if (type != XML_PACK_TAG) {
+		g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+			    "unknown frame type %u", type);
+		return FALSE;
+	}
+
+	tag = xml_tag_unpack(buf, len);
+	if (tag == NULL) {
+		g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+			    "malformed packed tag");
+		return FALSE;
+	}
+
+	if (unpacker->user_func(tag, unpacker->user_data))
+		xml_tag_free(tag);
+
+	return TRUE;
+}
+
+gboolean xml_unpacker_feed(XmlUnpacker *unpacker, gchar *buf, gsize len,
+			   GError **error)
+{
+	guchar *head;
+	gsize off, size;
+	gboolean ok = TRUE;
+
+	g_string_append_len(unpacker->buf, buf, len);
+
+	for (off = 0; unpacker->buf->len - off >= XML_PACK_HEAD_LEN; ) {
+		head = (guchar *) unpacker->buf->str + off;
+		size = ((gsize) head[0] << 24) | (head[1] << 16) |
+			(head[2] << 8) | head[3];
+
+		if (size > XML_PACK_FRAME_MAX) {
+			g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+				    "frame too large (%lu bytes)", (gulong) size);
+			ok = FALSE;
+			break;
+		}
+
+		if (unpacker->buf->len - off - XML_PACK_HEAD_LEN < size)
+			break;
+
+		off += XML_PACK_HEAD_LEN;
+		ok = xml_unpacker_frame(unpacker, head[4],
+			unpacker->buf->str + off, size, error
+		);
+		off += size;
+
+		if (! ok)
+			break;
+	}
+
+	g_string_erase(unpacker->buf, 0, off);
+
+	return ok;
+}
+
+void xml_unpacker_free(XmlUnpacker *unpacker)
+{
+	if (unpacker->parser != NULL)
+		xml_parser_free(unpacker->parser);
+
+	g_string_free(unpacker->buf, TRUE);
+	g_free(unpacker);
+}
@@ -5,17 +5,41 @@
 
 #include "xmlparser.h"
 #include "variant.h"
-#include "trash.h"
+#include "arena.h"
+
+/* names beyond that are copied into the document */
+#define PARSER_NAMES_MAX 256
 
 struct xml_parser {
 	GMarkupParseContext *ctxt;
 	GSList *tag_list;
-	Trash trash;
+
+	/* element and attribute names seen on the stream */
+	GHashTable *names;
+	/* arena of the document being parsed */
+	Arena *arena;
 
 	gboolean (*user_func)(XmlTag *tag, gpointer data);
 	gpointer user_data;
 };
 
+static gchar *parser_intern(XmlParser *parser, const gchar *name)
+{
+	gchar *s;
+
+	s = g_hash_table_lookup(parser->names, name);
+	if (s != NULL)
+		return s;
+
+	if (g_hash_table_size(parser->names) >= PARSER_NAMES_MAX)
+		return arena_strdup(parser->arena, name);
+
+	s = g_strdup(name);
+	g_hash_table_insert(parser->names, s, s);
+
+	return s;
+}
+
 static void parser_start_elem(GMarkupParseContext *ctxt G_GNUC_UNUSED,
 			      const gchar *elem_name,
 			      const gchar **attr_names,
@@ -25,24 +49,25 @@ static void parser_start_elem(GMarkupParseContext *ctxt G_GNUC_UNUSED,
 {
 	XmlParser *parser;
 	XmlTag *tag;
-	char *s;
 	int n;
 
 	parser = (XmlParser *) user_data;
 
-	s = g_strdup(elem_name);
-	trash_push(&parser->trash, s, NULL);
-	tag = xml_tag_new(s, NULL, NULL);
-	for (n = 0; attr_names[n] != NULL; n++) {
-		s = g_strdup(attr_names[n]);
+	if (parser->tag_list == NULL)
+		parser->arena = arena_new();
+
+	arena_enter(parser->arena);
 
-		trash_push(&parser->trash, s, NULL);
+	tag = xml_tag_new(parser_intern(parser, elem_name), NULL, NULL);
+	for (n = 0; attr_names[n] != NULL; n++) {
 		xml_tag_set_attr(
-			tag, s,
+			tag, parser_intern(parser, attr_names[n]),
 			variant_new_string((gchar *) attr_values[n])
 		);
 	}
 
+	arena_leave();
+
 	if (parser->tag_list != NULL) {
 		XmlTag *prev_tag;
 
@@ -101,7 +126,7 @@ static void parser_text(GMarkupParseContext *ctxt G_GNUC_UNUSED,
 	XmlParser *parser;
 	Variant *var;
 	XmlTag *tag;
-	char *body;
+	gchar *body;
 
 	if (strip_non_graph(&text, &text_len) == 0)
 		return;
@@ -110,19 +135,24 @@ static void parser_text(GMarkupParseContext *ctxt G_GNUC_UNUSED,
 	tag = (XmlTag *) parser->tag_list->data;
 	var = xml_tag_get_body(tag);
 
-	if (var == NULL) {
-		body = g_new(gchar, text_len + 1);
-		memcpy(body, text, text_len);
-		body[text_len] = '\0';
-	} else {
-		body = g_strdup_printf(
-			"%s%.*s", variant_get_string(var), (int) text_len, text
-		);
-		variant_free(var);
+	if (var == NULL)
+		body = arena_strndup(parser->arena, text, text_len);
+	else {
+		gchar *prev;
+		gsize len;
+
+		prev = variant_get_string(var);
+		len = strlen(prev);
+
+		body = arena_alloc(parser->arena, len + text_len + 1);
+		memcpy(body, prev, len);
+		memcpy(body + len, text, text_len);
+		body[len + text_len] = '\0';
 	}
 
+	arena_enter(parser->arena);
 	xml_tag_set_body(tag, variant_new_static_string(body));
-	trash_push(&parser->trash, body, NULL);
+	arena_leave();
 }
 
 static void parser_end_elem(GMarkupParseContext *ctxt G_GNUC_UNUSED,
@@ -147,10 +177,12 @@ static void parser_end_elem(GMarkupParseContext *ctxt G_GNUC_UNUSED,
 
 	parser->tag_list = g_slist_delete_link(list, list);
 	if (parser->tag_list == NULL) {
-		if (parser->user_func(tag, parser->user_data)) {
+		/* the document is handed over with its arena */
+		tag->owner = TRUE;
+		parser->arena = NULL;
+
+		if (parser->user_func(tag, parser->user_data))
 			xml_tag_free(tag);
-			trash_empty(&parser->trash);
-		}
 	}
 }
 
@@ -166,7 +198,10 @@ XmlParser *xml_parser_new(gboolean (*func)(XmlTag *, gpointer), gpointer data)
 
 	parser = g_new(XmlParser, 1);
 	parser->tag_list = NULL;
-	parser->trash = (Trash) TRASH_INITIALIZER;
+	parser->names = g_hash_table_new_full(
+		g_str_hash, g_str_equal, g_free, NULL
+	);
+	parser->arena = NULL;
 	parser->user_func = func;
 	parser->user_data = data;
 
@@ -189,11 +224,12 @@ void xml_parser_free(XmlParser *parser)
 
 		list = parser->tag_list;
 		tag = (XmlTag *) g_slist_last(list)->data;
+		tag->owner = TRUE;
 		xml_tag_free(tag);
 		g_slist_free(list);
 	}
 
-	trash_empty(&parser->trash);
+	g_hash_table_destroy(parser->names);
 	g_markup_parse_context_free(parser->ctxt);
 	g_free(parser);
 }
@@ -7,56 +7,115 @@
 
 #include "xmltag.h"
 
-typedef void (*XTPrintFunc)(gpointer, const gchar *fmt, ...);
 typedef gpointer (*XTActionFunc)(XmlTag *tag, gpointer data);
 
-struct process_data {
-	XTPrintFunc func;
-	gpointer data;
-	gboolean escape;
-};
-
 struct walk_data {
 	GSList *list;
 	XTActionFunc func;
 	gpointer data;
 };
 
-#define PD_APPLY(pd, ...) pd->func(pd->data, __VA_ARGS__)
+/* children are looked up by a scan until there are that many names */
+#define XML_TAG_INDEX_MIN 16
+
+static GStaticPrivate scope_key = G_STATIC_PRIVATE_INIT;
+
+static inline gboolean xml_tag_name_equal(const gchar *s1, const gchar *s2)
+{
+	return s1 == s2 || ! strcmp(s1, s2);
+}
+
+static gpointer xml_tag_grow(XmlTag *tag, gpointer data, guint *size,
+			     guint len, gsize elem)
+{
+	gpointer p;
+	guint n;
+
+	n = *size != 0 ? *size * 2 : 4;
+
+	if (tag->arena == NULL)
+		p = g_realloc(data, n * elem);
+	else {
+		p = arena_alloc(tag->arena, n * elem);
+		if (len != 0)
+			memcpy(p, data, len * elem);
+	}
+
+	*size = n;
+
+	return p;
+}
+
+/* values from outside the arena of the tag are freed along with it */
+static void xml_tag_adopt(XmlTag *tag, Variant *var)
+{
+	if (tag->arena != NULL && variant_get_arena(var) != tag->arena)
+		arena_push(tag->arena, var, (GDestroyNotify) variant_free);
+}
 
 void xml_tag_set_attr(XmlTag *tag, gchar *opt_name, Variant *var)
 {
+	struct xml_tag_attr *attr;
+	guint n;
+
 	g_return_if_fail(opt_name != NULL && var != NULL);
 
-	if (tag->attrs == NULL) {
-		tag->attrs = g_hash_table_new_full(
-			g_str_hash, g_str_equal,
-			NULL, (GDestroyNotify) variant_free
+	xml_tag_adopt(tag, var);
+
+	for (n = 0; n < tag->nattr; n++) {
+		attr = tag->attrs + n;
+
+		if (xml_tag_name_equal(attr->name, opt_name)) {
+			if (tag->arena == NULL)
+				variant_free(attr->value);
+
+			attr->name = opt_name;
+			attr->value = var;
+			return;
+		}
+	}
+
+	if (tag->nattr == tag->attr_size) {
+		tag->attrs = xml_tag_grow(tag, tag->attrs, &tag->attr_size,
+			tag->nattr, sizeof(struct xml_tag_attr)
 		);
 	}
 
-	g_hash_table_replace(tag->attrs, opt_name, var);
+	attr = tag->attrs + tag->nattr++;
+	attr->name = opt_name;
+	attr->value = var;
 }
 
 Variant *xml_tag_get_attr(XmlTag *tag, gchar *opt_name)
 {
-	if (tag->attrs == NULL)
-		return NULL;
+	struct xml_tag_attr *attr;
+	guint n;
+
+	for (n = 0; n < tag->nattr; n++) {
+		attr = tag->attrs + n;
 
-	return g_hash_table_lookup(tag->attrs, opt_name);
+		if (xml_tag_name_equal(attr->name, opt_name))
+			return attr->value;
+	}
+
+	return NULL;
 }
 
 XmlTag *xml_tag_new(gchar *name, ...)
 {
 	XmlTag *tag;
+	Arena *arena;
 	va_list ap;
 	gchar *arg;
 
-	tag = g_new(XmlTag, 1);
+	arena = arena_current();
+	if (arena == NULL)
+		tag = g_new0(XmlTag, 1);
+	else
+		tag = arena_new0(arena, XmlTag);
+
 	tag->name = name;
-	tag->attrs = NULL;
-	tag->childs = NULL;
-	tag->next = NULL;
+	tag->arena = arena;
 
 	va_start(ap, name);
 	while ((arg = va_arg(ap, gchar *)) != NULL) {
@@ -66,22 +125,88 @@ XmlTag *xml_tag_new(gchar *name, ...)
 		xml_tag_set_attr(tag, arg, value);
 	}
 
-	tag->body = va_arg(ap, Variant *);
+	xml_tag_set_body(tag, va_arg(ap, Variant *));
 	va_end(ap);
 
 	return tag;
 }
 
+static struct xml_tag_group *xml_tag_group_get(XmlTag *tag, gchar *name)
+{
+	gpointer p;
+	guint n;
+
+	if (tag->child_index != NULL) {
+		if (! g_hash_table_lookup_extended(tag->child_index, name,
+						   NULL, &p))
+			return NULL;
+
+		return tag->childs + GPOINTER_TO_UINT(p);
+	}
+
+	for (n = 0; n < tag->nchild; n++) {
+		if (xml_tag_name_equal(tag->childs[n].name, name))
+			return tag->childs + n;
+	}
+
+	return NULL;
+}
+
+static void xml_tag_group_add(XmlTag *tag, XmlTag *child)
+{
+	struct xml_tag_group *group;
+	guint n;
+
+	if (tag->nchild == tag->child_size) {
+		tag->childs = xml_tag_grow(tag, tag->childs, &tag->child_size,
+			tag->nchild, sizeof(struct xml_tag_group)
+		);
+	}
+
+	group = tag->childs + tag->nchild;
+	group->name = child->name;
+	group->head = child;
+
+	if (tag->child_index == NULL && tag->nchild == XML_TAG_INDEX_MIN) {
+		tag->child_index = g_hash_table_new(g_str_hash, g_str_equal);
+		if (tag->arena != NULL) {
+			arena_push(tag->arena, tag->child_index,
+				(GDestroyNotify) g_hash_table_destroy
+			);
+		}
+
+		for (n = 0; n < tag->nchild; n++) {
+			g_hash_table_insert(tag->child_index,
+				tag->childs[n].name, GUINT_TO_POINTER(n)
+			);
+		}
+	}
+
+	if (tag->child_index != NULL) {
+		g_hash_table_insert(tag->child_index,
+			group->name, GUINT_TO_POINTER(tag->nchild)
+		);
+	}
+
+	tag->nchild++;
+}
+
 XmlTag *xml_tag_get_child(XmlTag *tag, gchar *name)
 {
-	if (tag->childs == NULL)
+	struct xml_tag_group *group;
+
+	group = xml_tag_group_get(tag, name);
+	if (group == NULL)
 		return NULL;
 
-	return g_hash_table_lookup(tag->childs, name);
+	return group->head;
 }
 
 void xml_tag_set_body(XmlTag *tag, Variant *var)
 {
+	if (var != NULL)
+		xml_tag_adopt(tag, var);
+
 	tag->body = var;
 }
 
@@ -90,44 +215,174 @@ Variant *xml_tag_get_body(XmlTag *tag)
 	return tag->body;
 }
 
+static void xml_tag_free_one(XmlTag *tag)
+{
+	guint n;
+
+	if (tag->arena != NULL) {
+		if (tag->owner)
+			arena_free(tag->arena);
+		return;
+	}
+
+	if (tag->body != NULL)
+		variant_free(tag->body);
+
+	for (n = 0; n < tag->nattr; n++)
+		variant_free(tag->attrs[n].value);
+	g_free(tag->attrs);
+
+	for (n = 0; n < tag->nchild; n++)
+		xml_tag_free(tag->childs[n].head);
+	g_free(tag->childs);
+
+	if (tag->child_index != NULL)
+		g_hash_table_destroy(tag->child_index);
+
+	g_free(tag);
+}
+
 void xml_tag_free(XmlTag *tag)
 {
 	XmlTag *next;
 
 	for (; tag != NULL; tag = next) {
 		next = tag->next;
+		xml_tag_free_one(tag);
+	}
+}
+
+/* tags and values made until leave share one arena owned by the tag */
+void xml_tag_arena_enter(void)
+{
+	arena_enter(arena_new());
+}
+
+void xml_tag_arena_leave(XmlTag *tag)
+{
+	Arena *arena;
+
+	arena = arena_leave();
+	if (arena == NULL)
+		return;
+
+	if (tag != NULL && tag->arena == arena && ! tag->owner)
+		tag->owner = TRUE;
+	else
+		arena_free(arena);
+}
+
+void xml_tag_scope_begin(struct xml_tag_scope *scope)
+{
+	scope->armed = TRUE;
+	scope->arena = NULL;
+	scope->prev = g_static_private_get(&scope_key);
+	g_static_private_set(&scope_key, scope, NULL);
+}
+
+/* called before making a root, tags and values made from now
+ * until the scope ends share the arena */
+void xml_tag_scope_root(void)
+{
+	struct xml_tag_scope *scope;
+
+	scope = g_static_private_get(&scope_key);
+	if (scope == NULL || ! scope->armed)
+		return;
+
+	scope->armed = FALSE;
+	xml_tag_arena_enter();
+	scope->arena = arena_current();
+}
 
-		if (tag->body != NULL)
-			variant_free(tag->body);
-		if (tag->attrs != NULL)
-			g_hash_table_destroy(tag->attrs);
-		if (tag->childs != NULL)
-			g_hash_table_destroy(tag->childs);
-		g_free(tag);
+void xml_tag_scope_end(struct xml_tag_scope *scope, XmlTag *tag)
+{
+	g_static_private_set(&scope_key, scope->prev, NULL);
+
+	if (scope->arena != NULL)
+		xml_tag_arena_leave(tag);
+}
+
+static Variant *xml_tag_copy_value(Arena *arena, Variant *var)
+{
+	Variant *copy = NULL;
+	gchar *str;
+
+	if (variant_is_int(var))
+		copy = variant_new_int(variant_get_int(var));
+	else if (variant_is_long(var))
+		copy = variant_new_long(variant_get_long(var));
+	else if (variant_is_string(var)) {
+		str = arena_strdup(arena, variant_get_string(var));
+		copy = variant_new_static_string(str);
+	} else if ((str = variant_to_string(var)) != NULL) {
+		copy = variant_new_static_string(arena_strdup(arena, str));
+		g_free(str);
 	}
+
+	return copy;
 }
 
-XmlTag *xml_tag_add_child(XmlTag *tag, XmlTag *child)
+static XmlTag *xml_tag_copy_one(Arena *arena, XmlTag *tag)
 {
-	if (tag->childs == NULL) {
-		tag->childs = g_hash_table_new_full(
-			g_str_hash, g_str_equal,
-			NULL, (GDestroyNotify) xml_tag_free
-		);
+	XmlTag *copy, *child;
+	Variant *var;
+	guint n;
 
-		g_hash_table_insert(tag->childs, child->name, child);
-	} else {
-		XmlTag *prev;
+	copy = xml_tag_new(arena_strdup(arena, tag->name), NULL, NULL);
 
-		prev = g_hash_table_lookup(tag->childs, child->name);
-		if (prev == NULL)
-			g_hash_table_insert(tag->childs, child->name, child);
-		else {
-			child->next = prev->next;
-			prev->next = child;
+	for (n = 0; n < tag->nattr; n++) {
+		var = xml_tag_copy_value(arena, tag->attrs[n].value);
+		if (var != NULL) {
+			xml_tag_set_attr(copy,
+				arena_strdup(arena, tag->attrs[n].name), var
+			);
 		}
 	}
 
+	if (tag->body != NULL)
+		xml_tag_set_body(copy, xml_tag_copy_value(arena, tag->body));
+
+	for (n = 0; n < tag->nchild; n++) {
+		for (child = tag->childs[n].head; child; child = child->next)
+			xml_tag_add_child(copy, xml_tag_copy_one(arena, child));
+
+		xml_tag_reorder(copy->childs[n].head);
+	}
+
+	return copy;
+}
+
+/* deep copy of a single tag held in an arena of its own */
+XmlTag *xml_tag_copy(XmlTag *tag)
+{
+	XmlTag *copy;
+
+	xml_tag_arena_enter();
+	copy = xml_tag_copy_one(arena_current(), tag);
+	xml_tag_arena_leave(copy);
+
+	return copy;
+}
+
+XmlTag *xml_tag_add_child(XmlTag *tag, XmlTag *child)
+{
+	struct xml_tag_group *group;
+
+	group = xml_tag_group_get(tag, child->name);
+	if (group == NULL)
+		xml_tag_group_add(tag, child);
+	else {
+		child->next = group->head->next;
+		group->head->next = child;
+	}
+
+	if (tag->arena != NULL && child->arena != tag->arena) {
+		arena_push(tag->arena, child,
+			(GDestroyNotify) xml_tag_free_one
+		);
+	}
+
 	return child;
 }
 
@@ -152,17 +407,12 @@ void xml_tag_reorder(XmlTag *tag)
 
 void xml_tag_reorder_all(XmlTag *tag)
 {
-	GHashTableIter iter;
-	XmlTag *xt;
+	guint n;
 
 	xml_tag_reorder(tag);
 
-	if (tag->childs == NULL)
-		return;
-
-	g_hash_table_iter_init(&iter, tag->childs);
-	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &xt))
-		xml_tag_reorder_all(xt);
+	for (n = 0; n < tag->nchild; n++)
+		xml_tag_reorder_all(tag->childs[n].head);
 }
 
 static XmlTag *xml_tag_sort_merge(XmlTag *xt1, XmlTag *xt2, GFunc func,
@@ -225,19 +475,11 @@ void xml_tag_sort(XmlTag *tag, gchar *name, GCompareFunc func)
 void xml_tag_sort_with_data(XmlTag *tag, gchar *name, GCompareDataFunc func,
 			    gpointer data)
 {
-	XmlTag *xt;
+	struct xml_tag_group *group;
 
-	xt = xml_tag_get_child(tag, name);
-
-	if (xt != NULL) {
-		XmlTag *old = xt;
-
-		xt = xml_tag_sort_real(xt, (GFunc) func, data);
-		if (old != xt) {
-			g_hash_table_steal(tag->childs, name);
-			g_hash_table_insert(tag->childs, name, xt);
-		}
-	}
+	group = xml_tag_group_get(tag, name);
+	if (group != NULL)
+		group->head = xml_tag_sort_real(group->head, (GFunc) func, data);
 }
 
 static gint xml_tag_attr_cmp(XmlTag *xt1, XmlTag *xt2, gchar *attr)
@@ -262,234 +504,250 @@ void xml_tag_sort_by_attr(XmlTag *tag, gchar *name, gchar *attr)
 	);
 }
 
-static void xml_tag_process_attr(gchar *opt_name, Variant *var,
-				 struct process_data *pd)
+/* text of a value, strings are not copied and numbers go to buf */
+static const gchar *xml_tag_value(Variant *var, gchar *buf, gsize size,
+				  gchar **tmp)
 {
-	gchar *value;
+	*tmp = NULL;
 
-	value = variant_to_string(var);
-	if (value != NULL) {
-		if (pd->escape) {
-			gchar *tmp;
+	if (variant_is_string(var))
+		return variant_get_string(var);
 
-			tmp = g_markup_escape_text(value, -1);
-			g_free(value);
-			value = tmp;
-		}
+	if (variant_is_int(var)) {
+		g_snprintf(buf, size, "%d", variant_get_int(var));
+		return buf;
+	}
 
-		PD_APPLY(pd, " %s='%s'", opt_name, value);
-		g_free(value);
+	if (variant_is_long(var)) {
+		g_snprintf(buf, size, "%ld", variant_get_long(var));
+		return buf;
 	}
-}
 
-static void xml_tag_process(XmlTag *tag, struct process_data *pd);
+	return *tmp = variant_to_string(var);
+}
 
-static void foreach_child(gpointer key, gpointer value, gpointer data)
+static void xml_write_text(GString *string, const gchar *text,
+			   gboolean escape)
 {
-	(void) key;
+	const gchar *s, *p;
+	gchar *ent;
 
-	xml_tag_process(value, data);
+	if (! escape) {
+		g_string_append(string, text);
+		return;
+	}
+
+	for (s = p = text; *p != '\0'; p++) {
+		switch (*p) {
+		case '&':
+			ent = "&amp;";
+			break;
+		case '<':
+			ent = "&lt;";
+			break;
+		case '>':
+			ent = "&gt;";
+			break;
+		case '\'':
+			ent = "&apos;";
+			break;
+		case '"':
+			ent = "&quot;";
+			break;
+		default:
+			if ((guchar) *p >= ' ' || *p == '\t' ||
+			    *p == '\n' || *p == '\r')
+				continue;
+			ent = NULL;
+		}
+
+		g_string_append_len(string, s, p - s);
+		if (ent != NULL)
+			g_string_append(string, ent);
+		else
+			g_string_append_printf(string, "&#x%x;", (guchar) *p);
+		s = p + 1;
+	}
+
+	g_string_append_len(string, s, p - s);
 }
 
-static void xml_tag_process(XmlTag *tag, struct process_data *pd)
+static void xml_write_tag(XmlTag *tag, GString *string, gboolean escape)
 {
+	const gchar *value;
+	gchar buf[32];
+	gchar *tmp;
+	guint n;
+
 	for (; tag != NULL; tag = tag->next) {
-		PD_APPLY(pd, "<%s", tag->name);
-		if (tag->attrs != NULL)
-			g_hash_table_foreach(
-				tag->attrs, (GHFunc) xml_tag_process_attr, pd
+		g_string_append_c(string, '<');
+		g_string_append(string, tag->name);
+
+		for (n = 0; n < tag->nattr; n++) {
+			value = xml_tag_value(tag->attrs[n].value,
+				buf, sizeof(buf), &tmp
 			);
 
-		if (tag->body == NULL && tag->childs == NULL) {
-			PD_APPLY(pd, "/>"); /* \n */
+			if (value != NULL) {
+				g_string_append_c(string, ' ');
+				g_string_append(string, tag->attrs[n].name);
+				g_string_append(string, "='");
+				xml_write_text(string, value, escape);
+				g_string_append_c(string, '\'');
+				g_free(tmp);
+			}
+		}
+
+		if (tag->body == NULL && tag->nchild == 0) {
+			g_string_append(string, "/>");
 			continue;
 		}
 
-		PD_APPLY(pd, ">");
+		g_string_append_c(string, '>');
 
 		if (tag->body != NULL) {
-			gchar *value;
-
-			value = variant_to_string(tag->body);
+			value = xml_tag_value(tag->body, buf, sizeof(buf), &tmp);
 			if (value != NULL) {
-				/*
-				if (tag->childs != NULL)
-					PD_APPLY(pd, "\n");
-				*/
-
-				if (pd->escape) {
-					gchar *tmp;
-
-					tmp = g_markup_escape_text(value, -1);
-					g_free(value);
-					value = tmp;
-				}
-
-				PD_APPLY(pd, "%s", value);
-				g_free(value);
+				xml_write_text(string, value, escape);
+				g_free(tmp);
 			}
 		}
 
-		if (tag->childs != NULL) {
-			/* PD_APPLY(pd, "\n"); */
-			g_hash_table_foreach(tag->childs, foreach_child, pd);
-		}
+		for (n = 0; n < tag->nchild; n++)
+			xml_write_tag(tag->childs[n].head, string, escape);
 
-		PD_APPLY(pd, "</%s>", tag->name); /* \n */
+		g_string_append(string, "</");
+		g_string_append(string, tag->name);
+		g_string_append_c(string, '>');
 	}
 }
 
-void xml_tag_print(XmlTag *tag, FILE *fp)
+static void json_write_string(GString *string, const gchar *str)
 {
-	struct process_data pd;
+	static gchar *escape_chars  = "\\/\"\b\f\n\r\t";
+	static gchar *escape_pchars = "\\/\"bfnrt";
 
-	pd.func = (XTPrintFunc) fprintf;
-	pd.data = fp;
-	pd.escape = FALSE;
+	const gchar *s, *p;
+	gchar *e;
 
-	xml_tag_process(tag, &pd);
-}
+	g_string_append_c(string, '\"');
 
-static gchar *xml_tag_to_string_common(XmlTag *tag, gboolean escape)
-{
-	struct process_data pd;
-	GString *string;
+	for (s = p = str; *p != '\0'; p++) {
+		if ((guchar) *p >= ' ' && *p != '\\' && *p != '/' && *p != '\"')
+			continue;
 
-	string = g_string_new(NULL);
-	pd.func = (XTPrintFunc) g_string_append_printf;
-	pd.data = string;
-	pd.escape = escape;
+		g_string_append_len(string, s, p - s);
 
-	xml_tag_process(tag, &pd);
+		e = strchr(escape_chars, *p);
+		if (e != NULL) {
+			g_string_append_c(string, '\\');
+			g_string_append_c(string, escape_pchars[e - escape_chars]);
+		} else
+			g_string_append_printf(string, "\\u%04x", (guchar) *p);
 
-	return g_string_free(string, FALSE);
-}
+		s = p + 1;
+	}
 
-gchar *xml_tag_to_string(XmlTag *tag)
-{
-	return xml_tag_to_string_common(tag, FALSE);
+	g_string_append_len(string, s, p - s);
+	g_string_append_c(string, '\"');
 }
 
-gchar *xml_tag_to_string_escape(XmlTag *tag)
+static void json_write_tag(XmlTag *tag, GString *string)
 {
-	return xml_tag_to_string_common(tag, TRUE);
-}
+	const gchar *value;
+	gboolean first;
+	gchar buf[32];
+	XmlTag *xt;
+	gchar *tmp;
+	guint n;
 
-static void json_escape(gchar *str, GString *string)
-{
-	static gchar *escape_chars  = "\\/\"\b\f\n\r\t";
-	static gchar *escape_pchars = "\\/\"bfnrt";
+	g_string_append_c(string, '{');
+	first = TRUE;
 
-	gunichar uc;
-	gchar *p;
+	for (n = 0; n < tag->nattr; n++) {
+		value = xml_tag_value(tag->attrs[n].value, buf, sizeof(buf), &tmp);
+		if (value == NULL)
+			continue;
 
-	g_string_append_c(string, '\"');
-	for (p = str; *p != '\0'; p = g_utf8_next_char(p)) {
-		uc = g_utf8_get_char(p);
+		if (! first)
+			g_string_append_c(string, ',');
+		first = FALSE;
 
-		if (uc >= 0x80)
-			g_string_append_unichar(string, uc);
-		else {
-			gchar *s;
-			gsize off;
-
-			s = strchr(escape_chars, uc);
-			if (s != NULL) {
-				off = s - escape_chars;
-				g_string_append_printf(
-					string, "\\%c", escape_pchars[off]
-				);
-			} else {
-				if (uc < ' ')
-					g_string_append_printf(string, "\\u%x", uc);
-				else
-					g_string_append_unichar(string, uc);
-			}
-		}
+		json_write_string(string, tag->attrs[n].name);
+		g_string_append_c(string, ':');
+		json_write_string(string, value);
+		g_free(tmp);
 	}
 
-	g_string_append_c(string, '\"');
-}
+	for (n = 0; n < tag->nchild; n++) {
+		if (! first)
+			g_string_append_c(string, ',');
+		first = FALSE;
 
-static void xml_tag_to_json_add_attr(gchar *key, Variant *var, GString *string)
-{
-	gchar *value;
+		json_write_string(string, tag->childs[n].name);
+		g_string_append(string, ":[");
 
-	value = variant_to_string(var);
-	if (value == NULL)
-		return;
+		for (xt = tag->childs[n].head; xt != NULL; xt = xt->next) {
+			json_write_tag(xt, string);
 
-	if (string->str[string->len - 1] != '{')
-		g_string_append_c(string, ',');
+			if (xt->next != NULL)
+				g_string_append_c(string, ',');
+		}
 
-	json_escape(key, string);
-	g_string_append_c(string, ':');
-	json_escape(value, string);
+		g_string_append_c(string, ']');
+	}
 
-	g_free(value);
+	g_string_append_c(string, '}');
 }
 
-static void xml_tag_to_json_add_tag(XmlTag *tag, GString *string);
-
-static void xml_tag_to_json_add(gchar *name, XmlTag *tag, GString *string)
+void xml_tag_write(XmlTag *tag, XmlTagFormat format, GString *string)
 {
-	/* gboolean array = FALSE; */
-
-	if (string->str[string->len - 1] != '{')
-		g_string_append_c(string, ',');
-
-	json_escape(name, string);
-	g_string_append_c(string, ':');
-
-	/*
-	if (tag->next != NULL) {
-		g_string_append_c(string, '[');
-		array = TRUE;
+	switch (format) {
+	case XML_TAG_FORMAT_XML:
+		xml_write_tag(tag, string, FALSE);
+		break;
+	case XML_TAG_FORMAT_XML_ESCAPE:
+		xml_write_tag(tag, string, TRUE);
+		break;
+	case XML_TAG_FORMAT_JSON:
+		json_write_tag(tag, string);
+		break;
 	}
-	*/
+}
 
-	g_string_append_c(string, '[');
+void xml_tag_print(XmlTag *tag, FILE *fp)
+{
+	GString *string;
 
-	for (; tag != NULL; tag = tag->next) {
-		xml_tag_to_json_add_tag(tag, string);
+	string = g_string_new(NULL);
+	xml_tag_write(tag, XML_TAG_FORMAT_XML, string);
+	fputs(string->str, fp);
+	g_string_free(string, TRUE);
+}
 
-		if (tag->next != NULL)
-			g_string_append_c(string, ',');
-	}
+static gchar *xml_tag_to_string_common(XmlTag *tag, XmlTagFormat format)
+{
+	GString *string;
 
-	g_string_append_c(string, ']');
+	string = g_string_new(NULL);
+	xml_tag_write(tag, format, string);
 
-	/*
-	if (array)
-		g_string_append_c(string, ']');
-	*/
+	return g_string_free(string, FALSE);
 }
 
-static void xml_tag_to_json_add_tag(XmlTag *tag, GString *string)
+gchar *xml_tag_to_string(XmlTag *tag)
 {
-	g_string_append_c(string, '{');
-
-	if (tag->attrs != NULL)
-		g_hash_table_foreach(tag->attrs,
-			(GHFunc) xml_tag_to_json_add_attr, string
-		);
-
-	if (tag->childs != NULL)
-		g_hash_table_foreach(tag->childs,
-			(GHFunc) xml_tag_to_json_add, string
-		);
+	return xml_tag_to_string_common(tag, XML_TAG_FORMAT_XML);
+}
 
-	g_string_append_c(string, '}');
+gchar *xml_tag_to_string_escape(XmlTag *tag)
+{
+	return xml_tag_to_string_common(tag, XML_TAG_FORMAT_XML_ESCAPE);
 }
 
 gchar *xml_tag_to_json(XmlTag *tag)
 {
-	GString *string;
-
-	string = g_string_new(NULL);
-	xml_tag_to_json_add_tag(tag, string);
-
-	return g_string_free(string, FALSE);
+	return xml_tag_to_string_common(tag, XML_TAG_FORMAT_JSON);
 }
 
 XmlTag *get_xml_tag_source(gchar *file, gchar *func, gint line)
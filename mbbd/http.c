@@ -30,6 +30,9 @@ void http_response_free(HttpResponse *resp)
 {
 	g_queue_foreach(&resp->headers, (GFunc) g_free, NULL);
 	trash_empty(&resp->trash);
+
+	if (resp->body != NULL)
+		g_string_free(resp->body, TRUE);
 	g_free(resp);
 }
 
@@ -100,33 +103,41 @@ void http_response_add_header(HttpResponse *resp, gchar *name, gchar *value)
 	g_queue_push_tail(&resp->headers, header);
 }
 
-gchar *http_response_to_string(HttpResponse *resp)
+/* the head is put in front of the body, which is taken from resp */
+GString *http_response_to_string(HttpResponse *resp)
 {
 	HttpHeader *header;
 	GString *string;
+	GString *head;
 	GList *list;
 
-	string = g_string_new("HTTP/1.0");
-	g_string_append_printf(string, " %d", resp->status);
+	head = g_string_new("HTTP/1.0");
+	g_string_append_printf(head, " %d", resp->status);
 	if (resp->reason != NULL)
-		g_string_append_printf(string, " %s", resp->reason);
+		g_string_append_printf(head, " %s", resp->reason);
 	else
-		g_string_append_printf(string, " %d", resp->status);
-	g_string_append(string, CRLF);
+		g_string_append_printf(head, " %d", resp->status);
+	g_string_append(head, CRLF);
 
 	for (list = resp->headers.head; list != NULL; list = list->next) {
 		header = (HttpHeader *) list->data;
 
-		g_string_append_printf(string, "%s: %s", header->name, header->value);
-		g_string_append(string, CRLF);
+		g_string_append_printf(head, "%s: %s", header->name, header->value);
+		g_string_append(head, CRLF);
 	}
 
-	g_string_append(string, CRLF);
+	g_string_append(head, CRLF);
 
-	if (resp->body != NULL)
-		g_string_append(string, resp->body);
+	if (resp->body == NULL)
+		return head;
 
-	return g_string_free(string, FALSE);
+	string = resp->body;
+	resp->body = NULL;
+
+	g_string_prepend_len(string, head->str, head->len);
+	g_string_free(head, TRUE);
+
+	return string;
 }
 
 gchar *http_auth_basic(gchar *name, gchar *pass)
@@ -32,7 +32,7 @@ struct http_header {
 struct http_response {
 	guint status;
 	gchar *reason;
-	gchar *body;
+	GString *body;
 
 	GQueue headers;
 	Trash trash;
@@ -53,7 +53,7 @@ gchar *http_response_get_header(HttpResponse *resp, gchar *name);
 void http_response_add_header(HttpResponse *resp, gchar *name, gchar *value);
 gboolean http_response_set_header(HttpResponse *resp, gchar *name, gchar *value);
 
-gchar *http_response_to_string(HttpResponse *resp);
+GString *http_response_to_string(HttpResponse *resp);
 
 gchar *http_auth_basic(gchar *name, gchar *pass);
 
@@ -131,6 +131,7 @@ int main(int argc, char *argv[])
 	DB_LOAD(gateways);
 	DB_LOAD(operators);
 	DB_LOAD(gwlinks);
+	DB_LOAD(func_limits);
 
 	load_modules(settings.modules);
 
@@ -20,6 +20,23 @@ struct map_data {
 	struct map *map;
 };
 
+struct map_load {
+	struct map *map;
+	struct slice_ops *kops;
+	struct slice_ops *dops;
+
+	struct map_load_item *items;
+	guint *opens;
+	guint *closes;
+	guint nevents;
+
+	GQueue active;
+	GList **links;
+	GSList **conflicts;
+	struct map_entry **entries;
+	GArray *pieces;
+};
+
 struct map_search_data {
 	GCompareFunc cmp;
 	gpointer user_data;
@@ -368,7 +385,34 @@ void map_move(struct map *dst, struct map *src)
 	map_clear(dst);
 	*dst = *src;
 
-	slicer_set_user_data(dst->slicer, dst);
+	if (dst->slicer != NULL)
+		slicer_set_user_data(dst->slicer, dst);
+}
+
+static void map_data_announce(GQueue *queue, struct slice *slice G_GNUC_UNUSED,
+			      struct map *map)
+{
+	GList *list;
+
+	for (list = queue->head; list != NULL; list = list->next)
+		map_node_handle_add(map, queue, list);
+}
+
+void map_replace(struct map *dst, struct map *src)
+{
+	void (*node_add)(MapNode *node);
+	void (*node_del)(MapNode *node);
+
+	node_add = dst->node_add;
+	node_del = dst->node_del;
+
+	map_move(dst, src);
+
+	dst->node_add = node_add;
+	dst->node_del = node_del;
+
+	if (dst->slicer != NULL && dst->node_add != NULL)
+		slicer_foreach(dst->slicer, (s_user_func_t) map_data_announce, dst);
 }
 
 struct map_node *map_node_dup(struct map_node *node)
@@ -523,6 +567,305 @@ void map_del(struct map *map, struct slice *key, struct slice *dkey, gpointer pt
 	map_entry_unref(entry, map->dkey_ops);
 }
 
+static gint map_load_cmp_begin(const guint *a, const guint *b, struct map_load *ml)
+{
+	gint n;
+
+	n = ml->kops->cmp(ml->items[*a].key.begin, ml->items[*b].key.begin);
+	if (n == 0)
+		n = (*a > *b) - (*a < *b);
+
+	return n;
+}
+
+static gint map_load_cmp_end(const guint *a, const guint *b, struct map_load *ml)
+{
+	gint n;
+
+	n = ml->kops->cmp(ml->items[*a].key.end, ml->items[*b].key.end);
+	if (n == 0)
+		n = (*a > *b) - (*a < *b);
+
+	return n;
+}
+
+static gint map_load_cmp_active(guint a, guint b, struct map_load *ml)
+{
+	struct map_load_item *ia = ml->items + a;
+	struct map_load_item *ib = ml->items + b;
+	gint n;
+
+	n = ml->dops->cmp(ia->dkey.begin, ib->dkey.begin);
+	if (n == 0)
+		n = (ia->group > ib->group) - (ia->group < ib->group);
+	if (n == 0)
+		n = (a > b) - (a < b);
+
+	return n;
+}
+
+static void map_load_sort(struct map_load *ml)
+{
+	g_qsort_with_data(ml->opens, ml->nevents, sizeof(guint),
+		(GCompareDataFunc) map_load_cmp_begin, ml
+	);
+
+	g_qsort_with_data(ml->closes, ml->nevents, sizeof(guint),
+		(GCompareDataFunc) map_load_cmp_end, ml
+	);
+}
+
+static void map_load_check(struct map_load *ml, guint n)
+{
+	struct map_load_item *item, *other;
+	GList *list;
+	guint m;
+
+	item = ml->items + n;
+	for (list = ml->active.head; list != NULL; list = list->next) {
+		m = GPOINTER_TO_UINT(list->data);
+		other = ml->items + m;
+
+		if (other->group == item->group)
+			continue;
+
+		if (slice_cmp(&item->dkey, &other->dkey, ml->dops))
+			continue;
+
+		if (other->group < item->group)
+			ml->conflicts[item->group] = g_slist_prepend(
+				ml->conflicts[item->group], GUINT_TO_POINTER(m)
+			);
+		else
+			ml->conflicts[other->group] = g_slist_prepend(
+				ml->conflicts[other->group], GUINT_TO_POINTER(n)
+			);
+	}
+}
+
+static void map_load_open(struct map_load *ml, guint n)
+{
+	GList *list;
+
+	if (ml->entries == NULL)
+		map_load_check(ml, n);
+
+	for (list = ml->active.head; list != NULL; list = list->next)
+		if (map_load_cmp_active(n, GPOINTER_TO_UINT(list->data), ml) < 0)
+			break;
+
+	if (list == NULL) {
+		g_queue_push_tail(&ml->active, GUINT_TO_POINTER(n));
+		ml->links[n] = ml->active.tail;
+	} else {
+		g_queue_insert_before(&ml->active, list, GUINT_TO_POINTER(n));
+		ml->links[n] = list->prev;
+	}
+}
+
+static void map_load_close(struct map_load *ml, guint n)
+{
+	g_queue_delete_link(&ml->active, ml->links[n]);
+	ml->links[n] = NULL;
+}
+
+static void map_load_emit(struct map_load *ml, gpointer begin, gpointer end)
+{
+	struct slice_piece piece;
+	struct map_entry *cur;
+	GQueue *queue;
+	GList *list;
+#ifndef MAP_WITHOUT_SPLIT
+	struct map_data data;
+
+	data.cross = NULL;
+	data.entry = NULL;
+	data.ops = ml->dops;
+	data.map = ml->map;
+#endif
+
+	if (ml->entries == NULL || ml->active.length == 0)
+		return;
+
+	queue = g_queue_new();
+	for (list = ml->active.head; list != NULL; list = list->next) {
+		cur = map_entry_ref(ml->entries[GPOINTER_TO_UINT(list->data)]);
+
+#ifndef MAP_WITHOUT_SPLIT
+		if (queue->tail != NULL &&
+		    map_data_split(queue->tail, queue->tail->data, cur, &data))
+			continue;
+#endif
+
+		g_queue_push_tail(queue, cur);
+	}
+
+	piece.slice.begin = ml->kops->dup(begin);
+	piece.slice.end = ml->kops->dup(end);
+	piece.data = queue;
+
+	g_array_append_val(ml->pieces, piece);
+}
+
+static void map_load_sweep(struct map_load *ml)
+{
+	struct map_load_item *items = ml->items;
+	gpointer point, pos = NULL;
+	guint i, j;
+
+	for (i = j = 0; j < ml->nevents;) {
+		if (i < ml->nevents && ml->kops->cmp(
+			items[ml->opens[i]].key.begin, items[ml->closes[j]].key.end) <= 0) {
+			point = items[ml->opens[i]].key.begin;
+
+			if (ml->active.length && ml->kops->cmp(pos, point) < 0)
+				map_load_emit(ml, pos, ml->kops->dec(ml->kops->dup(point)));
+
+			while (i < ml->nevents && ml->kops->cmp(
+				items[ml->opens[i]].key.begin, point) == 0)
+				map_load_open(ml, ml->opens[i++]);
+		} else {
+			point = items[ml->closes[j]].key.end;
+
+			map_load_emit(ml, pos, point);
+
+			while (j < ml->nevents && ml->kops->cmp(
+				items[ml->closes[j]].key.end, point) == 0)
+				map_load_close(ml, ml->closes[j++]);
+
+			point = ml->kops->inc(ml->kops->dup(point));
+		}
+
+		pos = point;
+	}
+}
+
+static guint map_load_filter(guint *events, guint len, struct map_load_item *items,
+			     gboolean *rejected)
+{
+	guint i, n;
+
+	for (i = n = 0; i < len; i++)
+		if (rejected[items[events[i]].group] == FALSE)
+			events[n++] = events[i];
+
+	return n;
+}
+
+static gboolean map_load_resolve(struct map_load *ml, guint ngroups, gboolean *rejected,
+				 map_load_cross_func_t func, gpointer user_data)
+{
+	struct map_load_item *foe;
+	struct map_cross cross;
+	gboolean ret = TRUE;
+	GSList *list;
+	guint g;
+
+	for (g = 0; g < ngroups; g++) {
+		ml->conflicts[g] = g_slist_reverse(ml->conflicts[g]);
+
+		for (list = ml->conflicts[g]; list != NULL; list = list->next) {
+			foe = ml->items + GPOINTER_TO_UINT(list->data);
+
+			if (rejected[foe->group])
+				continue;
+
+			rejected[g] = TRUE;
+			ret = FALSE;
+
+			if (func != NULL) {
+				cross.slice.begin = ml->dops->dup(foe->dkey.begin);
+				cross.slice.end = ml->dops->dup(foe->dkey.end);
+				cross.data = foe->data;
+				cross.found = TRUE;
+
+				func(g, &cross, user_data);
+			}
+
+			break;
+		}
+
+		g_slist_free(ml->conflicts[g]);
+	}
+
+	return ret;
+}
+
+/*
+ * builds map from items in one sweep over sorted keys instead of map_add
+ * calls, items of crossing groups are handled as if groups were added one
+ * by one in order of their numbers: a group crossing any of accepted ones
+ * is skipped as a whole and reported to func; map must be initialized
+ */
+gboolean map_load(struct map *map, GArray *items, guint ngroups,
+		  map_load_cross_func_t func, gpointer user_data)
+{
+	struct map_load_item *item;
+	struct map_load ml;
+	gboolean *rejected;
+	gboolean ret;
+	guint n;
+
+	g_return_val_if_fail(map->slicer != NULL, FALSE);
+
+	ml.map = map;
+	ml.kops = slicer_get_ops(map->slicer);
+	ml.dops = map->dkey_ops;
+	ml.items = (struct map_load_item *) items->data;
+	ml.nevents = items->len;
+	ml.opens = g_new(guint, items->len);
+	ml.closes = g_new(guint, items->len);
+	ml.links = g_new0(GList *, items->len);
+	ml.conflicts = g_new0(GSList *, ngroups);
+	ml.entries = NULL;
+	ml.pieces = NULL;
+	g_queue_init(&ml.active);
+
+	for (n = 0; n < items->len; n++)
+		ml.opens[n] = ml.closes[n] = n;
+
+	map_load_sort(&ml);
+	map_load_sweep(&ml);
+
+	rejected = g_new0(gboolean, ngroups);
+	ret = map_load_resolve(&ml, ngroups, rejected, func, user_data);
+
+	ml.nevents = map_load_filter(ml.opens, items->len, ml.items, rejected);
+	map_load_filter(ml.closes, items->len, ml.items, rejected);
+
+	ml.entries = g_new(struct map_entry *, items->len);
+	ml.pieces = g_array_new(FALSE, FALSE, sizeof(struct slice_piece));
+
+	for (n = 0; n < ml.nevents; n++) {
+		item = ml.items + ml.opens[n];
+
+		ml.entries[ml.opens[n]] = map_entry_new(
+			ml.dops->dup(item->dkey.begin),
+			ml.dops->dup(item->dkey.end),
+			item->data
+		);
+	}
+
+	map_load_sweep(&ml);
+
+	slicer_load(map->slicer, ml.pieces);
+	if (map->node_add != NULL)
+		slicer_foreach(map->slicer, (s_user_func_t) map_data_announce, map);
+
+	for (n = 0; n < ml.nevents; n++)
+		map_entry_unref(ml.entries[ml.opens[n]], ml.dops);
+
+	g_array_free(ml.pieces, TRUE);
+	g_free(ml.entries);
+	g_free(rejected);
+	g_free(ml.conflicts);
+	g_free(ml.links);
+	g_free(ml.closes);
+	g_free(ml.opens);
+
+	return ret;
+}
+
 static void map_data_remove_custom(GQueue *queue, struct slice *slice G_GNUC_UNUSED,
 				   struct map_search_data *data)
 {
@@ -29,6 +29,16 @@ struct map_cross {
 	gboolean found;
 };
 
+struct map_load_item {
+	struct slice key;
+	struct slice dkey;
+	gpointer data;
+	guint group;
+};
+
+typedef void (*map_load_cross_func_t)(guint group, struct map_cross *cross,
+				      gpointer user_data);
+
 typedef SlicerIter MapIter;
 typedef struct map_data_iter MapDataIter;
 
@@ -40,6 +50,7 @@ void map_init(struct map *map, struct slice_ops *dkey_ops);
 void map_init_slicer(struct map *map, Slicer *(*create)(struct slice_data_ops *));
 void map_clear(struct map *map);
 void map_move(struct map *dst, struct map *src);
+void map_replace(struct map *dst, struct map *src);
 
 struct map_node *map_node_dup(struct map_node *node);
 gpointer map_node_get_data(struct map_node *node);
@@ -62,6 +73,9 @@ void map_add(struct map *map, struct slice *key, struct slice *dkey,
 void map_del(struct map *map, struct slice *key, struct slice *dkey,
 	     gpointer data);
 
+gboolean map_load(struct map *map, GArray *items, guint ngroups,
+		  map_load_cross_func_t func, gpointer user_data);
+
 void map_remove_custom(struct map *map, gpointer user_data, GCompareFunc cmp);
 void map_glue_null(struct map *map);
 
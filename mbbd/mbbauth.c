@@ -2,27 +2,49 @@
 /* Published under the GNU General Public License V.2, see file COPYING */
 
 #include <string.h>
+#include <time.h>
 
 #include "mbbmodule.h"
 #include "mbbplock.h"
+#include "mbblock.h"
 #include "mbbauth.h"
 
 #include "mbbxmlmsg.h"
 #include "mbbinit.h"
 #include "mbbfunc.h"
 #include "mbblog.h"
+#include "mbbvar.h"
 
+#include "varconv.h"
 #include "xmltag.h"
 
+#define AUTH_CACHE_MAX 1024
+
 struct mbb_auth_method {
 	gchar *name;
 	MbbModule *mod;
 	mbb_auth_func_t func;
+	gboolean cache;
+};
+
+struct auth_verdict {
+	gint user_id;
+	guint generation;
+	time_t expire;
 };
 
 static GHashTable *ht = NULL;
 
-static struct mbb_auth_method *mbb_auth_method_new(gchar *name, mbb_auth_func_t func)
+static GHashTable *cache_ht = NULL;
+static GStaticMutex cache_mutex = G_STATIC_MUTEX_INIT;
+
+static guint cache_ttl = 60;
+static volatile gint cache_generation = 0;
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+
+static struct mbb_auth_method *mbb_auth_method_new(gchar *name, mbb_auth_func_t func,
+						   gboolean cache)
 {
 	struct mbb_auth_method *am;
 
@@ -30,6 +52,7 @@ static struct mbb_auth_method *mbb_auth_method_new(gchar *name, mbb_auth_func_t
 	am->name = name;
 	am->mod = mbb_module_current();
 	am->func = func;
+	am->cache = cache;
 
 	return am;
 }
@@ -46,6 +69,117 @@ static inline void ht_init(void)
 	);
 }
 
+/* the secret itself is never kept, only its digest */
+static gchar *auth_cache_key(gchar *type, gchar *login, gchar *secret)
+{
+	gchar *digest, *key;
+
+	digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, secret, -1);
+	key = g_strdup_printf("%s:%s:%s", type, login, digest);
+	g_free(digest);
+
+	return key;
+}
+
+/* writer lock sections cover users and groups, changes made outside
+ * the lock, e.g. attributes checked by auth modules, are reported here */
+static inline guint auth_cache_generation(void)
+{
+	return mbb_lock_generation() +
+		(guint) g_atomic_int_get(&cache_generation);
+}
+
+void mbb_auth_cache_invalidate(void)
+{
+	g_atomic_int_inc(&cache_generation);
+}
+
+static void auth_cache_clear(void)
+{
+	g_static_mutex_lock(&cache_mutex);
+
+	if (cache_ht != NULL)
+		g_hash_table_remove_all(cache_ht);
+
+	g_static_mutex_unlock(&cache_mutex);
+}
+
+static MbbUser *auth_cache_lookup(gchar *key, gchar *login)
+{
+	struct auth_verdict *verdict;
+	MbbUser *user = NULL;
+	guint generation = 0;
+	gint user_id = -1;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	if (cache_ht != NULL && (verdict = g_hash_table_lookup(cache_ht, key))) {
+		if (verdict->expire > time(NULL)) {
+			user_id = verdict->user_id;
+			generation = verdict->generation;
+		} else
+			g_hash_table_remove(cache_ht, key);
+	}
+
+	g_static_mutex_unlock(&cache_mutex);
+
+	if (user_id < 0)
+		return NULL;
+
+	/* any change of users or attributes invalidates the verdict */
+	mbb_lock_reader_lock();
+	if (generation == auth_cache_generation()) {
+		user = mbb_user_get_by_id(user_id);
+		if (user != NULL && ! strcmp(user->name, login))
+			mbb_user_ref(user);
+		else
+			user = NULL;
+	}
+	mbb_lock_reader_unlock();
+
+	return user;
+}
+
+static gboolean auth_cache_is_stale(gpointer key G_GNUC_UNUSED,
+				    struct auth_verdict *verdict,
+				    gpointer data)
+{
+	return verdict->generation != auth_cache_generation() ||
+		verdict->expire <= *(time_t *) data;
+}
+
+static void auth_cache_store(gchar *key, gint user_id, guint generation)
+{
+	struct auth_verdict *verdict;
+	time_t now;
+
+	verdict = g_new(struct auth_verdict, 1);
+	verdict->user_id = user_id;
+	verdict->generation = generation;
+	verdict->expire = (now = time(NULL)) + cache_ttl;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	if (cache_ht == NULL) {
+		cache_ht = g_hash_table_new_full(
+			g_str_hash, g_str_equal, g_free, g_free
+		);
+	}
+
+	if (g_hash_table_size(cache_ht) >= AUTH_CACHE_MAX) {
+		g_hash_table_foreach_remove(cache_ht,
+			(GHRFunc) auth_cache_is_stale, &now
+		);
+
+		if (g_hash_table_size(cache_ht) >= AUTH_CACHE_MAX)
+			g_hash_table_remove_all(cache_ht);
+	}
+
+	g_hash_table_replace(cache_ht, key, verdict);
+
+	g_static_mutex_unlock(&cache_mutex);
+}
+
 MbbUser *mbb_auth_plain(gchar *login, gchar *secret)
 {
 	MbbUser *user;
@@ -53,41 +187,76 @@ MbbUser *mbb_auth_plain(gchar *login, gchar *secret)
 	if (secret == NULL)
 		return NULL;
 
-	if ((user = mbb_user_get_by_name(login)) == NULL)
-		return NULL;
+	mbb_lock_reader_lock();
 
-	if (user->secret == NULL)
-		return NULL;
+	user = mbb_user_get_by_name(login);
+	if (user != NULL && user->secret != NULL && ! strcmp(user->secret, secret))
+		mbb_user_ref(user);
+	else
+		user = NULL;
 
-	if (! strcmp(user->secret, secret))
-		return user;
+	mbb_lock_reader_unlock();
 
-	return NULL;
+	return user;
 }
 
 MbbUser *mbb_auth(gchar *login, gchar *secret, gchar *type)
 {
+	struct mbb_auth_method *am;
+	mbb_auth_func_t func = NULL;
+	MbbModule *mod = NULL;
+	gboolean cache = FALSE;
 	MbbUser *user = NULL;
+	guint generation;
+	gchar *key = NULL;
 
 	if (type == NULL)
 		type = "plain";
 
 	mbb_plock_reader_lock();
-	if (ht != NULL) {
-		struct mbb_auth_method *am;
-
-		am = g_hash_table_lookup(ht, type);
-		if (am != NULL && mbb_module_use(am->mod)) {
-			user = am->func(login, secret);
-			mbb_module_unuse(am->mod);
+	if (ht != NULL && (am = g_hash_table_lookup(ht, type)) != NULL) {
+		if (mbb_module_use(am->mod)) {
+			func = am->func;
+			mod = am->mod;
+			cache = am->cache;
 		}
 	}
 	mbb_plock_reader_unlock();
 
+	if (func == NULL)
+		return NULL;
+
+	if (cache && cache_ttl > 0 && login != NULL && secret != NULL) {
+		key = auth_cache_key(type, login, secret);
+		user = auth_cache_lookup(key, login);
+
+		g_static_mutex_lock(&cache_mutex);
+		if (user != NULL)
+			cache_hits++;
+		else
+			cache_misses++;
+		g_static_mutex_unlock(&cache_mutex);
+	}
+
+	if (user == NULL) {
+		/* taken before the check, a change in between drops the verdict */
+		generation = auth_cache_generation();
+
+		user = func(login, secret);
+		if (user != NULL && key != NULL) {
+			auth_cache_store(key, user->id, generation);
+			key = NULL;
+		}
+	}
+
+	mbb_module_unuse(mod);
+	g_free(key);
+
 	return user;
 }
 
-gpointer mbb_auth_method_register(gchar *name, mbb_auth_func_t func)
+static gpointer auth_method_register(gchar *name, mbb_auth_func_t func,
+				     gboolean cache)
 {
 	struct mbb_auth_method *am;
 
@@ -102,7 +271,7 @@ gpointer mbb_auth_method_register(gchar *name, mbb_auth_func_t func)
 		}
 	}
 
-	am = mbb_auth_method_new(name, func);
+	am = mbb_auth_method_new(name, func, cache);
 	g_hash_table_insert(ht, name, am);
 
 	mbb_plock_writer_unlock();
@@ -112,6 +281,16 @@ gpointer mbb_auth_method_register(gchar *name, mbb_auth_func_t func)
 	return am;
 }
 
+gpointer mbb_auth_method_register(gchar *name, mbb_auth_func_t func)
+{
+	return auth_method_register(name, func, FALSE);
+}
+
+gpointer mbb_auth_method_register_cached(gchar *name, mbb_auth_func_t func)
+{
+	return auth_method_register(name, func, TRUE);
+}
+
 void mbb_auth_method_unregister(gpointer method_key)
 {
 	struct mbb_auth_method *am = method_key;
@@ -127,8 +306,10 @@ void mbb_auth_method_unregister(gpointer method_key)
 		isremoved = g_hash_table_remove(ht, name);
 	mbb_plock_writer_unlock();
 
-	if (isremoved)
+	if (isremoved) {
+		auth_cache_clear();
 		mbb_log("unregister auth method '%s'", name);
+	}
 }
 
 static void auth_method_list(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
@@ -168,8 +349,35 @@ MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-server-auth-list", auth_method_list, MBB_CAP_ADMIN),
 MBB_INIT_FUNCTIONS_END
 
+static gboolean var_conv_cache_ttl(gchar *arg, gpointer p)
+{
+	if (! var_conv_uint(arg, p))
+		return FALSE;
+
+	if (cache_ttl == 0)
+		auth_cache_clear();
+
+	return TRUE;
+}
+
+MBB_VAR_DEF(cache_ttl_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_cache_ttl,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
+MBB_VAR_DEF(cache_stat_def) {
+	.op_read = var_str_uint,
+	.cap_read = MBB_CAP_ALL
+};
+
 static void init_vars(void)
 {
+	mbb_base_var_register("auth.cache.ttl", &cache_ttl_def, &cache_ttl);
+	mbb_base_var_register("auth.cache.hits", &cache_stat_def, &cache_hits);
+	mbb_base_var_register("auth.cache.misses", &cache_stat_def, &cache_misses);
+
 	mbb_auth_method_register("plain", mbb_auth_plain);
 }
 
@@ -6,12 +6,16 @@
 
 #include "mbbuser.h"
 
+/* called without the global lock, returns a referenced user */
 typedef MbbUser *(*mbb_auth_func_t)(gchar *login, gchar *secret);
 
 MbbUser *mbb_auth(gchar *login, gchar *secret, gchar *type);
 MbbUser *mbb_auth_plain(gchar *login, gchar *secret);
 
 gpointer mbb_auth_method_register(gchar *name, mbb_auth_func_t func);
+gpointer mbb_auth_method_register_cached(gchar *name, mbb_auth_func_t func);
 void mbb_auth_method_unregister(gpointer method_key);
 
+void mbb_auth_cache_invalidate(void);
+
 #endif
@@ -77,7 +77,7 @@ MbbUser *mbb_auth_key_get_user(gchar *key, gchar *dummy G_GNUC_UNUSED)
 		kd = (struct key_data *) g_hash_table_lookup(ht, key);
 
 		if (kd != NULL && ! g_strcmp0(peer, kd->peer)) {
-			user = kd->user;
+			user = mbb_user_ref(kd->user);
 			g_timer_start(kd->timer);
 		}
 	}
@@ -0,0 +1,162 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+/* <batch mode='stop|continue'><request name='...'/>...</batch>
+ *
+ * all requests run under one writer lock in one db transaction, every
+ * request in a savepoint of its own, so a failed one leaves no trace in
+ * the db, and the transaction is committed once at the end. stop mode
+ * ends the batch on the first error, continue mode runs it to the end.
+ *
+ * in-memory changes can't be rolled back, so a db error after some
+ * requests succeeded leaves memory ahead of the db. only methods marked
+ * batch safe are run: setters writing the whole value on every call,
+ * whose repeat brings the db back in step, and read-only cached methods.
+ * for the same reason there is no all-or-nothing mode */
+
+#include <string.h>
+
+#include "mbbxmlmsg.h"
+#include "mbbbatch.h"
+#include "mbbfunc.h"
+#include "mbblock.h"
+#include "mbbdb.h"
+#include "mbblog.h"
+
+static XmlTag *batch_call(XmlTag *tag, gboolean *ok)
+{
+	gchar *method;
+	Variant *var;
+	XmlTag *ans;
+
+	var = xml_tag_get_attr(tag, "name");
+	if (var == NULL) {
+		*ok = FALSE;
+		return mbb_xml_msg_error("bad format");
+	}
+
+	method = variant_get_string(var);
+	if (mbb_func_call(method, tag, &ans) == FALSE)
+		ans = mbb_xml_msg(MBB_MSG_UNKNOWN_METHOD, method);
+	else if (ans == NULL)
+		ans = mbb_xml_msg_ok();
+
+	*ok = mbb_xml_msg_is_ok(ans, NULL);
+	xml_tag_set_attr(ans, "origin", variant_new_string(method));
+
+	return ans;
+}
+
+static gboolean batch_run(XmlTag *tag, XmlTag *ans, gboolean stop,
+			  GError **error)
+{
+	guint done, failed;
+	gboolean ret;
+	XmlTag *sub;
+	gboolean ok;
+
+	ret = TRUE;
+	done = failed = 0;
+	for (; tag != NULL; tag = tag->next) {
+		if (! (ret = mbb_db_begin(error)))
+			break;
+
+		sub = batch_call(tag, &ok);
+		xml_tag_add_child(ans, sub);
+
+		if (ok) {
+			ret = mbb_db_commit(error);
+			done++;
+		} else {
+			ret = mbb_db_rollback(error);
+			failed++;
+		}
+
+		if (! ret || (! ok && stop))
+			break;
+	}
+
+	xml_tag_set_attr(ans, "done", variant_new_int(done));
+	xml_tag_set_attr(ans, "failed", variant_new_int(failed));
+
+	return ret;
+}
+
+static gchar *batch_check(XmlTag *tag)
+{
+	Variant *var;
+	gchar *method;
+
+	for (; tag != NULL; tag = tag->next) {
+		var = xml_tag_get_attr(tag, "name");
+		if (var == NULL)
+			continue;
+
+		method = variant_get_string(var);
+		if (! mbb_func_batch_safe(method))
+			return method;
+	}
+
+	return NULL;
+}
+
+XmlTag *mbb_batch_exec(XmlTag *tag)
+{
+	GError *error = NULL;
+	gchar *method;
+	gboolean stop;
+	Variant *var;
+	XmlTag *ans;
+	gchar *mode;
+
+	var = xml_tag_get_attr(tag, "mode");
+	mode = var == NULL ? NULL : variant_get_string(var);
+
+	if (mode == NULL || ! strcmp(mode, "stop"))
+		stop = TRUE;
+	else if (! strcmp(mode, "continue"))
+		stop = FALSE;
+	else if (! strcmp(mode, "all"))
+		return mbb_xml_msg_error("all-or-nothing batches are not "
+			"supported, in-memory changes can't be rolled back");
+	else
+		return mbb_xml_msg_error("invalid batch mode %s", mode);
+
+	tag = xml_tag_get_child(tag, "request");
+	xml_tag_reorder(tag);
+
+	if ((method = batch_check(tag)) != NULL)
+		return mbb_xml_msg_error("method %s is not allowed in batches",
+			method);
+
+	mbb_lock_writer_lock();
+
+	if (! mbb_db_begin(&error)) {
+		mbb_lock_writer_unlock();
+		return mbb_xml_msg_from_error(error);
+	}
+
+	ans = mbb_xml_msg_ok();
+	if (! batch_run(tag, ans, stop, &error))
+		mbb_db_rollback(NULL);
+	else
+		mbb_db_commit(&error);
+
+	if (error != NULL) {
+		/* memory keeps the changes, repeating the batch fixes the db */
+		mbb_log("batch aborted: %s", error->message);
+
+		xml_tag_set_attr(ans, "result", variant_new_static_string("error"));
+		xml_tag_set_attr(ans, "desc", variant_new_alloc_string(
+			g_strdup_printf("batch aborted: %s", error->message)
+		));
+
+		g_error_free(error);
+	}
+
+	mbb_lock_writer_unlock();
+
+	xml_tag_reorder(xml_tag_get_child(ans, "response"));
+
+	return ans;
+}
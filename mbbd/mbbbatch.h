@@ -0,0 +1,11 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef MBB_BATCH_H
+#define MBB_BATCH_H
+
+#include "xmltag.h"
+
+XmlTag *mbb_batch_exec(XmlTag *tag);
+
+#endif
@@ -339,14 +339,14 @@ static void consumer_unset_user(XmlTag *tag, XmlTag **ans)
 }
 
 MBB_INIT_FUNCTIONS_DO
-	MBB_FUNC_STRUCT("mbb-show-consumers", show_consumers, MBB_CAP_ADMIN),
+	MBB_FUNC_CACHED("mbb-show-consumers", show_consumers, MBB_CAP_ADMIN, 60),
 	MBB_FUNC_STRUCT("mbb-self-show-consumers", self_show_consumers, MBB_CAP_CONS),
 
 	MBB_FUNC_STRUCT("mbb-add-consumer", add_consumer, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-drop-consumer", drop_consumer, MBB_CAP_WHEEL),
 
 	MBB_FUNC_STRUCT("mbb-consumer-mod-name", consumer_mod_name, MBB_CAP_ADMIN),
-	MBB_FUNC_STRUCT("mbb-consumer-mod-time", consumer_mod_time, MBB_CAP_ADMIN),
+	MBB_FUNC_BATCH("mbb-consumer-mod-time", consumer_mod_time, MBB_CAP_ADMIN),
 
 	MBB_FUNC_STRUCT("mbb-consumer-set-user", consumer_set_user, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-consumer-unset-user", consumer_unset_user, MBB_CAP_ADMIN),
@@ -2,22 +2,54 @@
 /* Published under the GNU General Public License V.2, see file COPYING */
 
 #include <stdarg.h>
+#include <string.h>
 
 #include "mbbthread.h"
+#include "mbbinit.h"
 #include "mbblog.h"
+#include "mbbvar.h"
 #include "mbbdb.h"
 
 #include "strconv.h"
+#include "varconv.h"
 #include "macros.h"
 #include "query.h"
 
+struct db_vararg {
+	va_list ap;
+};
+
+struct db_stmt {
+	GString *sql;
+	GArray *params;
+};
+
+struct db_hold {
+	gpointer conn;
+	guint nref;
+	guint npending;
+
+	gboolean pinned;
+
+	/* transaction depth, nested ones are savepoints */
+	guint trans;
+};
+
 static GHashTable *ht = NULL;
 static struct mbb_db *db = NULL;
-static gpointer db_conn = NULL;
 static struct mbb_db_auth *db_auth = NULL;
 
 static GStaticPrivate db_priv_key = G_STATIC_PRIVATE_INIT;
-static GStaticRecMutex query_mutex; /* initialize it in init() */
+
+static GStaticMutex pool_mutex = G_STATIC_MUTEX_INIT;
+static GCond *pool_cond = NULL;
+static GQueue pool_idle = G_QUEUE_INIT;
+
+static guint pool_min = 1;
+static guint pool_max = 16;
+static guint pool_size = 0;
+static guint pool_waits = 0;
+static guint pool_wait_time = 0;
 
 void mbb_db_register(struct mbb_db *db)
 {
@@ -65,105 +97,269 @@ static inline gboolean db_get_initialized(GError **error)
 	return TRUE;
 }
 
-gboolean mbb_db_open(struct mbb_db_auth *auth, GError **error)
+static inline void db_close(gpointer conn)
 {
-	g_return_val_if_fail(db_get_initialized(error), FALSE);
+	db->close(conn);
+}
 
-	if (db_conn != NULL) {
-		g_set_error(error, MBB_DB_ERROR,
-			MBB_DB_ERROR_ALREADY_CONNECTED,
-			"connection is already opened");
-		return FALSE;
+static inline guint pool_limit(void)
+{
+	return MAX(pool_max, 1);
+}
+
+static void pool_account_wait(GTimeVal *start)
+{
+	GTimeVal now;
+
+	g_get_current_time(&now);
+	pool_wait_time += (now.tv_sec - start->tv_sec) * 1000 +
+			  (now.tv_usec - start->tv_usec) / 1000;
+}
+
+static void pool_drop(gpointer conn)
+{
+	if (conn != NULL)
+		db_close(conn);
+
+	g_static_mutex_lock(&pool_mutex);
+	pool_size--;
+	g_cond_signal(pool_cond);
+	g_static_mutex_unlock(&pool_mutex);
+}
+
+static gpointer pool_checkout(GError **error)
+{
+	gboolean waited = FALSE;
+	GTimeVal start;
+	gpointer conn;
+
+	g_static_mutex_lock(&pool_mutex);
+
+	while (g_queue_is_empty(&pool_idle) && pool_size >= pool_limit()) {
+		if (waited == FALSE) {
+			g_get_current_time(&start);
+			pool_waits++;
+			waited = TRUE;
+		}
+
+		g_cond_wait(pool_cond, g_static_mutex_get_mutex(&pool_mutex));
 	}
 
-	db_conn = db->open(auth, error);
-	if (db_conn != NULL) {
-		db_auth = auth;
-		return TRUE;
+	if (waited)
+		pool_account_wait(&start);
+
+	/* empty queue means a free slot, the connection is opened below */
+	conn = g_queue_pop_head(&pool_idle);
+	if (conn == NULL)
+		pool_size++;
+
+	g_static_mutex_unlock(&pool_mutex);
+
+	if (conn != NULL && db->check != NULL && ! db->check(conn)) {
+		mbb_log("drop broken db connection");
+		db_close(conn);
+		conn = NULL;
 	}
 
-	return FALSE;
+	if (conn == NULL) {
+		conn = db->open(db_auth, error);
+		if (conn == NULL)
+			pool_drop(NULL);
+	}
+
+	return conn;
 }
 
-static inline void db_close(gpointer conn)
+static void pool_checkin(gpointer conn)
 {
-	db->close(conn);
+	g_static_mutex_lock(&pool_mutex);
+
+	/* pool.max was lowered, shrink on return */
+	if (pool_size > pool_limit()) {
+		pool_size--;
+		g_static_mutex_unlock(&pool_mutex);
+		db_close(conn);
+		return;
+	}
+
+	g_queue_push_head(&pool_idle, conn);
+	g_cond_signal(pool_cond);
+	g_static_mutex_unlock(&pool_mutex);
 }
 
-gboolean mbb_db_dup_conn(GError **error)
+gboolean mbb_db_open(struct mbb_db_auth *auth, GError **error)
 {
 	gpointer conn;
 
 	g_return_val_if_fail(db_get_initialized(error), FALSE);
 
-	if (db_auth == NULL) {
-		g_set_error(error, MBB_DB_ERROR,
-			MBB_DB_ERROR_NOT_CONNECTED,
-			"not connected");
-		return FALSE;
-	}
-
-	if (g_static_private_get(&db_priv_key) != NULL) {
+	if (db_auth != NULL) {
 		g_set_error(error, MBB_DB_ERROR,
 			MBB_DB_ERROR_ALREADY_CONNECTED,
-			"connection is already alive");
+			"connection is already opened");
 		return FALSE;
 	}
 
-	conn = db->open(db_auth, error);
+	conn = db->open(auth, error);
 	if (conn == NULL)
 		return FALSE;
 
-	g_static_private_set(&db_priv_key, conn, db_close);
-	mbb_log("duplicate db connection");
+	pool_cond = g_cond_new();
+	g_queue_push_head(&pool_idle, conn);
+	pool_size = 1;
+
+	db_auth = auth;
+
+	for (; pool_size < MIN(pool_min, pool_limit()); pool_size++) {
+		GError *tmp_error = NULL;
+
+		conn = db->open(auth, &tmp_error);
+		if (conn == NULL) {
+			mbb_log("db pool: %s", tmp_error->message);
+			g_error_free(tmp_error);
+			break;
+		}
+
+		g_queue_push_head(&pool_idle, conn);
+	}
 
 	return TRUE;
 }
 
-static inline gpointer db_get_conn(GError **error)
+static void db_hold_free(struct db_hold *hold)
 {
-	gpointer conn;
+	if (hold->conn != NULL)
+		pool_checkin(hold->conn);
+
+	g_free(hold);
+}
+
+static struct db_hold *db_hold_get(void)
+{
+	struct db_hold *hold;
+
+	hold = g_static_private_get(&db_priv_key);
+	if (hold == NULL) {
+		hold = g_new0(struct db_hold, 1);
+		g_static_private_set(&db_priv_key, hold,
+			(GDestroyNotify) db_hold_free
+		);
+	}
+
+	return hold;
+}
+
+/* the thread keeps its connection while anything refers to it */
+static gpointer db_conn_ref(GError **error)
+{
+	struct db_hold *hold;
 
 	if (! db_get_initialized(error))
 		return NULL;
 
-	conn = g_static_private_get(&db_priv_key);
-	if (conn == NULL)
-		conn = db_conn;
-
-	if (conn == NULL) {
+	if (db_auth == NULL) {
 		g_set_error(error, MBB_DB_ERROR,
 			MBB_DB_ERROR_NOT_CONNECTED,
 			"not connected");
 		return NULL;
 	}
 
-	return conn;
+	hold = db_hold_get();
+	if (hold->conn == NULL) {
+		hold->conn = pool_checkout(error);
+		if (hold->conn == NULL)
+			return NULL;
+	}
+
+	hold->nref++;
+
+	return hold->conn;
 }
 
-gboolean mbb_db_dup_conn_once(GError **error)
+static void db_conn_unref(void)
 {
-	gpointer conn;
+	struct db_hold *hold;
 
-	conn = db_get_conn(error);
-	g_return_val_if_fail(conn != NULL, FALSE);
+	hold = g_static_private_get(&db_priv_key);
+	if (hold == NULL || hold->nref == 0)
+		return;
 
-	if (conn != db_conn)
-		return TRUE;
+	if (--hold->nref == 0) {
+		pool_checkin(hold->conn);
+		hold->conn = NULL;
+	}
+}
 
-	return mbb_db_dup_conn(error);
+gboolean mbb_db_conn_get(GError **error)
+{
+	return db_conn_ref(error) != NULL;
 }
 
-static inline void db_query_lock(gpointer conn)
+void mbb_db_conn_put(void)
 {
-	if (conn == db_conn)
-		g_static_rec_mutex_lock(&query_mutex);
+	db_conn_unref();
 }
 
-static inline void db_query_unlock(gpointer conn)
+gboolean mbb_db_dup_conn(GError **error)
 {
-	if (conn == db_conn)
-		g_static_rec_mutex_unlock(&query_mutex);
+	struct db_hold *hold;
+
+	g_return_val_if_fail(db_get_initialized(error), FALSE);
+
+	hold = g_static_private_get(&db_priv_key);
+	if (hold != NULL && hold->pinned) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_ALREADY_CONNECTED,
+			"connection is already alive");
+		return FALSE;
+	}
+
+	if (db_conn_ref(error) == NULL)
+		return FALSE;
+
+	db_hold_get()->pinned = TRUE;
+
+	return TRUE;
+}
+
+gboolean mbb_db_dup_conn_once(GError **error)
+{
+	struct db_hold *hold;
+
+	hold = g_static_private_get(&db_priv_key);
+	if (hold != NULL && hold->pinned)
+		return TRUE;
+
+	return mbb_db_dup_conn(error);
+}
+
+/* undoes mbb_db_dup_conn along with anything the thread left behind:
+ * pending results, an open transaction and the connection itself */
+void mbb_db_put_conn(void)
+{
+	struct db_hold *hold;
+
+	hold = g_static_private_get(&db_priv_key);
+	if (hold == NULL)
+		return;
+
+	if (hold->npending != 0)
+		mbb_db_sync(0, NULL);
+
+	if (hold->conn != NULL) {
+		if (hold->trans) {
+			mbb_log("db transaction left open, rolled back");
+			db->rollback(hold->conn, NULL);
+		}
+
+		pool_checkin(hold->conn);
+	}
+
+	hold->conn = NULL;
+	hold->nref = 0;
+	hold->npending = 0;
+	hold->pinned = FALSE;
+	hold->trans = 0;
 }
 
 gboolean mbb_db_query(gchar *command, mbb_db_func_t func, gpointer user_data, GError **error)
@@ -171,14 +367,13 @@ gboolean mbb_db_query(gchar *command, mbb_db_func_t func, gpointer user_data, GE
 	gpointer conn;
 	gboolean ret;
 
-	conn = db_get_conn(error);
+	conn = db_conn_ref(error);
 	g_return_val_if_fail(conn != NULL, FALSE);
 
 	mbb_log_lvl(MBB_LOG_QUERY, "%s", command);
 
-	db_query_lock(conn);
 	ret = db->query(conn, command, func, user_data, error);
-	db_query_unlock(conn);
+	db_conn_unref();
 
 	return ret;
 }
@@ -188,15 +383,14 @@ gchar *mbb_db_escape(gchar *str)
 	gpointer conn;
 	gchar *esc;
 
-	conn = db_get_conn(NULL);
-	g_return_val_if_fail(conn != NULL, NULL);
-
 	if (db->escape == NULL)
 		return NULL;
 
-	db_query_lock(conn);
+	conn = db_conn_ref(NULL);
+	g_return_val_if_fail(conn != NULL, NULL);
+
 	esc = db->escape(conn, str);
-	db_query_unlock(conn);
+	db_conn_unref();
 
 	return esc;
 }
@@ -206,14 +400,13 @@ struct mbb_db_iter *mbb_db_query_iter(gchar *command, GError **error)
 	struct mbb_db_iter *iter;
 	gpointer conn;
 
-	conn = db_get_conn(error);
+	conn = db_conn_ref(error);
 	g_return_val_if_fail(conn != NULL, NULL);
 
 	mbb_log_lvl(MBB_LOG_QUERY, "%s", command);
 
-	db_query_lock(conn);
 	iter = db->query_iter(conn, command, error);
-	db_query_unlock(conn);
+	db_conn_unref();
 
 	return iter;
 }
@@ -243,68 +436,508 @@ void mbb_db_iter_free(struct mbb_db_iter *iter)
 	db->iter_free(iter);
 }
 
-/*
-void mbb_db_close(void)
-{
-	g_return_if_fail(db_get_initialized(NULL));
-
-	if (db_conn != NULL) {
-		db->close(db_conn);
-		db_conn = db_auth = NULL;
-	}
-}
-*/
-
 static gboolean make_call(gboolean (*callback)(gpointer, GError **),
 			  gboolean open, GError **error)
 {
+	struct db_hold *hold;
 	gpointer conn;
 	gboolean ret;
 
-	conn = db_get_conn(error);
-	g_return_val_if_fail(conn != NULL, FALSE);
-
 	if (callback == NULL) {
 		g_set_error(error, MBB_DB_ERROR, MBB_DB_ERROR_UNSUPPORTED,
 			    "unsupported");
 		return FALSE;
 	}
 
-	if (conn != db_conn)
-		ret = callback(conn, error);
-	else {
-		if (open)
-			g_static_rec_mutex_lock(&query_mutex);
-
-		ret = callback(conn, error);
+	conn = db_conn_ref(error);
+	g_return_val_if_fail(conn != NULL, FALSE);
 
-		if (! open)
-			g_static_rec_mutex_unlock(&query_mutex);
+	ret = callback(conn, error);
+
+	/* an open transaction holds its own reference to the connection */
+	hold = db_hold_get();
+	if (open) {
+		if (ret && ! hold->trans) {
+			hold->trans = 1;
+			return ret;
+		}
+	} else if (hold->trans) {
+		hold->trans = 0;
+		db_conn_unref();
 	}
 
+	db_conn_unref();
+
+	return ret;
+}
+
+static inline guint trans_depth(void)
+{
+	struct db_hold *hold;
+
+	hold = g_static_private_get(&db_priv_key);
+
+	return hold != NULL ? hold->trans : 0;
+}
+
+static gboolean savepoint_call(gchar *fmt, guint level, GError **error)
+{
+	gchar *query;
+	gboolean ret;
+
+	query = g_strdup_printf(fmt, level, level);
+	ret = mbb_db_query(query, NULL, NULL, error);
+	g_free(query);
+
 	return ret;
 }
 
 gboolean mbb_db_begin(GError **error)
 {
-	return make_call(db->begin, TRUE, error);
+	guint depth = trans_depth();
+
+	if (depth == 0)
+		return make_call(db->begin, TRUE, error);
+
+	if (! savepoint_call("savepoint mbb_sp%u;", depth, error))
+		return FALSE;
+
+	db_hold_get()->trans++;
+
+	return TRUE;
 }
 
 gboolean mbb_db_rollback(GError **error)
 {
-	return make_call(db->rollback, FALSE, error);
+	guint depth = trans_depth();
+
+	if (depth <= 1)
+		return make_call(db->rollback, FALSE, error);
+
+	db_hold_get()->trans--;
+
+	return savepoint_call(
+		"rollback to savepoint mbb_sp%u; release savepoint mbb_sp%u;",
+		depth - 1, error
+	);
 }
 
 gboolean mbb_db_commit(GError **error)
 {
-	return make_call(db->commit, FALSE, error);
+	guint depth = trans_depth();
+
+	if (depth <= 1)
+		return make_call(db->commit, FALSE, error);
+
+	db_hold_get()->trans--;
+
+	return savepoint_call("release savepoint mbb_sp%u;", depth - 1, error);
+}
+
+static gboolean db_param_fetch(struct mbb_db_param *param, gchar fmt,
+			       struct db_vararg *va)
+{
+	switch (fmt) {
+	case 's':
+		param->un.s = va_arg(va->ap, gchar *);
+		param->type = param->un.s != NULL ?
+			MBB_DB_PARAM_TEXT : MBB_DB_PARAM_NULL;
+		break;
+	case 't':
+		param->un.q = va_arg(va->ap, time_t);
+		param->type = param->un.q >= 0 ?
+			MBB_DB_PARAM_INT64 : MBB_DB_PARAM_NULL;
+		break;
+	case 'l':
+		param->un.q = va_arg(va->ap, glong);
+		param->type = MBB_DB_PARAM_INT64;
+		break;
+	case 'q':
+		param->un.q = va_arg(va->ap, guint64);
+		param->type = MBB_DB_PARAM_INT64;
+		break;
+	case 'd':
+		param->un.i = va_arg(va->ap, gint);
+		param->type = MBB_DB_PARAM_INT;
+		break;
+	case 'b':
+		param->un.b = va_arg(va->ap, gint) != 0;
+		param->type = MBB_DB_PARAM_BOOL;
+		break;
+	default:
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean db_stmt_init(struct db_stmt *stmt)
+{
+	if (db == NULL || db->query_prepared == NULL)
+		return FALSE;
+
+	stmt->sql = g_string_new(NULL);
+	stmt->params = g_array_new(FALSE, FALSE, sizeof(struct mbb_db_param));
+
+	return TRUE;
+}
+
+static gboolean db_stmt_free(struct db_stmt *stmt)
+{
+	g_string_free(stmt->sql, TRUE);
+	g_array_free(stmt->params, TRUE);
+
+	return FALSE;
+}
+
+static gboolean db_stmt_param(struct db_stmt *stmt, GString *buf, gchar *prefix,
+			      gchar fmt, struct db_vararg *va)
+{
+	struct mbb_db_param param;
+
+	if (! db_param_fetch(&param, fmt, va))
+		return FALSE;
+
+	g_array_append_val(stmt->params, param);
+
+	if (buf != NULL)
+		g_string_append_printf(buf, "%s$%u", prefix, stmt->params->len);
+
+	return TRUE;
+}
+
+/* printf-like condition, integer conversions become parameters */
+static gboolean db_stmt_cond(struct db_stmt *stmt, gchar *cond,
+			     struct db_vararg *va)
+{
+	gchar conv;
+	gchar *p;
+
+	for (p = cond; *p != '\0'; p++) {
+		if (*p != '%') {
+			g_string_append_c(stmt->sql, *p);
+			continue;
+		}
+
+		p++;
+		if (*p == '%') {
+			g_string_append_c(stmt->sql, '%');
+			continue;
+		}
+
+		if (*p == 'd' || *p == 'i')
+			conv = 'd';
+		else if (! strncmp(p, "ld", 2) || ! strncmp(p, "li", 2)) {
+			conv = 'l';
+			p++;
+		} else if (! strncmp(p, "lld", 3) || ! strncmp(p, "lli", 3)) {
+			conv = 'q';
+			p += 2;
+		} else
+			return FALSE;
+
+		if (! db_stmt_param(stmt, stmt->sql, "", conv, va))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean db_stmt_insert(struct db_stmt *stmt, gchar *table, gchar *field,
+			       gchar *fmt, struct db_vararg *va)
+{
+	gchar *comma = "";
+	GString *values;
+	gchar *arg;
+
+	if (! db_stmt_init(stmt))
+		return FALSE;
+
+	values = g_string_new(NULL);
+	g_string_printf(stmt->sql, "insert into %s (", table);
+
+	while (fmt == NULL || *fmt != '\0') {
+		if ((arg = va_arg(va->ap, gchar *)) == NULL)
+			break;
+
+		if (! db_stmt_param(stmt, values, comma, fmt ? *fmt++ : 's', va)) {
+			g_string_free(values, TRUE);
+			return db_stmt_free(stmt);
+		}
+
+		g_string_append_printf(stmt->sql, "%s%s", comma, arg);
+		comma = ", ";
+	}
+
+	g_string_append_printf(stmt->sql, ") values (%s)", values->str);
+	g_string_free(values, TRUE);
+
+	if (field == NULL)
+		g_string_append_c(stmt->sql, ';');
+	else
+		g_string_append_printf(stmt->sql, " returning %s;", field);
+
+	return TRUE;
+}
+
+static gboolean db_stmt_update(struct db_stmt *stmt, gchar *table, gchar *fmt,
+			       gchar *name, struct db_vararg *va)
+{
+	gchar *arg;
+
+	if (! db_stmt_init(stmt))
+		return FALSE;
+
+	g_string_printf(stmt->sql, "update %s set %s = ", table, name);
+
+	for (;;) {
+		if (! db_stmt_param(stmt, stmt->sql, "", fmt ? *fmt++ : 's', va))
+			return db_stmt_free(stmt);
+
+		if (fmt != NULL && *fmt == '\0')
+			break;
+
+		if ((arg = va_arg(va->ap, gchar *)) == NULL)
+			break;
+
+		g_string_append_printf(stmt->sql, ", %s = ", arg);
+	}
+
+	if ((arg = va_arg(va->ap, gchar *)) != NULL) {
+		g_string_append(stmt->sql, " where ");
+		if (! db_stmt_cond(stmt, arg, va))
+			return db_stmt_free(stmt);
+	}
+
+	g_string_append_c(stmt->sql, ';');
+
+	return TRUE;
+}
+
+static gboolean db_stmt_delete(struct db_stmt *stmt, gchar *table, gchar *fmt,
+			       struct db_vararg *va)
+{
+	if (! db_stmt_init(stmt))
+		return FALSE;
+
+	g_string_printf(stmt->sql, "delete from %s", table);
+
+	if (fmt != NULL) {
+		g_string_append(stmt->sql, " where ");
+		if (! db_stmt_cond(stmt, fmt, va))
+			return db_stmt_free(stmt);
+	}
+
+	g_string_append_c(stmt->sql, ';');
+
+	return TRUE;
+}
+
+static struct mbb_db_iter *db_stmt_exec(struct db_stmt *stmt, GError **error)
+{
+	struct mbb_db_iter *iter;
+	gpointer conn;
+
+	conn = db_conn_ref(error);
+	if (conn != NULL) {
+		mbb_log_lvl(MBB_LOG_QUERY, "%s", stmt->sql->str);
+
+		iter = db->query_prepared(conn, stmt->sql->str,
+			stmt->params->len,
+			(struct mbb_db_param *) stmt->params->data, error
+		);
+
+		db_conn_unref();
+	} else
+		iter = NULL;
+
+	db_stmt_free(stmt);
+
+	return iter;
+}
+
+static gboolean db_stmt_run(struct db_stmt *stmt, GError **error)
+{
+	struct mbb_db_iter *iter;
+
+	iter = db_stmt_exec(stmt, error);
+	if (iter == NULL)
+		return FALSE;
+
+	mbb_db_iter_free(iter);
+
+	return TRUE;
+}
+
+static gboolean db_stmt_command(struct db_stmt *stmt, gchar *command,
+				gchar *fmt, struct db_vararg *va,
+				GError **error)
+{
+	if (! db_stmt_init(stmt)) {
+		g_set_error(error, MBB_DB_ERROR, MBB_DB_ERROR_UNSUPPORTED,
+			    "prepared statements unsupported");
+		return FALSE;
+	}
+
+	g_string_assign(stmt->sql, command);
+
+	for (; fmt != NULL && *fmt != '\0'; fmt++) {
+		if (! db_stmt_param(stmt, NULL, NULL, *fmt, va)) {
+			g_set_error(error, MBB_DB_ERROR, MBB_DB_ERROR_QUERY,
+				    "invalid format char '%c'", *fmt);
+			return db_stmt_free(stmt);
+		}
+	}
+
+	return TRUE;
+}
+
+static struct mbb_db_iter *db_prepared_ap(GError **error, gchar *command,
+					  gchar *fmt, struct db_vararg *va)
+{
+	struct db_stmt stmt;
+
+	if (! db_stmt_command(&stmt, command, fmt, va, error))
+		return NULL;
+
+	return db_stmt_exec(&stmt, error);
+}
+
+struct mbb_db_iter *mbb_db_prepared_iter(GError **error, gchar *command, gchar *fmt, ...)
+{
+	struct mbb_db_iter *iter;
+	struct db_vararg va;
+
+	va_start(va.ap, fmt);
+	iter = db_prepared_ap(error, command, fmt, &va);
+	va_end(va.ap);
+
+	return iter;
+}
+
+gboolean mbb_db_prepared(GError **error, gchar *command, gchar *fmt, ...)
+{
+	struct mbb_db_iter *iter;
+	struct db_vararg va;
+
+	va_start(va.ap, fmt);
+	iter = db_prepared_ap(error, command, fmt, &va);
+	va_end(va.ap);
+
+	if (iter == NULL)
+		return FALSE;
+
+	mbb_db_iter_free(iter);
+
+	return TRUE;
+}
+
+/* a sent command holds the connection until its result is received */
+gboolean mbb_db_send(GError **error, gchar *command, gchar *fmt, ...)
+{
+	struct db_stmt stmt;
+	struct db_vararg va;
+	gpointer conn;
+	gboolean ret;
+
+	va_start(va.ap, fmt);
+	ret = db_stmt_command(&stmt, command, fmt, &va, error);
+	va_end(va.ap);
+
+	if (ret == FALSE)
+		return FALSE;
+
+	if (db->send_prepared == NULL) {
+		g_set_error(error, MBB_DB_ERROR, MBB_DB_ERROR_UNSUPPORTED,
+			    "pipelining unsupported");
+		return db_stmt_free(&stmt);
+	}
+
+	conn = db_conn_ref(error);
+	if (conn == NULL)
+		return db_stmt_free(&stmt);
+
+	mbb_log_lvl(MBB_LOG_QUERY, "%s", stmt.sql->str);
+
+	ret = db->send_prepared(conn, stmt.sql->str, stmt.params->len,
+		(struct mbb_db_param *) stmt.params->data, error
+	);
+
+	db_stmt_free(&stmt);
+
+	if (ret)
+		db_hold_get()->npending++;
+	else
+		db_conn_unref();
+
+	return ret;
+}
+
+/* results come back in the order the commands were sent */
+struct mbb_db_iter *mbb_db_receive(GError **error)
+{
+	struct mbb_db_iter *iter;
+	struct db_hold *hold;
+
+	hold = g_static_private_get(&db_priv_key);
+	if (hold == NULL || hold->npending == 0) {
+		g_set_error(error, MBB_DB_ERROR, MBB_DB_ERROR_QUERY,
+			    "no pending result");
+		return NULL;
+	}
+
+	iter = db->receive(hold->conn, error);
+
+	hold->npending--;
+	db_conn_unref();
+
+	return iter;
+}
+
+/* drop results until at most keep are in flight, on error drop them all */
+gboolean mbb_db_sync(guint keep, GError **error)
+{
+	struct mbb_db_iter *iter;
+	struct db_hold *hold;
+	gboolean ret = TRUE;
+
+	hold = g_static_private_get(&db_priv_key);
+	while (hold != NULL && hold->npending > keep) {
+		GError *tmp = NULL;
+
+		iter = mbb_db_receive(&tmp);
+		if (iter != NULL) {
+			mbb_db_iter_free(iter);
+			continue;
+		}
+
+		if (ret)
+			g_propagate_error(error, tmp);
+		else
+			g_error_free(tmp);
+
+		ret = FALSE;
+		keep = 0;
+	}
+
+	return ret;
 }
 
 gboolean mbb_db_insert(GError **error, gchar *table, gchar *fmt, ...)
 {
+	struct db_vararg va;
+	struct db_stmt stmt;
+	gboolean prepared;
 	gchar *query;
 	va_list ap;
 
+	va_start(va.ap, fmt);
+	prepared = db_stmt_insert(&stmt, table, NULL, fmt, &va);
+	va_end(va.ap);
+
+	if (prepared)
+		return db_stmt_run(&stmt, error);
+
 	va_start(ap, fmt);
 	query = query_insert_ap(table, NULL, fmt, ap);
 	va_end(ap);
@@ -352,16 +985,28 @@ static gint fetch_number(gchar *str, GError **error)
 
 gint mbb_db_insert_ret(GError **error, gchar *table, gchar *field, gchar *fmt, ...)
 {
+	struct db_vararg va;
+	struct db_stmt stmt;
+	gboolean prepared;
 	MbbDbIter *iter;
 	gchar *query;
 	va_list ap;
 	gint id;
 
-	va_start(ap, fmt);
-	query = query_insert_ap(table, field, fmt, ap);
-	va_end(ap);
+	va_start(va.ap, fmt);
+	prepared = db_stmt_insert(&stmt, table, field, fmt, &va);
+	va_end(va.ap);
+
+	if (prepared)
+		iter = db_stmt_exec(&stmt, error);
+	else {
+		va_start(ap, fmt);
+		query = query_insert_ap(table, field, fmt, ap);
+		va_end(ap);
+
+		iter = mbb_db_query_iter(query, error);
+	}
 
-	iter = mbb_db_query_iter(query, error);
 	if (iter == NULL)
 		return -1;
 
@@ -377,11 +1022,52 @@ gint mbb_db_insert_ret(GError **error, gchar *table, gchar *field, gchar *fmt, .
 	return id;
 }
 
+/* multi-row insert with a returning clause, ids come in the row order */
+gboolean mbb_db_insert_ids(gchar *query, gint *ids, guint n, GError **error)
+{
+	MbbDbIter *iter;
+	gint nrow, ncol;
+	guint i;
+
+	if ((iter = mbb_db_query_iter(query, error)) == NULL)
+		return FALSE;
+
+	nrow = mbb_db_iter_nrow(iter);
+	ncol = mbb_db_iter_ncol(iter);
+
+	if (nrow != (gint) n || ncol != 1) {
+		g_set_error(error, MBB_DB_ERROR, MBB_DB_ERROR_INSERT_FAILED,
+			"invalid returning result: %d rows, %d cols", nrow, ncol);
+		mbb_db_iter_free(iter);
+		return FALSE;
+	}
+
+	for (i = 0; i < n && mbb_db_iter_next(iter); i++) {
+		ids[i] = fetch_number(mbb_db_iter_value(iter, 0), error);
+		if (ids[i] < 0)
+			break;
+	}
+
+	mbb_db_iter_free(iter);
+
+	return i == n;
+}
+
 gboolean mbb_db_delete(GError **error, gchar *table, gchar *fmt, ...)
 {
+	struct db_vararg va;
+	struct db_stmt stmt;
+	gboolean prepared;
 	gchar *query;
 	va_list ap;
 
+	va_start(va.ap, fmt);
+	prepared = db_stmt_delete(&stmt, table, fmt, &va);
+	va_end(va.ap);
+
+	if (prepared)
+		return db_stmt_run(&stmt, error);
+
 	va_start(ap, fmt);
 	query = query_delete_ap(table, fmt, ap);
 	va_end(ap);
@@ -391,9 +1077,19 @@ gboolean mbb_db_delete(GError **error, gchar *table, gchar *fmt, ...)
 
 gboolean mbb_db_update(GError **error, gchar *table, gchar *fmt, gchar *name, ...)
 {
+	struct db_vararg va;
+	struct db_stmt stmt;
+	gboolean prepared;
 	gchar *query;
 	va_list ap;
 
+	va_start(va.ap, name);
+	prepared = db_stmt_update(&stmt, table, fmt, name, &va);
+	va_end(va.ap);
+
+	if (prepared)
+		return db_stmt_run(&stmt, error);
+
 	va_start(ap, name);
 	query = query_update_ap(table, fmt, name, ap);
 	va_end(ap);
@@ -413,8 +1109,27 @@ struct mbb_db_iter *mbb_db_select(GError **error, gchar *table, ...)
 	return mbb_db_query_iter(query, error);
 }
 
-static void __init init(void)
+MBB_VAR_DEF(pool_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_uint,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
+MBB_VAR_DEF(pool_stat_def) {
+	.op_read = var_str_uint,
+	.cap_read = MBB_CAP_ALL
+};
+
+static void init_vars(void)
 {
-	g_static_rec_mutex_init(&query_mutex);
+	mbb_base_var_register("db.pool.min", &pool_def, &pool_min);
+	mbb_base_var_register("db.pool.max", &pool_def, &pool_max);
+
+	mbb_base_var_register("db.pool.size", &pool_stat_def, &pool_size);
+	mbb_base_var_register("db.pool.idle", &pool_stat_def, &pool_idle.length);
+	mbb_base_var_register("db.pool.waits", &pool_stat_def, &pool_waits);
+	mbb_base_var_register("db.pool.wait.time", &pool_stat_def, &pool_wait_time);
 }
 
+MBB_ON_INIT(MBB_INIT_VARS)
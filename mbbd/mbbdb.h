@@ -19,6 +19,25 @@ struct mbb_db_iter;
 
 typedef struct mbb_db_iter MbbDbIter;
 
+typedef enum {
+	MBB_DB_PARAM_NULL,
+	MBB_DB_PARAM_INT,
+	MBB_DB_PARAM_INT64,
+	MBB_DB_PARAM_BOOL,
+	MBB_DB_PARAM_TEXT
+} MbbDbParamType;
+
+struct mbb_db_param {
+	MbbDbParamType type;
+
+	union {
+		gint32 i;
+		gint64 q;
+		gboolean b;
+		gchar *s;
+	} un;
+};
+
 struct mbb_db {
 	gchar *name;
 
@@ -29,6 +48,13 @@ struct mbb_db {
 	gchar *(*escape)(gpointer conn, gchar *str);
 
 	struct mbb_db_iter *(*query_iter)(gpointer conn, gchar *command, GError **error);
+	struct mbb_db_iter *(*query_prepared)(gpointer conn, gchar *command,
+					      gint nparams,
+					      struct mbb_db_param *params,
+					      GError **error);
+	gboolean (*send_prepared)(gpointer conn, gchar *command, gint nparams,
+				  struct mbb_db_param *params, GError **error);
+	struct mbb_db_iter *(*receive)(gpointer conn, GError **error);
 	gboolean (*iter_next)(struct mbb_db_iter *iter);
 	gint (*iter_get_nrow)(struct mbb_db_iter *iter);
 	gint (*iter_get_ncol)(struct mbb_db_iter *iter);
@@ -39,6 +65,7 @@ struct mbb_db {
 	gboolean (*rollback)(gpointer conn, GError **error);
 	gboolean (*commit)(gpointer conn, GError **error);
 
+	gboolean (*check)(gpointer conn);
 	void (*close)(gpointer conn);
 };
 
@@ -51,7 +78,8 @@ typedef enum {
 	MBB_DB_ERROR_NOT_CONNECTED,
 	MBB_DB_ERROR_QUERY,
 	MBB_DB_ERROR_UNSUPPORTED,
-	MBB_DB_ERROR_INSERT_FAILED
+	MBB_DB_ERROR_INSERT_FAILED,
+	MBB_DB_ERROR_CONSTRAINT
 } MbbDbError;
 
 GQuark mbb_db_error_quark(void);
@@ -59,13 +87,21 @@ GQuark mbb_db_error_quark(void);
 gboolean mbb_db_choose(gchar *dbtype);
 
 gboolean mbb_db_open(struct mbb_db_auth *auth, GError **error);
+gboolean mbb_db_conn_get(GError **error);
+void mbb_db_conn_put(void);
 gboolean mbb_db_dup_conn(GError **error);
 gboolean mbb_db_dup_conn_once(GError **error);
+void mbb_db_put_conn(void);
 gboolean mbb_db_query(gchar *command, mbb_db_func_t func, gpointer user_data, GError **error);
 
 gchar *mbb_db_escape(gchar *str);
 
 struct mbb_db_iter *mbb_db_query_iter(gchar *command, GError **error);
+struct mbb_db_iter *mbb_db_prepared_iter(GError **error, gchar *command, gchar *fmt, ...);
+gboolean mbb_db_prepared(GError **error, gchar *command, gchar *fmt, ...);
+gboolean mbb_db_send(GError **error, gchar *command, gchar *fmt, ...);
+struct mbb_db_iter *mbb_db_receive(GError **error);
+gboolean mbb_db_sync(guint keep, GError **error);
 gboolean mbb_db_iter_next(struct mbb_db_iter *iter);
 gint mbb_db_iter_nrow(struct mbb_db_iter *iter);
 gint mbb_db_iter_ncol(struct mbb_db_iter *iter);
@@ -82,6 +118,7 @@ struct mbb_db *mbb_db_search(gchar *name);
 struct mbb_db_iter *mbb_db_select(GError **error, gchar *table, ...);
 gboolean mbb_db_insert(GError **error, gchar *table, gchar *fmt, ...);
 gint mbb_db_insert_ret(GError **error, gchar *table, gchar *field, gchar *fmt, ...);
+gboolean mbb_db_insert_ids(gchar *query, gint *ids, guint n, GError **error);
 gboolean mbb_db_delete(GError **error, gchar *table, gchar *fmt, ...);
 gboolean mbb_db_update(GError **error, gchar *table, gchar *fmt, gchar *name, ...);
 
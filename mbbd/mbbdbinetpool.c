@@ -9,6 +9,9 @@
 
 #define BUFLEN 32
 
+/* rows in one multi-row insert */
+#define ADD_CHUNK 512
+
 gint mbb_db_inet_pool_add(MbbInetPoolEntry *entry, gint owner_id, GError **error)
 {
 	inet_buf_t buf;
@@ -28,6 +31,61 @@ gint mbb_db_inet_pool_add(MbbInetPoolEntry *entry, gint owner_id, GError **error
 	return id;
 }
 
+static gboolean inet_pool_add_chunk(MbbInetPoolEntry **entries, guint n,
+				    GError **error)
+{
+	MbbInetPoolEntry *entry;
+	inet_buf_t buf;
+	gchar *query;
+	gboolean ret;
+	gint *ids;
+	guint i;
+
+	query_init("insert into unit_ip_pool (unit_id, inet_addr, inet_flag, "
+		"time_start, time_end, nice) values ");
+
+	for (i = 0; i < n; i++) {
+		entry = entries[i];
+		inettoa(buf, &entry->inet);
+
+		query_append_format("%S(%d, %s, %b, %t, %t, %d)",
+			i ? ", " : "", mbb_object_get_id(entry->owner), buf,
+			entry->flag, entry->start, entry->end, entry->nice
+		);
+	}
+
+	query = query_append(" returning self_id;");
+
+	ids = g_new(gint, n);
+	if ((ret = mbb_db_insert_ids(query, ids, n, error))) {
+		for (i = 0; i < n; i++)
+			entries[i]->id = ids[i];
+	}
+	g_free(ids);
+
+	return ret;
+}
+
+gboolean mbb_db_inet_pool_add_list(MbbInetPoolEntry **entries, guint n,
+				   GError **error)
+{
+	guint len;
+
+	/* the list goes in whole or not at all */
+	if (! mbb_db_begin(error))
+		return FALSE;
+
+	for (; n > 0; entries += len, n -= len) {
+		len = MIN(n, ADD_CHUNK);
+		if (! inet_pool_add_chunk(entries, len, error)) {
+			mbb_db_rollback(NULL);
+			return FALSE;
+		}
+	}
+
+	return mbb_db_commit(error);
+}
+
 static inline gchar *entry_where(gchar *buf, gint id)
 {
 	if (buf == NULL)
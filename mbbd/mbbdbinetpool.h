@@ -10,6 +10,8 @@
 #include "mbbinetpool.h"
 
 gint mbb_db_inet_pool_add(MbbInetPoolEntry *entry, gint owner_id, GError **error);
+gboolean mbb_db_inet_pool_add_list(MbbInetPoolEntry **entries, guint n,
+				   GError **error);
 gboolean mbb_db_inet_pool_drop(gint id, GError **error);
 gboolean mbb_db_inet_pool_mod_time(gint id, time_t start, time_t end, GError **error);
 gboolean mbb_db_inet_pool_mod_nice(gint id, guint nice, GError **error);
@@ -0,0 +1,34 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#include "mbbdblimit.h"
+#include "mbbdb.h"
+
+gboolean mbb_db_limit_del(gchar *scope, gchar *key, GError **error)
+{
+	return mbb_db_delete(error, "func_limits",
+		"limit_scope = %s and limit_key = %s", scope, key
+	);
+}
+
+gboolean mbb_db_limit_set(gchar *scope, gchar *key, guint rate, guint burst,
+			  guint calls, GError **error)
+{
+	gboolean ok;
+
+	if (! mbb_db_begin(error))
+		return FALSE;
+
+	ok = mbb_db_limit_del(scope, key, error) &&
+	     mbb_db_insert(error, "func_limits", "ssddd",
+		"limit_scope", scope, "limit_key", key,
+		"rate", rate, "burst", burst, "calls", calls
+	);
+
+	if (ok)
+		ok = mbb_db_commit(error);
+	else
+		mbb_db_rollback(NULL);
+
+	return ok;
+}
@@ -0,0 +1,13 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef MBB_DB_LIMIT_H
+#define MBB_DB_LIMIT_H
+
+#include <glib.h>
+
+gboolean mbb_db_limit_set(gchar *scope, gchar *key, guint rate, guint burst,
+			  guint calls, GError **error);
+gboolean mbb_db_limit_del(gchar *scope, gchar *key, GError **error);
+
+#endif
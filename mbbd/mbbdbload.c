@@ -5,6 +5,7 @@
 #include "mbbgateway.h"
 #include "mbbgwlink.h"
 #include "mbbconsumer.h"
+#include "mbblimit.h"
 #include "mbbunit.h"
 #include "mbbdbload.h"
 #include "mbbgroup.h"
@@ -45,6 +46,9 @@
 		"time_start, time_end " \
 	"from gwlinks"
 
+#define QUERY_FUNC_LIMITS \
+	"select limit_scope, limit_key, rate, burst, calls from func_limits"
+
 GQuark mbb_db_load_error_quark(void)
 {
 	return g_quark_from_static_string("mbb-db-load-error-quark");
@@ -503,3 +507,34 @@ gboolean mbb_db_load_gwlinks(GError **error)
 	return mbb_db_load(QUERY_GWLINKS, load_gwlink, error);
 }
 
+
+static gboolean load_func_limit(MbbDbIter *iter, Trash *trash, GError **error)
+{
+	guint rate, burst, calls;
+	gchar *scope, *key;
+
+	(void) trash;
+
+	scope = mbb_db_iter_value(iter, 0);
+	key = mbb_db_iter_value(iter, 1);
+
+	if (check_isnull(scope, error) || check_isnull(key, error))
+		return FALSE;
+
+	if (! conv_uint(&rate, mbb_db_iter_value(iter, 2), error))
+		return FALSE;
+	if (! conv_uint(&burst, mbb_db_iter_value(iter, 3), error))
+		return FALSE;
+	if (! conv_uint(&calls, mbb_db_iter_value(iter, 4), error))
+		return FALSE;
+
+	if (! mbb_limit_add(scope, key, rate, burst, calls))
+		msg_warn("invalid limit %s %s", scope, key);
+
+	return TRUE;
+}
+
+gboolean mbb_db_load_func_limits(GError **error)
+{
+	return mbb_db_load(QUERY_FUNC_LIMITS, load_func_limit, error);
+}
@@ -24,5 +24,6 @@ gboolean mbb_db_load_unit_inet_pool(GError **error);
 gboolean mbb_db_load_gateways(GError **error);
 gboolean mbb_db_load_operators(GError **error);
 gboolean mbb_db_load_gwlinks(GError **error);
+gboolean mbb_db_load_func_limits(GError **error);
 
 #endif
@@ -8,6 +8,9 @@
 
 #define BUFLEN 32
 
+/* rows in one multi-row insert */
+#define ADD_CHUNK 512
+
 gint mbb_db_unit_add(gchar *name, gint con_id, time_t start, time_t end,
 		     GError **error)
 {
@@ -31,6 +34,59 @@ gint mbb_db_unit_add(gchar *name, gint con_id, time_t start, time_t end,
 	return id;
 }
 
+static gboolean unit_add_chunk(MbbUnit **units, guint n, GError **error)
+{
+	gchar *query;
+	gboolean ret;
+	MbbUnit *unit;
+	gint *ids;
+	guint i;
+
+	query_init("insert into units (unit_name, consumer_id, "
+		"time_start, time_end) values ");
+
+	for (i = 0; i < n; i++) {
+		unit = units[i];
+
+		query_append_format("%S(%s, ", i ? ", " : "", unit->name);
+		if (unit->con == NULL)
+			query_append("NULL");
+		else
+			query_append_format("%d", unit->con->id);
+		query_append_format(", %t, %t)", unit->start, unit->end);
+	}
+
+	query = query_append(" returning unit_id;");
+
+	ids = g_new(gint, n);
+	if ((ret = mbb_db_insert_ids(query, ids, n, error))) {
+		for (i = 0; i < n; i++)
+			units[i]->id = ids[i];
+	}
+	g_free(ids);
+
+	return ret;
+}
+
+gboolean mbb_db_unit_add_list(MbbUnit **units, guint n, GError **error)
+{
+	guint len;
+
+	/* the list goes in whole or not at all */
+	if (! mbb_db_begin(error))
+		return FALSE;
+
+	for (; n > 0; units += len, n -= len) {
+		len = MIN(n, ADD_CHUNK);
+		if (! unit_add_chunk(units, len, error)) {
+			mbb_db_rollback(NULL);
+			return FALSE;
+		}
+	}
+
+	return mbb_db_commit(error);
+}
+
 static inline gchar *unit_where(gchar *buf, gint id)
 {
 	if (buf == NULL)
@@ -7,8 +7,11 @@
 #include <glib.h>
 #include <time.h>
 
+#include "mbbunit.h"
+
 gint mbb_db_unit_add(gchar *name, gint con_id, time_t start, time_t end,
 			 GError **error);
+gboolean mbb_db_unit_add_list(MbbUnit **units, guint n, GError **error);
 gboolean mbb_db_unit_mod_name(gint id, gchar *name, GError **error);
 gboolean mbb_db_unit_mod_time(gint id, time_t start, time_t end, GError **error);
 gboolean mbb_db_unit_drop(gint id, GError **error);
@@ -1,16 +1,42 @@
 /* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
 /* Published under the GNU General Public License V.2, see file COPYING */
 
+#include "mbbfuncstat.h"
 #include "mbbthread.h"
 #include "mbbxmlmsg.h"
+#include "mbblimit.h"
 #include "mbbinit.h"
 #include "mbbfunc.h"
+#include "mbblock.h"
 #include "mbblog.h"
+#include "mbbvar.h"
 
 #include "mbbplock.h"
 
+#include "varconv.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FUNC_CACHE_MAX 256
+
+struct func_cache_entry {
+	XmlTag *ans;
+	guint generation;
+	time_t expire;
+};
+
 static GHashTable *ht = NULL;
 
+static GHashTable *cache_ht = NULL;
+static GStaticMutex cache_mutex = G_STATIC_MUTEX_INIT;
+
+static gboolean cache_enabled = TRUE;
+static volatile gint cache_generation = 0;
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+
 void mbb_func_register_all(struct mbb_func_struct *func_struct)
 {
 	if (ht == NULL)
@@ -113,10 +139,183 @@ GSList *mbb_func_get_methods(mbb_cap_t mask)
 	return list;
 }
 
+static void func_cache_entry_free(struct func_cache_entry *entry)
+{
+	xml_tag_free(entry->ans);
+	g_free(entry);
+}
+
+static void func_cache_key_text(GString *key, Variant *var)
+{
+	gchar *str;
+
+	if (variant_is_string(var))
+		str = g_strdup(variant_get_string(var));
+	else
+		str = variant_to_string(var);
+
+	if (str != NULL) {
+		g_string_append_printf(key, "%lu:%s", (gulong) strlen(str), str);
+		g_free(str);
+	}
+}
+
+static gint func_cache_attr_cmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(((struct xml_tag_attr *) a)->name,
+		      ((struct xml_tag_attr *) b)->name);
+}
+
+static gint func_cache_group_cmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(((struct xml_tag_group *) a)->name,
+		      ((struct xml_tag_group *) b)->name);
+}
+
+/* attributes and child names are sorted, so equal requests give equal keys,
+ * the root id only tags a pipelined request and is left out */
+static void func_cache_key_tag(GString *key, XmlTag *tag, gboolean root)
+{
+	struct xml_tag_attr *attrs;
+	struct xml_tag_group *groups;
+	XmlTag *child;
+	guint n;
+
+	g_string_append_printf(key, "%s(", tag->name);
+
+	attrs = g_memdup(tag->attrs, tag->nattr * sizeof(*attrs));
+	qsort(attrs, tag->nattr, sizeof(*attrs), func_cache_attr_cmp);
+
+	for (n = 0; n < tag->nattr; n++) {
+		if (root && ! strcmp(attrs[n].name, "id"))
+			continue;
+
+		g_string_append_printf(key, "%s=", attrs[n].name);
+		func_cache_key_text(key, attrs[n].value);
+	}
+	g_free(attrs);
+
+	if (tag->body != NULL) {
+		g_string_append_c(key, '=');
+		func_cache_key_text(key, tag->body);
+	}
+
+	groups = g_memdup(tag->childs, tag->nchild * sizeof(*groups));
+	qsort(groups, tag->nchild, sizeof(*groups), func_cache_group_cmp);
+
+	for (n = 0; n < tag->nchild; n++) {
+		for (child = groups[n].head; child; child = child->next)
+			func_cache_key_tag(key, child, FALSE);
+	}
+	g_free(groups);
+
+	g_string_append_c(key, ')');
+}
+
+static gchar *func_cache_key(struct mbb_func_struct *fs, XmlTag *tag,
+			     mbb_cap_t cap)
+{
+	GString *key;
+
+	key = g_string_new(NULL);
+	g_string_append_printf(key, "%s:%lx:", fs->name, (gulong) cap);
+	func_cache_key_tag(key, tag, TRUE);
+
+	return g_string_free(key, FALSE);
+}
+
+/* writer lock sections spoil entries as well as changes made outside
+ * the lock, e.g. committed statistics, reported to the cache directly */
+static inline guint func_cache_generation(void)
+{
+	return mbb_lock_generation() +
+		(guint) g_atomic_int_get(&cache_generation);
+}
+
+void mbb_func_cache_invalidate(void)
+{
+	g_atomic_int_inc(&cache_generation);
+}
+
+static XmlTag *func_cache_lookup(gchar *key, guint generation)
+{
+	struct func_cache_entry *entry = NULL;
+	XmlTag *ans = NULL;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	if (cache_ht != NULL)
+		entry = g_hash_table_lookup(cache_ht, key);
+
+	if (entry != NULL) {
+		if (entry->generation == generation && entry->expire > time(NULL))
+			ans = xml_tag_copy(entry->ans);
+		else
+			g_hash_table_remove(cache_ht, key);
+	}
+
+	if (ans != NULL)
+		cache_hits++;
+	else
+		cache_misses++;
+
+	g_static_mutex_unlock(&cache_mutex);
+
+	return ans;
+}
+
+static gboolean func_cache_is_stale(gpointer key G_GNUC_UNUSED,
+				    struct func_cache_entry *entry,
+				    gpointer data)
+{
+	return entry->generation != func_cache_generation() ||
+		entry->expire <= *(time_t *) data;
+}
+
+static void func_cache_store(gchar *key, guint generation, guint ttl,
+			     XmlTag *ans)
+{
+	struct func_cache_entry *entry;
+	time_t now;
+
+	entry = g_new(struct func_cache_entry, 1);
+	entry->ans = xml_tag_copy(ans);
+	entry->generation = generation;
+	entry->expire = (now = time(NULL)) + ttl;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	if (cache_ht == NULL) {
+		cache_ht = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify) func_cache_entry_free
+		);
+	}
+
+	if (g_hash_table_size(cache_ht) >= FUNC_CACHE_MAX) {
+		g_hash_table_foreach_remove(cache_ht,
+			(GHRFunc) func_cache_is_stale, &now
+		);
+
+		if (g_hash_table_size(cache_ht) >= FUNC_CACHE_MAX)
+			g_hash_table_remove_all(cache_ht);
+	}
+
+	g_hash_table_replace(cache_ht, key, entry);
+
+	g_static_mutex_unlock(&cache_mutex);
+}
+
 gboolean mbb_func_call(gchar *name, XmlTag *tag, XmlTag **ans)
 {
+	struct mbb_limit_ticket ticket;
+	struct xml_tag_scope scope;
 	struct mbb_func_struct *fs;
+	guint generation = 0;
+	gchar *key = NULL;
+	GTimeVal start, end;
+	gboolean failed;
 	mbb_cap_t cap;
+	gint64 usec;
 
 	cap = mbb_thread_get_cap();
 
@@ -131,22 +330,125 @@ gboolean mbb_func_call(gchar *name, XmlTag *tag, XmlTag **ans)
 
 	mbb_log("call %s", name);
 
+	g_get_current_time(&start);
+	failed = FALSE;
+
+	if (fs->cache_ttl != 0 && cache_enabled) {
+		/* taken before the call, so a write meanwhile spoils the entry */
+		generation = func_cache_generation();
+		key = func_cache_key(fs, tag, cap);
+
+		*ans = func_cache_lookup(key, generation);
+		if (*ans != NULL) {
+			g_free(key);
+			goto out;
+		}
+	}
+
+	if (! mbb_limit_enter(fs->name, &ticket, ans)) {
+		mbb_log("%s limited", name);
+		g_free(key);
+		failed = TRUE;
+		goto out;
+	}
+
+	/* the answer tree is built in an arena freed along with it,
+	 * temporaries made before its root stay on the heap */
+	xml_tag_scope_begin(&scope);
+
 	*ans = NULL;
 	fs->func(tag, ans);
 
+	xml_tag_scope_end(&scope, *ans);
+	mbb_limit_leave(&ticket);
+
 	if (*ans != NULL) {
 		gchar *msg;
 
 		if (mbb_xml_msg_is_ok(*ans, &msg) == FALSE) {
+			failed = TRUE;
+
 			if (msg == NULL)
 				mbb_log("%s failed", name);
 			else
 				mbb_log("%s failed: %s", name, msg);
+		} else if (key != NULL) {
+			func_cache_store(key, generation, fs->cache_ttl, *ans);
+			key = NULL;
 		}
 	}
 
+	g_free(key);
+
+out:
+	g_get_current_time(&end);
+	usec = (gint64) (end.tv_sec - start.tv_sec) * G_USEC_PER_SEC +
+		end.tv_usec - start.tv_usec;
+	mbb_func_stat_call(fs->name, usec > 0 ? usec : 0, failed);
+
 	mbb_module_unuse(fs->module);
 
 	return TRUE;
 }
 
+/* unknown methods pass, the call itself reports them */
+gboolean mbb_func_batch_safe(gchar *name)
+{
+	struct mbb_func_struct *fs;
+	gboolean safe;
+
+	mbb_plock_reader_lock();
+	fs = mbb_func_search(name, mbb_thread_get_cap());
+	mbb_plock_reader_unlock();
+
+	if (fs == NULL)
+		return TRUE;
+
+	safe = fs->batch || fs->cache_ttl != 0;
+	mbb_module_unuse(fs->module);
+
+	return safe;
+}
+
+
+static void func_cache_clear(void)
+{
+	g_static_mutex_lock(&cache_mutex);
+
+	if (cache_ht != NULL)
+		g_hash_table_remove_all(cache_ht);
+
+	g_static_mutex_unlock(&cache_mutex);
+}
+
+static gboolean var_conv_cache_enabled(gchar *arg, gpointer p)
+{
+	if (! var_conv_bool(arg, p))
+		return FALSE;
+
+	if (! cache_enabled)
+		func_cache_clear();
+
+	return TRUE;
+}
+
+MBB_VAR_DEF(cache_enabled_def) {
+	.op_read = var_str_bool,
+	.op_write = var_conv_cache_enabled,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
+MBB_VAR_DEF(cache_stat_def) {
+	.op_read = var_str_uint,
+	.cap_read = MBB_CAP_ALL
+};
+
+static void init_vars(void)
+{
+	mbb_base_var_register("func.cache", &cache_enabled_def, &cache_enabled);
+	mbb_base_var_register("func.cache.hits", &cache_stat_def, &cache_hits);
+	mbb_base_var_register("func.cache.misses", &cache_stat_def, &cache_misses);
+}
+
+MBB_ON_INIT(MBB_INIT_VARS)
@@ -20,7 +20,12 @@ static struct mbb_func_struct MBB_INIT_FUNCTIONS_TABLE[] = {
 	MBB_FUNC_STRUCT(NULL, NULL, 0) \
 };
 
-#define MBB_FUNC_STRUCT(name, func, cap) { name, func, cap, NULL }
+#define MBB_FUNC_STRUCT(name, func, cap) { name, func, cap, NULL, 0, FALSE }
+/* answers of read-only methods are reused for ttl seconds */
+#define MBB_FUNC_CACHED(name, func, cap, ttl) { name, func, cap, NULL, ttl, FALSE }
+/* setters writing the whole value to the db and memory on every call,
+ * repeating them brings the db back in step, so batches may run them */
+#define MBB_FUNC_BATCH(name, func, cap) { name, func, cap, NULL, 0, TRUE }
 
 #define MBB_INIT_FUNCTIONS \
 MBB_INIT_STRUCT(mbb_func_register_all, MBB_INIT_FUNCTIONS_TABLE)
@@ -33,6 +38,8 @@ struct mbb_func_struct {
 	mbb_func_t func;
 	mbb_cap_t cap_mask;
 	MbbModule *module;
+	guint cache_ttl;
+	gboolean batch;
 };
 
 void mbb_func_register_all(struct mbb_func_struct *func_struct);
@@ -42,5 +49,8 @@ void mbb_func_unregister_all(struct mbb_func_struct *func_struct);
 
 GSList *mbb_func_get_methods(mbb_cap_t mask);
 gboolean mbb_func_call(gchar *name, XmlTag *tag, XmlTag **ans);
+gboolean mbb_func_batch_safe(gchar *name);
+
+void mbb_func_cache_invalidate(void);
 
 #endif
@@ -0,0 +1,330 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#include "mbbfuncstat.h"
+#include "mbbxmlmsg.h"
+#include "mbbinit.h"
+#include "mbbfunc.h"
+
+#include "variant.h"
+#include "xmltag.h"
+
+#include <string.h>
+
+/* threads are spread over the shards, so writers hardly ever meet */
+#define FUNC_STAT_SHARDS 16
+
+/* log buckets: exact below 16 usec, then four per power of two */
+#define FUNC_STAT_EXACT 16
+#define FUNC_STAT_BUCKETS (FUNC_STAT_EXACT + 28 * 4)
+
+struct func_stat {
+	guint64 calls;
+	guint64 fails;
+	guint64 bytes;
+	guint64 usec_sum;
+	guint64 usec_max;
+	guint32 hist[FUNC_STAT_BUCKETS];
+};
+
+struct func_stat_shard {
+	GStaticMutex mutex;
+	GHashTable *ht;
+};
+
+static struct func_stat_shard shards[FUNC_STAT_SHARDS];
+static GOnce shards_once = G_ONCE_INIT;
+static volatile gint shard_next = 0;
+static GStaticPrivate shard_key = G_STATIC_PRIVATE_INIT;
+
+static gpointer shards_init(gpointer arg G_GNUC_UNUSED)
+{
+	guint n;
+
+	for (n = 0; n < FUNC_STAT_SHARDS; n++) {
+		g_static_mutex_init(&shards[n].mutex);
+		shards[n].ht = g_hash_table_new_full(
+			g_str_hash, g_str_equal, g_free, g_free
+		);
+	}
+
+	return NULL;
+}
+
+static struct func_stat_shard *func_stat_shard(void)
+{
+	gint n;
+
+	g_once(&shards_once, shards_init, NULL);
+
+	/* the index is kept plus one, zero means not assigned yet */
+	n = GPOINTER_TO_INT(g_static_private_get(&shard_key));
+	if (n == 0) {
+		n = g_atomic_int_exchange_and_add(&shard_next, 1);
+		n = n % FUNC_STAT_SHARDS + 1;
+		g_static_private_set(&shard_key, GINT_TO_POINTER(n), NULL);
+	}
+
+	return shards + n - 1;
+}
+
+static struct func_stat *func_stat_get(GHashTable *ht, gchar *name)
+{
+	struct func_stat *fs;
+
+	fs = g_hash_table_lookup(ht, name);
+	if (fs == NULL) {
+		fs = g_new0(struct func_stat, 1);
+		g_hash_table_insert(ht, g_strdup(name), fs);
+	}
+
+	return fs;
+}
+
+static guint func_stat_bucket(guint64 usec)
+{
+	guint e;
+
+	if (usec < FUNC_STAT_EXACT)
+		return usec;
+
+	for (e = 4; usec >> (e + 1); e++)
+		;
+
+	if (e > 31)
+		return FUNC_STAT_BUCKETS - 1;
+
+	return FUNC_STAT_EXACT + (e - 4) * 4 + ((usec >> (e - 2)) & 3);
+}
+
+static guint64 func_stat_bucket_upper(guint n)
+{
+	guint e;
+
+	if (n < FUNC_STAT_EXACT)
+		return n;
+
+	n -= FUNC_STAT_EXACT;
+	e = 4 + n / 4;
+
+	return ((guint64) (4 + n % 4 + 1) << (e - 2)) - 1;
+}
+
+void mbb_func_stat_call(gchar *name, guint64 usec, gboolean failed)
+{
+	struct func_stat_shard *shard;
+	struct func_stat *fs;
+
+	shard = func_stat_shard();
+
+	g_static_mutex_lock(&shard->mutex);
+
+	fs = func_stat_get(shard->ht, name);
+	fs->calls++;
+	if (failed)
+		fs->fails++;
+
+	fs->usec_sum += usec;
+	if (usec > fs->usec_max)
+		fs->usec_max = usec;
+	fs->hist[func_stat_bucket(usec)]++;
+
+	g_static_mutex_unlock(&shard->mutex);
+}
+
+void mbb_func_stat_bytes(gchar *name, gsize bytes)
+{
+	struct func_stat_shard *shard;
+
+	shard = func_stat_shard();
+
+	g_static_mutex_lock(&shard->mutex);
+	func_stat_get(shard->ht, name)->bytes += bytes;
+	g_static_mutex_unlock(&shard->mutex);
+}
+
+static void func_stat_merge(struct func_stat *dst, struct func_stat *src)
+{
+	guint n;
+
+	dst->calls += src->calls;
+	dst->fails += src->fails;
+	dst->bytes += src->bytes;
+	dst->usec_sum += src->usec_sum;
+	if (src->usec_max > dst->usec_max)
+		dst->usec_max = src->usec_max;
+
+	for (n = 0; n < FUNC_STAT_BUCKETS; n++)
+		dst->hist[n] += src->hist[n];
+}
+
+static GHashTable *func_stat_collect(void)
+{
+	struct func_stat_shard *shard;
+	struct func_stat *fs;
+	GHashTableIter iter;
+	GHashTable *ht;
+	gchar *name;
+	guint n;
+
+	g_once(&shards_once, shards_init, NULL);
+
+	ht = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	for (n = 0; n < FUNC_STAT_SHARDS; n++) {
+		shard = shards + n;
+
+		g_static_mutex_lock(&shard->mutex);
+
+		g_hash_table_iter_init(&iter, shard->ht);
+		while (g_hash_table_iter_next(&iter, (gpointer *) &name,
+					      (gpointer *) &fs))
+			func_stat_merge(func_stat_get(ht, name), fs);
+
+		g_static_mutex_unlock(&shard->mutex);
+	}
+
+	return ht;
+}
+
+static guint64 func_stat_quantile(struct func_stat *fs, gdouble q)
+{
+	guint64 rank, sum;
+	guint64 upper;
+	guint n;
+
+	rank = fs->calls * q;
+	if (rank == 0)
+		rank = 1;
+
+	for (n = 0, sum = 0; n < FUNC_STAT_BUCKETS; n++) {
+		sum += fs->hist[n];
+		if (sum >= rank)
+			break;
+	}
+
+	upper = func_stat_bucket_upper(n);
+
+	return upper < fs->usec_max ? upper : fs->usec_max;
+}
+
+static gint func_stat_name_cmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(a, b);
+}
+
+static GList *func_stat_names(GHashTable *ht)
+{
+	return g_list_sort(g_hash_table_get_keys(ht), func_stat_name_cmp);
+}
+
+static inline Variant *variant_new_uint64(guint64 value)
+{
+	return variant_new_alloc_string(
+		g_strdup_printf("%" G_GUINT64_FORMAT, value)
+	);
+}
+
+static void show_stats(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
+{
+	struct func_stat *fs;
+	GHashTable *ht;
+	GList *names;
+	GList *list;
+
+	ht = func_stat_collect();
+	names = func_stat_names(ht);
+
+	*ans = mbb_xml_msg_ok();
+
+	for (list = names; list != NULL; list = list->next) {
+		fs = g_hash_table_lookup(ht, list->data);
+
+		xml_tag_new_child(*ans, "method",
+			"name", variant_new_string(list->data),
+			"calls", variant_new_uint64(fs->calls),
+			"fails", variant_new_uint64(fs->fails),
+			"bytes", variant_new_uint64(fs->bytes),
+			"avg", variant_new_uint64(fs->calls ?
+				fs->usec_sum / fs->calls : 0),
+			"p50", variant_new_uint64(func_stat_quantile(fs, 0.5)),
+			"p99", variant_new_uint64(func_stat_quantile(fs, 0.99)),
+			"max", variant_new_uint64(fs->usec_max)
+		);
+	}
+
+	g_list_free(names);
+	g_hash_table_destroy(ht);
+}
+
+#define PROM_SECONDS(usec) ((gdouble) (usec) / G_USEC_PER_SEC)
+
+void mbb_func_stat_prometheus(GString *string)
+{
+	static const gdouble quantiles[] = { 0.5, 0.99, 1 };
+
+	struct func_stat *fs;
+	GHashTable *ht;
+	GList *names;
+	GList *list;
+	gchar *name;
+	guint n;
+
+	ht = func_stat_collect();
+	names = func_stat_names(ht);
+
+	g_string_append(string, "# TYPE mbb_func_calls_total counter\n");
+	for (list = names; list != NULL; list = list->next) {
+		fs = g_hash_table_lookup(ht, name = list->data);
+		g_string_append_printf(string,
+			"mbb_func_calls_total{method=\"%s\"} %" G_GUINT64_FORMAT "\n",
+			name, fs->calls
+		);
+	}
+
+	g_string_append(string, "# TYPE mbb_func_errors_total counter\n");
+	for (list = names; list != NULL; list = list->next) {
+		fs = g_hash_table_lookup(ht, name = list->data);
+		g_string_append_printf(string,
+			"mbb_func_errors_total{method=\"%s\"} %" G_GUINT64_FORMAT "\n",
+			name, fs->fails
+		);
+	}
+
+	g_string_append(string, "# TYPE mbb_func_bytes_out_total counter\n");
+	for (list = names; list != NULL; list = list->next) {
+		fs = g_hash_table_lookup(ht, name = list->data);
+		g_string_append_printf(string,
+			"mbb_func_bytes_out_total{method=\"%s\"} %" G_GUINT64_FORMAT "\n",
+			name, fs->bytes
+		);
+	}
+
+	g_string_append(string, "# TYPE mbb_func_latency_seconds summary\n");
+	for (list = names; list != NULL; list = list->next) {
+		fs = g_hash_table_lookup(ht, name = list->data);
+
+		for (n = 0; n < G_N_ELEMENTS(quantiles); n++) {
+			g_string_append_printf(string,
+				"mbb_func_latency_seconds{method=\"%s\",quantile=\"%g\"} %.6f\n",
+				name, quantiles[n],
+				PROM_SECONDS(func_stat_quantile(fs, quantiles[n]))
+			);
+		}
+
+		g_string_append_printf(string,
+			"mbb_func_latency_seconds_sum{method=\"%s\"} %.6f\n"
+			"mbb_func_latency_seconds_count{method=\"%s\"} %" G_GUINT64_FORMAT "\n",
+			name, PROM_SECONDS(fs->usec_sum), name, fs->calls
+		);
+	}
+
+	g_list_free(names);
+	g_hash_table_destroy(ht);
+}
+
+MBB_INIT_FUNCTIONS_DO
+	MBB_FUNC_STRUCT("mbb-show-stats", show_stats, MBB_CAP_ADMIN),
+MBB_INIT_FUNCTIONS_END
+
+MBB_ON_INIT(MBB_INIT_FUNCTIONS)
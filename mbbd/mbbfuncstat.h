@@ -0,0 +1,14 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef MBB_FUNC_STAT_H
+#define MBB_FUNC_STAT_H
+
+#include <glib.h>
+
+void mbb_func_stat_call(gchar *name, guint64 usec, gboolean failed);
+void mbb_func_stat_bytes(gchar *name, gsize bytes);
+
+void mbb_func_stat_prometheus(GString *string);
+
+#endif
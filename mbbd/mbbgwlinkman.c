@@ -282,7 +282,7 @@ MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-gateway-show-gwlinks", gateway_show_gwlinks, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-add-gwlink", add_gwlink, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-drop-gwlink", drop_gwlink, MBB_CAP_WHEEL),
-	MBB_FUNC_STRUCT("mbb-gwlink-mod-time", gwlink_mod_time, MBB_CAP_ADMIN),
+	MBB_FUNC_BATCH("mbb-gwlink-mod-time", gwlink_mod_time, MBB_CAP_ADMIN),
 MBB_INIT_FUNCTIONS_END
 
 MBB_ON_INIT(MBB_INIT_FUNCTIONS)
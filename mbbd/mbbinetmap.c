@@ -19,9 +19,18 @@
 #include "macros.h"
 #include "debug.h"
 
+struct mbb_map_loader {
+	GArray *items;
+	GPtrArray *units;
+
+	mbb_map_cross_func_t func;
+	gpointer user_data;
+};
+
 struct umap_data_entry {
 	struct umap_data_entry *next;
 	MbbUnit *unit;
+	gint con_id;
 	time_t min;
 	time_t max;
 };
@@ -83,6 +92,74 @@ gboolean mbb_map_add_unit(MbbUnit *unit, struct map_cross *cross)
 	return TRUE;
 }
 
+void mbb_map_shadow_init(struct map *map)
+{
+	*map = (struct map) MAP_INIT;
+	inet_map_init(map);
+}
+
+void mbb_map_shadow_commit(struct map *map)
+{
+	map_replace(&global_map, map);
+}
+
+MbbMapLoader *mbb_map_loader_new(void)
+{
+	MbbMapLoader *loader;
+
+	loader = g_new(MbbMapLoader, 1);
+	loader->items = g_array_new(FALSE, FALSE, sizeof(struct map_load_item));
+	loader->units = g_ptr_array_new();
+
+	return loader;
+}
+
+void mbb_map_loader_add_unit(MbbMapLoader *loader, MbbUnit *unit, struct map *unit_map)
+{
+	struct map_load_item item;
+	MapDataIter data_iter;
+	MapIter iter;
+
+	item.group = loader->units->len;
+	g_ptr_array_add(loader->units, unit);
+
+	map_iter_init(&iter, unit_map);
+	while (map_iter_next(&iter, &data_iter, &item.dkey))
+		while (map_data_iter_next(&data_iter, &item.data, &item.key))
+			g_array_append_val(loader->items, item);
+}
+
+static void map_loader_cross(guint group, struct map_cross *cross, MbbMapLoader *loader)
+{
+	if (loader->func != NULL)
+		loader->func(g_ptr_array_index(loader->units, group), cross, loader->user_data);
+}
+
+gboolean mbb_map_loader_build(MbbMapLoader *loader, struct map *map,
+			      mbb_map_cross_func_t func, gpointer user_data)
+{
+	gboolean ret;
+
+	loader->func = func;
+	loader->user_data = user_data;
+
+	ret = map_load(map, loader->items, loader->units->len,
+		(map_load_cross_func_t) map_loader_cross, loader
+	);
+
+	if (ret == FALSE && map_glue_auto)
+		map_glue_null(map);
+
+	return ret;
+}
+
+void mbb_map_loader_free(MbbMapLoader *loader)
+{
+	g_array_free(loader->items, TRUE);
+	g_ptr_array_free(loader->units, TRUE);
+	g_free(loader);
+}
+
 void mbb_map_del_inet(MbbInetPoolEntry *entry)
 {
 	GList *list;
@@ -126,12 +203,16 @@ static struct umap_data_entry *umap_get_data(MapDataIter *data_iter)
 	struct umap_data_entry *data = NULL;
 	MbbInetPoolEntry *inet_entry;
 	struct slice time_slice;
+	MbbUnit *unit;
 
 	while (map_data_iter_next(data_iter, (gpointer *) &inet_entry, &time_slice)) {
+		unit = inet_entry->owner->ptr;
+
 		data = umap_data_entry_new(data);
 		data->min = GPOINTER_TO_TIME(time_slice.begin);
 		data->max = GPOINTER_TO_TIME(time_slice.end);
-		data->unit = mbb_unit_ref(inet_entry->owner->ptr);
+		data->unit = mbb_unit_ref(unit);
+		data->con_id = unit->con != NULL ? unit->con->id : 0;
 	}
 
 	return data;
@@ -238,11 +319,12 @@ static struct umap_entry *umap_bsearch(struct umap_entry *base, guint len, ipv4_
 	return NULL;
 }
 
-static MbbUnit *umap_data_search(struct umap_data_entry *data, time_t t)
+static struct umap_data_entry *umap_data_search(struct umap_data_entry *data,
+						time_t t)
 {
 	if (data->max == 0) {
 		if (t >= data->min)
-			return data->unit;
+			return data;
 
 		data = data->next;
 
@@ -254,13 +336,13 @@ static MbbUnit *umap_data_search(struct umap_data_entry *data, time_t t)
 		if (t > data->max)
 			return NULL;
 		if (t >= data->min)
-			return data->unit;
+			return data;
 	} while ((data = data->next) != NULL);
 
 	return NULL;
 }
 
-MbbUnit *mbb_umap_find(MbbUMap *umap, ipv4_t ip, time_t t)
+static struct umap_data_entry *umap_lookup(MbbUMap *umap, ipv4_t ip, time_t t)
 {
 	struct umap_entry *entry;
 	GArray *array;
@@ -274,6 +356,17 @@ MbbUnit *mbb_umap_find(MbbUMap *umap, ipv4_t ip, time_t t)
 	return umap_data_search(entry->data, t);
 }
 
+MbbUnit *mbb_umap_find(MbbUMap *umap, ipv4_t ip, time_t t)
+{
+	struct umap_data_entry *data;
+
+	data = umap_lookup(umap, ip, t);
+	if (data == NULL)
+		return NULL;
+
+	return data->unit;
+}
+
 static inline void umap_data_free(struct umap_data_entry *data)
 {
 	struct umap_data_entry *next;
@@ -303,6 +396,59 @@ void mbb_umap_free(MbbUMap *umap)
 	g_array_free(array, TRUE);
 }
 
+struct umap_snapshot {
+	MbbUMap *umap;
+	guint generation;
+	gint ref;
+};
+
+struct umap_request {
+	ipv4_t ip;
+	time_t t;
+};
+
+static GStaticMutex umap_snapshot_mutex = G_STATIC_MUTEX_INIT;
+static struct umap_snapshot *umap_snapshot = NULL;
+
+static void umap_snapshot_unref(struct umap_snapshot *us)
+{
+	if (g_atomic_int_dec_and_test(&us->ref)) {
+		if (us->umap != NULL)
+			mbb_umap_free(us->umap);
+		g_free(us);
+	}
+}
+
+/* compiled copy of the global map, recompiled only after a writer section,
+   so lookups do not hold the global lock */
+static struct umap_snapshot *umap_snapshot_get(void)
+{
+	struct umap_snapshot *us;
+
+	g_static_mutex_lock(&umap_snapshot_mutex);
+
+	us = umap_snapshot;
+	if (us == NULL || us->generation != mbb_lock_generation()) {
+		us = g_new(struct umap_snapshot, 1);
+		us->ref = 1;
+
+		mbb_lock_reader_lock();
+		us->generation = mbb_lock_generation();
+		us->umap = mbb_umap_create();
+		mbb_lock_reader_unlock();
+
+		if (umap_snapshot != NULL)
+			umap_snapshot_unref(umap_snapshot);
+		umap_snapshot = us;
+	}
+
+	g_atomic_int_inc(&us->ref);
+
+	g_static_mutex_unlock(&umap_snapshot_mutex);
+
+	return us;
+}
+
 static void map_add_unit(XmlTag *tag, XmlTag **ans)
 {
 	DEFINE_XTV(XTV_UNIT_NAME);
@@ -622,11 +768,132 @@ static void map_find_unit(XmlTag *tag, XmlTag **ans)
 	mbb_lock_reader_unlock();
 }
 
+static XmlTag *map_lookup_parse(XmlTag *tag, time_t t, GArray *array)
+{
+	struct umap_request req;
+	Variant *var;
+	XmlTag *xt;
+	gchar *arg;
+
+	xt = xml_tag_get_child(tag, "addr");
+	xml_tag_reorder(xt);
+
+	for (; xt != NULL; xt = xt->next) {
+		if ((var = xml_tag_get_attr(xt, "value")) == NULL)
+			return mbb_xml_msg(MBB_MSG_XTV_MISSED, "addr", "value");
+
+		arg = variant_get_string(var);
+		if (var_conv_ipv4(arg, &req.ip) == FALSE)
+			return mbb_xml_msg(MBB_MSG_XTV_INVALID, "addr", "value", arg);
+
+		req.t = t;
+		if ((var = xml_tag_get_attr(xt, "time")) != NULL) {
+			arg = variant_get_string(var);
+			if (var_conv_time(arg, &req.t) == FALSE) {
+				return mbb_xml_msg(
+					MBB_MSG_XTV_INVALID, "addr", "time", arg
+				);
+			}
+		}
+
+		g_array_append_val(array, req);
+	}
+
+	return NULL;
+}
+
+static void map_lookup_xml(XmlTag *tag, MbbUMap *umap, GArray *array)
+{
+	struct umap_data_entry *data;
+	struct umap_request *req;
+	ipv4_buf_t buf;
+	XmlTag *xt;
+	guint n;
+
+	req = (struct umap_request *) array->data;
+	for (n = array->len; n; n--, req++) {
+		ipv4toa(buf, req->ip);
+		xt = xml_tag_new_child(tag, "addr",
+			"value", variant_new_string(buf)
+		);
+
+		data = umap == NULL ? NULL : umap_lookup(umap, req->ip, req->t);
+		if (data == NULL)
+			continue;
+
+		xml_tag_set_attr(xt, "unit", variant_new_int(data->unit->id));
+		if (data->con_id)
+			xml_tag_set_attr(xt, "consumer", variant_new_int(data->con_id));
+	}
+
+	xml_tag_reorder(xml_tag_get_child(tag, "addr"));
+}
+
+/* packed records of three network order words: addr, unit id, consumer id,
+   zero ids stand for no owner */
+static void map_lookup_binary(XmlTag *tag, MbbUMap *umap, GArray *array)
+{
+	struct umap_data_entry *data;
+	struct umap_request *req;
+	guint32 *rec, *p;
+	guint n;
+
+	rec = p = g_new(guint32, array->len * 3);
+
+	req = (struct umap_request *) array->data;
+	for (n = array->len; n; n--, req++) {
+		data = umap == NULL ? NULL : umap_lookup(umap, req->ip, req->t);
+
+		*p++ = g_htonl(req->ip);
+		*p++ = g_htonl(data == NULL ? 0 : data->unit->id);
+		*p++ = g_htonl(data == NULL ? 0 : data->con_id);
+	}
+
+	xml_tag_new_child(tag, "lookup",
+		"count", variant_new_int(array->len),
+		"data", variant_new_alloc_string(g_base64_encode(
+			(guchar *) rec, array->len * 3 * sizeof(guint32)
+		))
+	);
+
+	g_free(rec);
+}
+
+static void map_lookup(XmlTag *tag, XmlTag **ans)
+{
+	DEFINE_XTV(XTV_TIME_VALUE_, XTV_BINARY_VALUE_);
+
+	struct umap_snapshot *us;
+	gboolean binary = FALSE;
+	GArray *array;
+	time_t t;
+
+	time(&t);
+	MBB_XTV_CALL(&t, &binary);
+
+	array = g_array_new(FALSE, FALSE, sizeof(struct umap_request));
+
+	*ans = map_lookup_parse(tag, t, array);
+	if (*ans != NULL) final
+		g_array_free(array, TRUE);
+
+	us = umap_snapshot_get();
+
+	*ans = mbb_xml_msg_ok();
+	if (binary)
+		map_lookup_binary(*ans, us->umap, array);
+	else
+		map_lookup_xml(*ans, us->umap, array);
+
+	umap_snapshot_unref(us);
+	g_array_free(array, TRUE);
+}
+
 MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-map-add-unit", map_add_unit, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-map-del-unit", map_del_unit, MBB_CAP_WHEEL),
 
-	MBB_FUNC_STRUCT("mbb-map-show-all", map_show_all, MBB_CAP_ADMIN),
+	MBB_FUNC_CACHED("mbb-map-show-all", map_show_all, MBB_CAP_ADMIN, 60),
 	MBB_FUNC_STRUCT("mbb-map-show-inet", map_show_inet, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-map-show-unit", map_show_unit, MBB_CAP_ADMIN),
 
@@ -635,6 +902,7 @@ MBB_INIT_FUNCTIONS_DO
 
 	MBB_FUNC_STRUCT("mbb-map-find-net", map_find_net, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-map-find-unit", map_find_unit, MBB_CAP_ADMIN),
+	MBB_FUNC_STRUCT("mbb-map-lookup", map_lookup, MBB_CAP_ADMIN),
 MBB_INIT_FUNCTIONS_END
 
 MBB_VAR_DEF(mga_def) {
@@ -7,6 +7,10 @@
 #include "mbbunit.h"
 
 typedef struct mbb_umap MbbUMap;
+typedef struct mbb_map_loader MbbMapLoader;
+
+typedef void (*mbb_map_cross_func_t)(MbbUnit *unit, struct map_cross *cross,
+				     gpointer user_data);
 
 gboolean mbb_map_add_unit(MbbUnit *unit, struct map_cross *cross);
 
@@ -14,6 +18,15 @@ void mbb_map_del_inet(MbbInetPoolEntry *entry);
 void mbb_map_del_unit(MbbUnit *unit);
 
 void mbb_map_clear(void);
+
+void mbb_map_shadow_init(struct map *map);
+void mbb_map_shadow_commit(struct map *map);
+
+MbbMapLoader *mbb_map_loader_new(void);
+void mbb_map_loader_add_unit(MbbMapLoader *loader, MbbUnit *unit, struct map *unit_map);
+gboolean mbb_map_loader_build(MbbMapLoader *loader, struct map *map,
+			      mbb_map_cross_func_t func, gpointer user_data);
+void mbb_map_loader_free(MbbMapLoader *loader);
 void mbb_map_auto_glue(void);
 
 MbbUMap *mbb_umap_create(void);
@@ -0,0 +1,498 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+/* limits on method calls, checked before dispatch.
+ *
+ * every user has a token bucket refilled at rate calls per minute and a
+ * count of calls in progress, a method with a rule of its own gets another
+ * pair per user. the user limit comes from the rule of the user, else from
+ * the most generous rule among his groups, else from func.limit.* vars.
+ * zero means no limit, root and internal calls are never limited.
+ * rules are kept in the func_limits table, users and groups by id */
+
+#include <string.h>
+
+#include "mbbxmlmsg.h"
+#include "mbbthread.h"
+#include "mbbgroup.h"
+#include "mbbdblimit.h"
+#include "mbblimit.h"
+#include "mbbinit.h"
+#include "mbblock.h"
+#include "mbbfunc.h"
+#include "mbbuser.h"
+#include "mbbvar.h"
+#include "mbbxtv.h"
+
+#include "varconv.h"
+#include "macros.h"
+
+enum {
+	LIMIT_USER,
+	LIMIT_GROUP,
+	LIMIT_METHOD,
+	LIMIT_SCOPE_MAX
+};
+
+struct limit_rule {
+	guint rate;
+	guint burst;
+	guint calls;
+};
+
+struct limit_state {
+	gdouble tokens;
+	GTimeVal stamp;
+	guint calls;
+};
+
+static gchar *scope_names[LIMIT_SCOPE_MAX] = {
+	[LIMIT_USER] = "user",
+	[LIMIT_GROUP] = "group",
+	[LIMIT_METHOD] = "method"
+};
+
+static GHashTable *rules[LIMIT_SCOPE_MAX];
+
+/* states are few and outlive their rules, so they are never dropped */
+static GHashTable *states = NULL;
+static GStaticMutex limit_mutex = G_STATIC_MUTEX_INIT;
+
+static struct limit_rule default_rule = { 0, 0, 0 };
+
+static inline guint rule_burst(struct limit_rule *rule)
+{
+	return rule->burst != 0 ? rule->burst : rule->rate;
+}
+
+static inline gboolean rule_is_set(struct limit_rule *rule)
+{
+	return rule->rate != 0 || rule->calls != 0;
+}
+
+static inline guint limit_max(guint a, guint b)
+{
+	return (a == 0 || b == 0) ? 0 : MAX(a, b);
+}
+
+static void user_rule(struct mbb_user *user, struct limit_rule *rule)
+{
+	struct limit_rule *p;
+	gboolean found;
+	guint id;
+
+	p = g_hash_table_lookup(rules[LIMIT_USER], GINT_TO_POINTER(user->id));
+	if (p != NULL) {
+		*rule = *p;
+		return;
+	}
+
+	found = FALSE;
+	for (id = 0; id < sizeof(mbb_cap_t) * 8; id++) {
+		if (! (user->cap_mask & (1 << id)))
+			continue;
+
+		p = g_hash_table_lookup(rules[LIMIT_GROUP], GINT_TO_POINTER(id));
+		if (p == NULL)
+			continue;
+
+		if (! found) {
+			*rule = *p;
+			rule->burst = rule_burst(p);
+			found = TRUE;
+		} else {
+			rule->rate = limit_max(rule->rate, p->rate);
+			rule->burst = limit_max(rule->burst, rule_burst(p));
+			rule->calls = limit_max(rule->calls, p->calls);
+		}
+	}
+
+	if (! found)
+		*rule = default_rule;
+}
+
+static struct limit_state *state_get(gchar *key, struct limit_rule *rule,
+				     GTimeVal *now)
+{
+	struct limit_state *st;
+
+	st = g_hash_table_lookup(states, key);
+	if (st != NULL) {
+		g_free(key);
+		return st;
+	}
+
+	st = g_new(struct limit_state, 1);
+	st->tokens = rule_burst(rule);
+	st->stamp = *now;
+	st->calls = 0;
+
+	g_hash_table_insert(states, key, st);
+
+	return st;
+}
+
+static gboolean state_check(struct limit_state *st, struct limit_rule *rule,
+			    GTimeVal *now, XmlTag **ans)
+{
+	gdouble elapsed;
+
+	if (st == NULL)
+		return TRUE;
+
+	if (rule->rate != 0) {
+		elapsed = (now->tv_sec - st->stamp.tv_sec) +
+			(now->tv_usec - st->stamp.tv_usec) / (gdouble) G_USEC_PER_SEC;
+		if (elapsed > 0)
+			st->tokens += elapsed * rule->rate / 60;
+		st->tokens = MIN(st->tokens, rule_burst(rule));
+		st->stamp = *now;
+
+		if (st->tokens < 1) {
+			*ans = mbb_xml_msg(MBB_MSG_RATE_LIMIT);
+			return FALSE;
+		}
+	}
+
+	if (rule->calls != 0 && st->calls >= rule->calls) {
+		*ans = mbb_xml_msg(MBB_MSG_CALL_LIMIT);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void state_take(struct limit_state *st, struct limit_rule *rule)
+{
+	if (st == NULL)
+		return;
+
+	if (rule->rate != 0)
+		st->tokens -= 1;
+	st->calls++;
+}
+
+gboolean mbb_limit_enter(gchar *method, struct mbb_limit_ticket *ticket,
+			 XmlTag **ans)
+{
+	struct limit_state *ust, *mst;
+	struct limit_rule urule, *mrule;
+	struct mbb_user *user;
+	GTimeVal now;
+	gboolean ok;
+
+	ticket->user = ticket->method = NULL;
+
+	user = mbb_thread_get_user();
+	if (user == NULL || MBB_CAP_IS_ROOT(user->cap_mask))
+		return TRUE;
+
+	g_get_current_time(&now);
+	ust = mst = NULL;
+
+	g_static_mutex_lock(&limit_mutex);
+
+	user_rule(user, &urule);
+	if (rule_is_set(&urule))
+		ust = state_get(g_strdup_printf("%d", user->id), &urule, &now);
+
+	mrule = g_hash_table_lookup(rules[LIMIT_METHOD], method);
+	if (mrule != NULL && rule_is_set(mrule)) {
+		mst = state_get(
+			g_strdup_printf("%d:%s", user->id, method), mrule, &now
+		);
+	}
+
+	ok = state_check(ust, &urule, &now, ans) &&
+		state_check(mst, mrule, &now, ans);
+
+	if (ok) {
+		state_take(ust, &urule);
+		state_take(mst, mrule);
+
+		ticket->user = ust;
+		ticket->method = mst;
+	}
+
+	g_static_mutex_unlock(&limit_mutex);
+
+	return ok;
+}
+
+void mbb_limit_leave(struct mbb_limit_ticket *ticket)
+{
+	struct limit_state *st;
+
+	if (ticket->user == NULL && ticket->method == NULL)
+		return;
+
+	g_static_mutex_lock(&limit_mutex);
+
+	if ((st = ticket->user) != NULL)
+		st->calls--;
+	if ((st = ticket->method) != NULL)
+		st->calls--;
+
+	g_static_mutex_unlock(&limit_mutex);
+}
+
+static gint limit_scope(gchar *scope_name)
+{
+	gint scope;
+
+	for (scope = 0; scope < LIMIT_SCOPE_MAX; scope++) {
+		if (! strcmp(scope_names[scope], scope_name))
+			break;
+	}
+
+	return scope;
+}
+
+static void rule_set(gint scope, gpointer key, guint rate, guint burst,
+		     guint calls)
+{
+	struct limit_rule *rule;
+
+	g_static_mutex_lock(&limit_mutex);
+
+	rule = g_hash_table_lookup(rules[scope], key);
+	if (rule == NULL) {
+		rule = g_new(struct limit_rule, 1);
+		if (scope == LIMIT_METHOD)
+			key = g_strdup(key);
+		g_hash_table_insert(rules[scope], key, rule);
+	}
+
+	rule->rate = rate;
+	rule->burst = burst;
+	rule->calls = calls;
+
+	g_static_mutex_unlock(&limit_mutex);
+}
+
+/* the db keeps user and group ids in text */
+static gchar *limit_db_key(gint scope, gpointer key)
+{
+	if (scope == LIMIT_METHOD)
+		return g_strdup(key);
+
+	return g_strdup_printf("%d", GPOINTER_TO_INT(key));
+}
+
+static XmlTag *limit_key(gchar *scope_name, gchar *name, gint *scope,
+			 gpointer *key)
+{
+	struct mbb_group *group = NULL;
+	struct mbb_user *user = NULL;
+
+	*scope = limit_scope(scope_name);
+
+	if (*scope == LIMIT_METHOD) {
+		*key = name;
+		return NULL;
+	}
+
+	if (*scope == LIMIT_SCOPE_MAX)
+		return mbb_xml_msg(MBB_MSG_XTV_INVALID, "limit", "scope", scope_name);
+
+	mbb_lock_reader_lock();
+
+	if (*scope == LIMIT_USER) {
+		user = mbb_user_get_by_name(name);
+		if (user != NULL)
+			*key = GINT_TO_POINTER(user->id);
+	} else {
+		group = mbb_group_get_by_name(name);
+		if (group != NULL)
+			*key = GINT_TO_POINTER(group->id);
+	}
+
+	mbb_lock_reader_unlock();
+
+	if (*scope == LIMIT_USER && user == NULL)
+		return mbb_xml_msg(MBB_MSG_UNKNOWN_USER);
+	if (*scope == LIMIT_GROUP && group == NULL)
+		return mbb_xml_msg(MBB_MSG_UNKNOWN_GROUP);
+
+	return NULL;
+}
+
+static void limit_set(XmlTag *tag, XmlTag **ans)
+{
+	DEFINE_XTV(XTV_LIMIT_SCOPE, XTV_LIMIT_NAME, XTV_LIMIT_RATE_,
+		   XTV_LIMIT_BURST_, XTV_LIMIT_CALLS_);
+
+	guint rate, burst, calls;
+	GError *error = NULL;
+	gchar *scope_name;
+	gpointer key;
+	gchar *name;
+	gchar *dkey;
+	gboolean ok;
+	gint scope;
+
+	rate = burst = calls = 0;
+	MBB_XTV_CALL(&scope_name, &name, &rate, &burst, &calls);
+
+	if ((*ans = limit_key(scope_name, name, &scope, &key)) != NULL)
+		return;
+
+	dkey = limit_db_key(scope, key);
+	ok = mbb_db_limit_set(scope_names[scope], dkey, rate, burst, calls,
+		&error
+	);
+	g_free(dkey);
+
+	if (! ok) final
+		*ans = mbb_xml_msg_from_error(error);
+
+	rule_set(scope, key, rate, burst, calls);
+}
+
+static void limit_del(XmlTag *tag, XmlTag **ans)
+{
+	DEFINE_XTV(XTV_LIMIT_SCOPE, XTV_LIMIT_NAME);
+
+	GError *error = NULL;
+	gchar *scope_name;
+	gpointer key;
+	gboolean ok;
+	gchar *name;
+	gchar *dkey;
+	gint scope;
+
+	MBB_XTV_CALL(&scope_name, &name);
+
+	if ((*ans = limit_key(scope_name, name, &scope, &key)) != NULL)
+		return;
+
+	g_static_mutex_lock(&limit_mutex);
+	ok = g_hash_table_lookup(rules[scope], key) != NULL;
+	g_static_mutex_unlock(&limit_mutex);
+
+	if (! ok) final
+		*ans = mbb_xml_msg_error("no such limit");
+
+	dkey = limit_db_key(scope, key);
+	ok = mbb_db_limit_del(scope_names[scope], dkey, &error);
+	g_free(dkey);
+
+	if (! ok) final
+		*ans = mbb_xml_msg_from_error(error);
+
+	g_static_mutex_lock(&limit_mutex);
+	g_hash_table_remove(rules[scope], key);
+	g_static_mutex_unlock(&limit_mutex);
+}
+
+gboolean mbb_limit_add(gchar *scope_name, gchar *key, guint rate, guint burst,
+		       guint calls)
+{
+	gint scope, id;
+
+	scope = limit_scope(scope_name);
+	if (scope == LIMIT_SCOPE_MAX)
+		return FALSE;
+
+	if (scope == LIMIT_METHOD)
+		rule_set(scope, key, rate, burst, calls);
+	else {
+		if (! var_conv_int(key, &id))
+			return FALSE;
+
+		rule_set(scope, GINT_TO_POINTER(id), rate, burst, calls);
+	}
+
+	return TRUE;
+}
+
+static gchar *limit_name(gint scope, gpointer key)
+{
+	struct mbb_group *group;
+	struct mbb_user *user;
+	gchar *name = NULL;
+
+	if (scope == LIMIT_METHOD)
+		return g_strdup(key);
+
+	if (scope == LIMIT_USER) {
+		user = mbb_user_get_by_id(GPOINTER_TO_INT(key));
+		if (user != NULL)
+			name = user->name;
+	} else {
+		group = mbb_group_get_by_id(GPOINTER_TO_INT(key));
+		if (group != NULL)
+			name = group->name;
+	}
+
+	if (name == NULL)
+		return g_strdup_printf("#%d", GPOINTER_TO_INT(key));
+
+	return g_strdup(name);
+}
+
+static void show_limits(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
+{
+	struct limit_rule *rule;
+	GHashTableIter iter;
+	gpointer key;
+	gint scope;
+
+	*ans = mbb_xml_msg_ok();
+
+	mbb_lock_reader_lock();
+	g_static_mutex_lock(&limit_mutex);
+
+	for (scope = 0; scope < LIMIT_SCOPE_MAX; scope++) {
+		g_hash_table_iter_init(&iter, rules[scope]);
+		while (g_hash_table_iter_next(&iter, &key, (gpointer *) &rule)) {
+			xml_tag_new_child(*ans, "limit",
+				"scope", variant_new_static_string(scope_names[scope]),
+				"name", variant_new_alloc_string(limit_name(scope, key)),
+				"rate", variant_new_int(rule->rate),
+				"burst", variant_new_int(rule->burst),
+				"calls", variant_new_int(rule->calls)
+			);
+		}
+	}
+
+	g_static_mutex_unlock(&limit_mutex);
+	mbb_lock_reader_unlock();
+}
+
+MBB_VAR_DEF(limit_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_uint,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
+MBB_INIT_FUNCTIONS_DO
+	MBB_FUNC_BATCH("mbb-limit-set", limit_set, MBB_CAP_WHEEL),
+	MBB_FUNC_STRUCT("mbb-limit-del", limit_del, MBB_CAP_WHEEL),
+	MBB_FUNC_STRUCT("mbb-show-limits", show_limits, MBB_CAP_ADMIN),
+MBB_INIT_FUNCTIONS_END
+
+static void init_local(void)
+{
+	rules[LIMIT_USER] = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, g_free
+	);
+	rules[LIMIT_GROUP] = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, g_free
+	);
+	rules[LIMIT_METHOD] = g_hash_table_new_full(
+		g_str_hash, g_str_equal, g_free, g_free
+	);
+
+	states = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+static void init_vars(void)
+{
+	mbb_base_var_register("func.limit.rate", &limit_def, &default_rule.rate);
+	mbb_base_var_register("func.limit.burst", &limit_def, &default_rule.burst);
+	mbb_base_var_register("func.limit.calls", &limit_def, &default_rule.calls);
+}
+
+MBB_ON_INIT(MBB_INIT_LOCAL, MBB_INIT_VARS, MBB_INIT_FUNCTIONS)
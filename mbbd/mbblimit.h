@@ -0,0 +1,23 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef MBB_LIMIT_H
+#define MBB_LIMIT_H
+
+#include <glib.h>
+
+#include "xmltag.h"
+
+struct mbb_limit_ticket {
+	gpointer user;
+	gpointer method;
+};
+
+gboolean mbb_limit_enter(gchar *method, struct mbb_limit_ticket *ticket,
+			 XmlTag **ans);
+void mbb_limit_leave(struct mbb_limit_ticket *ticket);
+
+gboolean mbb_limit_add(gchar *scope, gchar *key, guint rate, guint burst,
+		       guint calls);
+
+#endif
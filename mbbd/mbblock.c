@@ -7,23 +7,65 @@
 
 static GStaticRWLock rwlock = G_STATIC_RW_LOCK_INIT;
 
+/* bumped on every writer lock, lets readers detect changes between sections */
+static volatile gint generation = 0;
+
+/* depth of the writer lock held by this thread, a batch holds it across
+ * many method calls and their own lock calls only nest */
+static GStaticPrivate depth_key = G_STATIC_PRIVATE_INIT;
+
+static inline gint lock_depth(void)
+{
+	return GPOINTER_TO_INT(g_static_private_get(&depth_key));
+}
+
+static inline void lock_depth_set(gint depth)
+{
+	g_static_private_set(&depth_key, GINT_TO_POINTER(depth), NULL);
+}
+
 void mbb_lock_reader_lock(void)
 {
-	g_static_rw_lock_reader_lock(&rwlock);
+	gint depth = lock_depth();
+
+	if (depth > 0)
+		lock_depth_set(depth + 1);
+	else
+		g_static_rw_lock_reader_lock(&rwlock);
 }
 
 void mbb_lock_reader_unlock(void)
 {
-	g_static_rw_lock_reader_unlock(&rwlock);
+	gint depth = lock_depth();
+
+	if (depth > 0)
+		lock_depth_set(depth - 1);
+	else
+		g_static_rw_lock_reader_unlock(&rwlock);
 }
 
 void mbb_lock_writer_lock(void)
 {
-	g_static_rw_lock_writer_lock(&rwlock);
+	gint depth = lock_depth();
+
+	if (depth == 0)
+		g_static_rw_lock_writer_lock(&rwlock);
+
+	/* nested sections bump it too, they change things as well */
+	g_atomic_int_inc(&generation);
+	lock_depth_set(depth + 1);
 }
 
 void mbb_lock_writer_unlock(void)
 {
-	g_static_rw_lock_writer_unlock(&rwlock);
+	gint depth = lock_depth();
+
+	lock_depth_set(depth - 1);
+	if (depth == 1)
+		g_static_rw_lock_writer_unlock(&rwlock);
 }
 
+guint mbb_lock_generation(void)
+{
+	return (guint) g_atomic_int_get(&generation);
+}
@@ -4,10 +4,14 @@
 #ifndef MBB_LOCK_H
 #define MBB_LOCK_H
 
+#include <glib.h>
+
 void mbb_lock_reader_lock(void);
 void mbb_lock_reader_unlock(void);
 
 void mbb_lock_writer_lock(void);
 void mbb_lock_writer_unlock(void);
 
+guint mbb_lock_generation(void);
+
 #endif
@@ -66,6 +66,9 @@ static GHashTable *ht = NULL;
 static GStaticRWLock rwlock = G_STATIC_RW_LOCK_INIT;
 static GStaticPrivate log_mask_key = G_STATIC_PRIVATE_INIT;
 
+/* levels wanted by at least one subscriber, read without the lock */
+static volatile gint log_lvl_all = 0;
+
 static inline gboolean mask_has_lvl(mbb_log_lvl_t mask, mbb_log_lvl_t lvl)
 {
 	return (mask & lvl) == lvl;
@@ -78,6 +81,22 @@ static void tld_free(struct thread_log_data *tld)
 	g_free(tld);
 }
 
+static void log_writer_unlock(void)
+{
+	struct thread_log_data *tld;
+	mbb_log_lvl_t mask = 0;
+	GHashTableIter iter;
+
+	if (ht != NULL) {
+		g_hash_table_iter_init(&iter, ht);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &tld))
+			mask |= tld->lvl_mask;
+	}
+
+	g_atomic_int_set(&log_lvl_all, mask);
+	g_static_rw_lock_writer_unlock(&rwlock);
+}
+
 static inline void ht_init(void)
 {
 	ht = g_hash_table_new_full(
@@ -249,6 +268,9 @@ static void mbb_log_push_all(mbb_log_lvl_t lvl, gchar *fmt, va_list ap)
 		lvl = MBB_LOG_TASK;
 	}
 
+	if (! mask_has_lvl(g_atomic_int_get(&log_lvl_all), lvl))
+		return;
+
 	domain = log_lvl_name(lvl);
 	if (domain == NULL)
 		return;
@@ -282,6 +304,18 @@ static void mbb_log_push_all(mbb_log_lvl_t lvl, gchar *fmt, va_list ap)
 	g_static_rw_lock_reader_unlock(&rwlock);
 }
 
+/* lets callers skip rendering arguments nobody is going to read */
+gboolean mbb_log_lvl_enabled(mbb_log_lvl_t lvl)
+{
+	if (log_lvl_ispermit(lvl) == FALSE)
+		return FALSE;
+
+	if (mbb_thread_get_peer() == NULL)
+		lvl = MBB_LOG_TASK;
+
+	return mask_has_lvl(g_atomic_int_get(&log_lvl_all), lvl);
+}
+
 void mbb_log_lvl(mbb_log_lvl_t lvl, gchar *fmt, ...)
 {
 	va_list ap;
@@ -422,7 +456,7 @@ static void mbb_log_set_lvl_mask(mbb_log_lvl_t mask)
 		}
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 
 	if (ls == LOG_ON)
 		mbb_log_debugv("log on");
@@ -451,7 +485,7 @@ static void mbb_log_add_lvl_mask(mbb_log_lvl_t mask)
 		tld->lvl_mask |= mask;
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 
 	if (ls == LOG_ON)
 		mbb_log_debugv("log on");
@@ -480,7 +514,7 @@ static void mbb_log_del_lvl_mask(mbb_log_lvl_t mask)
 		}
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 
 	if (ls == LOG_OFF)
 		mbb_log_debugv("log off");
@@ -503,7 +537,7 @@ static void log_register(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans G_GNUC_UNUSED)
 		ls = LOG_ON;
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 
 	if (ls == LOG_ON)
 		mbb_log_debugv("log on");
@@ -524,7 +558,7 @@ void mbb_log_unregister(void)
 		ls = LOG_OFF;
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 
 	if (ls == LOG_OFF)
 		mbb_log_debugv("log off");
@@ -716,7 +750,7 @@ static void log_trace_add(XmlTag *tag, XmlTag **ans G_GNUC_UNUSED)
 		}
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 
 	g_slist_free(sid_list);
 }
@@ -752,7 +786,7 @@ static void log_trace_del(XmlTag *tag, XmlTag **ans G_GNUC_UNUSED)
 		g_slist_free(sid_list);
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 
 	g_slist_free(var_list);
 }
@@ -786,7 +820,7 @@ static void log_trace_zclean(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans G_GNUC_UNUS
 		}
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 }
 
 static void log_trace_clean(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans G_GNUC_UNUSED)
@@ -804,7 +838,7 @@ static void log_trace_clean(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans G_GNUC_UNUSE
 		tld->traced = NULL;
 	}
 
-	g_static_rw_lock_writer_unlock(&rwlock);
+	log_writer_unlock();
 }
 
 MBB_INIT_FUNCTIONS_DO
@@ -37,6 +37,7 @@ enum {
 
 void mbb_log(gchar *fmt, ...);
 void mbb_log_lvl(mbb_log_lvl_t lvl, gchar *fmt, ...);
+gboolean mbb_log_lvl_enabled(mbb_log_lvl_t lvl);
 void mbb_log_unregister(void);
 
 void mbb_log_mask(gint how, mbb_log_lvl_t mask, mbb_log_lvl_t *omask);
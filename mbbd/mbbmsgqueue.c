@@ -3,6 +3,8 @@
 
 #include "mbbmsgqueue.h"
 
+#include "xmlpack.h"
+
 enum {
 	MSG_CONST,
 	MSG_ALLOC,
@@ -14,6 +16,10 @@ struct msg_entry {
 	gsize len;
 	gsize off;
 
+	/* frame header sent ahead of the text on packed streams */
+	gchar head[XML_PACK_HEAD_LEN];
+	gsize head_len;
+
 	union {
 		Shared *msg;
 		gchar *text;
@@ -23,6 +29,7 @@ struct msg_entry {
 struct mbb_msg_queue {
 	GQueue *queue;
 	GMutex *mutex;
+	gboolean framed;
 
 	mbb_msg_func_t func;
 	gpointer user_data;
@@ -35,18 +42,32 @@ MbbMsgQueue *mbb_msg_queue_new(mbb_msg_func_t func, gpointer user_data)
 	msg_queue = g_new(MbbMsgQueue, 1);
 	msg_queue->queue = NULL;
 	msg_queue->mutex = g_mutex_new();
+	msg_queue->framed = FALSE;
 	msg_queue->func = func;
 	msg_queue->user_data = user_data;
 
 	return msg_queue;
 }
 
-static void mbb_msg_queue_push_entry(MbbMsgQueue *msg_queue,
-				     struct msg_entry *entry)
+void mbb_msg_queue_set_framed(MbbMsgQueue *msg_queue, gboolean framed)
+{
+	g_mutex_lock(msg_queue->mutex);
+	msg_queue->framed = framed;
+	g_mutex_unlock(msg_queue->mutex);
+}
+
+static void mbb_msg_queue_push_frame_entry(MbbMsgQueue *msg_queue,
+					   struct msg_entry *entry, guint type)
 {
 	g_mutex_lock(msg_queue->mutex);
 
 	entry->off = 0;
+	entry->head_len = 0;
+
+	if (msg_queue->framed) {
+		xml_pack_head(entry->head, type, entry->len);
+		entry->head_len = XML_PACK_HEAD_LEN;
+	}
 
 	if (msg_queue->queue == NULL)
 		msg_queue->queue = g_queue_new();
@@ -62,6 +83,12 @@ static void mbb_msg_queue_push_entry(MbbMsgQueue *msg_queue,
 	g_mutex_unlock(msg_queue->mutex);
 }
 
+static void mbb_msg_queue_push_entry(MbbMsgQueue *msg_queue,
+				     struct msg_entry *entry)
+{
+	mbb_msg_queue_push_frame_entry(msg_queue, entry, XML_PACK_TEXT);
+}
+
 void mbb_msg_queue_push_shared(MbbMsgQueue *msg_queue, Shared *msg, gsize len)
 {
 	struct msg_entry *entry;
@@ -98,6 +125,18 @@ void mbb_msg_queue_push_const(MbbMsgQueue *msg_queue, gchar *text, gsize len)
 	mbb_msg_queue_push_entry(msg_queue, entry);
 }
 
+void mbb_msg_queue_push_packed(MbbMsgQueue *msg_queue, gchar *msg, gsize len)
+{
+	struct msg_entry *entry;
+
+	entry = g_new(struct msg_entry, 1);
+	entry->type = MSG_ALLOC;
+	entry->len = len;
+	entry->un.text = msg;
+
+	mbb_msg_queue_push_frame_entry(msg_queue, entry, XML_PACK_TAG);
+}
+
 static void msg_entry_free(struct msg_entry *entry)
 {
 	if (entry->type == MSG_ALLOC)
@@ -124,13 +163,18 @@ gint mbb_msg_queue_pop(MbbMsgQueue *msg_queue)
 	if (entry == NULL)
 		return 0;
 
-	if (entry->type == MSG_SHARED)
-		text = entry->un.msg->data;
-	else
-		text = entry->un.text;
-
-	text += entry->off;
-	len = entry->len - entry->off;
+	if (entry->off < entry->head_len) {
+		text = entry->head + entry->off;
+		len = entry->head_len - entry->off;
+	} else {
+		if (entry->type == MSG_SHARED)
+			text = entry->un.msg->data;
+		else
+			text = entry->un.text;
+
+		text += entry->off - entry->head_len;
+		len = entry->head_len + entry->len - entry->off;
+	}
 
 /*
 	msg_warn("pop msg %.*s", len, text);
@@ -138,7 +182,7 @@ gint mbb_msg_queue_pop(MbbMsgQueue *msg_queue)
 	n = msg_queue->func(text, len, msg_queue->user_data);
 
 	if (n > 0) {
-		if ((gsize) n < len)
+		if (entry->off + n < entry->head_len + entry->len)
 			entry->off += n;
 		else {
 			g_mutex_lock(msg_queue->mutex);
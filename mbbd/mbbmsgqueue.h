@@ -15,6 +15,8 @@ MbbMsgQueue *mbb_msg_queue_new(mbb_msg_func_t func, gpointer user_data);
 void mbb_msg_queue_push_shared(MbbMsgQueue *msg_queue, Shared *msg, gsize len);
 void mbb_msg_queue_push_alloc(MbbMsgQueue *msg_queue, gchar *msg, gsize len);
 void mbb_msg_queue_push_const(MbbMsgQueue *msg_queue, gchar *text, gsize len);
+void mbb_msg_queue_push_packed(MbbMsgQueue *msg_queue, gchar *msg, gsize len);
+void mbb_msg_queue_set_framed(MbbMsgQueue *msg_queue, gboolean framed);
 gint mbb_msg_queue_pop(MbbMsgQueue *msg_queue);
 gboolean mbb_msg_queue_is_empty(MbbMsgQueue *msg_queue);
 guint mbb_msg_queue_get_length(MbbMsgQueue *msg_queue);
@@ -212,6 +212,7 @@ static gpointer mbb_thread_client(struct thread_param *tp)
 	sock_get_peername(te.sock, peer, &port);
 
 	te.parser = NULL;
+	te.unpacker = NULL;
 	te.msg_queue = NULL;
 	te.signaller = NULL;
 
@@ -236,6 +237,9 @@ static gpointer mbb_thread_client(struct thread_param *tp)
 	if (te.parser != NULL)
 		xml_parser_free(te.parser);
 
+	if (te.unpacker != NULL)
+		xml_unpacker_free(te.unpacker);
+
 	return NULL;
 }
 
@@ -15,6 +15,7 @@
 #include "mbbplock.h"
 
 #include "macros.h"
+#include "debug.h"
 
 #include <time.h>
 
@@ -22,8 +23,36 @@
 
 /* PROHIBITED calling mbb_log inside the lock */
 
-static guint session_id = 1;
-static GHashTable *ht = NULL;
+/* sessions are spread over the shards by sid, so connects and
+ * disconnects of different clients hardly ever meet on a lock */
+#define SESSION_SHARDS 16
+
+struct session_shard {
+	GStaticMutex mutex;
+	GHashTable *ht;
+};
+
+/* idle xml sessions are reaped by one thread sleeping till the oldest
+ * mtime of a min-heap expires. touching a session only moves its mtime,
+ * an entry found touched is pushed back with the new one */
+struct reap_entry {
+	time_t mtime;
+	guint sid;
+};
+
+static volatile gint session_id = 1;
+
+static struct session_shard shards[SESSION_SHARDS];
+static GOnce shards_once = G_ONCE_INIT;
+
+static GStaticMutex reap_mutex = G_STATIC_MUTEX_INIT;
+static GOnce reap_once = G_ONCE_INIT;
+static GArray *reap_heap = NULL;
+static GCond *reap_cond = NULL;
+
+static guint idle_timeout = 0;
+
+static gpointer shards_init(gpointer arg);
 
 static GQueue var_queue = G_QUEUE_INIT;
 
@@ -50,18 +79,25 @@ static inline gboolean session_lookup_var(struct mbb_session *ss,
 
 void mbb_session_del_var(struct mbb_var *var)
 {
+	struct mbb_session_var *priv;
+	struct mbb_session *ss;
+	GHashTableIter iter;
+	guint n;
+
 	mbb_plock_writer_lock();
 
 	g_queue_remove(&var_queue, var);
 
-	if (ht != NULL) {
-		struct mbb_session_var *priv;
-		struct mbb_session *ss;
-		GHashTableIter iter;
+	mbb_plock_writer_unlock();
 
-		priv = mbb_var_get_priv(var);
+	g_once(&shards_once, shards_init, NULL);
+
+	priv = mbb_var_get_priv(var);
 
-		g_hash_table_iter_init(&iter, ht);
+	for (n = 0; n < SESSION_SHARDS; n++) {
+		g_static_mutex_lock(&shards[n].mutex);
+
+		g_hash_table_iter_init(&iter, shards[n].ht);
 		while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &ss)) {
 			gpointer data;
 
@@ -72,9 +108,9 @@ void mbb_session_del_var(struct mbb_var *var)
 				g_hash_table_remove(ss->vars, var);
 			}
 		}
-	}
 
-	mbb_plock_writer_unlock();
+		g_static_mutex_unlock(&shards[n].mutex);
+	}
 }
 
 static gpointer session_insert_var(struct mbb_session *ss, struct mbb_var *var)
@@ -149,16 +185,224 @@ static void mbb_session_free(struct mbb_session *ss)
 		g_hash_table_destroy(ss->cached_vars);
 }
 
-static inline void ht_init(void)
+static gpointer shards_init(gpointer arg G_GNUC_UNUSED)
 {
-	ht = g_hash_table_new_full(
-		g_direct_hash, g_direct_equal,
-		NULL, (GDestroyNotify) mbb_session_free
-	);
+	guint n;
+
+	for (n = 0; n < SESSION_SHARDS; n++) {
+		g_static_mutex_init(&shards[n].mutex);
+		shards[n].ht = g_hash_table_new_full(
+			g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify) mbb_session_free
+		);
+	}
+
+	return NULL;
+}
+
+/* returns the session with its shard locked, unlocked if there is none */
+static struct mbb_session *session_lock(guint sid,
+					struct session_shard **pshard)
+{
+	struct session_shard *shard;
+	struct mbb_session *ss;
+
+	g_once(&shards_once, shards_init, NULL);
+
+	shard = shards + sid % SESSION_SHARDS;
+	g_static_mutex_lock(&shard->mutex);
+
+	ss = g_hash_table_lookup(shard->ht, GINT_TO_POINTER(sid));
+	if (ss == NULL)
+		g_static_mutex_unlock(&shard->mutex);
+
+	*pshard = shard;
+
+	return ss;
+}
+
+static inline void session_unlock(struct session_shard *shard)
+{
+	g_static_mutex_unlock(&shard->mutex);
+}
+
+static void session_kill(struct mbb_session *ss, gchar *msg)
+{
+	ss->killed = TRUE;
+
+	if (msg != NULL) {
+		g_free(ss->kill_msg);
+		ss->kill_msg = msg;
+	}
+
+	if (ss->signaller != NULL)
+		signaller_raise(ss->signaller);
+}
+
+static void reap_heap_push(struct reap_entry *entry)
+{
+	struct reap_entry *heap;
+	guint n, parent;
+
+	g_array_append_val(reap_heap, *entry);
+	heap = (struct reap_entry *) reap_heap->data;
+
+	for (n = reap_heap->len - 1; n > 0; n = parent) {
+		parent = (n - 1) / 2;
+		if (heap[parent].mtime <= entry->mtime)
+			break;
+		heap[n] = heap[parent];
+	}
+
+	heap[n] = *entry;
+}
+
+static void reap_heap_pop(struct reap_entry *entry)
+{
+	struct reap_entry *heap, last;
+	guint n, child, len;
+
+	heap = (struct reap_entry *) reap_heap->data;
+	*entry = heap[0];
+
+	len = reap_heap->len - 1;
+	last = heap[len];
+	g_array_set_size(reap_heap, len);
+
+	for (n = 0; (child = 2 * n + 1) < len; n = child) {
+		if (child + 1 < len && heap[child + 1].mtime < heap[child].mtime)
+			child++;
+		if (last.mtime <= heap[child].mtime)
+			break;
+		heap[n] = heap[child];
+	}
+
+	if (len > 0)
+		heap[n] = last;
+}
+
+static void reap_session(struct reap_entry *entry)
+{
+	struct session_shard *shard;
+	struct mbb_session *ss;
+	gboolean touched = FALSE;
+
+	if ((ss = session_lock(entry->sid, &shard)) == NULL)
+		return;
+
+	/* a killed session is dropped from the heap */
+	if (! ss->killed) {
+		if (ss->mtime > entry->mtime) {
+			entry->mtime = ss->mtime;
+			touched = TRUE;
+		} else
+			session_kill(ss, g_strdup("idle timeout"));
+	}
+
+	session_unlock(shard);
+
+	if (touched) {
+		g_static_mutex_lock(&reap_mutex);
+		reap_heap_push(entry);
+		g_static_mutex_unlock(&reap_mutex);
+	}
+}
+
+static gpointer reaper_work(gpointer data G_GNUC_UNUSED)
+{
+	struct reap_entry entry;
+	GMutex *mutex;
+	GTimeVal tv;
+	time_t now;
+
+	mutex = g_static_mutex_get_mutex(&reap_mutex);
+
+	for (;;) {
+		g_mutex_lock(mutex);
+
+		while (reap_heap->len == 0 || idle_timeout == 0)
+			g_cond_wait(reap_cond, mutex);
+
+		entry = g_array_index(reap_heap, struct reap_entry, 0);
+		time(&now);
+
+		if (entry.mtime + (time_t) idle_timeout > now) {
+			g_get_current_time(&tv);
+			tv.tv_sec += entry.mtime + idle_timeout - now;
+			g_cond_timed_wait(reap_cond, mutex, &tv);
+			g_mutex_unlock(mutex);
+			continue;
+		}
+
+		reap_heap_pop(&entry);
+		g_mutex_unlock(mutex);
+
+		reap_session(&entry);
+	}
+
+	return NULL;
+}
+
+static gpointer reaper_init(gpointer arg G_GNUC_UNUSED)
+{
+	reap_heap = g_array_new(FALSE, FALSE, sizeof(struct reap_entry));
+	reap_cond = g_cond_new();
+
+	if (g_thread_create(reaper_work, NULL, FALSE, NULL) == NULL)
+		msg_warn("g_thread_create failed");
+
+	return NULL;
+}
+
+/* called with reap_mutex held */
+static void reaper_add(guint sid, time_t mtime)
+{
+	struct reap_entry entry;
+
+	entry.sid = sid;
+	entry.mtime = mtime;
+
+	/* nothing is kept while disabled, the heap is seeded on enabling */
+	if (idle_timeout != 0) {
+		reap_heap_push(&entry);
+		if (reap_heap->len == 1)
+			g_cond_signal(reap_cond);
+	}
+}
+
+/* called with reap_mutex held, so sessions created meanwhile
+ * are either seen here or added after */
+static void reaper_seed(void)
+{
+	struct reap_entry entry;
+	struct mbb_session *ss;
+	GHashTableIter iter;
+	gpointer key;
+	guint n;
+
+	g_once(&shards_once, shards_init, NULL);
+
+	for (n = 0; n < SESSION_SHARDS; n++) {
+		g_static_mutex_lock(&shards[n].mutex);
+
+		g_hash_table_iter_init(&iter, shards[n].ht);
+		while (g_hash_table_iter_next(&iter, &key, (gpointer *) &ss)) {
+			if (ss->type != MBB_SESSION_XML || ss->killed)
+				continue;
+
+			entry.sid = GPOINTER_TO_INT(key);
+			entry.mtime = ss->mtime;
+			reap_heap_push(&entry);
+		}
+
+		g_static_mutex_unlock(&shards[n].mutex);
+	}
 }
 
+
 guint mbb_session_new(struct mbb_session *ss, gchar *peer, guint port, mbb_session_type type)
 {
+	struct session_shard *shard;
 	guint sid;
 
 	ss->user = NULL;
@@ -173,18 +417,32 @@ guint mbb_session_new(struct mbb_session *ss, gchar *peer, guint port, mbb_sessi
 	ss->kill_msg = NULL;
 
 	ss->cached_vars = NULL;
+	ss->signaller = NULL;
 
+	mbb_plock_reader_lock();
 	session_vars_init(ss);
+	mbb_plock_reader_unlock();
 
-	mbb_plock_writer_lock();
+	g_once(&shards_once, shards_init, NULL);
 
-	sid = session_id++;
-	if (ht == NULL)
-		ht_init();
+	sid = g_atomic_int_exchange_and_add(&session_id, 1);
+	shard = shards + sid % SESSION_SHARDS;
 
-	g_hash_table_insert(ht, GINT_TO_POINTER(sid), ss);
+	/* http sessions live for a single request, xml ones are added
+	 * to the reaper under reap_mutex taken before the shard as seeding does */
+	if (type == MBB_SESSION_XML) {
+		g_once(&reap_once, reaper_init, NULL);
+		g_static_mutex_lock(&reap_mutex);
+	}
 
-	mbb_plock_writer_unlock();
+	g_static_mutex_lock(&shard->mutex);
+	g_hash_table_insert(shard->ht, GINT_TO_POINTER(sid), ss);
+	g_static_mutex_unlock(&shard->mutex);
+
+	if (type == MBB_SESSION_XML) {
+		reaper_add(sid, ss->mtime);
+		g_static_mutex_unlock(&reap_mutex);
+	}
 
 	return sid;
 }
@@ -199,42 +457,54 @@ gboolean mbb_session_auth(struct mbb_session *ss, gchar *login, gchar *secret,
 {
 	MbbUser *user;
 
-	mbb_lock_reader_lock();
 	user = mbb_auth(login, secret, type);
-	if (user != NULL) {
-		if (ss->user != NULL)
-			mbb_user_unref(ss->user);
+	if (user == NULL)
+		return FALSE;
 
-		ss->user = mbb_user_ref(user);
-		mbb_log("auth as %s", user->name);
-	}
+	mbb_lock_reader_lock();
+	if (ss->user != NULL)
+		mbb_user_unref(ss->user);
+
+	ss->user = user;
+	mbb_log("auth as %s", user->name);
 	mbb_lock_reader_unlock();
 
-	return user != NULL;
+	return TRUE;
 }
 
 gboolean mbb_session_has(gint sid)
 {
-	gboolean ret = FALSE;
-
-	mbb_plock_reader_lock();
+	struct session_shard *shard;
 
-	if (ht != NULL && g_hash_table_lookup(ht, GINT_TO_POINTER(sid)) != NULL)
-		ret = TRUE;
+	if (session_lock(sid, &shard) == NULL)
+		return FALSE;
 
-	mbb_plock_reader_unlock();
+	session_unlock(shard);
 
-	return ret;
+	return TRUE;
 }
 
 void mbb_session_quit(guint sid)
 {
-	mbb_plock_writer_lock();
+	struct session_shard *shard;
 
-	if (ht != NULL)
-		g_hash_table_remove(ht, GINT_TO_POINTER(sid));
+	if (session_lock(sid, &shard) == NULL)
+		return;
 
-	mbb_plock_writer_unlock();
+	g_hash_table_remove(shard->ht, GINT_TO_POINTER(sid));
+	session_unlock(shard);
+}
+
+void mbb_session_set_signaller(guint sid, Signaller *signaller)
+{
+	struct session_shard *shard;
+	struct mbb_session *ss;
+
+	if ((ss = session_lock(sid, &shard)) == NULL)
+		return;
+
+	ss->signaller = signaller;
+	session_unlock(shard);
 }
 
 gboolean mbb_session_is_http(void)
@@ -302,19 +572,20 @@ static void gather_session(gpointer key, gpointer value, gpointer data)
 
 static void show_sessions(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
 {
-	mbb_plock_reader_lock();
+	struct show_sessions_data ssd;
+	guint n;
 
-	if (ht != NULL) {
-		struct show_sessions_data ssd;
+	*ans = mbb_xml_msg_ok();
+	ssd.ans = *ans;
+	ssd.show_mtime = *(gboolean *) mbb_session_var_get_data(show_mtime_var);
 
-		*ans = mbb_xml_msg_ok();
-		ssd.ans = *ans;
-		ssd.show_mtime = *(gboolean *) mbb_session_var_get_data(show_mtime_var);
+	g_once(&shards_once, shards_init, NULL);
 
-		g_hash_table_foreach(ht, gather_session, &ssd);
+	for (n = 0; n < SESSION_SHARDS; n++) {
+		g_static_mutex_lock(&shards[n].mutex);
+		g_hash_table_foreach(shards[n].ht, gather_session, &ssd);
+		g_static_mutex_unlock(&shards[n].mutex);
 	}
-
-	mbb_plock_reader_unlock();
 }
 
 static gchar *var_session_peer_get(gpointer p G_GNUC_UNUSED)
@@ -344,36 +615,50 @@ static void kill_session(XmlTag *tag, XmlTag **ans)
 	DEFINE_XTV(XTV_SESSION_SID);
 
 	struct mbb_session *current = NULL;
-	struct mbb_session *ss = NULL;
+	struct session_shard *shard;
+	struct mbb_session *ss;
+	gchar *msg = NULL;
 	guint sid = -1;
 
 	MBB_XTV_CALL(&sid);
 
 	current = current_session();
+	if (current != NULL && current->user != NULL) {
+		mbb_user_lock(current->user);
+		msg = g_strdup_printf("killed by %s", current->user->name);
+		mbb_user_unlock(current->user);
+	}
 
-	mbb_plock_reader_lock();
+	if ((ss = session_lock(sid, &shard)) == NULL) final {
+		g_free(msg);
+		*ans = mbb_xml_msg(MBB_MSG_UNKNOWN_SESSION);
+	}
 
-	on_final { mbb_plock_reader_unlock(); }
+	session_kill(ss, msg);
+	session_unlock(shard);
+}
 
-	if (ht != NULL)
-		ss = g_hash_table_lookup(ht, GINT_TO_POINTER(sid));
+static gboolean var_conv_idle_timeout(gchar *arg, gpointer p G_GNUC_UNUSED)
+{
+	gboolean enable;
+	guint timeout;
 
-	if (ss == NULL) final
-		*ans = mbb_xml_msg(MBB_MSG_UNKNOWN_SESSION);
+	if (! var_conv_uint(arg, &timeout))
+		return FALSE;
 
-	ss->killed = TRUE;
-	if (current != NULL && current->user != NULL) {
-		if (ss->kill_msg != NULL)
-			g_free(ss->kill_msg);
+	g_once(&reap_once, reaper_init, NULL);
 
-		mbb_user_lock(current->user);
-		ss->kill_msg = g_strdup_printf("killed by %s", current->user->name);
-		mbb_user_unlock(current->user);
+	g_static_mutex_lock(&reap_mutex);
+	enable = idle_timeout == 0 && timeout != 0;
+	if (enable) {
+		g_array_set_size(reap_heap, 0);
+		reaper_seed();
 	}
+	idle_timeout = timeout;
+	g_cond_signal(reap_cond);
+	g_static_mutex_unlock(&reap_mutex);
 
-	mbb_plock_reader_unlock();
-
-	mbb_thread_raise(sid);
+	return TRUE;
 }
 
 MBB_VAR_DEF(session_peer) {
@@ -395,6 +680,13 @@ MBB_VAR_DEF(ss_show_mtime_def) {
 	.cap_write = MBB_CAP_WHEEL
 };
 
+MBB_VAR_DEF(idle_timeout_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_idle_timeout,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
 MBB_SESSION_VAR_DEF(ss_show_mtime) {
 	.op_new = g_ptr_booldup,
 	.op_free = g_free,
@@ -410,6 +702,7 @@ static void init_vars(void)
 {
 	mbb_base_var_register(SS_("peer"), &session_peer, NULL);
 	mbb_base_var_register(SS_("user"), &session_user, NULL);
+	mbb_base_var_register("session.idle.timeout", &idle_timeout_def, &idle_timeout);
 
 	show_mtime_var = mbb_session_var_register(
 		SS_("session.show.mtime"), &ss_show_mtime_def, &ss_show_mtime
@@ -4,6 +4,7 @@
 #ifndef MBB_SESSION_H
 #define MBB_SESSION_H
 
+#include "signaller.h"
 #include "mbbuser.h"
 #include "mbbcap.h"
 
@@ -30,6 +31,9 @@ struct mbb_session {
 	gboolean killed;
 	gchar *kill_msg;
 
+	/* set by xml threads, raised to kill the session */
+	Signaller *signaller;
+
 	GHashTable *vars;
 	GHashTable *cached_vars;
 };
@@ -42,6 +46,7 @@ void mbb_session_touch(struct mbb_session *ss);
 
 gboolean mbb_session_has(gint sid);
 void mbb_session_quit(guint sid);
+void mbb_session_set_signaller(guint sid, Signaller *signaller);
 gboolean mbb_session_auth(struct mbb_session *ss, gchar *login, gchar *secret,
 			  gchar *type);
 
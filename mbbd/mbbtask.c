@@ -8,12 +8,16 @@
 #include "mbbtask.h"
 #include "mbbinit.h"
 #include "mbbfunc.h"
+#include "mbbdb.h"
 #include "mbblog.h"
+#include "mbbvar.h"
 #include "mbbxtv.h"
 
+#include "varconv.h"
 #include "xmltag.h"
 #include "macros.h"
 
+#include <string.h>
 #include <time.h>
 
 struct mbb_task {
@@ -22,6 +26,8 @@ struct mbb_task {
 
 	volatile gboolean cancel;
 	volatile gboolean run;
+	gboolean queued;
+	gint prio;
 
 	struct mbb_user *user;
 	time_t start;
@@ -30,6 +36,15 @@ struct mbb_task {
 	struct mbb_task_hook *hook;
 	gpointer data;
 
+	/* written by the task thread only, readers may see a stale value */
+	struct {
+		guint64 total;
+		guint64 done;
+		gdouble part;
+		guint64 records;
+		guint64 bytes;
+	} progress;
+
 	GMutex *mutex;
 	GCond *cond;
 
@@ -40,6 +55,19 @@ static guint task_id = 1;
 static GHashTable *ht = NULL;
 static GStaticPrivate task_key = G_STATIC_PRIVATE_INIT;
 
+/* tasks run on a pool of task_workers threads and a user may hold
+ * task_quota of them at once, the rest wait in the queue and go by
+ * priority, then in order of arrival. a stopped task holds its thread
+ * but not its slot, the pool grows while it waits so a queued task can
+ * run in its place */
+static guint task_workers = 4;
+static guint task_quota = 0;
+static guint nrunning = 0;
+static guint npaused = 0;
+static GHashTable *running = NULL;
+static GQueue pending = G_QUEUE_INIT;
+static GThreadPool *pool = NULL;
+
 gint mbb_task_get_id(void)
 {
 	struct mbb_task *task;
@@ -93,6 +121,8 @@ static struct mbb_task *mbb_task_new(GQuark name, struct mbb_task_hook *hook, gp
 	time(&task->start);
 	task->cancel = FALSE;
 	task->run = TRUE;
+	task->queued = FALSE;
+	task->prio = hook->prio;
 
 	task->sid = mbb_thread_get_tid();
 	if (task->sid >= 0)
@@ -104,6 +134,7 @@ static struct mbb_task *mbb_task_new(GQuark name, struct mbb_task_hook *hook, gp
 
 	task->hook = hook;
 	task->data = data;
+	memset(&task->progress, 0, sizeof(task->progress));
 
 	task->mutex = g_mutex_new();
 	task->cond = g_cond_new();
@@ -123,6 +154,120 @@ static struct mbb_task *mbb_task_new(GQuark name, struct mbb_task_hook *hook, gp
 	return task;
 }
 
+static void mbb_task_work(struct mbb_task *task, gpointer unused);
+
+/* the helpers below are called under the plock writer lock */
+static guint task_running(struct mbb_task *task)
+{
+	if (running == NULL)
+		return 0;
+
+	return GPOINTER_TO_UINT(
+		g_hash_table_lookup(running, GINT_TO_POINTER(task->user->id))
+	);
+}
+
+static void task_count(struct mbb_task *task, gint delta)
+{
+	guint count;
+
+	if (running == NULL)
+		running = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	nrunning += delta;
+	count = task_running(task) + delta;
+	if (count == 0)
+		g_hash_table_remove(running, GINT_TO_POINTER(task->user->id));
+	else {
+		g_hash_table_insert(running,
+			GINT_TO_POINTER(task->user->id), GUINT_TO_POINTER(count)
+		);
+	}
+}
+
+static gboolean task_may_run(struct mbb_task *task)
+{
+	if (task_quota == 0 || MBB_CAP_IS_ROOT(task->user->cap_mask))
+		return TRUE;
+
+	return task_running(task) < task_quota;
+}
+
+static inline gint pool_max_threads(void)
+{
+	return task_workers != 0 ? (gint) (task_workers + npaused) : -1;
+}
+
+static gboolean task_spawn(struct mbb_task *task)
+{
+	GError *error = NULL;
+
+	if (pool == NULL) {
+		pool = g_thread_pool_new((GFunc) mbb_task_work, NULL,
+			pool_max_threads(), FALSE, &error
+		);
+
+		if (pool == NULL) {
+			mbb_log("g_thread_pool_new failed: %s", error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+	}
+
+	time(&task->start);
+	task_count(task, 1);
+
+	/* the task stays in the pool queue and waits for a free thread */
+	g_thread_pool_push(pool, task, &error);
+	if (error != NULL) {
+		mbb_log("g_thread_pool_push: %s", error->message);
+		g_error_free(error);
+	}
+
+	return TRUE;
+}
+
+static GList *task_next(void)
+{
+	struct mbb_task *task, *best;
+	GList *list, *next;
+
+	next = NULL;
+	best = NULL;
+	for (list = pending.head; list != NULL; list = list->next) {
+		task = list->data;
+
+		if (! task_may_run(task))
+			continue;
+
+		if (best == NULL || task->prio > best->prio) {
+			best = task;
+			next = list;
+		}
+	}
+
+	return next;
+}
+
+static void task_dequeue(void)
+{
+	struct mbb_task *task;
+	GList *list;
+
+	while (task_workers == 0 || nrunning < task_workers) {
+		if ((list = task_next()) == NULL)
+			break;
+
+		/* keep it queued, the next finished task will try again */
+		task = list->data;
+		if (! task_spawn(task))
+			break;
+
+		task->queued = FALSE;
+		g_queue_delete_link(&pending, list);
+	}
+}
+
 static void mbb_task_free(struct mbb_task *task)
 {
 	mbb_plock_writer_lock();
@@ -130,6 +275,11 @@ static void mbb_task_free(struct mbb_task *task)
 	if (ht != NULL)
 		g_hash_table_remove(ht, GINT_TO_POINTER(task->id));
 
+	if (! task->queued) {
+		task_count(task, -1);
+		task_dequeue();
+	}
+
 	mbb_plock_writer_unlock();
 
 	mbb_module_unuse(task->mod);
@@ -148,12 +298,37 @@ static inline struct mbb_task *mbb_task_get(guint id)
 	return g_hash_table_lookup(ht, GINT_TO_POINTER(id));
 }
 
+static void task_park(struct mbb_task *task, gboolean park)
+{
+	mbb_plock_writer_lock();
+
+	if (park) {
+		npaused++;
+		task_count(task, -1);
+	} else {
+		npaused--;
+		task_count(task, 1);
+	}
+
+	if (pool != NULL)
+		g_thread_pool_set_max_threads(pool, pool_max_threads(), NULL);
+
+	if (park)
+		task_dequeue();
+
+	mbb_plock_writer_unlock();
+}
+
 static inline void mbb_task_pause(struct mbb_task *task)
 {
+	task_park(task, TRUE);
+
 	g_mutex_lock(task->mutex);
 	while (task->run == FALSE && task->cancel == FALSE)
 		g_cond_wait(task->cond, task->mutex);
 	g_mutex_unlock(task->mutex);
+
+	task_park(task, FALSE);
 }
 
 static inline void mbb_task_resume(struct mbb_task *task)
@@ -179,17 +354,14 @@ static gboolean task_poll(struct mbb_task *task)
 	return TRUE;
 }
 
-static gpointer mbb_task_work(struct mbb_task *task)
+static void task_run_hooks(struct mbb_task *task)
 {
 	struct mbb_task_hook *hook = task->hook;
 
-	g_static_private_set(&task_key, task, (GDestroyNotify) mbb_task_free);
-	mbb_log("started");
-
 	if (hook->init != NULL) {
 		if (! hook->init(task->data)) {
 			mbb_log("init failed");
-			return NULL;
+			return;
 		}
 	}
 
@@ -203,8 +375,25 @@ static gpointer mbb_task_work(struct mbb_task *task)
 
 	if (! task->cancel)
 		mbb_log("complete");
+}
+
+static void mbb_task_work(struct mbb_task *task, gpointer unused G_GNUC_UNUSED)
+{
+	g_static_private_set(&task_key, task, NULL);
+	mbb_log("started");
 
-	return NULL;
+	/* canceled while waiting for a pool thread */
+	if (task->cancel) {
+		mbb_log("canceled");
+		if (task->hook->fini != NULL)
+			task->hook->fini(task->data);
+	} else
+		task_run_hooks(task);
+
+	/* the worker goes back to the pool, the task is done with it */
+	mbb_db_put_conn();
+	g_static_private_set(&task_key, NULL, NULL);
+	mbb_task_free(task);
 }
 
 gboolean mbb_task_poll_state(void)
@@ -218,27 +407,91 @@ gboolean mbb_task_poll_state(void)
 	return task_poll(task);
 }
 
+void mbb_task_set_total(guint64 total)
+{
+	struct mbb_task *task;
+
+	task = g_static_private_get(&task_key);
+	if (task != NULL)
+		task->progress.total = total;
+}
+
+void mbb_task_set_done(guint64 done)
+{
+	struct mbb_task *task;
+
+	task = g_static_private_get(&task_key);
+	if (task != NULL) {
+		task->progress.done = done;
+		task->progress.part = 0;
+	}
+}
+
+/* position inside the unit being done, refines the eta */
+void mbb_task_set_part(guint64 cur, guint64 len)
+{
+	struct mbb_task *task;
+
+	task = g_static_private_get(&task_key);
+	if (task != NULL && len != 0)
+		task->progress.part = (gdouble) cur / len;
+}
+
+void mbb_task_add_records(guint64 records, guint64 bytes)
+{
+	struct mbb_task *task;
+
+	task = g_static_private_get(&task_key);
+	if (task != NULL) {
+		task->progress.records += records;
+		task->progress.bytes += bytes;
+	}
+}
+
+static void task_drop(struct mbb_task *task)
+{
+	if (task->hook->fini != NULL)
+		task->hook->fini(task->data);
+
+	mbb_task_free(task);
+}
+
 gint mbb_task_create(GQuark name, struct mbb_task_hook *hook, gpointer data)
 {
 	struct mbb_task *task;
-	GThread *thread;
+	gboolean ok = TRUE;
+	gint id;
 
 	if (hook->work == NULL)
 		return -1;
 
 	task = mbb_task_new(name, hook, data);
-	thread = g_thread_create((GThreadFunc) mbb_task_work, task, FALSE, NULL);
+	id = task->id;
 
-	if (thread == NULL) {
-		if (hook->fini != NULL)
-			hook->fini(data);
-		mbb_task_free(task);
+	mbb_plock_writer_lock();
 
-		mbb_log("g_thread_create failed");
+	task->queued = TRUE;
+	g_queue_push_tail(&pending, task);
+	task_dequeue();
+
+	if (task->queued) {
+		/* nothing runs, so nothing was in the way but the pool */
+		if (nrunning == 0) {
+			g_queue_remove(&pending, task);
+			g_hash_table_remove(ht, GINT_TO_POINTER(id));
+			ok = FALSE;
+		} else
+			mbb_log("task %d queued", id);
+	}
+
+	mbb_plock_writer_unlock();
+
+	if (! ok) {
+		task_drop(task);
 		return -1;
 	}
 
-	return task->id;
+	return id;
 }
 
 static void task_do_run(XmlTag *tag, XmlTag **ans, gboolean run)
@@ -292,14 +545,24 @@ static void task_cancel(XmlTag *tag, XmlTag **ans)
 
 	MBB_XTV_CALL(&id);
 
-	mbb_plock_reader_lock();
+	mbb_plock_writer_lock();
 
-	on_final { mbb_plock_reader_unlock(); }
+	on_final { mbb_plock_writer_unlock(); }
 
 	task = mbb_task_get(id);
 	if (task == NULL) final
 		*ans = mbb_xml_msg(MBB_MSG_UNKNOWN_TASK);
 
+	if (task->queued) {
+		g_queue_remove(&pending, task);
+		g_hash_table_remove(ht, GINT_TO_POINTER(id));
+		mbb_plock_writer_unlock();
+
+		mbb_log("task %d canceled", id);
+		task_drop(task);
+		return;
+	}
+
 	task->cancel = TRUE;
 	g_mutex_lock(task->mutex);
 	if (task->run == FALSE) {
@@ -308,7 +571,72 @@ static void task_cancel(XmlTag *tag, XmlTag **ans)
 	}
 	g_mutex_unlock(task->mutex);
 
-	mbb_plock_reader_unlock();
+	mbb_plock_writer_unlock();
+}
+
+static void task_prio(XmlTag *tag, XmlTag **ans)
+{
+	DEFINE_XTV(XTV_TASK_ID, XTV_TASK_PRIO);
+
+	struct mbb_task *task;
+	guint id;
+	gint prio;
+
+	MBB_XTV_CALL(&id, &prio);
+
+	mbb_plock_writer_lock();
+
+	task = mbb_task_get(id);
+	if (task == NULL)
+		*ans = mbb_xml_msg(MBB_MSG_UNKNOWN_TASK);
+	else
+		task->prio = prio;
+
+	mbb_plock_writer_unlock();
+}
+
+static inline Variant *variant_new_uint64(guint64 value)
+{
+	return variant_new_alloc_string(
+		g_strdup_printf("%" G_GUINT64_FORMAT, value)
+	);
+}
+
+static void gather_task_progress(struct mbb_task *task, XmlTag *tag)
+{
+	guint64 total, done, records;
+	gdouble frac;
+	time_t elapsed;
+
+	total = task->progress.total;
+	done = task->progress.done;
+	records = task->progress.records;
+
+	if (total == 0 && records == 0)
+		return;
+
+	elapsed = time(NULL) - task->start;
+
+	if (total != 0) {
+		xml_tag_set_attr(tag, "done", variant_new_uint64(done));
+		xml_tag_set_attr(tag, "total", variant_new_uint64(total));
+
+		frac = (done + task->progress.part) / total;
+		if (frac > 0 && frac <= 1) {
+			xml_tag_set_attr(tag, "eta",
+				variant_new_long(elapsed * (1 - frac) / frac)
+			);
+		}
+	}
+
+	xml_tag_set_attr(tag, "records", variant_new_uint64(records));
+	xml_tag_set_attr(tag, "bytes", variant_new_uint64(task->progress.bytes));
+
+	if (elapsed > 0) {
+		xml_tag_set_attr(tag, "rate",
+			variant_new_uint64(records / elapsed)
+		);
+	}
 }
 
 static void gather_task(gpointer key G_GNUC_UNUSED, gpointer value, gpointer data)
@@ -325,16 +653,22 @@ static void gather_task(gpointer key G_GNUC_UNUSED, gpointer value, gpointer dat
 	mbb_user_unlock(task->user);
 
 	name = (gchar *) g_quark_to_string(task->name);
-	state = task->run ? "run" : "stop";
+	if (task->queued)
+		state = "queued";
+	else
+		state = task->run ? "run" : "stop";
 
-	xml_tag_new_child(tag, "task",
+	tag = xml_tag_new_child(tag, "task",
 		"id", variant_new_int(task->id),
 		"name", variant_new_static_string(name),
 		"sid", variant_new_int(task->sid),
 		"state", variant_new_static_string(state),
+		"prio", variant_new_int(task->prio),
 		"start", variant_new_long(task->start),
 		"user", variant_new_alloc_string(username)
 	);
+
+	gather_task_progress(task, tag);
 }
 
 static void show_tasks(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
@@ -349,11 +683,64 @@ static void show_tasks(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
 	mbb_plock_reader_unlock();
 }
 
+static gboolean var_conv_task_quota(gchar *arg, gpointer p)
+{
+	if (! var_conv_uint(arg, p))
+		return FALSE;
+
+	/* a raised quota lets queued tasks go at once */
+	mbb_plock_writer_lock();
+	task_dequeue();
+	mbb_plock_writer_unlock();
+
+	return TRUE;
+}
+
+static gboolean var_conv_task_workers(gchar *arg, gpointer p)
+{
+	guint workers;
+
+	if (! var_conv_uint(arg, &workers))
+		return FALSE;
+
+	mbb_plock_writer_lock();
+
+	*(guint *) p = workers;
+	if (pool != NULL)
+		g_thread_pool_set_max_threads(pool, pool_max_threads(), NULL);
+	task_dequeue();
+
+	mbb_plock_writer_unlock();
+
+	return TRUE;
+}
+
+MBB_VAR_DEF(task_workers_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_task_workers,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
+MBB_VAR_DEF(task_quota_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_task_quota,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
 MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-task-run", task_run, MBB_CAP_WHEEL),
 	MBB_FUNC_STRUCT("mbb-task-stop", task_stop, MBB_CAP_WHEEL),
 	MBB_FUNC_STRUCT("mbb-task-cancel", task_cancel, MBB_CAP_WHEEL),
+	MBB_FUNC_STRUCT("mbb-task-prio", task_prio, MBB_CAP_WHEEL),
 	MBB_FUNC_STRUCT("mbb-show-tasks", show_tasks, MBB_CAP_ADMIN),
 MBB_INIT_FUNCTIONS_END
 
-MBB_ON_INIT(MBB_INIT_FUNCTIONS)
+static void init_vars(void)
+{
+	mbb_base_var_register("task.quota", &task_quota_def, &task_quota);
+	mbb_base_var_register("task.workers", &task_workers_def, &task_workers);
+}
+
+MBB_ON_INIT(MBB_INIT_VARS, MBB_INIT_FUNCTIONS)
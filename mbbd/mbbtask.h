@@ -13,6 +13,9 @@ struct mbb_task_hook {
 	gboolean (*init)(gpointer data);
 	void (*fini)(gpointer data);
 	gboolean (*work)(gpointer data);
+
+	/* queued tasks of higher priority start first */
+	gint prio;
 };
 
 gint mbb_task_create(GQuark name, struct mbb_task_hook *hook, gpointer data);
@@ -24,4 +27,9 @@ gchar *mbb_task_get_name(void);
 
 gboolean mbb_task_poll_state(void);
 
+void mbb_task_set_total(guint64 total);
+void mbb_task_set_done(guint64 done);
+void mbb_task_set_part(guint64 cur, guint64 len);
+void mbb_task_add_records(guint64 records, guint64 bytes);
+
 #endif
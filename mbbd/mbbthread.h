@@ -11,6 +11,7 @@
 #include "mbbcap.h"
 
 #include "xmlparser.h"
+#include "xmlpack.h"
 
 struct thread_env {
 	guint sid;
@@ -19,6 +20,8 @@ struct thread_env {
         int sock;
 
         XmlParser *parser;
+	/* set once the client switched to packed frames */
+	XmlUnpacker *unpacker;
 
 	MbbMsgQueue *msg_queue;
 	Signaller *signaller;
@@ -32,8 +35,6 @@ gint mbb_thread_get_tid(void);
 MbbMsgQueue *mbb_thread_get_msg_queue(void);
 Signaller *mbb_thread_get_signaller(void);
 
-void mbb_thread_raise(guint tid);
-
 void mbb_thread_update_cap(struct thread_env *te);
 
 void mbb_thread_http_client(struct thread_env *te);
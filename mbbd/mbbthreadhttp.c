@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <poll.h>
 
+#include "mbbfuncstat.h"
 #include "mbbxmlmsg.h"
+#include "mbbbatch.h"
 #include "mbbthread.h"
 #include "mbbuser.h"
 #include "mbbauth.h"
@@ -31,6 +33,9 @@
 
 #define JSON_PREFIX "json/"
 
+#define METRICS_PATH "metrics"
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+
 struct http_thread_env {
 	struct thread_env *te;
 	XmlTag *root_tag;
@@ -53,59 +58,76 @@ static struct mbb_var *ham_var = NULL;
 static gchar *http_url_prefix_get(gpointer p);
 static gboolean http_url_prefix_set(gchar *arg, gpointer p);
 
-static void add_std_headers(HttpResponse *resp, gchar *type)
+static void add_std_headers(HttpResponse *resp, gchar *ctype)
 {
-	gchar *ctype;
 	gchar *clen;
 
 	if (resp->body == NULL)
 		clen = "0";
 	else {
-		clen = g_strdup_printf("%" G_GSIZE_FORMAT, strlen(resp->body));
+		clen = g_strdup_printf("%" G_GSIZE_FORMAT, resp->body->len);
 		trash_push(&resp->trash, clen, NULL);
 	}
 
-	ctype = g_strdup_printf("application/%s; charset=utf-8", type);
-	trash_push(&resp->trash, ctype, NULL);
-
 	http_response_add_header(resp, "Server", "mbbd");
 	http_response_add_header(resp, "Content-Type", ctype);
 	http_response_add_header(resp, "Content-Length", clen);
 }
 
-static void push_http_response(struct http_thread_env *hte, HttpResponse *resp)
+static void push_http_response(struct http_thread_env *hte, HttpResponse *resp,
+			       gchar *ctype)
 {
-	gchar *msg;
+	GString *msg;
+
+	if (ctype == NULL) {
+		ctype = hte->json ? "application/json; charset=utf-8" :
+			"application/xml; charset=utf-8";
+	}
 
-	add_std_headers(resp, hte->json ? "json" : "xml");
+	add_std_headers(resp, ctype);
 
 	msg = http_response_to_string(resp);
 	http_response_free(resp);
 
-	write_all(hte->te->sock, msg, strlen(msg));
+	write_all(hte->te->sock, msg->str, msg->len);
 
-	mbb_log_lvl(MBB_LOG_HTTP, "send: %s", msg);
-	g_free(msg);
+	mbb_log_lvl(MBB_LOG_HTTP, "send: %s", msg->str);
+	g_string_free(msg, TRUE);
 }
 
-static void push_http_xml_msg(struct http_thread_env *hte, XmlTag *tag)
+static gsize push_http_xml_msg(struct http_thread_env *hte, XmlTag *tag)
 {
 	HttpResponse *resp;
+	gsize len;
 
 	resp = http_response_new(HTTP_STATUS_OK, NULL);
 
 	if (tag == NULL)
 		tag = mbb_xml_msg_ok();
 
-	if (hte->json)
-		resp->body = xml_tag_to_json(tag);
-	else
-		resp->body = xml_tag_to_string_escape(tag);
+	/* serialized once, straight into the buffer that is sent */
+	resp->body = g_string_new(NULL);
+	xml_tag_write(tag, hte->json ?
+		XML_TAG_FORMAT_JSON : XML_TAG_FORMAT_XML_ESCAPE, resp->body
+	);
 
 	xml_tag_free(tag);
-	trash_push(&resp->trash, resp->body, NULL);
 
-	push_http_response(hte, resp);
+	len = resp->body->len;
+	push_http_response(hte, resp, NULL);
+
+	return len;
+}
+
+static void push_http_metrics(struct http_thread_env *hte)
+{
+	HttpResponse *resp;
+
+	resp = http_response_new(HTTP_STATUS_OK, NULL);
+	resp->body = g_string_new(NULL);
+	mbb_func_stat_prometheus(resp->body);
+
+	push_http_response(hte, resp, METRICS_CONTENT_TYPE);
 }
 
 static gboolean parse_url(gchar *url, gboolean *json, gchar **method)
@@ -228,6 +250,15 @@ static void process_request(struct http_thread_env *hte)
 
 	method = hte->method;
 
+	if (method != NULL && ! hte->json && ! strcmp(method, METRICS_PATH)) {
+		if (! mbb_cap_check(mbb_thread_get_cap(), MBB_CAP_ADMIN))
+			push_http_msg(hte, MBB_MSG_UNAUTHORIZED);
+		else
+			push_http_metrics(hte);
+
+		return;
+	}
+
 	if (method != NULL) {
 		if (hte->root_tag == NULL)
 			hte->root_tag = xml_tag_newc("request");
@@ -236,9 +267,16 @@ static void process_request(struct http_thread_env *hte)
 			"name", variant_new_static_string(method)
 		);
 
-		if (mbb_func_call(method, hte->root_tag, &ans) == FALSE)
-			ans = mbb_xml_msg(MBB_MSG_UNKNOWN_METHOD, method);
-	} else {
+		if (mbb_func_call(method, hte->root_tag, &ans) == FALSE) {
+			push_http_msg(hte, MBB_MSG_UNKNOWN_METHOD, method);
+			return;
+		}
+
+		mbb_func_stat_bytes(method, push_http_xml_msg(hte, ans));
+	} else if (hte->root_tag != NULL &&
+		   ! strcmp(hte->root_tag->name, "batch"))
+		push_http_xml_msg(hte, mbb_batch_exec(hte->root_tag));
+	else {
 		Variant *var;
 		XmlTag *tag;
 		XmlTag *xt;
@@ -265,9 +303,8 @@ static void process_request(struct http_thread_env *hte)
 		}
 
 		xml_tag_reorder(xml_tag_get_child(ans, "response"));
+		push_http_xml_msg(hte, ans);
 	}
-
-	push_http_xml_msg(hte, ans);
 }
 
 static void process_http(struct http_thread_env *hte, HttpRequest *req)
@@ -390,7 +427,8 @@ static gboolean process_tag(XmlTag *tag, gpointer data)
 
 	hte = (struct http_thread_env *) data;
 
-	if (hte->root_tag == NULL && ! strcmp(tag->name, "request"))
+	if (hte->root_tag == NULL && (! strcmp(tag->name, "request") ||
+				      ! strcmp(tag->name, "batch")))
 		hte->root_tag = tag;
 	else
 		xml_tag_free(tag);
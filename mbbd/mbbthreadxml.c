@@ -6,8 +6,9 @@
 #include <errno.h>
 #include <poll.h>
 
+#include "mbbfuncstat.h"
 #include "mbbthread.h"
-#include "mbbplock.h"
+#include "mbbbatch.h"
 #include "mbbfunc.h"
 #include "mbbuser.h"
 #include "mbbauth.h"
@@ -17,23 +18,6 @@
 #include "macros.h"
 #include "debug.h"
 
-static GHashTable *ht = NULL;
-
-void mbb_thread_raise(guint tid)
-{
-	struct thread_env *te = NULL;
-
-	mbb_plock_reader_lock();
-
-	if (ht != NULL)
-		te = g_hash_table_lookup(ht, GINT_TO_POINTER(tid));
-
-	if (te != NULL)
-		signaller_raise(te->signaller);
-
-	mbb_plock_reader_unlock();
-}
-
 static void push_error_message(MbbMsgQueue *msg_queue, gchar *msg)
 {
 	gchar *output;
@@ -92,21 +76,80 @@ static void process_auth(struct thread_env *te, XmlTag *tag)
 	);
 }
 
-static void push_response(MbbMsgQueue *msg_queue, gchar *result, gchar *desc)
+/* the request id is echoed back, so clients may pipeline requests */
+static void push_response(MbbMsgQueue *msg_queue, gchar *id,
+			  gchar *result, gchar *desc)
 {
-	gchar *output;
+	GString *output;
+	gsize len;
 
-	if (desc == NULL)
-		output = g_strdup_printf("<response result='%s'/>", result);
-	else {
-		output = g_strdup_printf(
-			"<response result='%s' desc='%s'/>",
-			result, desc
-		);
+	output = g_string_new(NULL);
+	g_string_printf(output, "<response result='%s'", result);
+
+	if (desc != NULL)
+		g_string_append_printf(output, " desc='%s'", desc);
+
+	if (id != NULL) {
+		gchar *tmp = g_markup_escape_text(id, -1);
+		g_string_append_printf(output, " id='%s'", tmp);
+		g_free(tmp);
 	}
 
-	mbb_log_lvl(MBB_LOG_XML, "send: %s", output);
-	mbb_msg_queue_push_alloc(msg_queue, output, strlen(output));
+	g_string_append(output, "/>");
+
+	mbb_log_lvl(MBB_LOG_XML, "send: %s", output->str);
+
+	len = output->len;
+	mbb_msg_queue_push_alloc(msg_queue, g_string_free(output, FALSE), len);
+}
+
+static inline gchar *request_id(XmlTag *tag)
+{
+	Variant *var;
+
+	var = xml_tag_get_attr(tag, "id");
+
+	return var == NULL ? NULL : variant_get_string(var);
+}
+
+static void push_answer(struct thread_env *te, XmlTag *ans, gchar *func_name)
+{
+	GString *output;
+	gsize len;
+
+	output = g_string_new(NULL);
+
+	if (te->unpacker != NULL) {
+		if (mbb_log_lvl_enabled(MBB_LOG_XML)) {
+			gchar *str;
+
+			str = xml_tag_to_string(ans);
+			mbb_log_lvl(MBB_LOG_XML, "send: %s", str);
+			g_free(str);
+		}
+
+		xml_tag_pack(ans, output);
+		xml_tag_free(ans);
+
+		len = output->len;
+		if (func_name != NULL)
+			mbb_func_stat_bytes(func_name, len);
+		mbb_msg_queue_push_packed(te->msg_queue,
+			g_string_free(output, FALSE), len
+		);
+	} else {
+		xml_tag_write(ans, XML_TAG_FORMAT_XML_ESCAPE, output);
+		xml_tag_free(ans);
+
+		mbb_log_lvl(MBB_LOG_XML, "send: %s", output->str);
+
+		len = output->len;
+		if (func_name != NULL)
+			mbb_func_stat_bytes(func_name, len);
+		mbb_msg_queue_push_alloc(te->msg_queue,
+			g_string_free(output, FALSE), len
+		);
+	}
 }
 
 static void process_request(struct thread_env *te, XmlTag *tag)
@@ -114,27 +157,39 @@ static void process_request(struct thread_env *te, XmlTag *tag)
 	gchar *func_name;
 	Variant *var;
 	XmlTag *ans;
+	gchar *id;
+
+	id = request_id(tag);
 
 	var = xml_tag_get_attr(tag, "name");
 	if (var == NULL) final
-		push_response(te->msg_queue, "error", "bad format");
+		push_response(te->msg_queue, id, "error", "bad format");
 
 	func_name = variant_get_string(var);
 
 	if (mbb_func_call(func_name, tag, &ans) == FALSE) final
-		push_response(te->msg_queue, "error", "no such function");
+		push_response(te->msg_queue, id, "error", "no such function");
 
-	if (ans == NULL)
-		push_response(te->msg_queue, "ok", NULL);
-	else {
-		gchar *output;
+	if (ans == NULL) final
+		push_response(te->msg_queue, id, "ok", NULL);
 
-		output = xml_tag_to_string_escape(ans);
-		xml_tag_free(ans);
+	if (id != NULL)
+		xml_tag_set_attr(ans, "id", variant_new_string(id));
 
-		mbb_log_lvl(MBB_LOG_XML, "send: %s", output);
-		mbb_msg_queue_push_alloc(te->msg_queue, output, strlen(output));
-	}
+	push_answer(te, ans, func_name);
+}
+
+static void process_batch(struct thread_env *te, XmlTag *tag)
+{
+	XmlTag *ans;
+	gchar *id;
+
+	ans = mbb_batch_exec(tag);
+
+	if ((id = request_id(tag)) != NULL)
+		xml_tag_set_attr(ans, "id", variant_new_string(id));
+
+	push_answer(te, ans, NULL);
 }
 
 static gboolean process_xml(XmlTag *tag, gpointer data)
@@ -144,31 +199,78 @@ static gboolean process_xml(XmlTag *tag, gpointer data)
 
 	te = (struct thread_env *) data;
 
-	str = xml_tag_to_string(tag);
-	mbb_log_lvl(MBB_LOG_XML, "recv: %s", str);
-	g_free(str);
+	if (mbb_log_lvl_enabled(MBB_LOG_XML)) {
+		str = xml_tag_to_string(tag);
+		mbb_log_lvl(MBB_LOG_XML, "recv: %s", str);
+		g_free(str);
+	}
 
 	if (! strcmp(tag->name, "auth"))
 		process_auth(te, tag);
 	else if (! strcmp(tag->name, "request")) {
 		if (te->ss.user == NULL)
-			push_response(te->msg_queue, "error", "unauthorized");
+			push_response(te->msg_queue, request_id(tag),
+				"error", "unauthorized"
+			);
 		else
 			process_request(te, tag);
+	} else if (! strcmp(tag->name, "batch")) {
+		if (te->ss.user == NULL)
+			push_response(te->msg_queue, request_id(tag),
+				"error", "unauthorized"
+			);
+		else
+			process_batch(te, tag);
 	} else
-		push_response(te->msg_queue, "error", "unknown query");
+		push_response(te->msg_queue, NULL, "error", "unknown query");
 
 	return TRUE;
 }
 
+/* returns the number of bytes taken by the protocol magic */
+static gint xml_client_negotiate(struct thread_env *te, gchar *buf, gint n,
+				 gchar *magic, guint *nmagic)
+{
+	gint off;
+
+	if (*nmagic == 0 && *buf != '\0') {
+		*nmagic = XML_PACK_MAGIC_LEN;
+		return 0;
+	}
+
+	for (off = 0; off < n && *nmagic < XML_PACK_MAGIC_LEN; off++)
+		magic[(*nmagic)++] = buf[off];
+
+	if (*nmagic < XML_PACK_MAGIC_LEN)
+		return off;
+
+	if (memcmp(magic, XML_PACK_MAGIC, XML_PACK_MAGIC_LEN))
+		return -1;
+
+	/* the answer goes out unframed */
+	mbb_msg_queue_push_const(
+		te->msg_queue, XML_PACK_MAGIC, XML_PACK_MAGIC_LEN
+	);
+	mbb_msg_queue_set_framed(te->msg_queue, TRUE);
+
+	te->unpacker = xml_unpacker_new(process_xml, te);
+
+	return off;
+}
+
 static void xml_client_loop(struct thread_env *te)
 {
+	gchar magic[XML_PACK_MAGIC_LEN];
 	GError *error = NULL;
 	gboolean send_only;
 	struct pollfd pfd;
 	char buf[2048];
+	guint nmagic;
+	gboolean ok;
+	gint off;
 	int n;
 
+	nmagic = 0;
 	send_only = FALSE;
 	pfd.fd = te->sock;
 
@@ -209,7 +311,33 @@ static void xml_client_loop(struct thread_env *te)
 			} else if (n == 0)
 				break;
 
-			if (! xml_parser_parse(te->parser, buf, n, &error)) {
+			off = 0;
+			if (nmagic < XML_PACK_MAGIC_LEN) {
+				off = xml_client_negotiate(
+					te, buf, n, magic, &nmagic
+				);
+
+				if (off < 0) {
+					push_error_message(
+						te->msg_queue, "unknown protocol"
+					);
+
+					send_only = TRUE;
+					continue;
+				}
+
+				if (off == n)
+					continue;
+			}
+
+			if (te->unpacker != NULL) {
+				ok = xml_unpacker_feed(
+					te->unpacker, buf + off, n - off, &error
+				);
+			} else
+				ok = xml_parser_parse(te->parser, buf, n, &error);
+
+			if (! ok) {
 				mbb_log("xml_parser: %s", error->message);
 				g_error_free(error);
 
@@ -247,17 +375,9 @@ void mbb_thread_xml_client(struct thread_env *te)
 	te->signaller = signaller_new(SIGUSR1);
 	signaller_block(te->signaller);
 
-	mbb_plock_writer_lock();
-	if (ht == NULL)
-		ht = g_hash_table_new(g_direct_hash, g_direct_equal);
-	g_hash_table_insert(ht, GINT_TO_POINTER(te->sid), te);
-	mbb_plock_writer_unlock();
-
+	mbb_session_set_signaller(te->sid, te->signaller);
 	xml_client_loop(te);
-
-	mbb_plock_writer_lock();
-	g_hash_table_remove(ht, GINT_TO_POINTER(te->sid));
-	mbb_plock_writer_unlock();
+	mbb_session_set_signaller(te->sid, NULL);
 
 	mbb_log_unregister();
 
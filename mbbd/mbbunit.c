@@ -397,34 +397,43 @@ static gboolean unit_map_add_inet(struct map *map, MbbInetPoolEntry *entry,
 	return ! cross->found;
 }
 
-gboolean mbb_unit_map_rebuild(struct mbb_unit *unit, MbbInetPoolEntry *pp[2])
+gboolean mbb_unit_map_build(struct mbb_unit *unit, struct map *map,
+			    MbbInetPoolEntry *pp[2])
 {
 	MbbInetPoolEntry *entry;
 	struct map_cross cross;
-	struct map map;
 	GList *list;
 
-	if (separator_count(&unit->sep) == 0) {
-		map_clear(&unit->map);
+	map_init(map, NULL);
+
+	if (separator_count(&unit->sep) == 0)
 		return TRUE;
-	}
 
-	map_init(&map, NULL);
-	time_map_init(&map);
+	time_map_init(map);
 	for (list = unit->sep.queue.head; list != NULL; list = list->next) {
 		entry = (MbbInetPoolEntry *) list->data;
 
-		if (unit_map_add_inet(&map, entry, &cross) == FALSE) {
+		if (unit_map_add_inet(map, entry, &cross) == FALSE) {
 			if (pp != NULL) {
 				pp[0] = cross.data;
 				pp[1] = entry;
 			}
 
-			map_clear(&map);
+			map_clear(map);
 			return FALSE;
 		}
 	}
 
+	return TRUE;
+}
+
+gboolean mbb_unit_map_rebuild(struct mbb_unit *unit, MbbInetPoolEntry *pp[2])
+{
+	struct map map;
+
+	if (mbb_unit_map_build(unit, &map, pp) == FALSE)
+		return FALSE;
+
 	map_move(&unit->map, &map);
 	return TRUE;
 }
@@ -74,6 +74,8 @@ void mbb_unit_del_inet(struct mbb_unit *unit, MbbInetPoolEntry *entry);
 void mbb_unit_clear_inet(struct mbb_unit *unit);
 void mbb_unit_sep_reorder(MbbInetPoolEntry *entry);
 
+gboolean mbb_unit_map_build(struct mbb_unit *unit, struct map *map,
+			    MbbInetPoolEntry *pp[2]);
 gboolean mbb_unit_map_rebuild(struct mbb_unit *unit, MbbInetPoolEntry *pp[2]);
 gboolean mbb_unit_mapped(struct mbb_unit *unit);
 
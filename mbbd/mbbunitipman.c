@@ -145,6 +145,129 @@ static void unit_add_inet(XmlTag *tag, XmlTag **ans)
 	mbb_lock_writer_unlock();
 }
 
+static XmlTag *inet_entry_attr(XmlTag *xt, gchar *name,
+			       gboolean (*conv)(gchar *, gpointer), gpointer p)
+{
+	Variant *var;
+	gchar *arg;
+
+	if ((var = xml_tag_get_attr(xt, name)) == NULL)
+		return NULL;
+
+	arg = variant_get_string(var);
+	if (! conv(arg, p))
+		return mbb_xml_msg(MBB_MSG_XTV_INVALID, "inet_entry", name, arg);
+
+	return NULL;
+}
+
+static XmlTag *add_inets_parse_one(XmlTag *xt, MbbInetPoolEntry *entry)
+{
+	gboolean exclusive;
+	MbbUnit *unit;
+	Variant *var;
+	XmlTag *msg;
+	gchar *name;
+
+	if ((var = xml_tag_get_attr(xt, "unit")) == NULL)
+		return mbb_xml_msg(MBB_MSG_XTV_MISSED, "inet_entry", "unit");
+
+	name = variant_get_string(var);
+	if ((unit = mbb_unit_get_by_name(name)) == NULL)
+		return mbb_xml_msg(MBB_MSG_UNKNOWN_UNIT);
+
+	if (xml_tag_get_attr(xt, "inet") == NULL)
+		return mbb_xml_msg(MBB_MSG_XTV_MISSED, "inet_entry", "inet");
+
+	mbb_inet_pool_entry_init(entry);
+	exclusive = FALSE;
+	entry->nice = 0;
+	entry->start = MBB_TIME_UNSET;
+	entry->end = MBB_TIME_PARENT;
+
+	if ((msg = inet_entry_attr(xt, "inet", var_conv_inet, &entry->inet)) ||
+	    (msg = inet_entry_attr(xt, "exclusive", var_conv_bool, &exclusive)) ||
+	    (msg = inet_entry_attr(xt, "nice", var_conv_uint, &entry->nice)) ||
+	    (msg = inet_entry_attr(xt, "start", var_conv_etime, &entry->start)) ||
+	    (msg = inet_entry_attr(xt, "end", var_conv_etime, &entry->end)))
+		return msg;
+
+	entry->flag = ! exclusive;
+	entry->owner = &unit->self;
+
+	/* the same defaults as mbb-unit-add-inet without inherit */
+	if (entry->start == MBB_TIME_UNSET) {
+		if (mbb_unit_get_end(unit) != 0)
+			return mbb_xml_msg(MBB_MSG_UNIT_FREEZED, name);
+
+		time(&entry->start);
+	}
+
+	return mbb_time_test_order(entry->start, entry->end,
+		mbb_unit_get_start(unit), mbb_unit_get_end(unit)
+	);
+}
+
+static void gather_unit_name(MbbUnit *unit, gpointer value G_GNUC_UNUSED,
+			     XmlTag *tag)
+{
+	xml_tag_new_child(tag, "unit", "name", variant_new_string(unit->name));
+}
+
+/* the units touched are listed back, their maps are to be synced once */
+static void unit_add_inets(XmlTag *tag, XmlTag **ans)
+{
+	MbbInetPoolEntry *entry;
+	GError *error = NULL;
+	GHashTable *units;
+	GPtrArray *entries;
+	XmlTag *xt;
+	guint n;
+
+	xt = xml_tag_get_child(tag, "inet_entry");
+	xml_tag_reorder(xt);
+
+	entries = g_ptr_array_new();
+
+	mbb_lock_writer_lock();
+
+	on_final {
+		mbb_lock_writer_unlock();
+		g_ptr_array_foreach(entries, (GFunc) g_free, NULL);
+		g_ptr_array_free(entries, TRUE);
+	}
+
+	for (; xt != NULL; xt = xt->next) {
+		entry = g_new(MbbInetPoolEntry, 1);
+		g_ptr_array_add(entries, entry);
+
+		if ((*ans = add_inets_parse_one(xt, entry)) != NULL)
+			final;
+	}
+
+	if (! mbb_db_inet_pool_add_list((MbbInetPoolEntry **) entries->pdata,
+					entries->len, &error)) final
+		*ans = mbb_xml_msg_from_error(error);
+
+	units = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (n = 0; n < entries->len; n++) {
+		entry = g_ptr_array_index(entries, n);
+
+		mbb_unit_add_inet(entry->owner->ptr, entry);
+		g_hash_table_insert(units, entry->owner->ptr, NULL);
+	}
+
+	*ans = mbb_xml_msg_ok();
+	g_hash_table_foreach(units, (GHFunc) gather_unit_name, *ans);
+	g_hash_table_destroy(units);
+
+	mbb_lock_writer_unlock();
+
+	mbb_log_debug("add %u inet entries", entries->len);
+	g_ptr_array_free(entries, TRUE);
+}
+
 static void drop_inet(XmlTag *tag, XmlTag **ans)
 {
 	DEFINE_XTV(XTV_INET_ID);
@@ -453,10 +576,11 @@ MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-unit-show-raw-inet", unit_show_raw_inet, MBB_CAP_ADMIN),
 
 	MBB_FUNC_STRUCT("mbb-unit-add-inet", unit_add_inet, MBB_CAP_ADMIN),
+	MBB_FUNC_STRUCT("mbb-unit-add-inets", unit_add_inets, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-unit-drop-inet", drop_inet, MBB_CAP_WHEEL),
 	MBB_FUNC_STRUCT("mbb-unit-clear-inet", unit_clear_inet, MBB_CAP_WHEEL),
 
-	MBB_FUNC_STRUCT("mbb-unit-mod-inet-time", unit_mod_inet_time, MBB_CAP_ADMIN),
+	MBB_FUNC_BATCH("mbb-unit-mod-inet-time", unit_mod_inet_time, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-unit-mod-inet-nice", unit_mod_inet_nice, MBB_CAP_ADMIN),
 
 	MBB_FUNC_STRUCT("mbb-unit-map-showall", unit_map_showall, MBB_CAP_ADMIN),
@@ -185,13 +185,10 @@ static void unit_show_self(XmlTag *tag, XmlTag **ans)
 	mbb_lock_reader_unlock();
 }
 
-static gboolean unit_create(gchar *name, MbbConsumer *con, gboolean inherit,
-			    GError **error)
+static MbbUnit *unit_prepare(gchar *name, MbbConsumer *con, gboolean inherit)
 {
 	time_t start, end;
 	MbbUnit *unit;
-	gint con_id;
-	gint id;
 
 	if (inherit && con != NULL)
 		start = -1;
@@ -203,22 +200,40 @@ static gboolean unit_create(gchar *name, MbbConsumer *con, gboolean inherit,
 	else
 		end = 0;
 
-	con_id = con == NULL ? -1 : con->id;
-	if ((id = mbb_db_unit_add(name, con_id, start, end, error)) < 0)
-		return FALSE;
+	unit = mbb_unit_new(-1, name, start, end);
+	unit->con = con;
 
-	unit = mbb_unit_new(id, name, start, end);
+	return unit;
+}
 
-	if (con != NULL) {
-		unit->con = con;
-		mbb_consumer_add_unit(con, unit);
-	}
+static void unit_attach(MbbUnit *unit)
+{
+	if (unit->con != NULL)
+		mbb_consumer_add_unit(unit->con, unit);
 
 	mbb_unit_join(unit);
+}
+
+static gboolean unit_create(gchar *name, MbbConsumer *con, gboolean inherit,
+			    GError **error)
+{
+	MbbUnit *unit;
+	gint con_id;
+
+	unit = unit_prepare(name, con, inherit);
+
+	con_id = con == NULL ? -1 : con->id;
+	unit->id = mbb_db_unit_add(name, con_id, unit->start, unit->end, error);
+	if (unit->id < 0) {
+		mbb_unit_unref(unit);
+		return FALSE;
+	}
+
+	unit_attach(unit);
 
 	return TRUE;
 }
-	
+
 static void add_unit(XmlTag *tag, XmlTag **ans)
 {
 	DEFINE_XTV(XTV_NAME_VALUE);
@@ -474,6 +489,99 @@ static void consumer_add_unit(XmlTag *tag, XmlTag **ans)
 	mbb_log_debug("consumer '%s' add unit '%s'", con_name, unit_name);
 }
 
+/* everything is checked before the first insert, so the list goes in
+ * whole or not at all */
+static XmlTag *add_units_parse(XmlTag *tag, GPtrArray *units)
+{
+	GHashTable *names;
+	gboolean inherit;
+	MbbConsumer *con;
+	XmlTag *xt, *msg;
+	Variant *var;
+	gchar *name;
+
+	xt = xml_tag_get_child(tag, "unit");
+	xml_tag_reorder(xt);
+
+	names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (msg = NULL; msg == NULL && xt != NULL; xt = xt->next) {
+		if ((var = xml_tag_get_attr(xt, "name")) == NULL) {
+			msg = mbb_xml_msg(MBB_MSG_XTV_MISSED, "unit", "name");
+			break;
+		}
+
+		name = variant_get_string(var);
+		if (mbb_unit_get_by_name(name) != NULL ||
+		    g_hash_table_lookup(names, name) != NULL) {
+			msg = mbb_xml_msg(MBB_MSG_NAME_EXISTS, name);
+			break;
+		}
+
+		con = NULL;
+		if ((var = xml_tag_get_attr(xt, "consumer")) != NULL) {
+			con = mbb_consumer_get_by_name(variant_get_string(var));
+			if (con == NULL) {
+				msg = mbb_xml_msg(MBB_MSG_UNKNOWN_CONSUMER);
+				break;
+			}
+		}
+
+		inherit = FALSE;
+		if ((var = xml_tag_get_attr(xt, "inherit")) != NULL &&
+		    ! var_conv_bool(variant_get_string(var), &inherit)) {
+			msg = mbb_xml_msg(MBB_MSG_XTV_INVALID,
+				"unit", "inherit", variant_get_string(var)
+			);
+			break;
+		}
+
+		if (con != NULL && inherit == FALSE && con->end != 0) {
+			msg = mbb_xml_msg(MBB_MSG_CONSUMER_FREEZED, con->name);
+			break;
+		}
+
+		g_hash_table_insert(names, name, name);
+		g_ptr_array_add(units, unit_prepare(name, con, inherit));
+	}
+
+	g_hash_table_destroy(names);
+
+	return msg;
+}
+
+static void add_units(XmlTag *tag, XmlTag **ans)
+{
+	GError *error = NULL;
+	GPtrArray *units;
+	guint n;
+
+	units = g_ptr_array_new();
+
+	mbb_lock_writer_lock();
+
+	on_final {
+		mbb_lock_writer_unlock();
+		g_ptr_array_foreach(units, (GFunc) mbb_unit_unref, NULL);
+		g_ptr_array_free(units, TRUE);
+	}
+
+	if ((*ans = add_units_parse(tag, units)) != NULL)
+		final;
+
+	if (! mbb_db_unit_add_list((MbbUnit **) units->pdata, units->len,
+				   &error)) final
+		*ans = mbb_xml_msg_from_error(error);
+
+	for (n = 0; n < units->len; n++)
+		unit_attach(g_ptr_array_index(units, n));
+
+	mbb_lock_writer_unlock();
+
+	mbb_log_debug("add %u units", units->len);
+	g_ptr_array_free(units, TRUE);
+}
+
 static void gather_mapped_unit(MbbUnit *unit, struct ans_data *ad)
 {
 	if (mbb_unit_mapped(unit))
@@ -566,14 +674,15 @@ static void unit_local_del(XmlTag *tag, XmlTag **ans)
 }
 
 MBB_INIT_FUNCTIONS_DO
-	MBB_FUNC_STRUCT("mbb-show-units", show_units, MBB_CAP_ADMIN),
+	MBB_FUNC_CACHED("mbb-show-units", show_units, MBB_CAP_ADMIN, 60),
 	MBB_FUNC_STRUCT("mbb-unit-show-self", unit_show_self, MBB_CAP_ADMIN),
 
 	MBB_FUNC_STRUCT("mbb-add-unit", add_unit, MBB_CAP_ADMIN),
+	MBB_FUNC_STRUCT("mbb-add-units", add_units, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-drop-unit", drop_unit, MBB_CAP_WHEEL),
 
 	MBB_FUNC_STRUCT("mbb-unit-mod-name", unit_mod_name, MBB_CAP_ADMIN),
-	MBB_FUNC_STRUCT("mbb-unit-mod-time", unit_mod_time, MBB_CAP_ADMIN),
+	MBB_FUNC_BATCH("mbb-unit-mod-time", unit_mod_time, MBB_CAP_ADMIN),
 
 	MBB_FUNC_STRUCT("mbb-unit-set-consumer", unit_set_consumer, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-unit-unset-consumer", unit_unset_consumer, MBB_CAP_ADMIN),
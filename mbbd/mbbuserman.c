@@ -4,6 +4,7 @@
 #include "mbbxmlmsg.h"
 #include "mbbthread.h"
 #include "mbbdbuser.h"
+#include "mbbauth.h"
 #include "mbbgroup.h"
 #include "mbbuser.h"
 #include "mbbinit.h"
@@ -156,6 +157,7 @@ static void drop_user(XmlTag *tag, XmlTag **ans)
 		*ans = mbb_xml_msg_from_error(error);
 
 	mbb_user_remove(user);
+	mbb_auth_cache_invalidate();
 	mbb_lock_writer_unlock();
 
 	mbb_log_debug("drop user '%s'", name);
@@ -190,6 +192,7 @@ static void user_mod_name(XmlTag *tag, XmlTag **ans)
 	if (! mbb_user_mod_name(user, newname)) final
 		*ans = mbb_xml_msg(MBB_MSG_UNPOSSIBLE);
 
+	mbb_auth_cache_invalidate();
 	mbb_lock_writer_unlock();
 
 	mbb_log_debug("user '%s' mod name '%s'", name, newname);
@@ -204,6 +207,7 @@ static inline gboolean change_pass(MbbUser *user, gchar *pass, GError **error)
 		return FALSE;
 
 	mbb_user_mod_pass(user, pass);
+	mbb_auth_cache_invalidate();
 
 	return TRUE;
 }
@@ -278,7 +282,7 @@ MBB_INIT_FUNCTIONS_DO
 
 	MBB_FUNC_STRUCT("mbb-add-user", add_user, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-user-mod-name", user_mod_name, MBB_CAP_ADMIN),
-	MBB_FUNC_STRUCT("mbb-user-mod-pass", user_mod_pass, MBB_CAP_ADMIN),
+	MBB_FUNC_BATCH("mbb-user-mod-pass", user_mod_pass, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-self-mod-pass", self_mod_pass, MBB_CAP_ALL),
 
 	MBB_FUNC_STRUCT("mbb-drop-user", drop_user, MBB_CAP_WHEEL),
@@ -767,7 +767,7 @@ static void show_cached(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
 MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-var-list", var_list, MBB_CAP_ALL),
 	MBB_FUNC_STRUCT("mbb-var-show", var_show, MBB_CAP_ALL),
-	MBB_FUNC_STRUCT("mbb-var-set", var_set, MBB_CAP_ALL),
+	MBB_FUNC_BATCH("mbb-var-set", var_set, MBB_CAP_ALL),
 	MBB_FUNC_STRUCT("mbb-show-vars", show_vars, MBB_CAP_ALL),
 
 	MBB_FUNC_STRUCT("mbb-var-cache-add", var_cache_add, MBB_CAP_WHEEL),
@@ -58,7 +58,9 @@ static gchar *msg_table[] = {
 	[MBB_MSG_TASK_CREATE_FAILED] = "failed to create task",
 	[MBB_MSG_TIME_NOPARENT] = "parent time not allowed",
 	[MBB_MSG_ROOT_ONLY] = "only root can do this",
-	[MBB_MSG_UNKNOWN_SESSION] = "unknown session"
+	[MBB_MSG_UNKNOWN_SESSION] = "unknown session",
+	[MBB_MSG_RATE_LIMIT] = "call rate limit exceeded",
+	[MBB_MSG_CALL_LIMIT] = "too many calls in progress"
 };
 
 static XmlTag *responsev(gchar *result, gchar *fmt, va_list ap)
@@ -98,8 +100,11 @@ static XmlTag *mbb_xml_msg_response(gchar *result, gchar *fmt, ...)
 	return tag;
 }
 
+/* the answer of a method call, its tree goes to an arena */
 XmlTag *mbb_xml_msg_ok(void)
 {
+	xml_tag_scope_root();
+
 	return mbb_xml_msg_response("ok", NULL);
 }
 
@@ -56,7 +56,9 @@ typedef enum {
 	MBB_MSG_TASK_CREATE_FAILED,
 	MBB_MSG_TIME_NOPARENT,
 	MBB_MSG_ROOT_ONLY,
-	MBB_MSG_UNKNOWN_SESSION
+	MBB_MSG_UNKNOWN_SESSION,
+	MBB_MSG_RATE_LIMIT,
+	MBB_MSG_CALL_LIMIT
 } mbb_msg_t;
 
 XmlTag *mbb_xml_msg_ok(void);
@@ -69,6 +69,7 @@ DEFINE_XTV_ENTRY(gw_name, "gateway", "name", null);
 DEFINE_XTV_ENTRY(link_value, "link", "value", uint);
 DEFINE_XTV_ENTRY(module_name, "module", "name", null);
 DEFINE_XTV_ENTRY(task_id, "task", "id", uint);
+DEFINE_XTV_ENTRY(task_prio, "task", "prio", int);
 DEFINE_XTV_ENTRY(net_value, "net", "value", inet);
 DEFINE_XTV_ENTRY(attr_group, "attr", "group", null);
 DEFINE_XTV_ENTRY(attr_name, "attr", "name", null);
@@ -76,4 +77,10 @@ DEFINE_XTV_ENTRY(attr_value, "attr", "value", null);
 DEFINE_XTV_ENTRY(key_value, "key", "value", null);
 DEFINE_XTV_ENTRY(obj_name, "obj", "name", null);
 DEFINE_XTV_ENTRY(session_sid, "session", "sid", uint);
+DEFINE_XTV_ENTRY(binary_value, "binary", "value", bool);
+DEFINE_XTV_ENTRY(limit_scope, "limit", "scope", null);
+DEFINE_XTV_ENTRY(limit_name, "limit", "name", null);
+DEFINE_XTV_ENTRY(limit_rate, "limit", "rate", uint);
+DEFINE_XTV_ENTRY(limit_burst, "limit", "burst", uint);
+DEFINE_XTV_ENTRY(limit_calls, "limit", "calls", uint);
 
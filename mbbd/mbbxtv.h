@@ -69,6 +69,7 @@ XmlTag *mbb_xtv_call_z(XmlTag *tag, XmlTagVar **xtv, ...);
 #define XTV_LINK_VALUE &xtv_link_value, XTV_FALSE
 #define XTV_MODULE_NAME &xtv_module_name, XTV_FALSE
 #define XTV_TASK_ID &xtv_task_id, XTV_FALSE
+#define XTV_TASK_PRIO &xtv_task_prio, XTV_FALSE
 #define XTV_NET_VALUE &xtv_net_value, XTV_FALSE
 #define XTV_ATTR_GROUP &xtv_attr_group, XTV_FALSE
 #define XTV_ATTR_NAME &xtv_attr_name, XTV_FALSE
@@ -77,6 +78,12 @@ XmlTag *mbb_xtv_call_z(XmlTag *tag, XmlTagVar **xtv, ...);
 #define XTV_OBJ_NAME &xtv_obj_name, XTV_FALSE
 #define XTV_SESSION_SID &xtv_session_sid, XTV_FALSE
 #define XTV_SESSION_SID_ &xtv_session_sid, XTV_TRUE
+#define XTV_BINARY_VALUE_ &xtv_binary_value, XTV_TRUE
+#define XTV_LIMIT_SCOPE &xtv_limit_scope, XTV_FALSE
+#define XTV_LIMIT_NAME &xtv_limit_name, XTV_FALSE
+#define XTV_LIMIT_RATE_ &xtv_limit_rate, XTV_TRUE
+#define XTV_LIMIT_BURST_ &xtv_limit_burst, XTV_TRUE
+#define XTV_LIMIT_CALLS_ &xtv_limit_calls, XTV_TRUE
 
 DEFINE_EXTERN(regex_value);
 DEFINE_EXTERN(name_value);
@@ -113,6 +120,7 @@ DEFINE_EXTERN(gw_name);
 DEFINE_EXTERN(link_value);
 DEFINE_EXTERN(module_name);
 DEFINE_EXTERN(task_id);
+DEFINE_EXTERN(task_prio);
 DEFINE_EXTERN(net_value);
 DEFINE_EXTERN(attr_group);
 DEFINE_EXTERN(attr_name);
@@ -120,5 +128,11 @@ DEFINE_EXTERN(attr_value);
 DEFINE_EXTERN(key_value);
 DEFINE_EXTERN(obj_name);
 DEFINE_EXTERN(session_sid);
+DEFINE_EXTERN(binary_value);
+DEFINE_EXTERN(limit_scope);
+DEFINE_EXTERN(limit_name);
+DEFINE_EXTERN(limit_rate);
+DEFINE_EXTERN(limit_burst);
+DEFINE_EXTERN(limit_calls);
 
 #endif
@@ -0,0 +1,577 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+/* attribute values are cached per (group, object) with all values of the
+ * group loaded at once, so a missing value in an entry means no value */
+
+#include "attrcache.h"
+
+#include "mbbmodule.h"
+#include "mbblog.h"
+#include "mbbvar.h"
+#include "mbbdb.h"
+
+#include "varconv.h"
+#include "query.h"
+
+#define ATTR_GET_QUERY "select * from attr_get($1, $2);"
+#define ATTR_INDEX_QUERY \
+	"select obj_id, attr_value from attribute_pool where attr_id = $1;"
+
+struct cache_obj {
+	struct attr_group *ag;
+	gint obj;
+
+	GHashTable *values;
+	GList *link;
+};
+
+/* equality index of one attr, keys are casefolded like ~* compares */
+struct attr_index {
+	GHashTable *objs;
+	GHashTable *keys;
+};
+
+static GHashTable *ht_obj = NULL;
+static GHashTable *ht_index = NULL;
+static GQueue lru = G_QUEUE_INIT;
+
+static GStaticMutex cache_mutex = G_STATIC_MUTEX_INIT;
+
+/* bumped by every write, a load that raced with one is not stored */
+static guint cache_version = 0;
+
+static guint cache_size = 4096;
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+
+static guint cache_obj_hash(struct cache_obj *co)
+{
+	return GPOINTER_TO_UINT(co->ag) ^ (guint) co->obj;
+}
+
+static gboolean cache_obj_equal(struct cache_obj *ca, struct cache_obj *cb)
+{
+	return ca->ag == cb->ag && ca->obj == cb->obj;
+}
+
+static struct cache_obj *cache_obj_new(struct attr_group *ag, gint obj)
+{
+	struct cache_obj *co;
+
+	co = g_new(struct cache_obj, 1);
+	co->ag = ag;
+	co->obj = obj;
+	co->values = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, g_free
+	);
+	co->link = NULL;
+
+	return co;
+}
+
+static void cache_obj_free(struct cache_obj *co)
+{
+	g_hash_table_destroy(co->values);
+	g_free(co);
+}
+
+static inline void ht_obj_init(void)
+{
+	ht_obj = g_hash_table_new_full(
+		(GHashFunc) cache_obj_hash, (GEqualFunc) cache_obj_equal,
+		NULL, (GDestroyNotify) cache_obj_free
+	);
+}
+
+static void cache_obj_remove(struct cache_obj *co)
+{
+	g_queue_delete_link(&lru, co->link);
+	g_hash_table_remove(ht_obj, co);
+}
+
+static void cache_trim(guint size)
+{
+	while (lru.length > size)
+		cache_obj_remove(g_queue_peek_tail(&lru));
+}
+
+static struct cache_obj *cache_obj_get(struct attr_group *ag, gint obj)
+{
+	struct cache_obj key, *co;
+
+	if (ht_obj == NULL)
+		return NULL;
+
+	key.ag = ag;
+	key.obj = obj;
+
+	if ((co = g_hash_table_lookup(ht_obj, &key)) != NULL) {
+		g_queue_unlink(&lru, co->link);
+		g_queue_push_head_link(&lru, co->link);
+	}
+
+	return co;
+}
+
+static gboolean cache_obj_insert(struct cache_obj *co)
+{
+	struct cache_obj *old;
+
+	if (cache_size == 0)
+		return FALSE;
+
+	if (ht_obj == NULL)
+		ht_obj_init();
+	else if ((old = g_hash_table_lookup(ht_obj, co)) != NULL)
+		cache_obj_remove(old);
+
+	g_queue_push_head(&lru, co);
+	co->link = lru.head;
+	g_hash_table_insert(ht_obj, co, co);
+
+	cache_trim(cache_size);
+
+	return TRUE;
+}
+
+static gint cache_obj_fill(struct cache_obj *co, struct attr **attrs,
+			   gchar **values, gsize cnt)
+{
+	gint nelem = 0;
+	gsize n;
+
+	for (n = 0; n < cnt; n++) {
+		values[n] = g_hash_table_lookup(
+			co->values, GINT_TO_POINTER(attrs[n]->id)
+		);
+
+		if (values[n] != NULL) {
+			values[n] = g_strdup(values[n]);
+			nelem++;
+		}
+	}
+
+	return nelem;
+}
+
+static struct cache_obj *db_cache_obj_load(struct attr_group *ag, gint obj,
+					   GError **error)
+{
+	struct cache_obj *co;
+	MbbDbIter *iter;
+	GSList *list;
+	gchar *ids;
+
+	co = cache_obj_new(ag, obj);
+	if (ag->attr_list == NULL)
+		return co;
+
+	query_format("{%d", ((struct attr *) ag->attr_list->data)->id);
+	for (list = ag->attr_list->next; list != NULL; list = list->next)
+		query_append_format(",%d", ((struct attr *) list->data)->id);
+	ids = query_append_format("}");
+
+	iter = mbb_db_prepared_iter(error, ATTR_GET_QUERY, "sd", ids, obj);
+	if (iter == NULL) {
+		cache_obj_free(co);
+		return NULL;
+	}
+
+	while (mbb_db_iter_next(iter)) {
+		gint id;
+
+		if (! var_conv_int(mbb_db_iter_value(iter, 0), &id))
+			continue;
+
+		g_hash_table_insert(co->values, GINT_TO_POINTER(id),
+			g_strdup(mbb_db_iter_value(iter, 1))
+		);
+	}
+
+	mbb_db_iter_free(iter);
+
+	return co;
+}
+
+gint attr_cache_read(struct attr_group *ag, gint obj, struct attr **attrs,
+		     gchar **values, gsize cnt, GError **error)
+{
+	struct cache_obj *co;
+	guint version;
+	gint nelem = 0;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	if ((co = cache_obj_get(ag, obj)) != NULL) {
+		nelem = cache_obj_fill(co, attrs, values, cnt);
+		cache_hits++;
+	} else
+		cache_misses++;
+
+	version = cache_version;
+
+	g_static_mutex_unlock(&cache_mutex);
+
+	if (co != NULL)
+		return nelem;
+
+	if ((co = db_cache_obj_load(ag, obj, error)) == NULL)
+		return -1;
+
+	nelem = cache_obj_fill(co, attrs, values, cnt);
+
+	g_static_mutex_lock(&cache_mutex);
+	if (version == cache_version && cache_obj_insert(co))
+		co = NULL;
+	g_static_mutex_unlock(&cache_mutex);
+
+	if (co != NULL)
+		cache_obj_free(co);
+
+	return nelem;
+}
+
+static struct attr_index *attr_index_new(void)
+{
+	struct attr_index *idx;
+
+	idx = g_new(struct attr_index, 1);
+	idx->objs = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, g_free
+	);
+	idx->keys = g_hash_table_new_full(
+		g_str_hash, g_str_equal, g_free, NULL
+	);
+
+	return idx;
+}
+
+static void attr_index_free(struct attr_index *idx)
+{
+	GHashTableIter iter;
+	GSList *list;
+
+	g_hash_table_iter_init(&iter, idx->keys);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &list))
+		g_slist_free(list);
+
+	g_hash_table_destroy(idx->keys);
+	g_hash_table_destroy(idx->objs);
+	g_free(idx);
+}
+
+static void attr_index_set(struct attr_index *idx, gint obj, gchar *value)
+{
+	gpointer ptr = GINT_TO_POINTER(obj);
+	GSList *list;
+	gchar *old;
+	gchar *key;
+
+	if ((old = g_hash_table_lookup(idx->objs, ptr)) != NULL) {
+		key = g_utf8_casefold(old, -1);
+		list = g_hash_table_lookup(idx->keys, key);
+		list = g_slist_remove(list, ptr);
+
+		if (list != NULL)
+			g_hash_table_replace(idx->keys, key, list);
+		else {
+			g_hash_table_remove(idx->keys, key);
+			g_free(key);
+		}
+
+		g_hash_table_remove(idx->objs, ptr);
+	}
+
+	if (value != NULL) {
+		key = g_utf8_casefold(value, -1);
+		list = g_hash_table_lookup(idx->keys, key);
+		g_hash_table_replace(idx->keys, key, g_slist_prepend(list, ptr));
+		g_hash_table_insert(idx->objs, ptr, g_strdup(value));
+	}
+}
+
+static struct attr_index *db_attr_index_load(struct attr *attr, GError **error)
+{
+	struct attr_index *idx;
+	MbbDbIter *iter;
+
+	iter = mbb_db_prepared_iter(error, ATTR_INDEX_QUERY, "d", attr->id);
+	if (iter == NULL)
+		return NULL;
+
+	idx = attr_index_new();
+	while (mbb_db_iter_next(iter)) {
+		gint obj;
+
+		if (! var_conv_int(mbb_db_iter_value(iter, 0), &obj))
+			continue;
+
+		attr_index_set(idx, obj, mbb_db_iter_value(iter, 1));
+	}
+
+	mbb_db_iter_free(iter);
+
+	return idx;
+}
+
+static GSList *attr_index_match(struct attr_index *idx, gchar *value)
+{
+	struct attr_match *am;
+	GSList *list, *ret;
+	gchar *key;
+
+	key = g_utf8_casefold(value, -1);
+	list = g_hash_table_lookup(idx->keys, key);
+	g_free(key);
+
+	for (ret = NULL; list != NULL; list = list->next) {
+		am = g_new(struct attr_match, 1);
+		am->obj = GPOINTER_TO_INT(list->data);
+		am->value = g_strdup(g_hash_table_lookup(idx->objs, list->data));
+		ret = g_slist_prepend(ret, am);
+	}
+
+	return ret;
+}
+
+gboolean attr_cache_find(struct attr *attr, gchar *value, GSList **list,
+			 GError **error)
+{
+	struct attr_index *idx = NULL;
+	gpointer ptr = GINT_TO_POINTER(attr->id);
+	guint version;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	if (ht_index != NULL && (idx = g_hash_table_lookup(ht_index, ptr))) {
+		*list = attr_index_match(idx, value);
+		cache_hits++;
+	} else
+		cache_misses++;
+
+	version = cache_version;
+
+	g_static_mutex_unlock(&cache_mutex);
+
+	if (idx != NULL)
+		return TRUE;
+
+	if ((idx = db_attr_index_load(attr, error)) == NULL)
+		return FALSE;
+
+	*list = attr_index_match(idx, value);
+
+	g_static_mutex_lock(&cache_mutex);
+	if (version == cache_version && cache_size > 0) {
+		if (ht_index == NULL) {
+			ht_index = g_hash_table_new_full(g_direct_hash,
+				g_direct_equal, NULL, (GDestroyNotify) attr_index_free
+			);
+		}
+
+		g_hash_table_replace(ht_index, ptr, idx);
+		idx = NULL;
+	}
+	g_static_mutex_unlock(&cache_mutex);
+
+	if (idx != NULL)
+		attr_index_free(idx);
+
+	return TRUE;
+}
+
+void attr_match_list_free(GSList *list)
+{
+	GSList *next;
+
+	for (; list != NULL; list = next) {
+		struct attr_match *am = list->data;
+
+		next = list->next;
+		g_free(am->value);
+		g_free(am);
+		g_slist_free_1(list);
+	}
+}
+
+void attr_cache_set(struct attr *attr, gint obj, gchar *value)
+{
+	gpointer ptr = GINT_TO_POINTER(attr->id);
+	struct attr_index *idx;
+	struct cache_obj key;
+	struct cache_obj *co;
+
+	key.ag = attr->group;
+	key.obj = obj;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	cache_version++;
+
+	if (ht_obj != NULL && (co = g_hash_table_lookup(ht_obj, &key))) {
+		if (value != NULL)
+			g_hash_table_insert(co->values, ptr, g_strdup(value));
+		else
+			g_hash_table_remove(co->values, ptr);
+	}
+
+	if (ht_index != NULL && (idx = g_hash_table_lookup(ht_index, ptr)))
+		attr_index_set(idx, obj, value);
+
+	g_static_mutex_unlock(&cache_mutex);
+}
+
+void attr_cache_drop_attr(struct attr *attr)
+{
+	gpointer ptr = GINT_TO_POINTER(attr->id);
+	struct cache_obj *co;
+	GList *list;
+
+	g_static_mutex_lock(&cache_mutex);
+
+	cache_version++;
+
+	for (list = lru.head; list != NULL; list = list->next) {
+		co = list->data;
+		if (co->ag == attr->group)
+			g_hash_table_remove(co->values, ptr);
+	}
+
+	if (ht_index != NULL)
+		g_hash_table_remove(ht_index, ptr);
+
+	g_static_mutex_unlock(&cache_mutex);
+}
+
+static void attr_cache_clear(void)
+{
+	g_static_mutex_lock(&cache_mutex);
+
+	cache_version++;
+	cache_trim(0);
+
+	if (ht_index != NULL)
+		g_hash_table_remove_all(ht_index);
+
+	g_static_mutex_unlock(&cache_mutex);
+}
+
+gboolean attr_cache_enabled(void)
+{
+	return cache_size > 0;
+}
+
+/* fills the cache with whole objects until it is full */
+static void db_attr_cache_preload(void)
+{
+	GError *error = NULL;
+	struct cache_obj *co;
+	MbbDbIter *iter;
+
+	iter = mbb_db_select(&error, "attribute_pool",
+		"obj_id", "attr_id", "attr_value", NULL, NULL
+	);
+
+	if (iter == NULL) {
+		mbb_log_self("attr cache preload failed: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	g_static_mutex_lock(&cache_mutex);
+
+	if (ht_obj == NULL)
+		ht_obj_init();
+
+	while (mbb_db_iter_next(iter)) {
+		struct cache_obj key;
+		struct attr *attr;
+		gint obj, id;
+
+		if (! var_conv_int(mbb_db_iter_value(iter, 0), &obj))
+			continue;
+		if (! var_conv_int(mbb_db_iter_value(iter, 1), &id))
+			continue;
+		if ((attr = attr_get_by_id(id)) == NULL)
+			continue;
+
+		key.ag = attr->group;
+		key.obj = obj;
+
+		if ((co = g_hash_table_lookup(ht_obj, &key)) == NULL) {
+			if (lru.length >= cache_size)
+				continue;
+
+			co = cache_obj_new(attr->group, obj);
+			cache_obj_insert(co);
+		}
+
+		g_hash_table_insert(co->values, GINT_TO_POINTER(id),
+			g_strdup(mbb_db_iter_value(iter, 2))
+		);
+	}
+
+	g_static_mutex_unlock(&cache_mutex);
+
+	mbb_db_iter_free(iter);
+}
+
+static gboolean var_conv_cache_size(gchar *arg, gpointer p)
+{
+	guint size;
+
+	if (! var_conv_uint(arg, &size))
+		return FALSE;
+
+	g_static_mutex_lock(&cache_mutex);
+	*(guint *) p = size;
+	cache_trim(size);
+	g_static_mutex_unlock(&cache_mutex);
+
+	if (size == 0)
+		attr_cache_clear();
+
+	return TRUE;
+}
+
+MBB_VAR_DEF(cache_size_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_cache_size,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ADMIN
+};
+
+MBB_VAR_DEF(cache_stat_def) {
+	.op_read = var_str_uint,
+	.cap_read = MBB_CAP_ALL
+};
+
+void attr_cache_init(void)
+{
+	mbb_module_add_base_var("attr.cache.size", &cache_size_def, &cache_size);
+	mbb_module_add_base_var("attr.cache.hits", &cache_stat_def, &cache_hits);
+	mbb_module_add_base_var("attr.cache.misses", &cache_stat_def, &cache_misses);
+
+	if (cache_size > 0)
+		db_attr_cache_preload();
+}
+
+void attr_cache_free(void)
+{
+	g_static_mutex_lock(&cache_mutex);
+
+	cache_trim(0);
+
+	if (ht_obj != NULL) {
+		g_hash_table_destroy(ht_obj);
+		ht_obj = NULL;
+	}
+
+	if (ht_index != NULL) {
+		g_hash_table_destroy(ht_index);
+		ht_index = NULL;
+	}
+
+	g_static_mutex_unlock(&cache_mutex);
+}
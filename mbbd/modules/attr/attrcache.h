@@ -0,0 +1,29 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef ATTR_CACHE_H
+#define ATTR_CACHE_H
+
+#include <glib.h>
+
+#include "attr.h"
+
+struct attr_match {
+	gint obj;
+	gchar *value;
+};
+
+void attr_cache_init(void);
+void attr_cache_free(void);
+gboolean attr_cache_enabled(void);
+
+gint attr_cache_read(struct attr_group *ag, gint obj, struct attr **attrs,
+		     gchar **values, gsize cnt, GError **error);
+void attr_cache_set(struct attr *attr, gint obj, gchar *value);
+void attr_cache_drop_attr(struct attr *attr);
+
+gboolean attr_cache_find(struct attr *attr, gchar *value, GSList **list,
+			 GError **error);
+void attr_match_list_free(GSList *list);
+
+#endif
@@ -7,6 +7,7 @@
 #include "mbbplock.h"
 #include "mbblock.h"
 #include "mbbinit.h"
+#include "mbbauth.h"
 #include "mbbfunc.h"
 #include "mbbxtv.h"
 #include "mbblog.h"
@@ -18,14 +19,19 @@
 #include "query.h"
 #include "debug.h"
 
+#include "attrcache.h"
 #include "interface.h"
 #include "dbattr.h"
 #include "attr.h"
 
 #include <stdarg.h>
+#include <string.h>
 
 static GHashTable *ht_group;
 
+/* db writes of values and their cache updates go in the same order */
+static GStaticMutex write_mutex = G_STATIC_MUTEX_INIT;
+
 static void attr_group_free(struct attr_group *ag) {
 	g_slist_free(ag->attr_list);
 }
@@ -233,7 +239,10 @@ static void mbb_attr_del(XmlTag *tag, XmlTag **ans)
 		if (db_attr_del(attr->id, &error) == FALSE) final
 			*ans = mbb_xml_msg_from_error(error);
 
+		attr_cache_drop_attr(attr);
 		attr_del(attr);
+		mbb_func_cache_invalidate();
+		mbb_auth_cache_invalidate();
 		mbb_log_debug("del attr %s from group %s", name, group);
 	}
 
@@ -303,12 +312,21 @@ static void mbb_attr_set(XmlTag *tag, XmlTag **ans)
 			final *ans = mbb_xml_msg_error("unknown object");
 		}
 
+		g_static_mutex_lock(&write_mutex);
 		if (db_attr_set(attr->id, value, id, &error) == FALSE) {
+			g_static_mutex_unlock(&write_mutex);
 			mbb_lock_reader_unlock();
 			final *ans = mbb_xml_msg_from_error(error);
 		}
 
+		/* invalidated after the update, so nothing cached meanwhile
+		 * keeps the old value */
+		attr_cache_set(attr, id, value);
+		g_static_mutex_unlock(&write_mutex);
 		mbb_lock_reader_unlock();
+
+		mbb_func_cache_invalidate();
+		mbb_auth_cache_invalidate();
 	}
 
 	mbb_plock_reader_unlock();
@@ -342,52 +360,24 @@ static void mbb_attr_unset(XmlTag *tag, XmlTag **ans)
 			final *ans = mbb_xml_msg_error("unknown object");
 		}
 
+		g_static_mutex_lock(&write_mutex);
 		if (db_attr_unset(attr->id, id, &error) == FALSE) {
+			g_static_mutex_unlock(&write_mutex);
 			mbb_lock_reader_unlock();
 			final *ans = mbb_xml_msg_from_error(error);
 		}
 
+		/* invalidated after the update, so nothing cached meanwhile
+		 * keeps the old value */
+		attr_cache_set(attr, id, NULL);
+		g_static_mutex_unlock(&write_mutex);
 		mbb_lock_reader_unlock();
-	}
-
-	mbb_plock_reader_unlock();
-}
-
-static XmlTag *db_fetch_attrs(gchar *query)
-{
-	GError *error = NULL;
-	MbbDbIter *iter;
-	XmlTag *tag;
-
-	iter = mbb_db_query_iter(query, &error);
-	if (iter == NULL)
-		return mbb_xml_msg_from_error(error);
-
-	tag = mbb_xml_msg_ok();
-	while (mbb_db_iter_next(iter)) {
-		struct attr *attr;
-		gchar *value;
-		gchar *var;
-		gint id;
-
-		var = mbb_db_iter_value(iter, 0);
-		if (! var_conv_int(var, &id))
-			continue;
-
-		if ((attr = attr_get_by_id(id)) == NULL)
-			continue;
-
-		value = mbb_db_iter_value(iter, 1);
 
-		xml_tag_new_child(tag, "attr",
-			"name", variant_new_string(attr->name),
-			"value", variant_new_string(value)
-		);
+		mbb_func_cache_invalidate();
+		mbb_auth_cache_invalidate();
 	}
 
-	mbb_db_iter_free(iter);
-
-	return tag;
+	mbb_plock_reader_unlock();
 }
 
 static GSList *get_attr_list(gchar *group, GSList *var_list)
@@ -407,91 +397,87 @@ static GSList *get_attr_list(gchar *group, GSList *var_list)
 	return list;
 }
 
-static XmlTag *db_attr_get(GSList *list, gint obj_id)
+static XmlTag *attr_values_get(struct attr_group *ag, GSList *list, gint obj_id)
 {
-	struct attr *attr;
-	gchar *query;
-
-	attr = list->data;
-	query_format("select * from attr_get(array[%d", attr->id);
-
-	for (list = list->next; list != NULL; list = list->next) {
-		attr = list->data;
-		query_append_format(",%d", attr->id);
-	}
-
-	query = query_append_format("], %d);", obj_id);
-
-	return db_fetch_attrs(query);
-}
-
-static gint db_read_attrs(gchar *query, GHashTable *ht, GError **error)
-{
-	MbbDbIter *iter;
-	gsize nelem = 0;
+	GError *error = NULL;
+	struct attr **attrs;
+	gchar **values;
+	XmlTag *tag;
+	guint cnt, n;
 
-	iter = mbb_db_query_iter(query, error);
-	if (iter == NULL)
-		return -1;
+	cnt = g_slist_length(list);
+	attrs = g_new(struct attr *, cnt);
+	values = g_new(gchar *, cnt);
 
-	while (mbb_db_iter_next(iter)) {
-		struct attrvec *av;
-		gchar *var;
-		gint id;
+	for (n = 0; list != NULL; list = list->next)
+		attrs[n++] = list->data;
 
-		var = mbb_db_iter_value(iter, 0);
-		if (! var_conv_int(var, &id))
-			continue;
+	if (attr_cache_read(ag, obj_id, attrs, values, cnt, &error) < 0)
+		tag = mbb_xml_msg_from_error(error);
+	else {
+		tag = mbb_xml_msg_ok();
 
-		var = mbb_db_iter_value(iter, 1);
-		av = g_hash_table_lookup(ht, GINT_TO_POINTER(id));
+		for (n = 0; n < cnt; n++) {
+			if (values[n] == NULL)
+				continue;
 
-		if (av != NULL && av->value == NULL) {
-			av->value = g_strdup(var);
-			nelem++;
+			xml_tag_new_child(tag, "attr",
+				"name", variant_new_string(attrs[n]->name),
+				"value", variant_new_alloc_string(values[n])
+			);
 		}
 	}
 
-	return nelem;
+	g_free(values);
+	g_free(attrs);
+
+	return tag;
 }
 
 static gint mbb_attr_read(gchar *group, gint obj, struct attrvec *av, gsize cnt,
 			  GError **error)
 {
-	GHashTable *ht = NULL;
-	gsize nelem;
+	struct attr_group *ag = NULL;
+	struct attrvec **avs;
+	struct attr **attrs;
+	gchar **values;
+	gint nelem = 0;
+	gsize n, len;
+
+	avs = g_new(struct attrvec *, cnt);
+	attrs = g_new(struct attr *, cnt);
 
 	mbb_plock_reader_lock();
 
-	for (; cnt > 0; cnt--, av++) {
+	for (len = 0; cnt > 0; cnt--, av++) {
 		struct attr *attr;
 
 		attr = attr_get(group, av->name);
 		if (attr != NULL) {
-			if (ht != NULL)
-				query_append_format(",%d", attr->id);
-			else {
-				ht = g_hash_table_new(
-					g_direct_hash, g_direct_equal);
-				query_format("select * from attr_get(array[%d",
-					attr->id);
-			}
-
-			g_hash_table_insert(ht, GINT_TO_POINTER(attr->id), av);
+			ag = attr->group;
+			attrs[len] = attr;
+			avs[len++] = av;
 		}
 	}
 
-	if (ht == NULL) {
-		mbb_plock_reader_unlock();
-		return 0;
-	}
+	if (len > 0) {
+		values = g_new(gchar *, len);
+		nelem = attr_cache_read(ag, obj, attrs, values, len, error);
 
-	nelem = db_read_attrs(
-		query_append_format("], %d);", obj), ht, error
-	);
+		for (n = 0; nelem >= 0 && n < len; n++) {
+			if (avs[n]->value == NULL)
+				avs[n]->value = values[n];
+			else
+				g_free(values[n]);
+		}
+
+		g_free(values);
+	}
 
 	mbb_plock_reader_unlock();
-	g_hash_table_destroy(ht);
+
+	g_free(attrs);
+	g_free(avs);
 
 	return nelem;
 }
@@ -524,14 +510,14 @@ static void mbb_attr_get(XmlTag *tag, XmlTag **ans)
 
 	attrs = xml_tag_path_attr_list(tag, "attr", "name");
 	if (attrs == NULL)
-		*ans = db_attr_get(ag->attr_list, id);
+		*ans = attr_values_get(ag, ag->attr_list, id);
 	else {
 		GSList *list;
 
 		list = get_attr_list(group, attrs);
 
 		if (list != NULL) {
-			*ans = db_attr_get(list, id);
+			*ans = attr_values_get(ag, list, id);
 			g_slist_free(list);
 		}
 
@@ -589,11 +575,63 @@ static XmlTag *db_attr_find(struct attr *attr, gchar *value)
 	return tag;
 }
 
+/* an anchored pattern without metacharacters is an equality search */
+static gchar *attr_find_literal(gchar *exp)
+{
+	gchar *literal;
+	gsize len;
+
+	len = strlen(exp);
+	if (len < 2 || exp[0] != '^' || exp[len - 1] != '$')
+		return NULL;
+
+	literal = g_strndup(exp + 1, len - 2);
+	if (strpbrk(literal, ".[]()*+?{}|\\^$") != NULL) {
+		g_free(literal);
+		return NULL;
+	}
+
+	return literal;
+}
+
+static XmlTag *cache_attr_find(struct attr *attr, gchar *value)
+{
+	GError *error = NULL;
+	GSList *list, *p;
+	XmlTag *tag;
+
+	if (attr_cache_find(attr, value, &list, &error) == FALSE)
+		return mbb_xml_msg_from_error(error);
+
+	tag = mbb_xml_msg_ok();
+
+	mbb_lock_reader_lock();
+	for (p = list; p != NULL; p = p->next) {
+		struct attr_match *am = p->data;
+		gchar *name;
+
+		name = attr_group_get_obj_name(attr->group, am->obj);
+		if (name == NULL)
+			continue;
+
+		xml_tag_new_child(tag, "obj",
+			"name", variant_new_string(name),
+			"value", variant_new_string(am->value)
+		);
+	}
+	mbb_lock_reader_unlock();
+
+	attr_match_list_free(list);
+
+	return tag;
+}
+
 static void mbb_attr_find(XmlTag *tag, XmlTag **ans)
 {
 	DEFINE_XTV(XTV_ATTR_GROUP, XTV_ATTR_NAME, XTV_ATTR_VALUE);
 
 	struct attr *attr;
+	gchar *literal;
 	gchar *group;
 	gchar *name;
 	gchar *value;
@@ -607,7 +645,11 @@ static void mbb_attr_find(XmlTag *tag, XmlTag **ans)
 		*ans = mbb_xml_msg_error("unknown attr");
 	}
 
-	*ans = db_attr_find(attr, value);
+	if (attr_cache_enabled() && (literal = attr_find_literal(value)) != NULL) {
+		*ans = cache_attr_find(attr, literal);
+		g_free(literal);
+	} else
+		*ans = db_attr_find(attr, value);
 
 	mbb_plock_reader_unlock();
 }
@@ -617,8 +659,8 @@ MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-attr-add", mbb_attr_add, MBB_CAP_WHEEL),
 	MBB_FUNC_STRUCT("mbb-attr-del", mbb_attr_del, MBB_CAP_WHEEL),
 	MBB_FUNC_STRUCT("mbb-attr-rename", mbb_attr_rename, MBB_CAP_WHEEL),
-	MBB_FUNC_STRUCT("mbb-attr-set", mbb_attr_set, MBB_CAP_ADMIN),
-	MBB_FUNC_STRUCT("mbb-attr-unset", mbb_attr_unset, MBB_CAP_ADMIN),
+	MBB_FUNC_BATCH("mbb-attr-set", mbb_attr_set, MBB_CAP_ADMIN),
+	MBB_FUNC_BATCH("mbb-attr-unset", mbb_attr_unset, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-attr-get", mbb_attr_get, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-attr-find", mbb_attr_find, MBB_CAP_ADMIN),
 MBB_INIT_FUNCTIONS_END
@@ -635,6 +677,8 @@ static void load_module(void)
 	if (db_attr_load() == FALSE)
 		return;
 
+	attr_cache_init();
+
 	mbb_module_export(&ai);
 
 	mbb_module_add_functions(MBB_INIT_FUNCTIONS_TABLE);
@@ -642,6 +686,7 @@ static void load_module(void)
 
 static void unload_module(void)
 {
+	attr_cache_free();
 	attr_free_all();
 
 	if (ht_group != NULL)
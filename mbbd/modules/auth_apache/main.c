@@ -4,6 +4,7 @@
 #include "mbbmodule.h"
 #include "mbbauth.h"
 #include "mbbuser.h"
+#include "mbblock.h"
 #include "mbblog.h"
 #include "mbbvar.h"
 
@@ -58,10 +59,18 @@ static MbbUser *auth_apache(gchar *login, gchar *secret)
 	if (login == NULL || secret == NULL)
 		return NULL;
 
-	if ((user = mbb_user_get_by_name(login)) == NULL)
+	mbb_lock_reader_lock();
+	if ((user = mbb_user_get_by_name(login)) != NULL)
+		mbb_user_ref(user);
+	mbb_lock_reader_unlock();
+
+	if (user == NULL)
 		return NULL;
 
+	/* the db query and the hash check run without the global lock */
 	if (get_attr_value(user->id, &hash) == FALSE) {
+		mbb_user_unref(user);
+
 		if (auth_strict)
 			return NULL;
 
@@ -74,6 +83,8 @@ static MbbUser *auth_apache(gchar *login, gchar *secret)
 	if (status == APR_SUCCESS)
 		return user;
 
+	mbb_user_unref(user);
+
 	return NULL;
 }
 
@@ -89,7 +100,7 @@ static void load_module(void)
 	if ((attr_lib = mbb_module_import("attr.so")) == NULL) final
 		mbb_log_self("import module attr.so failed");
 
-	auth_method_key = mbb_auth_method_register("apache", auth_apache);
+	auth_method_key = mbb_auth_method_register_cached("apache", auth_apache);
 	if (auth_method_key == NULL) final
 		mbb_log_self("failed to register auth method");
 
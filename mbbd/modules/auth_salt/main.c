@@ -5,6 +5,7 @@
 #include "mbbthread.h"
 #include "mbbauth.h"
 #include "mbbuser.h"
+#include "mbblock.h"
 #include "mbblog.h"
 #include "mbbvar.h"
 
@@ -91,17 +92,22 @@ static MbbUser *auth_salt(gchar *login, gchar *secret)
 	if (strlen(secret) != (gsize) checksum_length)
 		return NULL;
 
-	if ((user = mbb_user_get_by_name(login)) == NULL)
-		return NULL;
-
 	if ((checksum = g_checksum_new(checksum_type)) == NULL)
 		return NULL;
 
-	g_checksum_update(checksum, (guchar *) user->secret, -1);
-	g_checksum_update(checksum, (guchar *) salt, -1);
+	mbb_lock_reader_lock();
+
+	if ((user = mbb_user_get_by_name(login)) != NULL) {
+		g_checksum_update(checksum, (guchar *) user->secret, -1);
+		g_checksum_update(checksum, (guchar *) salt, -1);
+
+		if (strcmp(secret, g_checksum_get_string(checksum)))
+			user = NULL;
+		else
+			mbb_user_ref(user);
+	}
 
-	if (strcmp(secret, g_checksum_get_string(checksum)))
-		user = NULL;
+	mbb_lock_reader_unlock();
 
 	g_checksum_free(checksum);
 
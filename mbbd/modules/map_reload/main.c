@@ -16,69 +16,225 @@
 #include "xmltag.h"
 
 static gboolean map_reload_oninit = FALSE;
+static guint map_reload_threads = 4;
+
+struct map_reload_job {
+	MbbUnit *unit;
+	struct map map;
+	MbbInetPoolEntry *pp[2];
+	gboolean ok;
+	gchar *msg;
+};
+
+struct map_reload_merge {
+	GPtrArray *jobs;
+	guint cur;
+};
+
+static gchar *map_reload_rebuild_msg(MbbUnit *unit, MbbInetPoolEntry *pp[2])
+{
+	inet_buf_t buf1, buf2;
+
+	inettoa(buf1, &pp[0]->inet);
+	inettoa(buf2, &pp[1]->inet);
+
+	return g_strdup_printf("unit '%s' reload map failed: cross %s (%d) and %s (%d)",
+		unit->name, buf1, pp[0]->id, buf2, pp[1]->id
+	);
+}
+
+static gchar *map_reload_cross_msg(MbbUnit *unit, struct map_cross *cross)
+{
+	MbbInetPoolEntry *entry;
+	MbbUnit *foe;
+
+	entry = (MbbInetPoolEntry *) cross->data;
+	foe = entry->owner->ptr;
+
+	return g_strdup_printf("map add unit '%s' failed: crosses with '%s'",
+		unit->name, foe->name
+	);
+}
 
 static gboolean mbb_map_reload_unit(MbbUnit *unit, gpointer data)
 {
 	MbbInetPoolEntry *pp[2];
 	struct map_cross cross;
 	XmlTag **ans = data;
+	gchar *msg;
+
+	if (mbb_unit_map_rebuild(unit, pp) == FALSE)
+		msg = map_reload_rebuild_msg(unit, pp);
+	else {
+		mbb_map_del_unit(unit);
+		if (mbb_map_add_unit(unit, &cross))
+			return TRUE;
 
-	if (mbb_unit_map_rebuild(unit, pp) == FALSE) {
-		inet_buf_t buf1, buf2;
-		gchar *msg;
+		mbb_map_del_unit(unit);
+		mbb_map_auto_glue();
+
+		msg = map_reload_cross_msg(unit, &cross);
+	}
+
+	if (ans == NULL)
+		mbb_log_self("%s", msg);
+	else
+		*ans = mbb_xml_msg_error("%s", msg);
+
+	g_free(msg);
+
+	return FALSE;
+}
+
+static void map_reload_job_add(MbbUnit *unit, GPtrArray *jobs)
+{
+	struct map_reload_job *job;
+
+	job = g_new(struct map_reload_job, 1);
+	job->unit = mbb_unit_ref(unit);
+	job->map = (struct map) MAP_INIT;
+	job->ok = FALSE;
+	job->msg = NULL;
+
+	g_ptr_array_add(jobs, job);
+}
+
+static void map_reload_job_free(struct map_reload_job *job)
+{
+	map_clear(&job->map);
+	mbb_unit_unref(job->unit);
+	g_free(job->msg);
+	g_free(job);
+}
+
+static void map_reload_job_build(struct map_reload_job *job,
+				 gpointer data G_GNUC_UNUSED)
+{
+	job->ok = mbb_unit_map_build(job->unit, &job->map, job->pp);
+}
 
-		inettoa(buf1, &pp[0]->inet);
-		inettoa(buf2, &pp[1]->inet);
+static void map_reload_build(GPtrArray *jobs)
+{
+	GThreadPool *pool = NULL;
+	guint n;
 
-		msg = g_strdup_printf("unit '%s' reload map failed: cross %s (%d) and %s (%d)",
-			unit->name, buf1, pp[0]->id, buf2, pp[1]->id
+	if (map_reload_threads > 1 && jobs->len > 1) {
+		pool = g_thread_pool_new(
+			(GFunc) map_reload_job_build, NULL,
+			MIN(map_reload_threads, jobs->len), TRUE, NULL
 		);
+	}
+
+	if (pool == NULL) {
+		g_ptr_array_foreach(jobs, (GFunc) map_reload_job_build, NULL);
+		return;
+	}
+
+	for (n = 0; n < jobs->len; n++)
+		g_thread_pool_push(pool, g_ptr_array_index(jobs, n), NULL);
 
-		if (ans == NULL)
-			mbb_log_self("%s", msg);
-		else
-			*ans = mbb_xml_msg_error("%s", msg);
+	g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+static void map_reload_cross(MbbUnit *unit, struct map_cross *cross,
+			     struct map_reload_merge *merge)
+{
+	struct map_reload_job *job;
 
-		g_free(msg);
+	do
+		job = g_ptr_array_index(merge->jobs, merge->cur++);
+	while (job->unit != unit);
+
+	job->msg = map_reload_cross_msg(unit, cross);
+}
 
-		return FALSE;
+static void map_reload_merge(GPtrArray *jobs, struct map *map)
+{
+	struct map_reload_merge merge;
+	struct map_reload_job *job;
+	MbbMapLoader *loader;
+	guint n;
+
+	loader = mbb_map_loader_new();
+
+	for (n = 0; n < jobs->len; n++) {
+		job = g_ptr_array_index(jobs, n);
+
+		if (job->ok == FALSE)
+			job->msg = map_reload_rebuild_msg(job->unit, job->pp);
+
+		mbb_map_loader_add_unit(loader, job->unit, &job->map);
 	}
 
-	mbb_map_del_unit(unit);
-	if (mbb_map_add_unit(unit, &cross) == FALSE) {
-		MbbInetPoolEntry *entry;
-		MbbUnit *foe;
-		gchar *msg;
+	merge.jobs = jobs;
+	merge.cur = 0;
 
-		mbb_map_del_unit(unit);
-		mbb_map_auto_glue();
+	mbb_map_shadow_init(map);
+	mbb_map_loader_build(loader, map,
+		(mbb_map_cross_func_t) map_reload_cross, &merge
+	);
 
-		entry = (MbbInetPoolEntry *) cross.data;
-		foe = entry->owner->ptr;
+	mbb_map_loader_free(loader);
+}
 
-		msg = g_strdup_printf("map add unit '%s' failed: crosses with '%s'",
-			unit->name, foe->name
-		);
+static void map_reload_prepare(GPtrArray *jobs, struct map *map)
+{
+	mbb_unit_foreach((GFunc) map_reload_job_add, jobs);
+	map_reload_build(jobs);
+	map_reload_merge(jobs, map);
+}
 
-		if (ans == NULL)
-			mbb_log_self("%s", msg);
-		else
-			*ans = mbb_xml_msg_error("%s", msg);
+static void map_reload_commit(GPtrArray *jobs, struct map *map)
+{
+	struct map_reload_job *job;
+	guint n;
 
-		g_free(msg);
+	for (n = 0; n < jobs->len; n++) {
+		job = g_ptr_array_index(jobs, n);
 
-		return FALSE;
+		if (job->ok) {
+			map_move(&job->unit->map, &job->map);
+			job->map = (struct map) MAP_INIT;
+		}
+
+		if (job->msg != NULL)
+			mbb_log_self("%s", job->msg);
 	}
 
-	return TRUE;
+	mbb_map_shadow_commit(map);
 }
 
-static inline void mbb_map_reload(void)
+static void mbb_map_reload(void)
 {
+	struct map map;
+	GPtrArray *jobs;
+	guint gen;
+
+	jobs = g_ptr_array_new();
+
+	/* unit maps and the new global map are built under reader lock only */
+	mbb_lock_reader_lock();
+	map_reload_prepare(jobs, &map);
+	gen = mbb_lock_generation();
+	mbb_lock_reader_unlock();
+
 	mbb_lock_writer_lock();
-	mbb_map_clear();
-	mbb_unit_foreach((GFunc) mbb_map_reload_unit, NULL);
+
+	if (mbb_lock_generation() != gen + 1) {
+		/* objects were modified in between, build again under writer lock */
+		map_clear(&map);
+		g_ptr_array_foreach(jobs, (GFunc) map_reload_job_free, NULL);
+		g_ptr_array_set_size(jobs, 0);
+
+		map_reload_prepare(jobs, &map);
+	}
+
+	map_reload_commit(jobs, &map);
+	g_ptr_array_foreach(jobs, (GFunc) map_reload_job_free, NULL);
+
 	mbb_lock_writer_unlock();
+
+	g_ptr_array_free(jobs, TRUE);
 }
 
 static void map_reload(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans G_GNUC_UNUSED)
@@ -121,6 +277,14 @@ MBB_VAR_DEF(var_def) {
 	.cap_write = MBB_CAP_ROOT
 };
 
+MBB_VAR_DEF(threads_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_uint,
+
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ROOT
+};
+
 static void ready(void)
 {
 	if (map_reload_oninit) {
@@ -132,6 +296,7 @@ static void ready(void)
 static void load_module(void)
 {
 	mbb_module_add_base_var("map.reload.oninit", &var_def, &map_reload_oninit);
+	mbb_module_add_base_var("map.reload.threads", &threads_def, &map_reload_threads);
 	mbb_module_add_functions(MBB_INIT_FUNCTIONS_TABLE);
 	mbb_module_onready(ready);
 }
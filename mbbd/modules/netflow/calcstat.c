@@ -90,6 +90,8 @@ static gboolean path_tree_open_next(struct base_task_data *td)
 	if ((fname = path_tree_next(&td->pt)) == NULL)
 		return FALSE;
 
+	mbb_task_set_done(td->pt.cur - 1);
+
 	td->flow = flow_stream_new(fname, 0, &error);
 	if (td->flow != NULL) {
 		mbb_log("open %s", fname);
@@ -182,6 +184,8 @@ static gboolean base_task_init(struct base_task_data *td)
 	if (! stat_lib->pool_init())
 		return FALSE;
 
+	mbb_task_set_total(td->pt.array->len);
+
 	if (td->op_init != NULL)
 		return td->op_init(td);
 
@@ -196,6 +200,8 @@ static gboolean update_task_work(struct base_task_data *td)
 	if (flow_stream_read(td->flow, &fd) == FALSE)
 		return FALSE;
 
+	netflow_task_progress(td->flow, &fd);
+
 	if (utd->start <= fd.begin && fd.begin < utd->end)
 		process_flow_data(&fd, td->umap, td->pool);
 
@@ -209,6 +215,7 @@ static gboolean plain_task_work(struct base_task_data *td)
 	if (flow_stream_read(td->flow, &fd) == FALSE)
 		return FALSE;
 
+	netflow_task_progress(td->flow, &fd);
 	process_flow_data(&fd, td->umap, td->pool);
 
 	return TRUE;
@@ -225,6 +232,8 @@ static gboolean base_task_work(struct base_task_data *td)
 
 		stat_lib->pool_save(td->pool);
 		td->pool = NULL;
+
+		mbb_task_set_done(td->pt.cur);
 	}
 
 	return TRUE;
@@ -376,6 +385,7 @@ static gboolean feed_stat_init(struct feed_task_data *td)
 		return FALSE;
 
 	td->pool = stat_lib->pool_new();
+	mbb_task_set_total(1);
 
 	return TRUE;
 }
@@ -384,12 +394,15 @@ static gboolean feed_stat_work(struct feed_task_data *td)
 {
 	struct flow_data fd;
 
-	if (flow_stream_read(td->flow, &fd))
+	if (flow_stream_read(td->flow, &fd)) {
+		netflow_task_progress(td->flow, &fd);
 		process_flow_data(&fd, td->umap, td->pool);
-	else {
+	} else {
 		stat_lib->pool_save(td->pool);
 		td->pool = NULL;
 
+		mbb_task_set_done(1);
+
 		return FALSE;
 	}
 
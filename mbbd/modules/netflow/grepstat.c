@@ -59,6 +59,8 @@ static gboolean grep_stat_init(struct task_data *td)
 	gboolean created = FALSE;
 	mode_t mode = 0755;
 
+	mbb_task_set_total(td->pt.array->len);
+
 	if (mkdir(td->dir, mode) == 0)
 		created = TRUE;
 	else {
@@ -110,6 +112,8 @@ static gboolean grep_stat_open_next(struct task_data *td)
 	if ((fname = path_tree_next(&td->pt)) == NULL)
 		return FALSE;
 
+	mbb_task_set_done(td->pt.cur - 1);
+
 	if (td->opt.with_proto)
 		mask |= FLOW_FIELD_PROTO;
 	if (td->opt.with_port)
@@ -201,9 +205,12 @@ static gboolean grep_stat_work(struct task_data *td)
 
 	if (flow_stream_read(td->flow, &fd) == FALSE) {
 		grep_stat_close(td);
+		mbb_task_set_done(td->pt.cur);
 		return TRUE;
 	}
 
+	netflow_task_progress(td->flow, &fd);
+
 	if (! td->cond_func(td->umap, &fd, &prefix))
 		return TRUE;
 
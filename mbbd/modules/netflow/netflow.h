@@ -4,6 +4,7 @@
 #ifndef MBB_NETFLOW_H
 #define MBB_NETFLOW_H
 
+#include "mbbtask.h"
 #include "xmltag.h"
 
 #include "pathtree.h"
@@ -18,4 +19,10 @@ XmlTag *mbb_xml_msg_task_id(gint id);
 GString *netflow_get_data_dir(void);
 gchar *netflow_get_store_dir(gchar *name);
 
+static inline void netflow_task_progress(FlowStream *flow, struct flow_data *fd)
+{
+	mbb_task_add_records(1, fd->nbytes);
+	mbb_task_set_part(flow_stream_tell(flow), flow_stream_length(flow));
+}
+
 #endif
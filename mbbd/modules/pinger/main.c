@@ -4,6 +4,7 @@
 #include "mbbmodule.h"
 #include "mbbxmlmsg.h"
 #include "mbbplock.h"
+#include "mbbinit.h"
 #include "mbbunit.h"
 #include "mbbfunc.h"
 #include "mbblock.h"
@@ -13,11 +14,13 @@
 #include "mbbdb.h"
 
 #include "varconv.h"
+#include "query.h"
 #include "inet.h"
 
 #include "xmltag.h"
 #include "macros.h"
 
+#include "attr/interface.h"
 #include "pingerloop.h"
 
 #include <string.h>
@@ -35,11 +38,6 @@ typedef enum {
 
 static GQuark pinger_error_quark(void);
 
-struct attr {
-	gchar *name;
-	gchar *value;
-};
-
 struct attr_map_elem {
 	gchar *attr;
 	guint off;
@@ -80,10 +78,18 @@ static struct attr_map punit_map = {
 	.group = "unit"
 };
 
-static gint (*attr_read_ptr)(gchar *, gint, struct attr *, gsize, GError **);
+struct pinger_load {
+	gint id;
+	struct pinger_state state;
+};
 
-#define mbb_attr_read(group, id, av, len, err) \
-	(*attr_read_ptr)(group, id, av, len, err)
+static struct attr_interface *attr_lib;
+
+static inline gint mbb_attr_read(gchar *group, gint id, struct attrvec *av,
+				 gsize nelem, GError **error)
+{
+	return attr_lib->attr_readv(group, id, av, nelem, error);
+}
 
 static guint pinger_default_period = PINGER_DEFAULT_PERIOD;
 static guint pinger_warn_timeout = PINGER_WARN_TIMEOUT;
@@ -113,10 +119,10 @@ static gboolean attr_do_map(gpointer ptr, gint id, struct attr_map *map,
 			    GError **error)
 {
 	gboolean ret = FALSE;
-	struct attr *av;
+	struct attrvec *av;
 	guint n;
 
-	av = g_new0(struct attr, map->count);
+	av = g_new0(struct attrvec, map->count);
 	for (n = 0; n < map->count; n++)
 		av[n].name = map->elem[n].attr;
 
@@ -125,7 +131,7 @@ static gboolean attr_do_map(gpointer ptr, gint id, struct attr_map *map,
 
 	for (n = 0; n < map->count; n++) {
 		struct attr_map_elem *elem = &map->elem[n];
-		struct attr *attr = &av[n];
+		struct attrvec *attr = &av[n];
 		gpointer p;
 
 		if (attr->value == NULL) {
@@ -189,13 +195,18 @@ static struct pinger_unit *pinger_unit_new(MbbUnit *unit, GError **error)
 	return g_memdup(&punit, sizeof(punit));
 }
 
-static inline void pinger_add_unit(struct pinger_unit *pu)
+static inline void pinger_add_unit(struct pinger_unit *pu,
+				   struct pinger_state *state)
 {
 	g_hash_table_insert(ht, GINT_TO_POINTER(pu->unit->id), pu);
+	pinger_loop_add(pu->unit->id, pu->client, pu->period,
+		pu->warn_timeout, state
+	);
 }
 
 static inline void pinger_del_unit(gint id)
 {
+	pinger_loop_del(id);
 	g_hash_table_remove(ht, GINT_TO_POINTER(id));
 }
 
@@ -230,29 +241,55 @@ static MbbUnit *mbb_unit_ref_by_id(gint id)
 	return unit;
 }
 
+/* units are removed without telling modules, so the pinger loop
+ * checks for them before saving results */
+static void pinger_prune_units(void)
+{
+	struct pinger_unit *pu;
+	GHashTableIter iter;
+	gpointer key;
+
+	mbb_lock_reader_lock();
+	mbb_plock_writer_lock();
+
+	if (ht != NULL) {
+		g_hash_table_iter_init(&iter, ht);
+		while (g_hash_table_iter_next(&iter, &key, (gpointer *) &pu)) {
+			if (mbb_unit_get_by_id(GPOINTER_TO_INT(key)) == pu->unit)
+				continue;
+
+			pinger_loop_del(GPOINTER_TO_INT(key));
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+
+	mbb_plock_writer_unlock();
+	mbb_lock_reader_unlock();
+}
+
 static void load_units(GSList *list)
 {
+	struct pinger_load *pl;
 	struct pinger_unit *pu;
 	MbbUnit *unit;
-	gint id;
 
 	ht_init();
 
 	for (; list != NULL; list = list->next) {
 		GError *error = NULL;
 
-		id = GPOINTER_TO_INT(list->data);
-		unit = mbb_unit_ref_by_id(id);
+		pl = list->data;
+		unit = mbb_unit_ref_by_id(pl->id);
 
 		if (unit == NULL) {
-			mbb_log_self("unknown unit with id %d", id);
+			mbb_log_self("unknown unit with id %d", pl->id);
 			continue;
 		}
 
 		pu = pinger_unit_new(unit, &error);
 
 		if (pu != NULL)
-			pinger_add_unit(pu);
+			pinger_add_unit(pu, &pl->state);
 		else {
 			mbb_log_self("unit %s: %s", unit->name, error->message);
 			mbb_unit_unref(unit);
@@ -267,7 +304,9 @@ static gboolean db_pinger_load(void)
 	MbbDbIter *iter;
 	GSList *list;
 
-	iter = mbb_db_select(&error, "pinger_units", "unit_id", NULL, NULL);
+	iter = mbb_db_select(&error, "pinger_units",
+		"unit_id", "last_reply", "sent", "lost", "rtt", NULL, NULL
+	);
 
 	if (iter == NULL) {
 		mbb_log_self("db_pinger_load failed: %s", error->message);
@@ -277,23 +316,36 @@ static gboolean db_pinger_load(void)
 
 	list = NULL;
 	while (mbb_db_iter_next(iter)) {
+		struct pinger_load *pl;
 		gchar *var;
-		gint id;
+
+		pl = g_new0(struct pinger_load, 1);
+		list = g_slist_prepend(list, pl);
 
 		var = mbb_db_iter_value(iter, 0);
-		if (! var_conv_int(var, &id)) {
+		if (! var_conv_int(var, &pl->id)) {
 			mbb_log_self("non integer unit_id '%s'", var);
 
+			g_slist_foreach(list, (GFunc) g_free, NULL);
 			g_slist_free(list);
 			mbb_db_iter_free(iter);
 			return FALSE;
 		}
 
-		list = g_slist_prepend(list, GINT_TO_POINTER(id));
+		/* null columns leave the state zeroed */
+		if ((var = mbb_db_iter_value(iter, 1)) != NULL)
+			var_conv_utime(var, &pl->state.last_reply);
+		if ((var = mbb_db_iter_value(iter, 2)) != NULL)
+			var_conv_uint(var, &pl->state.sent);
+		if ((var = mbb_db_iter_value(iter, 3)) != NULL)
+			var_conv_uint(var, &pl->state.lost);
+		if ((var = mbb_db_iter_value(iter, 4)) != NULL)
+			var_conv_uint(var, &pl->state.rtt);
 	}
 
 	load_units(list);
 
+	g_slist_foreach(list, (GFunc) g_free, NULL);
 	g_slist_free(list);
 	mbb_db_iter_free(iter);
 
@@ -339,7 +391,7 @@ static void mbb_pinger_add(XmlTag *tag, XmlTag **ans)
 		}
 	}
 
-	pinger_add_unit(pu);
+	pinger_add_unit(pu, NULL);
 	mbb_plock_writer_unlock();
 }
 
@@ -384,15 +436,188 @@ static void mbb_pinger_show_units(XmlTag *tag G_GNUC_UNUSED, XmlTag **ans)
 
 	g_hash_table_iter_init(&iter, ht);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &pu)) {
-		xml_tag_new_child(*ans, "unit",
-			"name", variant_new_string(pu->unit->name)
+		struct pinger_state state;
+		ipv4_buf_t buf;
+		XmlTag *xt;
+
+		xt = xml_tag_new_child(*ans, "unit",
+			"name", variant_new_string(pu->unit->name),
+			"ip", variant_new_string(ipv4toa(buf, pu->client))
 		);
+
+		if (! pinger_loop_get_state(pu->unit->id, &state))
+			continue;
+
+		xml_tag_set_attr(xt, "sent", variant_new_int(state.sent));
+		xml_tag_set_attr(xt, "lost", variant_new_int(state.lost));
+		xml_tag_set_attr(xt, "rtt", variant_new_int(state.rtt));
+
+		if (state.last_reply != 0) {
+			xml_tag_set_attr(xt, "last_reply",
+				variant_new_long(state.last_reply)
+			);
+		}
 	}
 
 	mbb_plock_reader_unlock();
 	mbb_lock_reader_unlock();
 }
 
+static gchar *stat_table(gchar *step)
+{
+	static gchar *tables[][2] = {
+		{ "day", "pinger_stat_day" },
+		{ "hour", "pinger_stat_hour" },
+		{ "raw", "pinger_stat" }
+	};
+	guint n;
+
+	for (n = 0; n < NELEM(tables); n++) {
+		if (! strcmp(step, tables[n][0]))
+			return tables[n][1];
+	}
+
+	return NULL;
+}
+
+/* rollups are bucketed in the db time zone, so the db picks the coarsest
+ * table the range is aligned to and cuts a default end to its buckets */
+static gboolean stat_range(time_t start, time_t *end, gchar **step,
+			   GError **error)
+{
+	MbbDbIter *iter;
+	gchar *query;
+	gboolean ret;
+
+	query = query_format("select * from pinger_stat_range(%t, %t, %s);",
+		start, *end, *step
+	);
+
+	if ((iter = mbb_db_query_iter(query, error)) == NULL)
+		return FALSE;
+
+	ret = mbb_db_iter_next(iter) &&
+	      mbb_db_iter_value(iter, 1) != NULL &&
+	      var_conv_utime(mbb_db_iter_value(iter, 1), end);
+
+	if (ret)
+		*step = g_strdup(mbb_db_iter_value(iter, 0));
+
+	if (! ret) {
+		g_set_error(error, MBB_DB_ERROR, MBB_DB_ERROR_QUERY,
+			"pinger_stat_range: invalid result");
+	}
+
+	mbb_db_iter_free(iter);
+
+	return ret;
+}
+
+static inline gchar *availability(guint64 sent, guint64 recv)
+{
+	return g_strdup_printf("%.2f", sent ? 100.0 * recv / sent : 0.0);
+}
+
+static void stat_set_rtt(XmlTag *xt, MbbDbIter *iter, gint field, gchar *name)
+{
+	gchar *value;
+
+	if ((value = mbb_db_iter_value(iter, field)) != NULL)
+		xml_tag_set_attr(xt, name, variant_new_string(value));
+}
+
+static void mbb_pinger_stat_unit(XmlTag *tag, XmlTag **ans)
+{
+	DEFINE_XTV(XTV_UNIT_NAME, XTV_TIME_START, XTV_TIME_END_, XTV_TIME_STEP_);
+
+	guint64 sent, recv, total_sent, total_recv;
+	GError *error = NULL;
+	time_t start, end;
+	MbbDbIter *iter;
+	MbbUnit *unit;
+	gchar *table;
+	gchar *query;
+	gchar *name;
+	gchar *step;
+	gint id;
+
+	step = NULL;
+	end = VAR_CONV_TIME_UNSET;
+	MBB_XTV_CALL(&name, &start, &end, &step);
+
+	if (end != VAR_CONV_TIME_UNSET && start >= end) final
+		*ans = mbb_xml_msg(MBB_MSG_INVALID_TIME_ORDER);
+
+	if (step != NULL && stat_table(step) == NULL) final
+		*ans = mbb_xml_msg_error("invalid step name");
+
+	if ((unit = mbb_unit_ref_by_name(name)) == NULL) final
+		*ans = mbb_xml_msg(MBB_MSG_UNKNOWN_UNIT);
+
+	id = unit->id;
+	mbb_unit_unref(unit);
+
+	if (! stat_range(start, &end, &step, &error)) final
+		*ans = mbb_xml_msg_from_error(error);
+
+	table = stat_table(step);
+	g_free(step);
+
+	if (table == NULL) final
+		*ans = mbb_xml_msg_error("invalid step name");
+
+	if (start >= end) final
+		*ans = mbb_xml_msg(MBB_MSG_INVALID_TIME_ORDER);
+
+	/* raw rows may split a point, rollups hold one row per point */
+	query = query_format("select point, sum(sent), sum(recv), min(rtt_min), "
+		"sum(rtt_avg::bigint * recv) / nullif(sum(recv), 0), "
+		"max(rtt_max) from %S where unit_id = $1 and "
+		"point >= $2 and point < $3 group by point order by point;",
+		table
+	);
+
+	iter = mbb_db_prepared_iter(&error, query, "dtt", id, start, end);
+
+	if (iter == NULL) final
+		*ans = mbb_xml_msg_from_error(error);
+
+	*ans = mbb_xml_msg_ok();
+	total_sent = total_recv = 0;
+
+	while (mbb_db_iter_next(iter)) {
+		XmlTag *xt;
+
+		sent = g_ascii_strtoull(mbb_db_iter_value(iter, 1), NULL, 10);
+		recv = g_ascii_strtoull(mbb_db_iter_value(iter, 2), NULL, 10);
+		total_sent += sent;
+		total_recv += recv;
+
+		xt = xml_tag_new_child(*ans, "stat",
+			"point", variant_new_string(mbb_db_iter_value(iter, 0)),
+			"sent", variant_new_string(mbb_db_iter_value(iter, 1)),
+			"recv", variant_new_string(mbb_db_iter_value(iter, 2)),
+			"availability", variant_new_alloc_string(
+				availability(sent, recv)
+			)
+		);
+
+		stat_set_rtt(xt, iter, 3, "rtt_min");
+		stat_set_rtt(xt, iter, 4, "rtt_avg");
+		stat_set_rtt(xt, iter, 5, "rtt_max");
+	}
+
+	mbb_db_iter_free(iter);
+
+	xml_tag_new_child(*ans, "total",
+		"sent", variant_new_long(total_sent),
+		"recv", variant_new_long(total_recv),
+		"availability", variant_new_alloc_string(
+			availability(total_sent, total_recv)
+		)
+	);
+}
+
 static gboolean pinger_default_period_set(gchar *arg, gpointer p G_GNUC_UNUSED)
 {
 	guint val;
@@ -427,45 +652,58 @@ static gboolean pinger_warn_timeout_set(gchar *arg, gpointer p G_GNUC_UNUSED)
 	return TRUE;
 }
 
-MBB_DEFINE_VAR(
-	pinger_default_period, &pinger_default_period,
-	var_str_uint, pinger_default_period_set,
-	MBB_CAP_ALL, MBB_CAP_ADMIN
-);
+MBB_VAR_DEF(default_period_def) {
+	.op_read = var_str_uint,
+	.op_write = pinger_default_period_set,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ADMIN
+};
 
-MBB_DEFINE_VAR(
-	pinger_warn_timeout, &pinger_warn_timeout,
-	var_str_uint, pinger_warn_timeout_set,
-	MBB_CAP_ALL, MBB_CAP_ADMIN
-);
+MBB_VAR_DEF(warn_timeout_def) {
+	.op_read = var_str_uint,
+	.op_write = pinger_warn_timeout_set,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ADMIN
+};
+
+MBB_VAR_DEF(stat_keep_def) {
+	.op_read = var_str_uint,
+	.op_write = var_conv_uint,
+	.cap_read = MBB_CAP_ALL,
+	.cap_write = MBB_CAP_ADMIN
+};
 
 MBB_INIT_FUNCTIONS_DO
 	MBB_FUNC_STRUCT("mbb-pinger-add", mbb_pinger_add, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-pinger-del", mbb_pinger_del, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-pinger-show-units", mbb_pinger_show_units, MBB_CAP_ADMIN),
+	MBB_FUNC_CACHED("mbb-pinger-stat-unit", mbb_pinger_stat_unit, MBB_CAP_ADMIN, 60),
 MBB_INIT_FUNCTIONS_END
 
 static void load_module(void)
 {
-	mbb_module_sym_t sym;
-
-	if ((sym = mbb_module_ref_sym("attr.so", "mbb_attr_read")) == NULL) {
-		mbb_log_self("cannot find symbol attr.so:mbb_attr_read");
+	if ((attr_lib = mbb_module_import("attr.so")) == NULL) {
+		mbb_log_self("import module attr.so failed");
 		return;
 	}
 
-	mbb_module_sym_assign(attr_read_ptr, sym);
-
-	if (db_pinger_load() == FALSE)
-		return;
-
-	if (pinger_loop_init() == FALSE) {
+	if (pinger_loop_init(pinger_prune_units) == FALSE) {
 		mbb_log_self("unable to create socket");
 		return;
 	}
 
-	mbb_module_add_var(&MBB_VAR(pinger_default_period));
-	mbb_module_add_var(&MBB_VAR(pinger_warn_timeout));
+	if (db_pinger_load() == FALSE)
+		return;
+
+	mbb_module_add_base_var("pinger.default.period",
+		&default_period_def, &pinger_default_period
+	);
+	mbb_module_add_base_var("pinger.warn.timeout",
+		&warn_timeout_def, &pinger_warn_timeout
+	);
+	mbb_module_add_base_var("pinger.stat.keep",
+		&stat_keep_def, &pinger_stat_keep
+	);
 
 	mbb_module_add_functions(MBB_INIT_FUNCTIONS_TABLE);
 }
@@ -474,8 +712,6 @@ static void unload_module(void)
 {
 	pinger_loop_end();
 
-	mbb_module_unref_sym((mbb_module_sym_t) attr_read_ptr);
-
 	if (ht != NULL)
 		g_hash_table_destroy(ht);
 }
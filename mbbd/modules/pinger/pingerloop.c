@@ -1,34 +1,134 @@
 /* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
 /* Published under the GNU General Public License V.2, see file COPYING */
 
+/* one thread drives every target: echoes are scheduled on a timer wheel,
+ * sent and received in batches and matched to targets by id and seq,
+ * results are summed into per-interval buckets for pinger_stat.
+ * collected results are saved by a writer thread, so a slow db neither
+ * delays echoes nor adds to the rtt of replies waiting in the socket */
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-
-#define __USE_BSD
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
-#undef __USE_BSD
 
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <time.h>
 #include <poll.h>
 
 #include "mbblog.h"
+#include "mbbdb.h"
+
+#include "query.h"
 
 #include "pingerloop.h"
+#include "timerwheel.h"
 #include "strerr.h"
-#include "inet.h"
+
+#define PINGER_TICK_MSEC 100
+#define PINGER_TICKS(sec) ((guint64) (sec) * 1000 / PINGER_TICK_MSEC)
+
+#define PINGER_BATCH 64
+#define PINGER_RECV_BUFSIZE 128
+#define PINGER_FLUSH_PERIOD 30
+#define PINGER_PIPELINE_DEPTH 64
+#define PINGER_STAT_CHUNK 256
+#define PINGER_PURGE_PERIOD 3600
+
+#if defined(__GLIBC__) && \
+	(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 14))
+#define HAVE_MMSG
+#endif
 
 struct icmpmsg {
-	struct icmp hdr;
-	time_t timestamp;
+	struct icmphdr hdr;
+	guint64 stamp;
+};
+
+/* the timer comes first, wheel callbacks cast it back */
+struct pinger_bucket {
+	time_t point;
+
+	guint sent;
+	guint recv;
+
+	/* microseconds, meaningful only if recv is not zero */
+	guint rtt_min;
+	guint rtt_max;
+	guint64 rtt_sum;
 };
 
+struct pinger_target {
+	struct tw_timer timer;
+
+	gint id;
+	ipv4_t ip;
+
+	guint period;
+	guint warn_timeout;
+	gboolean warned;
+	time_t since;
+
+	/* echo waiting for a reply, zero if none */
+	guint32 key;
+	guint64 sent_at;
+	time_t sent_point;
+
+	struct pinger_state state;
+	gboolean dirty;
+
+	struct pinger_bucket bucket;
+};
+
+struct pinger_out {
+	guint64 now;
+	guint count;
+
+	struct icmpmsg msg[PINGER_BATCH];
+	struct sockaddr_in sai[PINGER_BATCH];
+};
+
+struct pinger_rec {
+	gint id;
+	struct pinger_state state;
+};
+
+struct pinger_stat_rec {
+	gint id;
+	struct pinger_bucket bucket;
+};
+
+struct pinger_flush {
+	GArray *recs;
+	GArray *stats;
+	gboolean last;
+};
+
+guint pinger_stat_keep = PINGER_STAT_KEEP;
+
 static gint pinger_socket = -1;
+static GThread *pinger_thread = NULL;
+static GThread *writer_thread = NULL;
+static GAsyncQueue *flush_queue = NULL;
+static volatile gint pinger_stop = 0;
+static GMutex *pinger_mutex = NULL;
+
+static GHashTable *ht_target = NULL;
+static GHashTable *ht_echo = NULL;
+static struct timer_wheel wheel;
+static guint32 echo_key = 0;
 
-guint16 checksum(guint16 *buf, guint len)
+/* closed buckets waiting for the next flush */
+static GArray *stat_done = NULL;
+
+/* drops targets of deleted units, called before every flush */
+static pinger_prune_t pinger_prune = NULL;
+
+static guint16 checksum(guint16 *buf, guint len)
 {
 	guint32 sum = 0;
 
@@ -46,53 +146,630 @@ guint16 checksum(guint16 *buf, guint len)
 	return ~sum;
 }
 
-gboolean pinger_send_echo(ipv4_t ip, guint16 id, guint16 seq, time_t t)
+static guint64 now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (guint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static inline guint64 now_tick(guint64 usec)
+{
+	return usec / (PINGER_TICK_MSEC * 1000);
+}
+
+static void log_errno(gchar *func)
+{
+	gchar *tmp = strerr(errno);
+	mbb_log("%s failed: %s", func, tmp);
+	g_free(tmp);
+}
+
+static inline time_t stat_point(time_t t)
 {
-	struct sockaddr_in sai;
-	struct sockaddr *sa;
-	struct icmpmsg msg;
+	return t - t % PINGER_STAT_INTERVAL;
+}
 
-	memset(&msg, 0, sizeof(msg));
-	msg.hdr.icmp_type = ICMP_ECHO;
-	msg.hdr.icmp_id = id;
-	msg.hdr.icmp_seq = seq;
-	msg.timestamp = t;
+static void pinger_bucket_close(struct pinger_target *pt)
+{
+	struct pinger_stat_rec rec;
 
-	msg.hdr.icmp_cksum = checksum(&msg, sizeof(msg));
+	if (pt->bucket.sent != 0) {
+		rec.id = pt->id;
+		rec.bucket = pt->bucket;
+		g_array_append_val(stat_done, rec);
+	}
 
-	memset(&sa, 0, sizeof(sa));
-	sai.sin_family = AF_INET;
-	sai.sin_addr.s_addr = ipv4ton(ip);
-	sai.sin_port = g_htons(IPPROTO_ICMP);
+	memset(&pt->bucket, 0, sizeof(pt->bucket));
+}
 
-	sa = &sai;
-	if (sendto(pinger_socket, &msg, sizeof(msg), 0, sa, sizeof(sai)) < 0) {
-		gchar *tmp = strerr(errno);
-		mbb_log("sendto failed: %s", strerr(errno));
-		g_free(tmp);
+static void pinger_target_free(struct pinger_target *pt)
+{
+	timer_wheel_del(&pt->timer);
 
-		return FALSE;
+	if (pt->key != 0)
+		g_hash_table_remove(ht_echo, GUINT_TO_POINTER(pt->key));
+
+	/* results of a deleted target are still written */
+	pinger_bucket_close(pt);
+
+	g_free(pt);
+}
+
+static void pinger_out_flush(struct pinger_out *out)
+{
+	guint n;
+	gint ret;
+
+#ifdef HAVE_MMSG
+	struct mmsghdr hdr[PINGER_BATCH];
+	struct iovec iov[PINGER_BATCH];
+	guint sent = 0;
+
+	memset(hdr, 0, sizeof(hdr[0]) * out->count);
+	for (n = 0; n < out->count; n++) {
+		iov[n].iov_base = &out->msg[n];
+		iov[n].iov_len = sizeof(out->msg[n]);
+
+		hdr[n].msg_hdr.msg_name = &out->sai[n];
+		hdr[n].msg_hdr.msg_namelen = sizeof(out->sai[n]);
+		hdr[n].msg_hdr.msg_iov = &iov[n];
+		hdr[n].msg_hdr.msg_iovlen = 1;
 	}
 
-	return TRUE;
+	while (sent < out->count) {
+		ret = sendmmsg(pinger_socket, hdr + sent, out->count - sent, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* the echo is counted as lost, skip it */
+			log_errno("sendmmsg");
+			ret = 1;
+		}
+
+		sent += ret;
+	}
+#else
+	for (n = 0; n < out->count; n++) {
+		ret = sendto(pinger_socket, &out->msg[n], sizeof(out->msg[n]), 0,
+			(struct sockaddr *) &out->sai[n], sizeof(out->sai[n])
+		);
+
+		if (ret < 0)
+			log_errno("sendto");
+	}
+#endif
+
+	out->count = 0;
 }
 
-static gboolean pinger_loop_work(gpointer data)
+static void pinger_out_push(struct pinger_out *out, struct pinger_target *pt)
 {
-	struct pollfd pfd;
+	struct sockaddr_in *sai;
+	struct icmpmsg *msg;
+	time_t point;
 
-	pfd.fd = GPOINTER_TO_INT(data);
-	pfd.events = POLLIN;
+	if (pt->key != 0) {
+		g_hash_table_remove(ht_echo, GUINT_TO_POINTER(pt->key));
+		pt->state.lost++;
+	}
+
+	point = stat_point(time(NULL));
+	if (pt->bucket.point != point) {
+		pinger_bucket_close(pt);
+		pt->bucket.point = point;
+	}
+
+	pt->bucket.sent++;
+	pt->sent_point = point;
+
+	if (++echo_key == 0)
+		echo_key++;
+
+	pt->key = echo_key;
+	pt->sent_at = out->now;
+	pt->state.sent++;
+	pt->dirty = TRUE;
+	g_hash_table_replace(ht_echo, GUINT_TO_POINTER(pt->key), pt);
+
+	msg = &out->msg[out->count];
+	memset(msg, 0, sizeof(*msg));
+	msg->hdr.type = ICMP_ECHO;
+	msg->hdr.un.echo.id = g_htons(pt->key >> 16);
+	msg->hdr.un.echo.sequence = g_htons(pt->key & 0xffff);
+	msg->stamp = out->now;
+	msg->hdr.checksum = checksum((guint16 *) msg, sizeof(*msg));
+
+	sai = &out->sai[out->count];
+	memset(sai, 0, sizeof(*sai));
+	sai->sin_family = AF_INET;
+	sai->sin_addr.s_addr = ipv4ton(pt->ip);
+
+	if (++out->count == PINGER_BATCH)
+		pinger_out_flush(out);
+}
+
+static void pinger_target_fire(struct tw_timer *timer, gpointer data)
+{
+	struct pinger_target *pt = (struct pinger_target *) timer;
+	time_t last;
+
+	last = MAX(pt->state.last_reply, pt->since);
+	if (! pt->warned && time(NULL) - last >= (time_t) pt->warn_timeout) {
+		ipv4_buf_t buf;
+
+		mbb_log("pinger: no reply from %s for %u seconds",
+			ipv4toa(buf, pt->ip), pt->warn_timeout);
+		pt->warned = TRUE;
+	}
+
+	pinger_out_push(data, pt);
+	timer_wheel_add(&wheel, timer, timer->expire + PINGER_TICKS(pt->period));
+}
+
+static void pinger_reply(guchar *buf, gsize len, ipv4_t from, guint64 now)
+{
+	struct pinger_bucket *bucket;
+	struct pinger_target *pt;
+	struct icmphdr *icmp;
+	gint64 sample;
+	gsize hlen;
+	guint32 key;
+
+	if (len < sizeof(struct ip))
+		return;
+
+	hlen = ((struct ip *) buf)->ip_hl * 4;
+	if (len < hlen + sizeof(struct icmphdr))
+		return;
+
+	icmp = (struct icmphdr *) (buf + hlen);
+	if (icmp->type != ICMP_ECHOREPLY)
+		return;
+
+	key = (g_ntohs(icmp->un.echo.id) << 16) | g_ntohs(icmp->un.echo.sequence);
+	pt = g_hash_table_lookup(ht_echo, GUINT_TO_POINTER(key));
+	if (pt == NULL || pt->ip != from)
+		return;
+
+	g_hash_table_remove(ht_echo, GUINT_TO_POINTER(key));
+	pt->key = 0;
+
+	/* srtt as in tcp, gain 1/8 */
+	sample = now - pt->sent_at;
+	if (pt->state.rtt == 0)
+		pt->state.rtt = sample;
+	else
+		pt->state.rtt += (sample - (gint64) pt->state.rtt) / 8;
+
+	/* a reply to an echo of a closed bucket is counted as lost there */
+	bucket = &pt->bucket;
+	if (pt->sent_point == bucket->point) {
+		if (bucket->recv == 0 || sample < bucket->rtt_min)
+			bucket->rtt_min = sample;
+		if (sample > bucket->rtt_max)
+			bucket->rtt_max = sample;
+
+		bucket->rtt_sum += sample;
+		bucket->recv++;
+	}
+
+	pt->state.last_reply = time(NULL);
+	pt->warned = FALSE;
+	pt->dirty = TRUE;
+}
+
+static void pinger_recv(guint64 now)
+{
+	static guchar buf[PINGER_BATCH][PINGER_RECV_BUFSIZE];
+	static struct sockaddr_in sai[PINGER_BATCH];
+	gint ret, n;
+
+#ifdef HAVE_MMSG
+	struct mmsghdr hdr[PINGER_BATCH];
+	struct iovec iov[PINGER_BATCH];
+
+	for (;;) {
+		memset(hdr, 0, sizeof(hdr));
+		for (n = 0; n < PINGER_BATCH; n++) {
+			iov[n].iov_base = buf[n];
+			iov[n].iov_len = PINGER_RECV_BUFSIZE;
+
+			hdr[n].msg_hdr.msg_name = &sai[n];
+			hdr[n].msg_hdr.msg_namelen = sizeof(sai[n]);
+			hdr[n].msg_hdr.msg_iov = &iov[n];
+			hdr[n].msg_hdr.msg_iovlen = 1;
+		}
+
+		ret = recvmmsg(pinger_socket, hdr, PINGER_BATCH, MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				log_errno("recvmmsg");
+			break;
+		}
+
+		for (n = 0; n < ret; n++) {
+			pinger_reply(buf[n], hdr[n].msg_len,
+				g_ntohl(sai[n].sin_addr.s_addr), now
+			);
+		}
+
+		if (ret < PINGER_BATCH)
+			break;
+	}
+#else
+	for (n = 0; n < PINGER_BATCH; n++) {
+		socklen_t salen = sizeof(sai[n]);
+
+		ret = recvfrom(pinger_socket, buf[n], PINGER_RECV_BUFSIZE,
+			MSG_DONTWAIT, (struct sockaddr *) &sai[n], &salen
+		);
+
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				log_errno("recvfrom");
+			break;
+		}
+
+		pinger_reply(buf[n], ret, g_ntohl(sai[n].sin_addr.s_addr), now);
+	}
+#endif
+}
+
+/* buckets of finished intervals are closed here as well,
+ * so targets with a period longer than the interval are not delayed */
+static GArray *pinger_collect(gboolean last, GArray **stats)
+{
+	struct pinger_target *pt;
+	struct pinger_rec rec;
+	GHashTableIter iter;
+	GArray *recs;
+	time_t point;
+
+	recs = g_array_new(FALSE, FALSE, sizeof(struct pinger_rec));
+	point = stat_point(time(NULL));
 
-	if (poll(&pfd, 1, 1000) < 0) {
-		gchar *tmp = strerr(errno);
-		mbb_log("poll failed: %s", tmp);
-		g_free(tmp);
+	g_hash_table_iter_init(&iter, ht_target);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &pt)) {
+		if (pt->dirty) {
+			rec.id = pt->id;
+			rec.state = pt->state;
+			g_array_append_val(recs, rec);
+			pt->dirty = FALSE;
+		}
+
+		if (last || pt->bucket.point < point)
+			pinger_bucket_close(pt);
+	}
+
+	*stats = stat_done;
+	stat_done = g_array_new(FALSE, FALSE, sizeof(struct pinger_stat_rec));
+
+	return recs;
+}
+
+static gboolean pinger_rec_send(struct pinger_rec *rec, GError **error)
+{
+	return mbb_db_send(error,
+		"update pinger_units set last_reply = $2, sent = $3, lost = $4, "
+		"rtt = $5 where unit_id = $1;", "dtddd",
+		rec->id, rec->state.last_reply ? rec->state.last_reply : -1,
+		rec->state.sent, rec->state.lost, rec->state.rtt
+	);
+}
+
+static gboolean pinger_save_state(GArray *recs, GError **error)
+{
+	gboolean ok = TRUE;
+	guint n;
+
+	for (n = 0; ok && n < recs->len; n++) {
+		ok = pinger_rec_send(&g_array_index(recs, struct pinger_rec, n), error);
+		if (ok && (n + 1) % (PINGER_PIPELINE_DEPTH / 2) == 0)
+			ok = mbb_db_sync(PINGER_PIPELINE_DEPTH / 2, error);
+	}
+
+	if (ok)
+		ok = mbb_db_sync(0, error);
+	else
+		mbb_db_sync(0, NULL);
+
+	return ok;
+}
 
+static void stat_rec_append(struct pinger_stat_rec *rec, gboolean first)
+{
+	struct pinger_bucket *b = &rec->bucket;
+
+	query_append_format("%S(%d, %d, %d, ", first ? "" : ", ",
+		rec->id, b->sent, b->recv
+	);
+
+	if (b->recv == 0)
+		query_append("NULL, NULL, NULL");
+	else {
+		query_append_format("%d, %d, %d", b->rtt_min,
+			(gint) (b->rtt_sum / b->recv), b->rtt_max
+		);
+	}
+
+	query_append_format(", %t)", b->point);
+}
+
+/* raw rows go in multi-row inserts, then the hourly and daily rollups
+ * covering them are rebuilt */
+static gboolean pinger_save_stat(GArray *stats, GError **error)
+{
+	struct pinger_stat_rec *rec;
+	time_t start = 0, end = 0;
+	gchar *query = NULL;
+	guint n;
+
+	for (n = 0; n < stats->len; n++) {
+		rec = &g_array_index(stats, struct pinger_stat_rec, n);
+
+		/* rows of units deleted meanwhile are skipped,
+		 * rtt columns are cast since they may be all null */
+		if (n % PINGER_STAT_CHUNK == 0) {
+			query = query_init("insert into pinger_stat (unit_id, "
+				"sent, recv, rtt_min, rtt_avg, rtt_max, point) "
+				"select v.unit_id, v.sent, v.recv, "
+				"v.rtt_min::integer, v.rtt_avg::integer, "
+				"v.rtt_max::integer, v.point from (values "
+			);
+		}
+
+		stat_rec_append(rec, n % PINGER_STAT_CHUNK == 0);
+
+		if (n == 0 || rec->bucket.point < start)
+			start = rec->bucket.point;
+		if (n == 0 || rec->bucket.point >= end)
+			end = rec->bucket.point + PINGER_STAT_INTERVAL;
+
+		if ((n + 1) % PINGER_STAT_CHUNK == 0 || n + 1 == stats->len) {
+			query = query_append(") as v (unit_id, sent, recv, "
+				"rtt_min, rtt_avg, rtt_max, point) where exists "
+				"(select 1 from units u where u.unit_id = v.unit_id);"
+			);
+			if (! mbb_db_query(query, NULL, NULL, error))
+				return FALSE;
+		}
+	}
+
+	if (stats->len == 0)
+		return TRUE;
+
+	query = query_function("pinger_stat_rollup", "tt", start, end);
+
+	return mbb_db_query(query, NULL, NULL, error);
+}
+
+static gboolean pinger_purge_stat(GError **error)
+{
+	static time_t purge_time = 0;
+	guint keep;
+	time_t now;
+
+	now = time(NULL);
+	keep = pinger_stat_keep;
+
+	if (keep == 0 || now < purge_time)
+		return TRUE;
+
+	if (! mbb_db_delete(error, "pinger_stat", "point < %t",
+		stat_point(now) - (time_t) keep * 24 * 3600))
+		return FALSE;
+
+	purge_time = now + PINGER_PURGE_PERIOD;
+
+	return TRUE;
+}
+
+/* state and results go to the db in one transaction */
+static gboolean pinger_save(GArray *recs, GArray *stats, GError **error)
+{
+	gboolean ok;
+
+	if (recs->len == 0 && stats->len == 0)
+		return TRUE;
+
+	if (! mbb_db_begin(error))
 		return FALSE;
+
+	ok = pinger_save_state(recs, error) &&
+	     pinger_save_stat(stats, error) &&
+	     pinger_purge_stat(error);
+
+	if (ok)
+		ok = mbb_db_commit(error);
+	else
+		mbb_db_rollback(NULL);
+
+	return ok;
+}
+
+static void pinger_flush(GArray *recs, GArray *stats)
+{
+	struct pinger_target *pt;
+	GError *error = NULL;
+	guint n;
+
+	if (pinger_prune != NULL)
+		pinger_prune();
+
+	/* everything is kept for the next try unless the rows are rejected,
+	 * which would only fail the same way again */
+	if (! pinger_save(recs, stats, &error)) {
+		mbb_log("pinger: save state failed: %s", error->message);
+
+		if (g_error_matches(error, MBB_DB_ERROR, MBB_DB_ERROR_CONSTRAINT))
+			g_array_set_size(stats, 0);
+		g_error_free(error);
+
+		g_mutex_lock(pinger_mutex);
+		for (n = 0; n < recs->len; n++) {
+			gint id = g_array_index(recs, struct pinger_rec, n).id;
+
+			pt = g_hash_table_lookup(ht_target, GINT_TO_POINTER(id));
+			if (pt != NULL)
+				pt->dirty = TRUE;
+		}
+
+		g_array_append_vals(stat_done, stats->data, stats->len);
+		g_mutex_unlock(pinger_mutex);
 	}
+}
 
-gboolean pinger_loop_init(void)
+/* hands the results over to the writer, the last one stops it */
+static void pinger_flush_push(gboolean last)
+{
+	struct pinger_flush *pf;
+
+	pf = g_new(struct pinger_flush, 1);
+	pf->last = last;
+
+	g_mutex_lock(pinger_mutex);
+	pf->recs = pinger_collect(last, &pf->stats);
+	g_mutex_unlock(pinger_mutex);
+
+	g_async_queue_push(flush_queue, pf);
+}
+
+static gpointer pinger_writer_work(gpointer data G_GNUC_UNUSED)
+{
+	struct pinger_flush *pf;
+	GError *error = NULL;
+	gboolean save = TRUE;
+	gboolean last;
+
+	if (! mbb_db_dup_conn(&error)) {
+		mbb_log("pinger: mbb_db_dup_conn failed: %s", error->message);
+		g_error_free(error);
+		save = FALSE;
+	}
+
+	do {
+		pf = g_async_queue_pop(flush_queue);
+		last = pf->last;
+
+		if (save)
+			pinger_flush(pf->recs, pf->stats);
+
+		g_array_free(pf->stats, TRUE);
+		g_array_free(pf->recs, TRUE);
+		g_free(pf);
+	} while (! last);
+
+	return NULL;
+}
+
+static gpointer pinger_loop_work(gpointer data G_GNUC_UNUSED)
+{
+	struct pinger_out *out;
+	time_t flush_time;
+	guint64 now;
+
+	out = g_new(struct pinger_out, 1);
+	out->count = 0;
+	flush_time = time(NULL) + PINGER_FLUSH_PERIOD;
+
+	while (! g_atomic_int_get(&pinger_stop)) {
+		struct pollfd pfd;
+
+		pfd.fd = pinger_socket;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, PINGER_TICK_MSEC) < 0 && errno != EINTR) {
+			log_errno("poll");
+			break;
+		}
+
+		now = now_usec();
+
+		g_mutex_lock(pinger_mutex);
+
+		if (pfd.revents & POLLIN)
+			pinger_recv(now);
+
+		out->now = now;
+		timer_wheel_advance(&wheel, now_tick(now), pinger_target_fire, out);
+		pinger_out_flush(out);
+
+		g_mutex_unlock(pinger_mutex);
+
+		if (time(NULL) >= flush_time) {
+			pinger_flush_push(FALSE);
+			flush_time = time(NULL) + PINGER_FLUSH_PERIOD;
+		}
+	}
+
+	g_free(out);
+
+	return NULL;
+}
+
+void pinger_loop_add(gint id, ipv4_t ip, guint period, guint warn_timeout,
+		     struct pinger_state *state)
+{
+	struct pinger_target *pt, *old;
+	guint64 spread;
+
+	pt = g_new0(struct pinger_target, 1);
+	pt->id = id;
+	pt->ip = ip;
+	pt->period = period;
+	pt->warn_timeout = warn_timeout;
+	pt->since = time(NULL);
+	timer_init(&pt->timer);
+
+	if (state != NULL)
+		pt->state = *state;
+
+	/* spread the first echoes over the period */
+	spread = g_random_int_range(0, MAX(PINGER_TICKS(period), 1));
+
+	g_mutex_lock(pinger_mutex);
+
+	/* a target updated in place keeps its statistics */
+	old = g_hash_table_lookup(ht_target, GINT_TO_POINTER(id));
+	if (old != NULL) {
+		if (state == NULL)
+			pt->state = old->state;
+
+		pt->bucket = old->bucket;
+		memset(&old->bucket, 0, sizeof(old->bucket));
+	}
+
+	g_hash_table_replace(ht_target, GINT_TO_POINTER(id), pt);
+	timer_wheel_add(&wheel, &pt->timer, wheel.now + spread);
+	g_mutex_unlock(pinger_mutex);
+}
+
+void pinger_loop_del(gint id)
+{
+	g_mutex_lock(pinger_mutex);
+	g_hash_table_remove(ht_target, GINT_TO_POINTER(id));
+	g_mutex_unlock(pinger_mutex);
+}
+
+gboolean pinger_loop_get_state(gint id, struct pinger_state *state)
+{
+	struct pinger_target *pt;
+
+	g_mutex_lock(pinger_mutex);
+	pt = g_hash_table_lookup(ht_target, GINT_TO_POINTER(id));
+	if (pt != NULL)
+		*state = pt->state;
+	g_mutex_unlock(pinger_mutex);
+
+	return pt != NULL;
+}
+
+gboolean pinger_loop_init(pinger_prune_t prune)
 {
 	gint fd;
 
@@ -100,20 +777,79 @@ gboolean pinger_loop_init(void)
 	if (fd < 0)
 		return FALSE;
 
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		close(fd);
+		return FALSE;
+	}
+
 	pinger_socket = fd;
-	return TRUE;
-}
+	pinger_mutex = g_mutex_new();
+	pinger_prune = prune;
 
-gboolean pinger_loop_isrun(void)
-{
-	return pinger_socket >= 0;
+	stat_done = g_array_new(FALSE, FALSE, sizeof(struct pinger_stat_rec));
+	ht_echo = g_hash_table_new(g_direct_hash, g_direct_equal);
+	ht_target = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal,
+		NULL, (GDestroyNotify) pinger_target_free
+	);
+
+	timer_wheel_init(&wheel, now_tick(now_usec()));
+
+	flush_queue = g_async_queue_new();
+	writer_thread = g_thread_create(pinger_writer_work, NULL, TRUE, NULL);
+	if (writer_thread == NULL) {
+		pinger_loop_end();
+		return FALSE;
+	}
+
+	pinger_stop = 0;
+	pinger_thread = g_thread_create(pinger_loop_work, NULL, TRUE, NULL);
+	if (pinger_thread == NULL) {
+		pinger_loop_end();
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 void pinger_loop_end(void)
 {
+	if (pinger_thread != NULL) {
+		g_atomic_int_set(&pinger_stop, 1);
+		g_thread_join(pinger_thread);
+		pinger_thread = NULL;
+	}
+
+	/* the final results are saved before the targets go */
+	if (writer_thread != NULL) {
+		pinger_flush_push(TRUE);
+		g_thread_join(writer_thread);
+		writer_thread = NULL;
+	}
+
+	if (flush_queue != NULL) {
+		g_async_queue_unref(flush_queue);
+		flush_queue = NULL;
+	}
+
+	if (ht_target != NULL) {
+		g_hash_table_destroy(ht_target);
+		g_hash_table_destroy(ht_echo);
+		ht_target = ht_echo = NULL;
+	}
+
+	if (stat_done != NULL) {
+		g_array_free(stat_done, TRUE);
+		stat_done = NULL;
+	}
+
+	if (pinger_mutex != NULL) {
+		g_mutex_free(pinger_mutex);
+		pinger_mutex = NULL;
+	}
+
 	if (pinger_socket >= 0) {
 		close(pinger_socket);
 		pinger_socket = -1;
 	}
 }
-
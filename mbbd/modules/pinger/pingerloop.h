@@ -5,8 +5,36 @@
 #define PINGER_LOOP_H
 
 #include <glib.h>
+#include <time.h>
 
-gboolean pinger_loop_init(void);
+#include "inet.h"
+
+/* results are summed over intervals of this many seconds */
+#define PINGER_STAT_INTERVAL 300
+
+/* days of raw intervals kept, older ones live in the rollups only */
+#define PINGER_STAT_KEEP 31
+
+extern guint pinger_stat_keep;
+
+struct pinger_state {
+	time_t last_reply;
+
+	guint sent;
+	guint lost;
+
+	/* smoothed round trip time in microseconds */
+	guint rtt;
+};
+
+typedef void (*pinger_prune_t)(void);
+
+gboolean pinger_loop_init(pinger_prune_t prune);
 void pinger_loop_end(void);
 
+void pinger_loop_add(gint id, ipv4_t ip, guint period, guint warn_timeout,
+		     struct pinger_state *state);
+void pinger_loop_del(gint id);
+gboolean pinger_loop_get_state(gint id, struct pinger_state *state);
+
 #endif
@@ -0,0 +1,112 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+/* hierarchical timing wheel: level n holds timers expiring within
+ * TW_SIZE^(n + 1) ticks and is cascaded down once per TW_SIZE^n ticks */
+
+#include <string.h>
+
+#include "timerwheel.h"
+
+#define TW_SPAN(level) ((guint64) 1 << (TW_BITS * (level)))
+
+void timer_wheel_init(struct timer_wheel *tw, guint64 now)
+{
+	memset(tw->slots, 0, sizeof(tw->slots));
+	tw->now = now;
+}
+
+static void tw_link(struct tw_timer **head, struct tw_timer *timer)
+{
+	timer->next = *head;
+	timer->pprev = head;
+
+	if (*head != NULL)
+		(*head)->pprev = &timer->next;
+	*head = timer;
+}
+
+static void tw_insert(struct timer_wheel *tw, struct tw_timer *timer)
+{
+	guint64 delta;
+	guint level;
+
+	if (timer->expire < tw->now)
+		timer->expire = tw->now;
+
+	delta = timer->expire - tw->now;
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < TW_SPAN(level + 1))
+			break;
+	}
+
+	if (delta >= TW_SPAN(TW_LEVELS))
+		timer->expire = tw->now + TW_SPAN(TW_LEVELS) - 1;
+
+	tw_link(
+		&tw->slots[level][(timer->expire >> (TW_BITS * level)) & TW_MASK],
+		timer
+	);
+}
+
+void timer_wheel_add(struct timer_wheel *tw, struct tw_timer *timer,
+		     guint64 expire)
+{
+	if (timer_pending(timer))
+		timer_wheel_del(timer);
+
+	timer->expire = expire;
+	tw_insert(tw, timer);
+}
+
+void timer_wheel_del(struct tw_timer *timer)
+{
+	if (! timer_pending(timer))
+		return;
+
+	*timer->pprev = timer->next;
+	if (timer->next != NULL)
+		timer->next->pprev = timer->pprev;
+
+	timer_init(timer);
+}
+
+static void tw_cascade(struct timer_wheel *tw, guint level)
+{
+	struct tw_timer *timer;
+	guint slot;
+
+	slot = (tw->now >> (TW_BITS * level)) & TW_MASK;
+	while ((timer = tw->slots[level][slot]) != NULL) {
+		timer_wheel_del(timer);
+		tw_insert(tw, timer);
+	}
+
+	if (slot == 0 && level + 1 < TW_LEVELS)
+		tw_cascade(tw, level + 1);
+}
+
+void timer_wheel_advance(struct timer_wheel *tw, guint64 now,
+			 tw_func_t func, gpointer data)
+{
+	struct tw_timer *list, *timer;
+	struct tw_timer **head;
+
+	while (tw->now <= now) {
+		if ((tw->now & TW_MASK) == 0)
+			tw_cascade(tw, 1);
+
+		/* relink the slot to a local head, callbacks may delete timers */
+		head = &tw->slots[0][tw->now & TW_MASK];
+		if ((list = *head) != NULL)
+			list->pprev = &list;
+		*head = NULL;
+		tw->now++;
+
+		/* the callback may re-arm the timer, it lands in a later tick */
+		while ((timer = list) != NULL) {
+			timer_wheel_del(timer);
+			func(timer, data);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+/* Copyright (C) 2010 Mikhail Osipov <mike.osipov@gmail.com> */
+/* Published under the GNU General Public License V.2, see file COPYING */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <glib.h>
+
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+
+struct tw_timer {
+	struct tw_timer *next;
+	struct tw_timer **pprev;
+
+	guint64 expire;
+};
+
+struct timer_wheel {
+	guint64 now;
+
+	struct tw_timer *slots[TW_LEVELS][TW_SIZE];
+};
+
+typedef void (*tw_func_t)(struct tw_timer *timer, gpointer data);
+
+void timer_wheel_init(struct timer_wheel *tw, guint64 now);
+void timer_wheel_add(struct timer_wheel *tw, struct tw_timer *timer,
+		     guint64 expire);
+void timer_wheel_del(struct tw_timer *timer);
+void timer_wheel_advance(struct timer_wheel *tw, guint64 now,
+			 tw_func_t func, gpointer data);
+
+static inline void timer_init(struct tw_timer *timer)
+{
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+static inline gboolean timer_pending(struct tw_timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+#endif
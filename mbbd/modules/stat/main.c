@@ -30,6 +30,9 @@ struct stat_opt {
 	time_t start;
 	time_t end;
 	gchar *step;
+
+	/* suffix of the rollup table the stat is read from */
+	gchar *rollup;
 };
 
 struct size_sym {
@@ -53,22 +56,23 @@ enum {
 #define SQI(name) (&sqi_table[SQI_##name])
 
 struct sqi {
+	gchar *stat;
 	gchar *tables;
 	gchar *field;
 	gchar *cond;
 	gchar *opt_cond;
 } sqi_table[] = { {
-	"unit_stat s, units u", "u.unit_name", "s.unit_id = u.unit_id", NULL
+	"unit_stat", "units u", "u.unit_name", "s.unit_id = u.unit_id", NULL
 }, {
-	"unit_stat s, units u, consumers c", "c.consumer_name",
+	"unit_stat", "units u, consumers c", "c.consumer_name",
 	"s.unit_id = u.unit_id and u.consumer_id = c.consumer_id", NULL
 }, {
-	"link_stat s, gwlinks l, operators o", "o.oper_name",
+	"link_stat", "gwlinks l, operators o", "o.oper_name",
 	"s.gwlink_id = l.gwlink_id and l.oper_id = o.oper_id", NULL
 }, {
-	"link_stat s", "gwlink_id", NULL, NULL
+	"link_stat", NULL, "gwlink_id", NULL, NULL
 }, {
-	"link_stat s, gwlinks l, gateways g", "g.gw_name",
+	"link_stat", "gwlinks l, gateways g", "g.gw_name",
 	"s.gwlink_id = l.gwlink_id and l.gw_id = g.gw_id", NULL
 } };
 
@@ -124,6 +128,38 @@ static XmlTag *stat_exec_query(gchar *query, gboolean bystep, gboolean reorder)
 
 #define ROUND_FMT(field) "round(sum(" #field ") / %d, 3)"
 
+/* coarsest rollup table which still holds the requested range exactly,
+ * rollups are bucketed in the db time zone, so the db tells */
+static gchar *stat_rollup_suffix(struct stat_opt *so)
+{
+	static gchar *suffixes[] = { "_month", "_day" };
+
+	MbbDbIter *iter;
+	gchar *suffix = "";
+	gchar *query;
+	gchar *value;
+	guint n;
+
+	query = query_function("stat_rollup_suffix", "tts",
+		so->start, so->end, so->step
+	);
+
+	iter = mbb_db_query_iter(query, NULL);
+	if (iter == NULL)
+		return suffix;
+
+	if (mbb_db_iter_next(iter) && (value = mbb_db_iter_value(iter, 0))) {
+		for (n = 0; n < NELEM(suffixes); n++) {
+			if (! strcmp(value, suffixes[n]))
+				suffix = suffixes[n];
+		}
+	}
+
+	mbb_db_iter_free(iter);
+
+	return suffix;
+}
+
 static gchar *stat_query(struct sqi *sqi, GSList *names, struct stat_opt *so)
 {
 	query_format("select %S", sqi->field);
@@ -134,17 +170,21 @@ static gchar *stat_query(struct sqi *sqi, GSList *names, struct stat_opt *so)
 		query_append_format(", " ROUND_FMT(nbyte_out), so->block_size);
 	}
 
-	if (so->step == NULL)
-		query_append_format(" from %S", sqi->tables);
-	else {
+	if (so->step != NULL) {
 		if (so->human == FALSE)
 			query_append(", ptou(d.date)");
 		else
 			query_append(", to_char(d.date, 'YYYY-MM-DD HH24-MI')");
-
-		query_append_format(" from %S, dates d", sqi->tables);
 	}
 
+	query_append_format(" from %S%S s", sqi->stat, so->rollup);
+
+	if (sqi->tables != NULL)
+		query_append_format(", %S", sqi->tables);
+
+	if (so->step != NULL)
+		query_append(", dates d");
+
 	query_append(" where ");
 	if (names != NULL) {
 		query_append_format("%S in (%s", sqi->field, names->data);
@@ -160,10 +200,11 @@ static gchar *stat_query(struct sqi *sqi, GSList *names, struct stat_opt *so)
 			query_append_format("%S and ", sqi->opt_cond);
 	}
 
+	/* constant bounds let the planner prune stat partitions */
+	query_append_format(POINT_IN_COND, so->start, so->end);
+
 	if (so->step != NULL)
-		query_append_format(POINT_BY_COND, so->step);
-	else
-		query_append_format(POINT_IN_COND, so->start, so->end);
+		query_append_format(" and " POINT_BY_COND, so->step);
 
 	query_append_format(" group by %S", sqi->field);
 
@@ -189,14 +230,16 @@ static XmlTag *stat_fetch(struct sqi *sqi, GSList *names, struct stat_opt *so)
 	return stat_exec_query(query, so->step != NULL, so->human);
 }
 
-static gboolean create_view_dates(time_t start, time_t end, gchar *step,
-				  GError **error)
+static gboolean create_view_dates(struct stat_opt *so, GError **error)
 {
+	gchar *table;
 	gchar *query;
 
+	table = g_strconcat("unit_stat", so->rollup, NULL);
 	query = query_function("create_view_dates",
-		"sstt", "dates", step, start, end
+		"sstts", "dates", so->step, so->start, so->end, table
 	);
+	g_free(table);
 
 	return mbb_db_query(query, NULL, NULL, error);
 }
@@ -357,17 +400,20 @@ static void stat_common(XmlTag *tag, XmlTag **ans, struct sqi *sqi)
 	so.start = start;
 	so.end = end;
 
+	/* the dates view lives on one connection */
+	if (! mbb_db_conn_get(&error)) final
+		*ans = mbb_xml_msg_from_error(error);
+
 	names = get_name_list(xml_tag_path_attr_list(tag, "name", "value"));
 
-	on_final { g_slist_free(names); }
+	on_final { g_slist_free(names); mbb_db_conn_put(); }
 
-	if (! mbb_db_dup_conn_once(&error)) final
-		*ans = mbb_xml_msg_from_error(error);
+	so.rollup = stat_rollup_suffix(&so);
 
 	if (so.step == NULL)
 		*ans = stat_fetch(sqi, names, &so);
 	else {
-		if (! create_view_dates(start, end, so.step, &error)) final
+		if (! create_view_dates(&so, &error)) final
 			*ans = mbb_xml_msg_from_error(error);
 
 		*ans = stat_fetch(sqi, names, &so);
@@ -375,6 +421,7 @@ static void stat_common(XmlTag *tag, XmlTag **ans, struct sqi *sqi)
 		drop_view_dates();
 	}
 
+	mbb_db_conn_put();
 	g_slist_free(names);
 }
 
@@ -406,6 +453,7 @@ static void stat_gateway(XmlTag *tag, XmlTag **ans)
 static void self_sqi_init(struct sqi *sqi, gchar *name)
 {
 	sqi->field = name;
+	sqi->stat = SQI(CONSUMER)->stat;
 	sqi->tables = SQI(CONSUMER)->tables;
 	sqi->cond = SQI(CONSUMER)->cond;
 
@@ -452,7 +500,7 @@ static void stat_wipe(XmlTag *tag, XmlTag **ans)
 }
 
 MBB_INIT_FUNCTIONS_DO
-	MBB_FUNC_STRUCT("mbb-stat-unit", stat_unit, MBB_CAP_ADMIN),
+	MBB_FUNC_CACHED("mbb-stat-unit", stat_unit, MBB_CAP_ADMIN, 60),
 	MBB_FUNC_STRUCT("mbb-stat-consumer", stat_consumer, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-stat-operator", stat_operator, MBB_CAP_ADMIN),
 	MBB_FUNC_STRUCT("mbb-stat-link", stat_link, MBB_CAP_ADMIN),
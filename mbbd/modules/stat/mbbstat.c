@@ -6,6 +6,7 @@
 #include "mbbinit.h"
 #include "mbblog.h"
 #include "mbbvar.h"
+#include "mbbfunc.h"
 #include "mbbdb.h"
 
 #include "varconv.h"
@@ -15,6 +16,10 @@
 
 #include <string.h>
 
+/* partitions are kept at least this far ahead of the current time */
+#define STAT_PARTITION_AHEAD (31 * 24 * 3600)
+#define STAT_PIPELINE_DEPTH 256
+
 struct stat_rec {
 	guint64 nbyte_in;
 	guint64 nbyte_out;
@@ -46,6 +51,8 @@ struct mbb_stat_pool {
 	GHashTable *ulstat;
 };
 
+static gchar *stat_tables[] = { "unit_stat", "link_stat", "unit_link_stat" };
+
 static gboolean double_key_equal(struct double_key *a, struct double_key *b)
 {
 	if (a->aid != b->aid)
@@ -155,40 +162,45 @@ static inline gboolean rec_save_query(gchar *query, const gchar *func)
 	return TRUE;
 }
 
-static gboolean unit_link_rec_save(struct stat_rec *rec)
+static inline gboolean rec_save_check(gboolean ok, GError *error,
+				      const gchar *func)
+{
+	if (! ok) {
+		mbb_log("%s: %s", func, error->message);
+		g_error_free(error);
+	}
+
+	return ok;
+}
+
+static gboolean unit_link_rec_send(struct stat_rec *rec, GError **error)
 {
 	struct double_key *key = STAT_REC_KEY(rec);
-	gchar *query;
 
-	query = query_function("update_unit_link_stat", "ddqqt",
+	return mbb_db_send(error,
+		"select update_unit_link_stat($1, $2, $3, $4, $5);", "ddqqt",
 		key->aid, key->bid, rec->nbyte_in, rec->nbyte_out, key->point
 	);
-
-	return rec_save_query(query, __FUNCTION__);
 }
 
-static gboolean unit_rec_save(struct stat_rec *rec)
+static gboolean unit_rec_send(struct stat_rec *rec, GError **error)
 {
 	struct single_key *key = STAT_REC_KEY(rec);
-	gchar *query;
 
-	query = query_function("update_unit_stat", "dqqt",
+	return mbb_db_send(error,
+		"select update_unit_stat($1, $2, $3, $4);", "dqqt",
 		key->id, rec->nbyte_in, rec->nbyte_out, key->point
 	);
-
-	return rec_save_query(query, __FUNCTION__);
 }
 
-static gboolean link_rec_save(struct stat_rec *rec)
+static gboolean link_rec_send(struct stat_rec *rec, GError **error)
 {
 	struct single_key *key = STAT_REC_KEY(rec);
-	gchar *query;
 
-	query = query_function("update_link_stat", "dqqt",
+	return mbb_db_send(error,
+		"select update_link_stat($1, $2, $3, $4);", "dqqt",
 		key->id, rec->nbyte_in, rec->nbyte_out, key->point
 	);
-
-	return rec_save_query(query, __FUNCTION__);
 }
 
 gboolean mbb_stat_pool_init(void)
@@ -237,20 +249,101 @@ static inline void db_commit(void)
 	}
 }
 
-static gboolean save_records(GHashTable *ht, gboolean (*save)(struct stat_rec *))
+/* all the keys begin with the point */
+static gboolean table_time_range(GHashTable *ht, time_t *start, time_t *end,
+				 gboolean found)
 {
-	struct stat_rec *rec;
 	GHashTableIter iter;
+	union key *key;
 
 	g_hash_table_iter_init(&iter, ht);
-	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &rec)) {
-		if (! mbb_task_poll_state() || ! save(rec))
+	while (g_hash_table_iter_next(&iter, (gpointer *) &key, NULL)) {
+		if (! found || key->point < *start)
+			*start = key->point;
+		if (! found || key->point >= *end)
+			*end = key->point + 1;
+		found = TRUE;
+	}
+
+	return found;
+}
+
+static gboolean pool_time_range(struct mbb_stat_pool *pool,
+				time_t *start, time_t *end)
+{
+	gboolean found;
+
+	found = table_time_range(pool->ustat, start, end, FALSE);
+	found = table_time_range(pool->lstat, start, end, found);
+	found = table_time_range(pool->ulstat, start, end, found);
+
+	return found;
+}
+
+static gboolean create_partitions(struct mbb_stat_pool *pool)
+{
+	time_t start, end;
+	gchar *query;
+
+	if (! pool_time_range(pool, &start, &end))
+		start = end = time(NULL);
+	end = MAX(end, time(NULL) + STAT_PARTITION_AHEAD);
+
+	for (guint n = 0; n < NELEM(stat_tables); n++) {
+		query = query_function("create_stat_partitions", "stt",
+			stat_tables[n], start, end
+		);
+
+		if (! rec_save_query(query, __FUNCTION__))
 			return FALSE;
 	}
 
 	return TRUE;
 }
 
+static gboolean refresh_rollups(struct mbb_stat_pool *pool)
+{
+	time_t start, end;
+	gchar *query;
+
+	if (! pool_time_range(pool, &start, &end))
+		return TRUE;
+
+	query = query_function("stat_rollup", "tt", start, end);
+
+	return rec_save_query(query, __FUNCTION__);
+}
+
+/* upserts are pipelined, results are collected every half of the depth */
+static gboolean save_records(GHashTable *ht,
+			     gboolean (*send)(struct stat_rec *, GError **))
+{
+	struct stat_rec *rec;
+	GHashTableIter iter;
+	GError *error = NULL;
+	guint nsent = 0;
+	gboolean ok = TRUE;
+
+	g_hash_table_iter_init(&iter, ht);
+	while (ok && g_hash_table_iter_next(&iter, NULL, (gpointer *) &rec)) {
+		if (! mbb_task_poll_state()) {
+			mbb_db_sync(0, NULL);
+			return FALSE;
+		}
+
+		ok = send(rec, &error);
+		if (ok && ++nsent % (STAT_PIPELINE_DEPTH / 2) == 0)
+			ok = mbb_db_sync(STAT_PIPELINE_DEPTH / 2, &error);
+	}
+
+	if (ok)
+		ok = mbb_db_sync(0, &error);
+	else
+		mbb_db_sync(0, NULL);
+
+	return rec_save_check(ok, error, __FUNCTION__);
+}
+
 void mbb_stat_pool_save(struct mbb_stat_pool *pool)
 {
 	static GStaticMutex mutex = G_STATIC_MUTEX_INIT;
@@ -272,16 +365,23 @@ void mbb_stat_pool_save(struct mbb_stat_pool *pool)
 	if (! db_begin())
 		goto out;
 
-	if (! save_records(pool->ustat, unit_rec_save))
+	if (! create_partitions(pool))
+		goto rollback;
+
+	if (! save_records(pool->ustat, unit_rec_send))
+		goto rollback;
+
+	if (! save_records(pool->lstat, link_rec_send))
 		goto rollback;
 
-	if (! save_records(pool->lstat, link_rec_save))
+	if (! save_records(pool->ulstat, unit_link_rec_send))
 		goto rollback;
 
-	if (! save_records(pool->ulstat, unit_link_rec_save))
+	if (! refresh_rollups(pool))
 		goto rollback;
 
 	db_commit();
+	mbb_func_cache_invalidate();
 	goto out;
 
 rollback:
@@ -292,31 +392,37 @@ out:
 	mbb_stat_pool_free(pool);
 }
 
+/* whole months are truncated, the rest is deleted from its partition */
 static gboolean stat_table_clean(gchar *table, time_t start, time_t end,
 				 GError **error)
 {
-	return mbb_db_update(error,
-		table, "qq",
-		"nbyte_in", (guint64) 0, "nbyte_out", (guint64) 0,
-		"point >= %lld and point < %lld",
-		(guint64) start, (guint64) end
-	);
+	gchar *query;
+
+	query = query_function("stat_wipe", "stt", table, start, end);
+
+	return mbb_db_query(query, NULL, NULL, error);
 }
 
 gboolean mbb_stat_db_wipe(time_t start, time_t end, GError **error)
 {
-	gchar *tables[] = { "unit_stat", "link_stat", "unit_link_stat" };
+	gchar *query;
 
 	if (! mbb_db_begin(error))
 		return FALSE;
 
-	for (guint n = 0; n < NELEM(tables); n++) {
-		if (! stat_table_clean(tables[n], start, end, error)) {
+	for (guint n = 0; n < NELEM(stat_tables); n++) {
+		if (! stat_table_clean(stat_tables[n], start, end, error)) {
 			mbb_db_rollback(NULL);
 			return FALSE;
 		}
 	}
 
+	query = query_function("stat_rollup", "tt", start, end);
+	if (! mbb_db_query(query, NULL, NULL, error)) {
+		mbb_db_rollback(NULL);
+		return FALSE;
+	}
+
 	mbb_db_commit(NULL);
 
 	return TRUE;
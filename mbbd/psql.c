@@ -12,6 +12,48 @@
 
 #include <libpq-fe.h>
 
+/* type oids of binary parameters */
+#define PQ_BOOLOID 16
+#define PQ_INT8OID 20
+#define PQ_INT4OID 23
+
+#define PQ_CONN(conn) (((struct pq_conn *) (conn))->pg_conn)
+
+struct pq_conn {
+	PGconn *pg_conn;
+
+	/* prepared statement names keyed by parameter types and command */
+	GHashTable *stmts;
+	guint nstmt;
+
+	/* pipelined commands awaiting their results */
+	GQueue pending;
+	gboolean unsynced;
+	gchar *abort_msg;
+};
+
+enum {
+	PQ_PENDING_PREPARE,
+	PQ_PENDING_EXEC,
+	PQ_PENDING_SYNC
+};
+
+struct pq_pending {
+	gint kind;
+	gchar *name;
+
+	struct mbb_db_iter *iter;
+	GError *error;
+};
+
+struct pq_params {
+	const gchar **values;
+	gint *lengths;
+	gint *formats;
+	Oid *types;
+	guint64 *bin;
+};
+
 struct mbb_db_iter {
 	PGresult *res;
 	gint nrow;
@@ -19,6 +61,9 @@ struct mbb_db_iter {
 	gint current_row;
 };
 
+static void pq_iter_free(struct mbb_db_iter *iter);
+static void pq_drain(struct pq_conn *pc);
+
 static struct mbb_db_iter *iter_new(PGresult *res)
 {
 	struct mbb_db_iter *iter;
@@ -55,6 +100,7 @@ static void append_key_value(GString *string, gchar *key, gchar *value)
 
 static gpointer pq_open(struct mbb_db_auth *auth, GError **error)
 {
+	struct pq_conn *pc;
 	PGconn *conn;
 	GString *string;
 
@@ -85,27 +131,53 @@ static gpointer pq_open(struct mbb_db_auth *auth, GError **error)
 		return NULL;
 	}
 
-	return conn;
+	pc = g_new(struct pq_conn, 1);
+	pc->pg_conn = conn;
+	pc->stmts = g_hash_table_new_full(
+		g_str_hash, g_str_equal, g_free, g_free
+	);
+	pc->nstmt = 0;
+
+	g_queue_init(&pc->pending);
+	pc->unsynced = FALSE;
+	pc->abort_msg = NULL;
+
+	return pc;
+}
+
+/* class 23 is integrity constraint violation, retrying it is pointless */
+static gint pq_error_code(PGresult *res)
+{
+	gchar *state;
+
+	state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+	if (state != NULL && ! strncmp(state, "23", 2))
+		return MBB_DB_ERROR_CONSTRAINT;
+
+	return MBB_DB_ERROR_QUERY;
 }
 
 static PGresult *pq_exec(gpointer conn, const gchar *command, GError **error)
 {
-	PGconn *pg_conn = conn;
 	ExecStatusType status;
+	PGconn *pg_conn;
 	PGresult *res;
 
-	if (pg_conn == NULL) {
+	if (conn == NULL) {
 		g_set_error(error, MBB_DB_ERROR,
 			MBB_DB_ERROR_NOT_CONNECTED,
 			"not connected");
 		return NULL;
 	}
 
+	pq_drain(conn);
+
+	pg_conn = PQ_CONN(conn);
 	res = PQexec(pg_conn, command);
 	status = PQresultStatus(res);
 	if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
 		g_set_error(error, MBB_DB_ERROR,
-			MBB_DB_ERROR_QUERY,
+			pq_error_code(res),
 			"%s", PQerrorMessage(pg_conn));
 		PQclear(res);
 		res = NULL;
@@ -117,7 +189,6 @@ static PGresult *pq_exec(gpointer conn, const gchar *command, GError **error)
 static gboolean pq_query(gpointer conn, gchar *command, mbb_db_func_t func,
 			 gpointer user_data, GError **error)
 {
-	PGconn *pg_conn = conn;
 	PGresult *res;
 	gint nrow;
 	gint ncol;
@@ -126,7 +197,7 @@ static gboolean pq_query(gpointer conn, gchar *command, mbb_db_func_t func,
 	gboolean ret;
 
 	pp = NULL;
-	res = pq_exec(pg_conn, command, error);
+	res = pq_exec(conn, command, error);
 	if (res == NULL)
 		return FALSE;
 
@@ -167,14 +238,16 @@ out:
 
 static gchar *pq_escape(gpointer conn, gchar *str)
 {
-	PGconn *pg_conn = conn;
+	PGconn *pg_conn;
 	gint error;
 	gchar *tmp;
 	gsize len;
 
-	if (pg_conn == NULL)
+	if (conn == NULL)
 		return NULL;
 
+	pg_conn = PQ_CONN(conn);
+
 	len = strlen(str);
 	tmp = g_malloc(2 * len + 1);
 
@@ -203,6 +276,445 @@ static struct mbb_db_iter *pq_query_iter(gpointer conn, gchar *command, GError *
 	return iter;
 }
 
+static void pq_pending_push(struct pq_conn *pc, gint kind, gchar *name)
+{
+	struct pq_pending *pp;
+
+	pp = g_new0(struct pq_pending, 1);
+	pp->kind = kind;
+	pp->name = g_strdup(name);
+
+	g_queue_push_tail(&pc->pending, pp);
+}
+
+static void pq_pending_free(struct pq_pending *pp)
+{
+	if (pp->iter != NULL)
+		pq_iter_free(pp->iter);
+	if (pp->error != NULL)
+		g_error_free(pp->error);
+
+	g_free(pp->name);
+	g_free(pp);
+}
+
+static gchar *pq_stmt_get(struct pq_conn *pc, gchar *command, gint nparams,
+			  Oid *types, gboolean send, GError **error)
+{
+	ExecStatusType status;
+	PGresult *res;
+	GString *key;
+	gchar *name;
+	gint n;
+
+	key = g_string_new(NULL);
+	for (n = 0; n < nparams; n++)
+		g_string_append_printf(key, "%u,", types[n]);
+	g_string_append_printf(key, ":%s", command);
+
+	name = g_hash_table_lookup(pc->stmts, key->str);
+	if (name != NULL) {
+		g_string_free(key, TRUE);
+		return name;
+	}
+
+	name = g_strdup_printf("mbb_stmt_%u", ++pc->nstmt);
+
+	if (send) {
+		/* the outcome arrives with the pipelined results */
+		status = PGRES_COMMAND_OK;
+		if (PQsendPrepare(pc->pg_conn, name, command, nparams, types))
+			pq_pending_push(pc, PQ_PENDING_PREPARE, name);
+		else
+			status = PGRES_FATAL_ERROR;
+	} else {
+		res = PQprepare(pc->pg_conn, name, command, nparams, types);
+		status = PQresultStatus(res);
+		PQclear(res);
+	}
+
+	if (status != PGRES_COMMAND_OK) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_QUERY,
+			"%s", PQerrorMessage(pc->pg_conn));
+		g_string_free(key, TRUE);
+		g_free(name);
+		return NULL;
+	}
+
+	g_hash_table_insert(pc->stmts, g_string_free(key, FALSE), name);
+
+	return name;
+}
+
+static void pq_param_set(struct mbb_db_param *param, guint64 *bin,
+			 const gchar **value, gint *length, gint *format,
+			 Oid *type)
+{
+	*format = 1;
+
+	switch (param->type) {
+	case MBB_DB_PARAM_INT:
+		*(guint32 *) bin = g_htonl((guint32) param->un.i);
+		*length = sizeof(guint32);
+		*type = PQ_INT4OID;
+		break;
+	case MBB_DB_PARAM_INT64:
+		*bin = GUINT64_TO_BE((guint64) param->un.q);
+		*length = sizeof(guint64);
+		*type = PQ_INT8OID;
+		break;
+	case MBB_DB_PARAM_BOOL:
+		*(guchar *) bin = param->un.b ? 1 : 0;
+		*length = 1;
+		*type = PQ_BOOLOID;
+		break;
+	case MBB_DB_PARAM_TEXT:
+		/* untyped like a quoted literal, so inet and friends still cast */
+		*value = param->un.s;
+		*length = 0;
+		*format = 0;
+		*type = 0;
+		return;
+	default:
+		*value = NULL;
+		*length = 0;
+		*format = 0;
+		*type = 0;
+		return;
+	}
+
+	*value = (const gchar *) bin;
+}
+
+static void pq_params_init(struct pq_params *pp, gint nparams,
+			   struct mbb_db_param *params)
+{
+	gint n;
+
+	pp->values = g_new(const gchar *, nparams + 1);
+	pp->lengths = g_new(gint, nparams + 1);
+	pp->formats = g_new(gint, nparams + 1);
+	pp->types = g_new(Oid, nparams + 1);
+	pp->bin = g_new(guint64, nparams + 1);
+
+	for (n = 0; n < nparams; n++) {
+		pq_param_set(params + n, pp->bin + n, pp->values + n,
+			pp->lengths + n, pp->formats + n, pp->types + n
+		);
+	}
+}
+
+static void pq_params_free(struct pq_params *pp)
+{
+	g_free(pp->values);
+	g_free(pp->lengths);
+	g_free(pp->formats);
+	g_free(pp->types);
+	g_free(pp->bin);
+}
+
+static struct mbb_db_iter *pq_result_iter(PGresult *res, GError **error)
+{
+	ExecStatusType status;
+
+	status = PQresultStatus(res);
+	if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+		g_set_error(error, MBB_DB_ERROR,
+			pq_error_code(res),
+			"%s", PQresultErrorMessage(res));
+		PQclear(res);
+		return NULL;
+	}
+
+	return iter_new(res);
+}
+
+static struct mbb_db_iter *pq_query_prepared(gpointer conn, gchar *command,
+					     gint nparams,
+					     struct mbb_db_param *params,
+					     GError **error)
+{
+	struct pq_conn *pc = conn;
+	struct pq_params pp;
+	PGresult *res;
+	gchar *name;
+
+	if (pc == NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_NOT_CONNECTED,
+			"not connected");
+		return NULL;
+	}
+
+	pq_drain(pc);
+	pq_params_init(&pp, nparams, params);
+
+	res = NULL;
+	name = pq_stmt_get(pc, command, nparams, pp.types, FALSE, error);
+	if (name != NULL) {
+		res = PQexecPrepared(pc->pg_conn, name, nparams,
+			pp.values, pp.lengths, pp.formats, 0
+		);
+	}
+
+	pq_params_free(&pp);
+
+	if (res == NULL)
+		return NULL;
+
+	return pq_result_iter(res, error);
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+static gboolean pq_send_prepared(gpointer conn, gchar *command, gint nparams,
+				 struct mbb_db_param *params, GError **error)
+{
+	struct pq_conn *pc = conn;
+	struct pq_params pp;
+	gboolean ret;
+	gchar *name;
+
+	if (pc == NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_NOT_CONNECTED,
+			"not connected");
+		return FALSE;
+	}
+
+	if (PQpipelineStatus(pc->pg_conn) == PQ_PIPELINE_OFF &&
+	    ! PQenterPipelineMode(pc->pg_conn)) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_QUERY,
+			"%s", PQerrorMessage(pc->pg_conn));
+		return FALSE;
+	}
+
+	pq_params_init(&pp, nparams, params);
+
+	ret = FALSE;
+	name = pq_stmt_get(pc, command, nparams, pp.types, TRUE, error);
+	if (name != NULL) {
+		ret = PQsendQueryPrepared(pc->pg_conn, name, nparams,
+			pp.values, pp.lengths, pp.formats, 0
+		);
+
+		if (ret) {
+			pq_pending_push(pc, PQ_PENDING_EXEC, NULL);
+			pc->unsynced = TRUE;
+		} else {
+			g_set_error(error, MBB_DB_ERROR,
+				MBB_DB_ERROR_QUERY,
+				"%s", PQerrorMessage(pc->pg_conn));
+		}
+	}
+
+	pq_params_free(&pp);
+
+	return ret;
+}
+
+static struct mbb_db_iter *pq_pipeline_result(struct pq_conn *pc,
+					      PGresult *res, GError **error)
+{
+	if (res == NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_QUERY,
+			"%s", PQerrorMessage(pc->pg_conn));
+		return NULL;
+	}
+
+	if (PQresultStatus(res) != PGRES_PIPELINE_ABORTED)
+		return pq_result_iter(res, error);
+
+	PQclear(res);
+
+	/* commands after a failed one are skipped up to the next sync */
+	if (pc->abort_msg != NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_QUERY,
+			"%s", pc->abort_msg);
+	} else {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_QUERY,
+			"pipeline aborted");
+	}
+
+	return NULL;
+}
+
+static gboolean pq_stmt_forget(gpointer key, gpointer value, gpointer name)
+{
+	(void) key;
+
+	return ! strcmp(value, name);
+}
+
+static void pq_pipeline_abort(struct pq_conn *pc, gchar *msg)
+{
+	if (pc->abort_msg == NULL)
+		pc->abort_msg = g_strdup(msg);
+}
+
+static struct mbb_db_iter *pq_receive(gpointer conn, GError **error)
+{
+	struct pq_conn *pc = conn;
+	struct mbb_db_iter *iter;
+	struct pq_pending *pp;
+	GError *tmp = NULL;
+	PGresult *res;
+
+	if (pc == NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_NOT_CONNECTED,
+			"not connected");
+		return NULL;
+	}
+
+	if (pc->unsynced) {
+		if (PQpipelineSync(pc->pg_conn))
+			pq_pending_push(pc, PQ_PENDING_SYNC, NULL);
+		pc->unsynced = FALSE;
+	}
+
+	while ((pp = g_queue_pop_head(&pc->pending)) != NULL) {
+		res = PQgetResult(pc->pg_conn);
+
+		switch (pp->kind) {
+		case PQ_PENDING_SYNC:
+			PQclear(res);
+			g_free(pc->abort_msg);
+			pc->abort_msg = NULL;
+
+			if (g_queue_is_empty(&pc->pending))
+				PQexitPipelineMode(pc->pg_conn);
+			break;
+		case PQ_PENDING_PREPARE:
+			if (res == NULL || PQresultStatus(res) != PGRES_COMMAND_OK) {
+				pq_pipeline_abort(pc, res != NULL ?
+					PQresultErrorMessage(res) :
+					PQerrorMessage(pc->pg_conn)
+				);
+
+				g_hash_table_foreach_remove(pc->stmts,
+					pq_stmt_forget, pp->name
+				);
+			}
+
+			if (res != NULL) {
+				PQclear(res);
+				PQgetResult(pc->pg_conn);
+			}
+			break;
+		case PQ_PENDING_EXEC:
+			iter = pq_pipeline_result(pc, res, &tmp);
+			if (res != NULL)
+				PQgetResult(pc->pg_conn);
+			if (iter == NULL) {
+				pq_pipeline_abort(pc, tmp->message);
+				g_propagate_error(error, tmp);
+			}
+
+			pq_pending_free(pp);
+			return iter;
+		}
+
+		pq_pending_free(pp);
+	}
+
+	g_set_error(error, MBB_DB_ERROR,
+		MBB_DB_ERROR_QUERY,
+		"no pending result");
+
+	return NULL;
+}
+#else
+/* no pipeline mode in this libpq, results are queued as they come */
+static gboolean pq_send_prepared(gpointer conn, gchar *command, gint nparams,
+				 struct mbb_db_param *params, GError **error)
+{
+	struct pq_conn *pc = conn;
+	struct pq_pending *pp;
+	GQueue pending;
+
+	if (pc == NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_NOT_CONNECTED,
+			"not connected");
+		return FALSE;
+	}
+
+	/* pq_query_prepared drains the queue, keep it aside */
+	pending = pc->pending;
+	g_queue_init(&pc->pending);
+
+	pp = g_new0(struct pq_pending, 1);
+	pp->kind = PQ_PENDING_EXEC;
+	pp->iter = pq_query_prepared(conn, command, nparams, params,
+		&pp->error
+	);
+
+	pc->pending = pending;
+	g_queue_push_tail(&pc->pending, pp);
+
+	return TRUE;
+}
+
+static struct mbb_db_iter *pq_receive(gpointer conn, GError **error)
+{
+	struct pq_conn *pc = conn;
+	struct mbb_db_iter *iter;
+	struct pq_pending *pp;
+
+	if (pc == NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_NOT_CONNECTED,
+			"not connected");
+		return NULL;
+	}
+
+	pp = g_queue_pop_head(&pc->pending);
+	if (pp == NULL) {
+		g_set_error(error, MBB_DB_ERROR,
+			MBB_DB_ERROR_QUERY,
+			"no pending result");
+		return NULL;
+	}
+
+	iter = pp->iter;
+	if (iter == NULL) {
+		g_propagate_error(error, pp->error);
+		pp->error = NULL;
+	}
+
+	pp->iter = NULL;
+	pq_pending_free(pp);
+
+	return iter;
+}
+#endif
+
+/* results nobody is going to receive */
+static void pq_drain(struct pq_conn *pc)
+{
+	struct mbb_db_iter *iter;
+
+	if (g_queue_is_empty(&pc->pending) && ! pc->unsynced)
+		return;
+
+	msg_warn("discard pipelined results");
+
+	while (! g_queue_is_empty(&pc->pending)) {
+		GError *error = NULL;
+
+		iter = pq_receive(pc, &error);
+		if (iter != NULL)
+			pq_iter_free(iter);
+		else
+			g_error_free(error);
+	}
+}
+
 static gboolean pq_iter_next(struct mbb_db_iter *iter)
 {
 	iter->current_row++;
@@ -243,11 +755,16 @@ static void pq_iter_free(struct mbb_db_iter *iter)
 
 static void pq_close(gpointer conn)
 {
-	PGconn *pg_conn = conn;
+	struct pq_conn *pc = conn;
 
-	if (pg_conn != NULL) {
+	if (pc != NULL) {
 		msg_warn("close db connection");
-		PQfinish(pg_conn);
+		PQfinish(pc->pg_conn);
+		g_queue_foreach(&pc->pending, (GFunc) pq_pending_free, NULL);
+		g_queue_clear(&pc->pending);
+		g_hash_table_destroy(pc->stmts);
+		g_free(pc->abort_msg);
+		g_free(pc);
 	}
 }
 
@@ -279,12 +796,42 @@ static gboolean commit(gpointer conn, GError **error)
 	return silent_exec(conn, "commit", error);
 }
 
+static gboolean pq_check(gpointer conn)
+{
+	struct pq_conn *pc = conn;
+	PGconn *pg_conn = pc->pg_conn;
+
+	if (PQstatus(pg_conn) != CONNECTION_OK) {
+		msg_warn("reset db connection");
+		PQreset(pg_conn);
+
+		/* statements and pipelined results died with the old session */
+		g_hash_table_remove_all(pc->stmts);
+		g_queue_foreach(&pc->pending, (GFunc) pq_pending_free, NULL);
+		g_queue_clear(&pc->pending);
+		pc->unsynced = FALSE;
+
+		return PQstatus(pg_conn) == CONNECTION_OK;
+	}
+
+	pq_drain(pc);
+
+	/* transaction left open by the previous owner */
+	if (PQtransactionStatus(pg_conn) != PQTRANS_IDLE)
+		return silent_exec(conn, "rollback", NULL);
+
+	return TRUE;
+}
+
 static struct mbb_db pg_db = {
 	.name = "postgres",
 
 	.open = pq_open,
 	.query = pq_query,
 	.query_iter = pq_query_iter,
+	.query_prepared = pq_query_prepared,
+	.send_prepared = pq_send_prepared,
+	.receive = pq_receive,
 
 	.escape = pq_escape,
 
@@ -298,6 +845,7 @@ static struct mbb_db pg_db = {
 	.rollback = rollback,
 	.commit = commit,
 
+	.check = pq_check,
 	.close = pq_close
 };
 
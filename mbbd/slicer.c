@@ -400,6 +400,68 @@ static void slicer_apply_change(struct slicer *slicer, gpointer data,
 	}
 }
 
+static void slicer_push(struct slicer *slicer, gpointer data,
+			gpointer begin, gpointer end)
+{
+	struct slicer_entry *entry;
+
+	entry = slicer_entry_new(data, begin, end);
+	insert_before(slicer, NULL, entry);
+
+	if (data != NULL)
+		slicer->count++;
+}
+
+/*
+ * replaces slicer content with pieces which must be disjoint and sorted,
+ * keys and data of pieces are owned by slicer after call,
+ * holes between pieces are filled with null entries
+ */
+void slicer_load(struct slicer *slicer, GArray *pieces)
+{
+	struct slicer_entry *first, *last;
+	struct slice_piece *piece = NULL;
+	gpointer begin, end;
+	guint n;
+
+	g_return_if_fail(slicer->queue->length != 0);
+
+	first = (struct slicer_entry *) slicer->queue->head->data;
+	last = (struct slicer_entry *) slicer->queue->tail->data;
+
+	begin = slicer->sops->dup(first->slice.begin);
+	end = slicer->sops->dup(last->slice.end);
+
+	g_queue_foreach(slicer->queue, (GFunc) slicer_entry_free, slicer);
+	g_queue_clear(slicer->queue);
+	g_tree_destroy(slicer->tree);
+
+	slicer->tree = g_tree_new_with_data(
+		(GCompareDataFunc) slice_cmp, slicer->sops
+	);
+
+	for (n = 0; n < pieces->len; n++) {
+		piece = &g_array_index(pieces, struct slice_piece, n);
+
+		if (begin_begin_cmp(slicer->sops, begin, piece->slice.begin) < 0) {
+			slicer_push(slicer, NULL, begin, slicer->sops->dec(
+				slicer->sops->dup(piece->slice.begin)
+			));
+		} else if (slicer->sops->free != NULL)
+			slicer->sops->free(begin);
+
+		slicer_push(slicer, piece->data, piece->slice.begin, piece->slice.end);
+		begin = slicer->sops->inc(slicer->sops->dup(piece->slice.end));
+	}
+
+	if (pieces->len == 0 || end_end_cmp(slicer->sops, piece->slice.end, end) < 0)
+		slicer_push(slicer, NULL, begin, end);
+	else if (slicer->sops->free != NULL) {
+		slicer->sops->free(begin);
+		slicer->sops->free(end);
+	}
+}
+
 void slicer_insert(struct slicer *slicer, gpointer data, gpointer begin, gpointer end)
 {
 	slicer_apply_change(slicer, data, begin, end, insert_add);
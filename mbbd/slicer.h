@@ -30,6 +30,11 @@ struct slice_ops {
 	void (*free)(gpointer);
 };
 
+struct slice_piece {
+	struct slice slice;
+	gpointer data;
+};
+
 struct slice_data_ops {
 	gpointer (*add)(gpointer data, gpointer elem);
 	gpointer (*del)(gpointer data, gpointer elem);
@@ -62,6 +67,7 @@ void slicer_destroy(Slicer *);
 
 gpointer slicer_dup_dummy(gpointer data);
 
+void slicer_load(Slicer *, GArray *pieces);
 void slicer_insert(Slicer *, gpointer data, gpointer begin, gpointer end);
 void slicer_delete(Slicer *, gpointer data, gpointer begin, gpointer end);
 
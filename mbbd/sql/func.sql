@@ -63,16 +63,153 @@ create or replace function utop(bigint) returns timestamp with time zone as $$
 	select (timestamp with time zone 'epoch' + $1 * interval '1 second');
 $$ language sql strict stable;
 
+-- the 4-arg version would make calls without tab ambiguous
+drop function if exists create_view_dates(text, text, bigint, bigint);
+
 create or replace function
-	create_view_dates(name text, step text, tstart bigint, tend bigint)
+	create_view_dates(name text, step text, tstart bigint, tend bigint,
+			  tab text default 'unit_stat')
 returns void as $$
 begin
 	execute 'create temp view ' || quote_ident(name) || ' as'
 		|| ' select distinct date_trunc(' || quote_literal(step)
 		|| ' , utop(point)) as date'
-		|| ' from (select distinct point from unit_stat'
+		|| ' from (select distinct point from ' || quote_ident(tab)
 		|| ' where point >= ' || tstart
 		|| ' and point < ' || tend || ') as points order by date';
 end;
 $$ language plpgsql;
 
+
+create or replace function
+	stat_partition_name(tab text, mon timestamp)
+returns text as $$
+	select $1 || '_' || to_char($2, 'YYYYMM');
+$$ language sql strict stable;
+
+create or replace function
+	create_stat_partitions(tab text, tstart bigint, tend bigint)
+returns void as $$
+declare
+	mon timestamp;
+begin
+	mon := date_trunc('month', utop(tstart) at time zone 'UTC');
+	while ptou(mon at time zone 'UTC') < tend loop
+		execute 'create table if not exists '
+			|| quote_ident(stat_partition_name(tab, mon))
+			|| ' partition of ' || quote_ident(tab)
+			|| ' for values from (' || ptou(mon at time zone 'UTC')
+			|| ') to (' || ptou((mon + interval '1 month') at time zone 'UTC')
+			|| ')';
+		mon := mon + interval '1 month';
+	end loop;
+end;
+$$ language plpgsql;
+
+create or replace function
+	stat_wipe(tab text, tstart bigint, tend bigint)
+returns void as $$
+declare
+	mon timestamp;
+	part text;
+	pstart bigint;
+	pend bigint;
+begin
+	mon := date_trunc('month', utop(tstart) at time zone 'UTC');
+	while ptou(mon at time zone 'UTC') < tend loop
+		part := stat_partition_name(tab, mon);
+		pstart := ptou(mon at time zone 'UTC');
+		pend := ptou((mon + interval '1 month') at time zone 'UTC');
+		mon := mon + interval '1 month';
+
+		continue when to_regclass(quote_ident(part)) is null;
+
+		if tstart <= pstart and pend <= tend then
+			execute 'truncate ' || quote_ident(part);
+		else
+			execute 'delete from ' || quote_ident(part)
+				|| ' where point >= ' || greatest(tstart, pstart)
+				|| ' and point < ' || least(tend, pend);
+		end if;
+	end loop;
+end;
+$$ language plpgsql;
+
+-- days touched by [tstart, tend) are rebuilt from hourly rows,
+-- their months are rebuilt from the days
+create or replace function
+	stat_rollup(tstart bigint, tend bigint)
+returns void as $$
+declare
+	dstart bigint;
+	dend bigint;
+	mstart bigint;
+	mend bigint;
+	period timestamp with time zone;
+begin
+	dstart := ptou(date_trunc('day', utop(tstart)));
+	dend := ptou(date_trunc('day', utop(tend - 1)) + interval '1 day');
+	mstart := ptou(date_trunc('month', utop(tstart)));
+	mend := ptou(date_trunc('month', utop(tend - 1)) + interval '1 month');
+
+	-- concurrent rebuilds of a month wait for each other, the months
+	-- cover the days and are locked in order, so there is no deadlock
+	for period in select generate_series(utop(mstart),
+			utop(mend) - interval '1 month', interval '1 month') loop
+		perform pg_advisory_xact_lock(ptou(period));
+	end loop;
+
+	delete from unit_stat_day where point >= dstart and point < dend;
+	insert into unit_stat_day (unit_id, nbyte_in, nbyte_out, point)
+		select unit_id, sum(nbyte_in), sum(nbyte_out),
+			ptou(date_trunc('day', utop(point)))
+		from unit_stat where point >= dstart and point < dend
+		group by 1, 4;
+
+	delete from unit_stat_month where point >= mstart and point < mend;
+	insert into unit_stat_month (unit_id, nbyte_in, nbyte_out, point)
+		select unit_id, sum(nbyte_in), sum(nbyte_out),
+			ptou(date_trunc('month', utop(point)))
+		from unit_stat_day where point >= mstart and point < mend
+		group by 1, 4;
+
+	delete from link_stat_day where point >= dstart and point < dend;
+	insert into link_stat_day (gwlink_id, nbyte_in, nbyte_out, point)
+		select gwlink_id, sum(nbyte_in), sum(nbyte_out),
+			ptou(date_trunc('day', utop(point)))
+		from link_stat where point >= dstart and point < dend
+		group by 1, 4;
+
+	delete from link_stat_month where point >= mstart and point < mend;
+	insert into link_stat_month (gwlink_id, nbyte_in, nbyte_out, point)
+		select gwlink_id, sum(nbyte_in), sum(nbyte_out),
+			ptou(date_trunc('month', utop(point)))
+		from link_stat_day where point >= mstart and point < mend
+		group by 1, 4;
+end;
+$$ language plpgsql;
+
+-- suffix of the coarsest rollup which holds [tstart, tend) exactly,
+-- checked here since rollups are bucketed in the session time zone
+create or replace function
+	stat_rollup_suffix(tstart bigint, tend bigint, step text)
+returns text as $$
+begin
+	if step = 'hour' then
+		return '';
+	end if;
+
+	if (step is null or step <> 'day')
+	   and date_trunc('month', utop(tstart)) = utop(tstart)
+	   and date_trunc('month', utop(tend)) = utop(tend) then
+		return '_month';
+	end if;
+
+	if date_trunc('day', utop(tstart)) = utop(tstart)
+	   and date_trunc('day', utop(tend)) = utop(tend) then
+		return '_day';
+	end if;
+
+	return '';
+end;
+$$ language plpgsql stable;
@@ -0,0 +1,12 @@
+-- adds method call limits to an existing database
+
+create table func_limits (
+	limit_scope text not null,
+	limit_key text not null,
+
+	rate integer not null,
+	burst integer not null,
+	calls integer not null,
+
+	unique (limit_scope, limit_key)
+);
@@ -1,8 +1,137 @@
 create table pinger_units (
 	unit_id integer references units not null,
-	creation bigint not null default ptou(current_timestamp)
+	creation bigint not null default ptou(current_timestamp),
+
+	last_reply bigint,
+	sent integer not null default 0,
+	lost integer not null default 0,
+	rtt integer not null default 0
 );
 
-create rule pinger_unit_del as on delete to units do also
-	delete from pinger_units where unit_id = OLD.unit_id;
+-- raw intervals are only appended, one point may be split between rows
+create table pinger_stat (
+	unit_id integer references units not null,
+
+	sent integer not null,
+	recv integer not null,
+
+	rtt_min integer,
+	rtt_avg integer,
+	rtt_max integer,
+
+	point bigint not null
+);
+
+create index pinger_stat_unit_point_index on pinger_stat (unit_id, point);
+create index pinger_stat_point_index on pinger_stat (point);
+
+create table pinger_stat_hour (
+	unit_id integer references units not null,
+
+	sent integer not null,
+	recv integer not null,
+
+	rtt_min integer,
+	rtt_avg integer,
+	rtt_max integer,
+
+	point bigint not null,
+
+	unique (unit_id, point)
+);
+
+create index pinger_stat_hour_point_index on pinger_stat_hour (point);
 
+create table pinger_stat_day (
+	unit_id integer references units not null,
+
+	sent integer not null,
+	recv integer not null,
+
+	rtt_min integer,
+	rtt_avg integer,
+	rtt_max integer,
+
+	point bigint not null,
+
+	unique (unit_id, point)
+);
+
+create index pinger_stat_day_point_index on pinger_stat_day (point);
+
+-- hours touched by [tstart, tend) are rebuilt from raw rows,
+-- their days are rebuilt from the hours
+create or replace function
+	pinger_stat_rollup(tstart bigint, tend bigint)
+returns void as $$
+declare
+	hstart bigint;
+	hend bigint;
+	dstart bigint;
+	dend bigint;
+begin
+	hstart := ptou(date_trunc('hour', utop(tstart)));
+	hend := ptou(date_trunc('hour', utop(tend - 1)) + interval '1 hour');
+	dstart := ptou(date_trunc('day', utop(tstart)));
+	dend := ptou(date_trunc('day', utop(tend - 1)) + interval '1 day');
+
+	delete from pinger_stat_hour where point >= hstart and point < hend;
+	insert into pinger_stat_hour
+		(unit_id, sent, recv, rtt_min, rtt_avg, rtt_max, point)
+		select unit_id, sum(sent), sum(recv), min(rtt_min),
+			sum(rtt_avg::bigint * recv) / nullif(sum(recv), 0),
+			max(rtt_max), ptou(date_trunc('hour', utop(point)))
+		from pinger_stat where point >= hstart and point < hend
+		group by 1, 7;
+
+	delete from pinger_stat_day where point >= dstart and point < dend;
+	insert into pinger_stat_day
+		(unit_id, sent, recv, rtt_min, rtt_avg, rtt_max, point)
+		select unit_id, sum(sent), sum(recv), min(rtt_min),
+			sum(rtt_avg::bigint * recv) / nullif(sum(recv), 0),
+			max(rtt_max), ptou(date_trunc('day', utop(point)))
+		from pinger_stat_hour where point >= dstart and point < dend
+		group by 1, 7;
+end;
+$$ language plpgsql;
+
+-- coarsest step whose buckets [tstart, tend) is aligned to,
+-- a missing tend becomes the start of the current bucket of the step
+create or replace function
+	pinger_stat_range(tstart bigint, tend bigint, tstep text,
+			  out step text, out point bigint)
+returns record as $$
+declare
+	s text;
+begin
+	step := coalesce(tstep, 'raw');
+	point := coalesce(tend, ptou(now()));
+
+	for s in select unnest(array['day', 'hour']) loop
+		if tstep is not null and tstep <> s then
+			continue;
+		end if;
+
+		if tend is null then
+			if date_trunc(s, now()) > utop(tstart) and (tstep is not null
+			   or date_trunc(s, utop(tstart)) = utop(tstart)) then
+				step := s;
+				point := ptou(date_trunc(s, now()));
+				return;
+			end if;
+		elsif tstep is null
+		   and date_trunc(s, utop(tstart)) = utop(tstart)
+		   and date_trunc(s, utop(tend)) = utop(tend) then
+			step := s;
+			return;
+		end if;
+	end loop;
+end;
+$$ language plpgsql stable;
+
+create rule pinger_unit_del as on delete to units do also (
+	delete from pinger_units where unit_id = OLD.unit_id;
+	delete from pinger_stat where unit_id = OLD.unit_id;
+	delete from pinger_stat_hour where unit_id = OLD.unit_id;
+	delete from pinger_stat_day where unit_id = OLD.unit_id
+);
@@ -1,2 +1,7 @@
 drop rule if exists pinger_unit_del on units;
+drop function if exists pinger_stat_rollup(bigint, bigint);
+drop function if exists pinger_stat_range(bigint, bigint, text);
+drop table if exists pinger_stat_day;
+drop table if exists pinger_stat_hour;
+drop table if exists pinger_stat;
 drop table if exists pinger_units;
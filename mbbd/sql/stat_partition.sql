@@ -0,0 +1,76 @@
+-- converts stat tables of an existing database to monthly partitions,
+-- functions from func.sql must be installed first
+
+begin;
+
+drop index unit_stat_unit_id_index;
+drop index unit_stat_hour_no_index;
+alter table unit_stat rename to unit_stat_old;
+
+create table unit_stat (
+	unit_id integer references units not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (unit_id, point)
+) partition by range (point);
+
+create index unit_stat_unit_id_index on unit_stat (unit_id);
+create index unit_stat_hour_no_index on unit_stat (point);
+
+select create_stat_partitions('unit_stat', min(point), max(point) + 1)
+	from unit_stat_old;
+insert into unit_stat select * from unit_stat_old;
+drop table unit_stat_old;
+
+drop index link_stat_gwlink_id_index;
+drop index link_stat_hour_no_index;
+alter table link_stat rename to link_stat_old;
+
+create table link_stat (
+	gwlink_id integer references gwlinks not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (gwlink_id, point)
+) partition by range (point);
+
+create index link_stat_gwlink_id_index on link_stat (gwlink_id);
+create index link_stat_hour_no_index on link_stat (point);
+
+select create_stat_partitions('link_stat', min(point), max(point) + 1)
+	from link_stat_old;
+insert into link_stat select * from link_stat_old;
+drop table link_stat_old;
+
+drop index unit_link_stat_unit_id_index;
+drop index unit_link_stat_hour_no_index;
+alter table unit_link_stat rename to unit_link_stat_old;
+
+create table unit_link_stat (
+	unit_id integer references units not null,
+	gwlink_id integer references gwlinks not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (unit_id, gwlink_id, point)
+) partition by range (point);
+
+create index unit_link_stat_unit_id_index on unit_link_stat (unit_id);
+create index unit_link_stat_hour_no_index on unit_link_stat (point);
+
+select create_stat_partitions('unit_link_stat', min(point), max(point) + 1)
+	from unit_link_stat_old;
+insert into unit_link_stat select * from unit_link_stat_old;
+drop table unit_link_stat_old;
+
+commit;
@@ -0,0 +1,60 @@
+-- adds daily and monthly stat rollups to an existing database,
+-- functions from func.sql must be installed first
+
+begin;
+
+create table unit_stat_day (
+	unit_id integer references units not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (unit_id, point)
+);
+
+create index unit_stat_day_point_index on unit_stat_day (point);
+
+create table unit_stat_month (
+	unit_id integer references units not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (unit_id, point)
+);
+
+create index unit_stat_month_point_index on unit_stat_month (point);
+
+create table link_stat_day (
+	gwlink_id integer references gwlinks not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (gwlink_id, point)
+);
+
+create index link_stat_day_point_index on link_stat_day (point);
+
+create table link_stat_month (
+	gwlink_id integer references gwlinks not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (gwlink_id, point)
+);
+
+create index link_stat_month_point_index on link_stat_month (point);
+
+select stat_rollup(min(point), max(point) + 1) from unit_stat;
+
+commit;
@@ -116,7 +116,7 @@ create table unit_stat (
 	point bigint not null,
 
 	unique (unit_id, point)
-);
+) partition by range (point);
 
 create index unit_stat_unit_id_index on unit_stat (unit_id);
 create index unit_stat_hour_no_index on unit_stat (point);
@@ -130,7 +130,7 @@ create table link_stat (
 	point bigint not null,
 
 	unique (gwlink_id, point)
-);
+) partition by range (point);
 
 create index link_stat_gwlink_id_index on link_stat (gwlink_id);
 create index link_stat_hour_no_index on link_stat (point);
@@ -145,8 +145,71 @@ create table unit_link_stat (
 	point bigint not null,
 
 	unique (unit_id, gwlink_id, point)
-);
+) partition by range (point);
 
 create index unit_link_stat_unit_id_index on unit_link_stat (unit_id);
 create index unit_link_stat_hour_no_index on unit_link_stat (point);
 
+create table unit_stat_day (
+	unit_id integer references units not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (unit_id, point)
+);
+
+create index unit_stat_day_point_index on unit_stat_day (point);
+
+create table unit_stat_month (
+	unit_id integer references units not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (unit_id, point)
+);
+
+create index unit_stat_month_point_index on unit_stat_month (point);
+
+create table link_stat_day (
+	gwlink_id integer references gwlinks not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (gwlink_id, point)
+);
+
+create index link_stat_day_point_index on link_stat_day (point);
+
+create table link_stat_month (
+	gwlink_id integer references gwlinks not null,
+
+	nbyte_in bigint not null,
+	nbyte_out bigint not null,
+
+	point bigint not null,
+
+	unique (gwlink_id, point)
+);
+
+create index link_stat_month_point_index on link_stat_month (point);
+
+-- method call limits, users and groups are keyed by id
+create table func_limits (
+	limit_scope text not null,
+	limit_key text not null,
+
+	rate integer not null,
+	burst integer not null,
+	calls integer not null,
+
+	unique (limit_scope, limit_key)
+);
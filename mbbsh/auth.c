@@ -69,7 +69,7 @@ static inline void salt_free(void)
 	}
 }
 
-void salt_handler(XmlTag *tag)
+gboolean salt_handler(XmlTag *tag)
 {
 	Variant *var;
 
@@ -80,6 +80,8 @@ void salt_handler(XmlTag *tag)
 		g_free(salt);
 		salt = str;
 	}
+
+	return TRUE;
 }
 
 gboolean auth_salt(const gchar *user, const gchar *pass)
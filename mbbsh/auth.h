@@ -9,7 +9,7 @@
 gboolean auth_plain(const gchar *user, const gchar *pass);
 gboolean auth_key(const gchar *key);
 
-void salt_handler(XmlTag *tag);
+gboolean salt_handler(XmlTag *tag);
 gboolean auth_salt(const gchar *user, const gchar *pass);
 
 #endif
@@ -8,65 +8,49 @@
 
 #include <stdarg.h>
 
-static GMutex *recv_mutex;
-static GCond *recv_cond;
-
-static GMutex *cont_mutex;
-static GCond *cont_cond;
+static GAsyncQueue *sync_queue;
 
 static GOnce sync_once = G_ONCE_INIT;
 
+/* tag handed to the main thread, freed by sync_handler_cont */
 static XmlTag *xml_tag = NULL;
 
 static gpointer init_sync(gpointer arg G_GNUC_UNUSED)
 {
-	recv_mutex = g_mutex_new();
-	recv_cond = g_cond_new();
-
-	cont_mutex = g_mutex_new();
-	cont_cond = g_cond_new();
+	sync_queue = g_async_queue_new();
 
 	return NULL;
 }
 
-void sync_handler(XmlTag *tag)
+/* the reader thread does not wait for the main one,
+ * so other connections and pipelined responses keep flowing */
+gboolean sync_handler(XmlTag *tag)
 {
 	g_once(&sync_once, init_sync, NULL);
 
-	xml_tag = tag;
-
-	g_mutex_lock(recv_mutex);
-	g_cond_signal(recv_cond);
-	g_mutex_unlock(recv_mutex);
+	g_async_queue_push(sync_queue, tag);
 
-	g_mutex_lock(cont_mutex);
-	while (xml_tag != NULL)
-		g_cond_wait(cont_cond, cont_mutex);
-	g_mutex_unlock(cont_mutex);
+	return FALSE;
 }
 
 XmlTag *sync_handler_get_tag(void)
 {
 	g_once(&sync_once, init_sync, NULL);
 
-	g_mutex_lock(recv_mutex);
-	while (xml_tag == NULL)
-		g_cond_wait(recv_cond, recv_mutex);
-	g_mutex_unlock(recv_mutex);
+	xml_tag = g_async_queue_pop(sync_queue);
 
 	return xml_tag;
 }
 
 void sync_handler_cont(void)
 {
-	xml_tag = NULL;
-
-	g_mutex_lock(cont_mutex);
-	g_cond_signal(cont_cond);
-	g_mutex_unlock(cont_mutex);
+	if (xml_tag != NULL) {
+		xml_tag_free(xml_tag);
+		xml_tag = NULL;
+	}
 }
 
-void log_handler(XmlTag *tag)
+gboolean log_handler(XmlTag *tag)
 {
 	GString *string;
 	Variant *var;
@@ -102,9 +86,11 @@ void log_handler(XmlTag *tag)
 		g_printerr("LOG: %s\n", string->str);
 
 	g_string_free(string, TRUE);
+
+	return TRUE;
 }
 
-void kill_handler(XmlTag *tag)
+gboolean kill_handler(XmlTag *tag)
 {
 	Variant *var;
 
@@ -113,6 +99,8 @@ void kill_handler(XmlTag *tag)
 		g_printerr("KILL\n");
 	else
 		g_printerr("KILL: %s\n", variant_get_string(var));
+
+	return TRUE;
 }
 
 void talk_say(gchar *msg, void (*func)(XmlTag *, gpointer), gpointer data)
@@ -148,7 +136,7 @@ void talk_say_stdv(gchar *fmt, ...)
 	g_free(request);
 }
 
-XmlTag *talk_half_say(gchar *msg)
+static XmlTag *talk_half_say_common(gchar *msg, XmlTag *tag)
 {
 	static gboolean cont_wait = FALSE;
 
@@ -157,12 +145,25 @@ XmlTag *talk_half_say(gchar *msg)
 		sync_handler_cont();
 	}
 
-	if (msg == NULL)
+	if (msg == NULL && tag == NULL)
 		return NULL;
 
 	cont_wait = TRUE;
-	talk_write(msg);
+	if (tag != NULL)
+		talk_write_tag(tag);
+	else
+		talk_write(msg);
 
 	return sync_handler_get_tag();
 }
 
+XmlTag *talk_half_say(gchar *msg)
+{
+	return talk_half_say_common(msg, NULL);
+}
+
+XmlTag *talk_half_say_tag(XmlTag *tag)
+{
+	return talk_half_say_common(NULL, tag);
+}
+
@@ -12,7 +12,7 @@
 		return; \
 	}
 
-void sync_handler(XmlTag *tag);
+gboolean sync_handler(XmlTag *tag);
 XmlTag *sync_handler_get_tag(void);
 void sync_handler_cont(void);
 
@@ -21,8 +21,9 @@ void talk_say_std(gchar *msg);
 void talk_say_stdv(gchar *fmt, ...) G_GNUC_PRINTF(1, 2);
 
 XmlTag *talk_half_say(gchar *msg);
+XmlTag *talk_half_say_tag(XmlTag *tag);
 
-void log_handler(XmlTag *tag);
-void kill_handler(XmlTag *tag);
+gboolean log_handler(XmlTag *tag);
+gboolean kill_handler(XmlTag *tag);
 
 #endif
@@ -13,6 +13,7 @@ dofile("gwman")
 dofile("operman")
 dofile("linkman")
 dofile("taskman")
+dofile("limitman")
 dofile("statman")
 dofile("module")
 dofile("netflow")
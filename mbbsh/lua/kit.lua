@@ -37,3 +37,24 @@ function nearload(name)
 		printf("nearload '%s' failed: invalid file", name)
 	end
 end
+
+-- iterates over whitespace separated fields of a file lines,
+-- empty lines and # comments are skipped
+function file_fields(name)
+	local lines = io.lines(name)
+
+	return function ()
+		for line in lines do
+			local fields = {}
+
+			line = line:gsub("#.*", "")
+			for word in line:gmatch("%S+") do
+				list_push(fields, word)
+			end
+
+			if #fields > 0 then
+				return fields
+			end
+		end
+	end
+end
@@ -0,0 +1,32 @@
+function show_limits(tag)
+	local xml
+
+	xml = mbb.request(tag)
+
+	for n, xt in ipairs(xml_tag_sort(xml.limit, "_name")) do
+		local fmt = "%-7s %-20s rate %s/min, burst %s, calls %s"
+
+		printf(fmt, xt._scope, xt._name, xt._rate, xt._burst, xt._calls)
+	end
+end
+
+function limit_set(tag, scope, name, rate, burst, calls)
+	tag.limit._scope = scope
+	tag.limit._name = name
+	if rate then tag.limit._rate = rate end
+	if burst then tag.limit._burst = burst end
+	if calls then tag.limit._calls = calls end
+
+	mbb.request(tag)
+end
+
+function limit_del(tag, scope, name)
+	tag.limit._scope = scope
+	tag.limit._name = name
+
+	mbb.request(tag)
+end
+
+cmd_register("show limits", "mbb-show-limits", "show_limits")
+cmd_register("limit set", "mbb-limit-set", "limit_set", 2, 3)
+cmd_register("limit del", "mbb-limit-del", "limit_del", 2)
@@ -9,10 +9,62 @@ function pinger_show_units(tag)
 	xml = mbb.request(tag)
 
 	for n, xt in ipairs(xml_tag_sort(xml.unit, "_name")) do
-		print(xt._name)
+		local rtt = tonumber(xt._rtt or 0) / 1000
+
+		print(string.format("%s\t%s\t%s/%s\t%.1fms",
+			xt._name, xt._ip, xt._lost or 0, xt._sent or 0, rtt))
+	end
+end
+
+function pinger_stat_unit(tag, name, start, ...)
+	local args = { ... }
+	local xml
+
+	tag.unit._name = name
+	tag.time._start = start
+
+	local n = 1
+	while n <= #args do
+		local op = args[n]
+
+		if n == #args then
+			error("option missed")
+		end
+
+		if op == "to" then
+			tag.time._end = args[n + 1]
+		elseif op == "--by" then
+			tag.time._step = args[n + 1]
+		else
+			error("invalid operand '%s'", op)
+		end
+
+		n = n + 2
+	end
+
+	xml = mbb.request(tag)
+
+	for xt in xml_tag_iter(xml.stat) do
+		local rtt = "-"
+
+		if xt._rtt_avg then
+			rtt = string.format("%.1f/%.1f/%.1fms",
+				tonumber(xt._rtt_min) / 1000,
+				tonumber(xt._rtt_avg) / 1000,
+				tonumber(xt._rtt_max) / 1000)
+		end
+
+		printf("%s\t%s/%s\t%s%%\t%s", timefmt(xt._point),
+			xt._recv, xt._sent, xt._availability, rtt)
+	end
+
+	if xml.total then
+		printf("total\t%s/%s\t%s%%", xml.total._recv, xml.total._sent,
+			xml.total._availability)
 	end
 end
 
 cmd_register("pinger add", "mbb-pinger-add", "pinger_do", 1)
 cmd_register("pinger del", "mbb-pinger-del", "pinger_do", 1)
 cmd_register("pinger show units", "mbb-pinger-show-units", "pinger_show_units")
+cmd_register("pinger stat unit", "mbb-pinger-stat-unit", "pinger_stat_unit", 2, nil)
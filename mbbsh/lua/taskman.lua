@@ -7,7 +7,32 @@ function show_tasks(tag)
 		local ts = timewrap(xt._start, false)
 		local fmt = "%-7s %s %s %s:%s %s"
 
+		if xt._prio and xt._prio ~= "0" then
+			fmt = fmt .. " prio " .. xt._prio
+		end
+
 		printf(fmt, xt._id, xt._name, xt._state, xt._user, xt._sid, ts)
+
+		if xt._total or xt._records then
+			local l = {}
+
+			if xt._total then
+				list_push(l, string.format("%s/%s", xt._done, xt._total))
+			end
+
+			list_push(l, string.format("%s records", xt._records))
+			list_push(l, string.format("%s bytes", xt._bytes))
+
+			if xt._rate then
+				list_push(l, string.format("%s rec/s", xt._rate))
+			end
+
+			if xt._eta then
+				list_push(l, string.format("eta %ss", xt._eta))
+			end
+
+			printf("        %s", table.concat(l, ", "))
+		end
 	end
 end
 
@@ -16,7 +41,14 @@ function task_do_run(tag, no)
 	mbb.request(tag)
 end
 
+function task_prio(tag, no, prio)
+	tag.task._id = no
+	tag.task._prio = prio
+	mbb.request(tag)
+end
+
 cmd_register("show tasks", "mbb-show-tasks", "show_tasks")
 cmd_register("task run", "mbb-task-run", "task_do_run", 1)
 cmd_register("task stop", "mbb-task-stop", "task_do_run", 1)
 cmd_register("task cancel", "mbb-task-cancel", "task_do_run", 1)
+cmd_register("task prio", "mbb-task-prio", "task_prio", 2)
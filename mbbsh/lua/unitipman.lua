@@ -50,6 +50,40 @@ function unit_add_inherit_neg_inet(tag, ...)
 	unit_add_inet(tag, ...)
 end
 
+-- file lines: unit inet [nice [neg]], maps of the units are synced once
+function unit_add_inets(tag, file)
+	local tags = {}
+	local xml, xt
+
+	for f in file_fields(file) do
+		if xt == nil then xt = tag.inet_entry else xt = xt.__next end
+
+		xt._unit = f[1]
+		xt._inet = f[2]
+		if f[3] then xt._nice = f[3] end
+		if f[4] == "neg" then xt._exclusive = true end
+	end
+
+	if xt == nil then
+		return
+	end
+
+	xml = mbb.request(tag)
+	for xt in xml_tag_iter(xml.unit) do
+		local t = mbb.tag "mbb-map-reload-unit"
+
+		t.unit._name = xt._name
+		list_push(tags, t)
+	end
+
+	for n, xml in ipairs(mbb.requests(tags, false)) do
+		if xml._desc then
+			printf("unit '%s' map sync failed: %s",
+				tags[n].unit._name, xml._desc)
+		end
+	end
+end
+
 function unit_drop_inet(tag, id)
 	if caution() then
 		tag.inet_entry._id = id
@@ -213,6 +247,22 @@ function map_find_unit(tag, name)
 	map_find_common(tag)
 end
 
+function map_lookup(tag, addr, time)
+	local xml
+
+	tag.addr._value = addr
+
+	if time then
+		tag.addr._time = time
+	end
+
+	xml = mbb.request(tag)
+
+	for xt in xml_tag_iter(xml.addr) do
+		print(xt._value, xt._unit or "-", xt._consumer or "-")
+	end
+end
+
 function old_map_reload(tag)
 	local units = {}
 	local xml, msg
@@ -225,9 +275,35 @@ function old_map_reload(tag)
 	end
 
 	table.sort(units)
-	for _, name in ipairs(units) do
-		old_unit_map_sync(nil, name)
+
+	-- both passes are pipelined, a unit is mapped after its rebuild
+	local function pass(method, set, units, what)
+		local tags = {}
+		local done = {}
+
+		for n, name in ipairs(units) do
+			tags[n] = mbb.tag(method)
+			set(tags[n], name)
+		end
+
+		for n, xml in ipairs(mbb.requests(tags, false)) do
+			if xml._desc then
+				printf("%s '%s' failed: %s", what, units[n], xml._desc)
+			else
+				list_push(done, units[n])
+			end
+		end
+
+		return done
 	end
+
+	units = pass("mbb-unit-map-rebuild",
+		function (t, name) t.name._value = name end,
+		units, "rebuild map for unit")
+
+	pass("mbb-map-add-unit",
+		function (t, name) t.unit._name = name end,
+		units, "map add unit")
 end
 
 cmd_register("unit show inet", "mbb-unit-show-raw-inet", "unit_show_raw_inet", 0, 1)
@@ -236,6 +312,7 @@ cmd_register("unit add inet", "mbb-unit-add-inet", "unit_add_inet", 2, 1)
 cmd_register("unit add neg inet", "mbb-unit-add-inet", "unit_add_neg_inet", 2, 1)
 cmd_register("unit add inherit inet", "mbb-unit-add-inet", "unit_add_inherit_inet", 2, 1)
 cmd_register("unit add inherit neg inet", "mbb-unit-add-inet", "unit_add_inherit_neg_inet", 2, 1)
+cmd_register("unit add inets", "mbb-unit-add-inets", "unit_add_inets", 1)
 cmd_register("unit drop inet", "mbb-unit-drop-inet", "unit_drop_inet", 1)
 cmd_register("unit clear inet", "mbb-unit-clear-inet", "unit_clear_inet", 1)
 
@@ -258,6 +335,7 @@ cmd_register("map clear", "mbb-map-clear")
 cmd_register("map glue null", "mbb-map-glue-null")
 cmd_register("map find net", "mbb-map-find-net", "map_find_net", 1, 3)
 cmd_register("map find unit", "mbb-map-find-unit", "map_find_unit", 1)
+cmd_register("map lookup", "mbb-map-lookup", "map_lookup", 1, 2)
 
 cmd_register("map reload", "mbb-map-reload")
 cmd_register("unit map sync", "mbb-map-reload-unit", "map_do_unit", 1)
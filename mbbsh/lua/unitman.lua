@@ -46,6 +46,21 @@ function add_unit(tag, name)
 	mbb.request(tag)
 end
 
+-- file lines: name [consumer [inherit]]
+function add_units(tag, file)
+	local xt
+
+	for f in file_fields(file) do
+		if xt == nil then xt = tag.unit else xt = xt.__next end
+
+		xt._name = f[1]
+		if f[2] then xt._consumer = f[2] end
+		if f[3] == "inherit" then xt._inherit = true end
+	end
+
+	if xt then mbb.request(tag) end
+end
+
 function drop_unit(tag, name)
 	if caution() then
 		tag.name._value = name
@@ -110,6 +125,7 @@ cmd_register("self consumer show units", "mbb-self-show-units", "consumer_show_u
 cmd_register("unit show self", "mbb-unit-show-self", "unit_show_self", 1)
 
 cmd_register("add unit", "mbb-add-unit", "add_unit", 1)
+cmd_register("add units", "mbb-add-units", "add_units", 1)
 cmd_register("drop unit", "mbb-drop-unit", "drop_unit", 1)
 cmd_register("unit mod name", "mbb-unit-mod-name", "unit_mod_name", 2)
 cmd_register("unit set consumer", "mbb-unit-set-consumer", "unit_set_consumer", 2)
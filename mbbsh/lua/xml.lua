@@ -228,15 +228,21 @@ function xml_new(name, table)
 	return t
 end
 
+local function check_arg(check)
+	if check == nil then
+		return true
+	elseif type(check) ~= "boolean" then
+		error("invalid type for 'check' arg")
+	end
+
+	return check
+end
+
 mbb = {
 	request = function (tag, check)
 		local xml
 
-		if check == nil then
-			check = true
-		elseif type(check) ~= "boolean" then
-			error("invalid type for 'check' arg")
-		end
+		check = check_arg(check)
 
 		xml = server_request(tag)
 		if check and xml._result ~= "ok" then
@@ -246,6 +252,52 @@ mbb = {
 		return xml, xml._desc 
 	end,
 
+	-- pipelined requests: send returns an id, wait returns the answer,
+	-- answers stay valid until the command is finished
+	send = function (tag)
+		return server_send(tag)
+	end,
+
+	wait = function (id, check)
+		local xml
+
+		check = check_arg(check)
+
+		xml = server_wait(id)
+		if check and xml._result ~= "ok" then
+			error("request %d failed: %s", id, xml._desc)
+		end
+
+		return xml, xml._desc
+	end,
+
+	-- sends all the tags before waiting, answers keep the order of tags
+	requests = function (tags, check)
+		local ids = {}
+		local res = {}
+
+		check = check_arg(check)
+
+		for n, tag in ipairs(tags) do
+			ids[n] = server_send(tag)
+		end
+
+		for n, id in ipairs(ids) do
+			res[n] = server_wait(id)
+		end
+
+		if check then
+			for n, xml in ipairs(res) do
+				if xml._result ~= "ok" then
+					error("method '%s' failed: %s",
+						tags[n]._name, xml._desc)
+				end
+			end
+		end
+
+		return res
+	end,
+
 	tag = function (method)
 		tag = xml_new("request")
 		tag._name = method
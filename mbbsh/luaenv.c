@@ -5,6 +5,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "nettalker.h"
 #include "handler.h"
 #include "caution.h"
 #include "luaenv.h"
@@ -23,6 +24,8 @@ static gint c_xml_tag_get_body(lua_State *ls);
 static gint c_xml_tag_get_child(lua_State *ls);
 static gint c_markup_escape(lua_State *ls);
 static gint c_server_request(lua_State *ls);
+static gint c_server_send(lua_State *ls);
+static gint c_server_wait(lua_State *ls);
 static gint c_time_format(lua_State *ls);
 static gint c_caution(lua_State *ls);
 static gint c_readpass(lua_State *ls);
@@ -53,6 +56,8 @@ lua_env_t lua_env_new(gchar *dir)
 		lua_register(ls, "xml_tag_get_child", c_xml_tag_get_child);
 		lua_register(ls, "markup_escape", c_markup_escape);
 		lua_register(ls, "server_request", c_server_request);
+		lua_register(ls, "server_send", c_server_send);
+		lua_register(ls, "server_wait", c_server_wait);
 		lua_register(ls, "timefmt", c_time_format);
 		lua_register(ls, "caution", c_caution);
 		lua_register(ls, "readpass", c_readpass);
@@ -115,6 +120,8 @@ gboolean lua_env_dofile(lua_State *ls, const gchar *filename, GError **error)
 	gint ecode;
 
 	ecode = luaL_dofile(ls, filename);
+	talk_async_release();
+
 	if (ecode) {
 		lua_env_set_error(ls, ecode, error);
 		return FALSE;
@@ -167,6 +174,7 @@ gboolean lua_env_call(lua_State *ls, struct cmd_params *p, GError **error)
 
 	ecode = lua_pcall(ls, n + with_method, 0, 0);
 	talk_half_say(NULL);
+	talk_async_release();
 
 	if (ecode) {
 		lua_env_set_error(ls, ecode, error);
@@ -448,6 +456,99 @@ static gint c_markup_escape(lua_State *ls)
 	return 1;
 }
 
+static gchar *lua_table_string(lua_State *ls, gint index)
+{
+	const gchar *str;
+
+	if (lua_type(ls, index) == LUA_TBOOLEAN)
+		str = lua_toboolean(ls, index) ? "true" : "false";
+	else if (lua_type(ls, index) == LUA_TSTRING ||
+		 lua_type(ls, index) == LUA_TNUMBER)
+		str = lua_tostring(ls, index);
+	else
+		return NULL;
+
+	return arena_strdup(arena_current(), str);
+}
+
+/* walks the raw fields set up by xml_meta in xml.lua */
+static XmlTag *lua_table_to_xml_tag(lua_State *ls, gint index)
+{
+	XmlTag *tag, *child;
+	gchar *name, *value;
+	gint top;
+	guint n;
+
+	top = lua_gettop(ls);
+
+	lua_pushstring(ls, "__self");
+	lua_rawget(ls, index);
+	name = lua_table_string(ls, -1);
+	lua_pop(ls, 1);
+
+	if (name == NULL)
+		return NULL;
+
+	tag = xml_tag_newc(name);
+
+	lua_pushstring(ls, "__attrs");
+	lua_rawget(ls, index);
+	if (lua_istable(ls, -1)) {
+		lua_pushnil(ls);
+		while (lua_next(ls, -2) != 0) {
+			if (lua_type(ls, -2) != LUA_TSTRING)
+				break;
+
+			name = lua_table_string(ls, -2);
+			value = lua_table_string(ls, -1);
+			if (value == NULL)
+				break;
+
+			xml_tag_set_attr(tag, name, variant_new_static_string(value));
+			lua_pop(ls, 1);
+		}
+
+		if (lua_gettop(ls) != top + 1)
+			tag = NULL;
+	}
+	lua_pop(ls, 1);
+
+	lua_pushstring(ls, "__childs");
+	lua_rawget(ls, index);
+	if (tag != NULL && lua_istable(ls, -1)) {
+		lua_pushnil(ls);
+		while (lua_next(ls, -2) != 0) {
+			while (lua_istable(ls, -1)) {
+				child = lua_table_to_xml_tag(ls, lua_gettop(ls));
+				if (child == NULL)
+					break;
+
+				xml_tag_add_child(tag, child);
+
+				lua_pushstring(ls, "__next_");
+				lua_rawget(ls, -2);
+				lua_remove(ls, -2);
+			}
+
+			if (! lua_isnil(ls, -1))
+				break;
+
+			lua_pop(ls, 1);
+		}
+
+		if (lua_gettop(ls) != top + 1)
+			tag = NULL;
+		else {
+			for (n = 0; n < tag->nchild; n++)
+				xml_tag_reorder(tag->childs[n].head);
+		}
+	}
+
+	lua_settop(ls, top);
+
+	return tag;
+}
+
 static gint c_server_request(lua_State *ls)
 {
 	XmlTag *tag;
@@ -456,6 +557,25 @@ static gint c_server_request(lua_State *ls)
 
 	arg_check(ls, 1, 1);
 
+	if (talk_is_packed()) {
+		XmlTag *req;
+
+		luaL_checktype(ls, 1, LUA_TTABLE);
+
+		xml_tag_arena_enter();
+		req = lua_table_to_xml_tag(ls, 1);
+		xml_tag_arena_leave(req);
+
+		if (req == NULL)
+			luaL_argerror(ls, 1, "invalid xml table");
+
+		tag = talk_half_say_tag(req);
+		xml_tag_free(req);
+		lua_push_xml_tag(ls, tag);
+
+		return 1;
+	}
+
 	lua_getglobal(ls, "tostring");
 	lua_pushvalue(ls, 1);
 	ecode = lua_pcall(ls, 1, 1, 0);
@@ -474,6 +594,82 @@ static gint c_server_request(lua_State *ls)
 	return 1;
 }
 
+/* the id is set on the table only while it is serialized */
+static gboolean server_send_common(lua_State *ls, guint id)
+{
+	gboolean ok = FALSE;
+
+	lua_pushinteger(ls, id);
+	lua_setfield(ls, 1, "_id");
+
+	if (talk_is_packed()) {
+		XmlTag *req;
+
+		xml_tag_arena_enter();
+		req = lua_table_to_xml_tag(ls, 1);
+		xml_tag_arena_leave(req);
+
+		if (req != NULL) {
+			talk_async_write_tag(id, req);
+			xml_tag_free(req);
+			ok = TRUE;
+		}
+	} else {
+		lua_getglobal(ls, "tostring");
+		lua_pushvalue(ls, 1);
+
+		if (lua_pcall(ls, 1, 1, 0) == 0 && lua_isstring(ls, -1)) {
+			talk_async_write(id, (gchar *) lua_tostring(ls, -1));
+			ok = TRUE;
+		}
+
+		lua_pop(ls, 1);
+	}
+
+	lua_pushnil(ls);
+	lua_setfield(ls, 1, "_id");
+
+	return ok;
+}
+
+static gint c_server_send(lua_State *ls)
+{
+	guint id;
+
+	arg_check(ls, 1, 1);
+	luaL_checktype(ls, 1, LUA_TTABLE);
+
+	id = talk_async_reserve();
+
+	if (server_send_common(ls, id) == FALSE) {
+		talk_async_cancel(id);
+		luaL_argerror(ls, 1, "invalid xml table");
+	}
+
+	lua_pushinteger(ls, id);
+
+	return 1;
+}
+
+static gint c_server_wait(lua_State *ls)
+{
+	XmlTag *tag;
+	gint id;
+
+	arg_check(ls, 1, 1);
+
+	id = luaL_checkinteger(ls, 1);
+	luaL_argcheck(ls, id > 0, 1, "invalid request id");
+
+	tag = talk_async_wait(id);
+	if (tag == NULL)
+		luaL_argerror(ls, 1, "no such request");
+
+	lua_push_xml_tag(ls, tag);
+
+	return 1;
+}
+
 static gint c_time_format(lua_State *ls)
 {
 	static gchar buf[64];
@@ -46,6 +46,8 @@ static gchar **opt_file = NULL;
 static gboolean opt_nosh = FALSE;
 static gboolean opt_follow = FALSE;
 static gboolean opt_salt = FALSE;
+static gboolean opt_pack = FALSE;
+static gint opt_conns = 1;
 static gboolean caught_sigint = FALSE;
 static gboolean info_mode = FALSE;
 
@@ -529,12 +531,26 @@ static gchar *lua_get_set(gchar *name)
 	return value;
 }
 
+/* every connection is logged in, pipelined requests use all of them */
 static gboolean do_auth(const gchar *user, const gchar *pass)
 {
-	if (opt_salt)
-		return auth_salt(user, pass);
+	gboolean ok = TRUE;
+	guint n;
+
+	for (n = 0; ok && n < talk_conn_count(); n++) {
+		talk_conn_select(n);
+
+		if (opt_key != NULL && user == NULL)
+			ok = auth_key(opt_key);
+		else if (opt_salt)
+			ok = auth_salt(user, pass);
+		else
+			ok = auth_plain(user, pass);
+	}
+
+	talk_conn_select(0);
 
-	return auth_plain(user, pass);
+	return ok;
 }
 
 static void internal_su(gint argc, gchar **argv)
@@ -867,6 +883,8 @@ int main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 		{ "nosh", 'n', 0, G_OPTION_ARG_NONE, &opt_nosh, "no shell, scripts only", NULL },
 		{ "follow", 'f', 0, G_OPTION_ARG_NONE, &opt_follow, "show output when stdin is closed", NULL },
 		{ "salt", 0, 0, G_OPTION_ARG_NONE, &opt_salt, "enable salt authorization", NULL },
+		{ "pack", 0, 0, G_OPTION_ARG_NONE, &opt_pack, "use packed binary protocol", NULL },
+		{ "conns", 'c', 0, G_OPTION_ARG_INT, &opt_conns, "connections for pipelined requests", "1" },
 		{ NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
 	};
 
@@ -905,6 +923,9 @@ int main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 	if (opt_serv == NULL)
 		errx(1, "serv option missed");
 
+	if (opt_conns < 1)
+		errx(1, "conns option must be positive");
+
 	init_signals(opt_follow);
 
 	lua_env = lua_env_new((gchar *) opt_dir);
@@ -922,9 +943,14 @@ int main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 	if (opt_salt)
 		talk_register_handler("salt", salt_handler);
 
-	if (talk_init((gchar *) opt_host, (gchar *) opt_serv) == FALSE)
+	if (talk_init((gchar *) opt_host, (gchar *) opt_serv, opt_pack) == FALSE)
 		errx(1, "talk failed");
 
+	while (talk_conn_count() < (guint) opt_conns) {
+		if (talk_conn_open() < 0)
+			errx(1, "talk failed");
+	}
+
 	if (opt_key == NULL) {
 		if (opt_pass == NULL) {
 			opt_pass = getpass("password: ");
@@ -934,7 +960,7 @@ int main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 
 		if (do_auth(opt_user, opt_pass) == FALSE)
 			errx(1, "auth failed");
-	} else if (auth_key(opt_key) == FALSE)
+	} else if (do_auth(NULL, NULL) == FALSE)
 		errx(1, "auth failed");
 
 	if (opt_file != NULL) {
@@ -2,9 +2,12 @@
 /* Published under the GNU General Public License V.2, see file COPYING */
 
 #include "xmlparser.h"
+#include "xmlpack.h"
 #include "debug.h"
 #include "net.h"
 
+#include <sys/socket.h>
+
 #include <pthread.h>
 #include <signal.h>
 #include <string.h>
@@ -13,17 +16,49 @@
 
 #include <glib.h>
 
+#include "nettalker.h"
+
+/* requests in flight on one connection before talk_async_reserve blocks */
+#define TALK_ASYNC_WINDOW 128
+
 struct talk_handler {
 	gchar *name;
-	void (*func)(XmlTag *tag);
+	talk_handler_t func;
 };
 
-static gint sock_fd = -1;
+struct talk_conn {
+	gint fd;
+	GThread *thread;
+
+	guint inflight;
+};
+
+/* pipelined request, tag is set by the reader thread */
+struct talk_async {
+	guint id;
+	struct talk_conn *conn;
+	XmlTag *tag;
+};
+
+static gchar *talk_host = NULL;
+static gchar *talk_service = NULL;
+static gboolean packed = FALSE;
 static GStaticMutex thread_mutex = G_STATIC_MUTEX_INIT;
-static GThread *thread;
+static gboolean active = FALSE;
 static pthread_t main_thread;
 static GSList *handler_list = NULL;
 
+/* conns[0] is the main connection, cur is where plain requests go */
+static GPtrArray *conns = NULL;
+static struct talk_conn *cur = NULL;
+static guint next_conn = 0;
+
+static GMutex *async_mutex = NULL;
+static GCond *async_cond = NULL;
+static GHashTable *async_ht = NULL;
+static GSList *async_done = NULL;
+static guint async_id = 0;
+
 static gpointer talk_thread(gpointer arg);
 
 static gboolean fd_set_cloexec(gint fd)
@@ -45,33 +80,122 @@ static gboolean fd_set_cloexec(gint fd)
 	return TRUE;
 }
 
-gboolean talk_init(gchar *host, gchar *service)
+static gboolean talk_negotiate(gint fd)
 {
-	if (thread != NULL)
-		err_quit("talk is already initialized");
+	gchar magic[XML_PACK_MAGIC_LEN];
+	gsize off;
+	gint n;
 
-	sock_fd = tcp_client(host, service);
-	if (sock_fd < 0)
-		return FALSE;
+	write_all(fd, XML_PACK_MAGIC, XML_PACK_MAGIC_LEN);
 
-	if (fd_set_cloexec(sock_fd) == FALSE) {
-		close(sock_fd);
+	for (off = 0; off < sizeof(magic); off += n) {
+		n = read(fd, magic + off, sizeof(magic) - off);
+		if (n <= 0) {
+			msg_warn("read magic failed");
+			return FALSE;
+		}
+	}
+
+	if (memcmp(magic, XML_PACK_MAGIC, sizeof(magic))) {
+		msg_warn("server does not support packed protocol");
 		return FALSE;
 	}
 
-	main_thread = pthread_self();
+	return TRUE;
+}
+
+static struct talk_conn *talk_conn_new(void)
+{
+	struct talk_conn *conn;
+	gint fd;
+
+	fd = tcp_client(talk_host, talk_service);
+	if (fd < 0)
+		return NULL;
+
+	if (fd_set_cloexec(fd) == FALSE) {
+		close(fd);
+		return NULL;
+	}
+
+	if (packed && talk_negotiate(fd) == FALSE) {
+		close(fd);
+		return NULL;
+	}
+
+	conn = g_new0(struct talk_conn, 1);
+	conn->fd = fd;
 
-	thread = g_thread_create(talk_thread, NULL, TRUE, NULL);
-	if (thread == NULL) {
-		close(sock_fd);
+	conn->thread = g_thread_create(talk_thread, conn, TRUE, NULL);
+	if (conn->thread == NULL) {
+		close(fd);
+		g_free(conn);
 		msg_warn("g_thread_create failed");
+		return NULL;
+	}
+
+	return conn;
+}
+
+gboolean talk_init(gchar *host, gchar *service, gboolean pack)
+{
+	struct talk_conn *conn;
+
+	if (active)
+		err_quit("talk is already initialized");
+
+	talk_host = g_strdup(host);
+	talk_service = g_strdup(service);
+	packed = pack;
+
+	main_thread = pthread_self();
+	active = TRUE;
+
+	async_mutex = g_mutex_new();
+	async_cond = g_cond_new();
+	async_ht = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, g_free
+	);
+
+	if ((conn = talk_conn_new()) == NULL) {
+		active = FALSE;
 		return FALSE;
 	}
 
+	conns = g_ptr_array_new();
+	g_ptr_array_add(conns, conn);
+	cur = conn;
+
 	return TRUE;
 }
 
-void talk_register_handler(gchar *name, void (*func)(XmlTag *))
+gint talk_conn_open(void)
+{
+	struct talk_conn *conn;
+
+	if ((conn = talk_conn_new()) == NULL)
+		return -1;
+
+	g_ptr_array_add(conns, conn);
+
+	return conns->len - 1;
+}
+
+/* sync requests and auth go to the selected connection */
+void talk_conn_select(guint n)
+{
+	if (n >= conns->len)
+		err_quit("no such connection: %u", n);
+
+	cur = g_ptr_array_index(conns, n);
+}
+
+guint talk_conn_count(void)
+{
+	return conns == NULL ? 0 : conns->len;
+}
+
+void talk_register_handler(gchar *name, talk_handler_t func)
 {
 	struct talk_handler *th;
 
@@ -82,10 +206,44 @@ void talk_register_handler(gchar *name, void (*func)(XmlTag *))
 	handler_list = g_slist_prepend(handler_list, th);
 }
 
-static gboolean talk_dispatcher(XmlTag *tag, gpointer user_data G_GNUC_UNUSED)
+/* returns FALSE if the tag is kept for talk_async_wait */
+static gboolean talk_async_complete(struct talk_conn *conn, XmlTag *tag,
+				    Variant *var)
+{
+	struct talk_async *ta;
+	guint id;
+
+	id = g_ascii_strtoull(variant_get_string(var), NULL, 10);
+
+	g_mutex_lock(async_mutex);
+	ta = g_hash_table_lookup(async_ht, GUINT_TO_POINTER(id));
+	if (ta != NULL && (ta->conn != conn || ta->tag != NULL))
+		ta = NULL;
+	else if (ta != NULL) {
+		ta->tag = tag;
+		conn->inflight--;
+		g_cond_broadcast(async_cond);
+	}
+	g_mutex_unlock(async_mutex);
+
+	/* stray or duplicate responses are freed by the reader */
+	if (ta == NULL)
+		msg_warn("unexpected response to request %u", id);
+
+	return ta == NULL;
+}
+
+static gboolean talk_dispatcher(XmlTag *tag, gpointer user_data)
 {
 	struct talk_handler *th;
 	GSList *list;
+	Variant *var;
+
+	if (! strcmp(tag->name, "response")) {
+		var = xml_tag_get_attr(tag, "id");
+		if (var != NULL)
+			return talk_async_complete(user_data, tag, var);
+	}
 
 	g_static_mutex_lock(&thread_mutex);
 
@@ -93,34 +251,44 @@ static gboolean talk_dispatcher(XmlTag *tag, gpointer user_data G_GNUC_UNUSED)
 		th = (struct talk_handler *) list->data;
 		if (!strcmp(tag->name, th->name)) {
 			g_static_mutex_unlock(&thread_mutex);
-			th->func(tag);
-			return TRUE;
+			return th->func(tag);
 		}
 	}
 
 	g_static_mutex_unlock(&thread_mutex);
-	g_printerr("WARN: unhandled message '%s'\n", tag->name);
+	msg_warn("unhandled message '%s'", tag->name);
 
 	return TRUE;
 }
 
-static gpointer talk_thread(gpointer arg G_GNUC_UNUSED)
+static gpointer talk_thread(gpointer arg)
 {
+	struct talk_conn *conn = arg;
 	GError *error = NULL;
-	XmlParser *parser;
+	XmlUnpacker *unpacker = NULL;
+	XmlParser *parser = NULL;
 	gchar buf[2048];
 	gint n;
 
-	parser = xml_parser_new(talk_dispatcher, NULL);
+	if (packed)
+		unpacker = xml_unpacker_new(talk_dispatcher, conn);
+	else
+		parser = xml_parser_new(talk_dispatcher, conn);
 
-	while ((n = read(sock_fd, buf, sizeof(buf))) > 0) {
-		if (xml_parser_parse(parser, buf, n, &error) == FALSE)
+	while ((n = read(conn->fd, buf, sizeof(buf))) > 0) {
+		if (unpacker != NULL) {
+			if (xml_unpacker_feed(unpacker, buf, n, &error) == FALSE)
+				err_quit("xml_unpacker_feed: %s", error->message);
+		} else if (xml_parser_parse(parser, buf, n, &error) == FALSE)
 			err_quit("xml_parser_parse: %s", error->message);
 	}
 
-	xml_parser_free(parser);
+	if (unpacker != NULL)
+		xml_unpacker_free(unpacker);
+	else
+		xml_parser_free(parser);
 
-	if (thread != NULL)
+	if (active)
 		pthread_kill(main_thread, SIGUSR1);
 
 	return NULL;
@@ -128,12 +296,27 @@ static gpointer talk_thread(gpointer arg G_GNUC_UNUSED)
 
 void talk_fini(void)
 {
-	if (thread == NULL)
+	guint n;
+
+	if (! active)
 		err_quit("talk is already finalized");
 
-	thread = NULL;
+	active = FALSE;
+
+	for (n = 0; n < conns->len; n++) {
+		struct talk_conn *conn = g_ptr_array_index(conns, n);
 
-	close(sock_fd);
+		/* wakes the reader up from read, it still uses conn */
+		shutdown(conn->fd, SHUT_RDWR);
+		g_thread_join(conn->thread);
+
+		close(conn->fd);
+		g_free(conn);
+	}
+
+	g_ptr_array_free(conns, TRUE);
+	conns = NULL;
+	cur = NULL;
 
 	g_static_mutex_lock(&thread_mutex);
 
@@ -144,9 +327,190 @@ void talk_fini(void)
 	g_static_mutex_unlock(&thread_mutex);
 }
 
+gboolean talk_is_packed(void)
+{
+	return packed;
+}
+
+static void talk_conn_write(struct talk_conn *conn, gchar *buf)
+{
+	GString *string;
+
+	if (! packed) {
+		write_all(conn->fd, buf, strlen(buf));
+		return;
+	}
+
+	string = g_string_new(NULL);
+	xml_text_pack_frame(buf, strlen(buf), string);
+	write_all(conn->fd, string->str, string->len);
+	g_string_free(string, TRUE);
+}
+
+static void talk_conn_write_tag(struct talk_conn *conn, XmlTag *tag)
+{
+	GString *string;
+
+	string = g_string_new(NULL);
+	if (packed)
+		xml_tag_pack_frame(tag, string);
+	else
+		xml_tag_write(tag, XML_TAG_FORMAT_XML_ESCAPE, string);
+
+	write_all(conn->fd, string->str, string->len);
+	g_string_free(string, TRUE);
+}
+
 void talk_write(gchar *buf)
 {
-	write_all(sock_fd, buf, strlen(buf));
+	talk_conn_write(cur, buf);
+}
+
+void talk_write_tag(XmlTag *tag)
+{
+	talk_conn_write_tag(cur, tag);
+}
+
+/* picks the least loaded connection, waits while its window is full */
+guint talk_async_reserve(void)
+{
+	struct talk_conn *conn, *best;
+	struct talk_async *ta;
+	guint n;
+
+	g_mutex_lock(async_mutex);
+
+	for (;;) {
+		best = NULL;
+		for (n = 0; n < conns->len; n++) {
+			conn = g_ptr_array_index(conns,
+				(next_conn + n) % conns->len
+			);
+
+			if (best == NULL || conn->inflight < best->inflight)
+				best = conn;
+		}
+
+		if (best->inflight < TALK_ASYNC_WINDOW)
+			break;
+
+		g_cond_wait(async_cond, async_mutex);
+	}
+
+	next_conn = (next_conn + 1) % conns->len;
+	best->inflight++;
+
+	if (++async_id == 0)
+		async_id++;
+
+	ta = g_new(struct talk_async, 1);
+	ta->id = async_id;
+	ta->conn = best;
+	ta->tag = NULL;
+	g_hash_table_insert(async_ht, GUINT_TO_POINTER(ta->id), ta);
+
+	g_mutex_unlock(async_mutex);
+
+	return ta->id;
+}
+
+/* for a request which could not be written */
+void talk_async_cancel(guint id)
+{
+	struct talk_async *ta;
+
+	g_mutex_lock(async_mutex);
+	ta = g_hash_table_lookup(async_ht, GUINT_TO_POINTER(id));
+	if (ta != NULL) {
+		ta->conn->inflight--;
+		g_hash_table_remove(async_ht, GUINT_TO_POINTER(id));
+		g_cond_broadcast(async_cond);
+	}
+	g_mutex_unlock(async_mutex);
+}
+
+static struct talk_conn *talk_async_conn(guint id)
+{
+	struct talk_async *ta;
+
+	g_mutex_lock(async_mutex);
+	ta = g_hash_table_lookup(async_ht, GUINT_TO_POINTER(id));
+	g_mutex_unlock(async_mutex);
+
+	if (ta == NULL)
+		err_quit("no such request: %u", id);
+
+	return ta->conn;
+}
+
+/* the request must carry the id given by talk_async_reserve */
+void talk_async_write(guint id, gchar *buf)
+{
+	talk_conn_write(talk_async_conn(id), buf);
+}
+
+void talk_async_write_tag(guint id, XmlTag *tag)
+{
+	talk_conn_write_tag(talk_async_conn(id), tag);
+}
+
+/* the tag stays valid until talk_async_release */
+XmlTag *talk_async_wait(guint id)
+{
+	struct talk_async *ta;
+	XmlTag *tag;
+
+	g_mutex_lock(async_mutex);
+
+	ta = g_hash_table_lookup(async_ht, GUINT_TO_POINTER(id));
+	if (ta == NULL) {
+		g_mutex_unlock(async_mutex);
+		return NULL;
+	}
+
+	while (ta->tag == NULL)
+		g_cond_wait(async_cond, async_mutex);
+
+	tag = ta->tag;
+	g_hash_table_remove(async_ht, GUINT_TO_POINTER(id));
+	async_done = g_slist_prepend(async_done, tag);
+
+	g_mutex_unlock(async_mutex);
+
+	return tag;
+}
+
+static gboolean async_is_done(gpointer key G_GNUC_UNUSED,
+			      struct talk_async *ta, gpointer data G_GNUC_UNUSED)
+{
+	if (ta->tag == NULL)
+		return FALSE;
+
+	xml_tag_free(ta->tag);
+	return TRUE;
+}
+
+/* requests nobody waited for are drained, so no late response is left */
+void talk_async_release(void)
+{
+	g_mutex_lock(async_mutex);
+
+	for (;;) {
+		g_hash_table_foreach_remove(async_ht,
+			(GHRFunc) async_is_done, NULL
+		);
+
+		if (g_hash_table_size(async_ht) == 0)
+			break;
+
+		g_cond_wait(async_cond, async_mutex);
+	}
+
+	g_slist_foreach(async_done, (GFunc) xml_tag_free, NULL);
+	g_slist_free(async_done);
+	async_done = NULL;
+
+	g_mutex_unlock(async_mutex);
 }
 
 void talk_get_fields(XmlTag *tag, gchar **result, gchar **desc)
@@ -8,11 +8,26 @@
 
 #include "xmltag.h"
 
-gboolean talk_init(gchar *host, gchar *service);
-void talk_register_handler(gchar *name, void (*func)(XmlTag *));
+/* returns FALSE if the handler keeps the tag */
+typedef gboolean (*talk_handler_t)(XmlTag *tag);
+
+gboolean talk_init(gchar *host, gchar *service, gboolean pack);
+gint talk_conn_open(void);
+void talk_conn_select(guint n);
+guint talk_conn_count(void);
+void talk_register_handler(gchar *name, talk_handler_t func);
 void talk_get_fields(XmlTag *tag, gchar **result, gchar **desc);
 gboolean talk_response_handle(XmlTag *tag);
+gboolean talk_is_packed(void);
 void talk_write(gchar *buf);
+void talk_write_tag(XmlTag *tag);
 void talk_fini(void);
 
+guint talk_async_reserve(void);
+void talk_async_write(guint id, gchar *buf);
+void talk_async_write_tag(guint id, XmlTag *tag);
+void talk_async_cancel(guint id);
+XmlTag *talk_async_wait(guint id);
+void talk_async_release(void);
+
 #endif